@@ -19,6 +19,7 @@ import (
 	"encoding/json"
 	"fmt"
 	"strconv"
+	"strings"
 	"time"
 
 	"github.com/google/zoekt/query"
@@ -109,6 +110,11 @@ type Stats struct {
 	// Amount of I/O for reading contents.
 	ContentBytesLoaded int64
 
+	// Amount of compressed content read to decompress the contents
+	// loaded, for shards with compressed content. Content found in
+	// the cache of decompressed content is not counted.
+	CompressedContentBytesLoaded int64
+
 	// Amount of I/O for reading from index.
 	IndexBytesLoaded int64
 
@@ -138,6 +144,10 @@ type Stats struct {
 	// Shards that we did not process because a query was canceled.
 	ShardsSkipped int
 
+	// Shards that we did not process because their ngram filter
+	// showed they can't match.
+	ShardsSkippedFilter int
+
 	// Number of non-overlapping matches
 	MatchCount int
 
@@ -147,12 +157,14 @@ type Stats struct {
 	// Wall clock time for queued search.
 	Wait time.Duration
 
-	// Number of times regexp was called on files that we evaluated.
+	// Number of files that we evaluated which still needed the regexp
+	// engine after scanning for the literals of the regexp.
 	RegexpsConsidered int
 }
 
 func (s *Stats) Add(o Stats) {
 	s.ContentBytesLoaded += o.ContentBytesLoaded
+	s.CompressedContentBytesLoaded += o.CompressedContentBytesLoaded
 	s.IndexBytesLoaded += o.IndexBytesLoaded
 	s.Crashes += o.Crashes
 	s.FileCount += o.FileCount
@@ -161,8 +173,10 @@ func (s *Stats) Add(o Stats) {
 	s.FilesSkipped += o.FilesSkipped
 	s.MatchCount += o.MatchCount
 	s.NgramMatches += o.NgramMatches
+	s.RegexpsConsidered += o.RegexpsConsidered
 	s.ShardFilesConsidered += o.ShardFilesConsidered
 	s.ShardsSkipped += o.ShardsSkipped
+	s.ShardsSkippedFilter += o.ShardsSkippedFilter
 	s.Wait += o.Wait
 }
 
@@ -173,6 +187,7 @@ func (s *Stats) Zero() bool {
 	}
 
 	return !(s.ContentBytesLoaded > 0 ||
+		s.CompressedContentBytesLoaded > 0 ||
 		s.IndexBytesLoaded > 0 ||
 		s.Crashes > 0 ||
 		s.FileCount > 0 ||
@@ -183,6 +198,7 @@ func (s *Stats) Zero() bool {
 		s.NgramMatches > 0 ||
 		s.ShardFilesConsidered > 0 ||
 		s.ShardsSkipped > 0 ||
+		s.ShardsSkippedFilter > 0 ||
 		s.Wait > 0)
 }
 
@@ -213,6 +229,115 @@ type SearchResult struct {
 	// FragmentNames holds a repo => template string map, for
 	// the line number fragment.
 	LineFragments map[string]string
+
+	// Release is set if the result references the memory of index
+	// files, see SearchOptions.NoCopy. Calling it lets the index
+	// files be unmapped.
+	Release func() `json:"-"`
+
+	// Profile breaks down the cost of the search, if
+	// SearchOptions.Profile is set.
+	Profile *QueryProfile `json:",omitempty"`
+}
+
+// QueryProfile breaks down where a search spent its time, by phase and
+// by node of the match tree. Times are summed over shards, so they
+// exceed the wall time of parallel searches.
+type QueryProfile struct {
+	// Shards is the number of shards profiled.
+	Shards int
+
+	// Iterate is the time spent finding candidate documents in the
+	// posting lists.
+	Iterate time.Duration
+
+	// Evaluate is the time spent evaluating the match tree on
+	// candidate documents.
+	Evaluate time.Duration
+
+	// FillMatches is the time spent collecting the line matches of
+	// matching documents.
+	FillMatches time.Duration
+
+	// GatherBranches is the time spent collecting their branches.
+	GatherBranches time.Duration
+
+	// Nodes are the nodes of the match tree, in preorder.
+	Nodes []ProfileNode
+}
+
+// ProfileNode holds the cost of evaluating a node of the match tree.
+type ProfileNode struct {
+	// Depth is the depth of the node in the match tree.
+	Depth int
+
+	// Node describes the node.
+	Node string
+
+	// Time is the time spent evaluating the node, including its
+	// children.
+	Time time.Duration
+
+	// Evals is the number of evaluations, at increasing costs.
+	Evals int
+
+	// Docs is the number of documents the node was evaluated on.
+	Docs int
+
+	// Matched is the number of documents the node matched.
+	Matched int
+
+	// ContentBytesLoaded is the content loaded while evaluating the
+	// node, including its children.
+	ContentBytesLoaded int64
+
+	// Candidates is the number of candidate matches of atoms in the
+	// documents they matched.
+	Candidates int
+}
+
+// Add merges o into p. Nodes are matched by depth and description, as
+// the trees of shards differ where they are simplified.
+func (p *QueryProfile) Add(o *QueryProfile) {
+	p.Shards += o.Shards
+	p.Iterate += o.Iterate
+	p.Evaluate += o.Evaluate
+	p.FillMatches += o.FillMatches
+	p.GatherBranches += o.GatherBranches
+
+	next := 0
+	for _, n := range o.Nodes {
+		i := next
+		for i < len(p.Nodes) && (p.Nodes[i].Depth != n.Depth || p.Nodes[i].Node != n.Node) {
+			i++
+		}
+		if i == len(p.Nodes) {
+			p.Nodes = append(p.Nodes, n)
+			next = len(p.Nodes)
+			continue
+		}
+		m := &p.Nodes[i]
+		m.Time += n.Time
+		m.Evals += n.Evals
+		m.Docs += n.Docs
+		m.Matched += n.Matched
+		m.ContentBytesLoaded += n.ContentBytesLoaded
+		m.Candidates += n.Candidates
+		next = i + 1
+	}
+}
+
+// String formats the profile like EXPLAIN ANALYZE, one node per line
+// indented by depth.
+func (p *QueryProfile) String() string {
+	var b strings.Builder
+	fmt.Fprintf(&b, "shards: %d, iterate: %v, evaluate: %v, fill matches: %v, gather branches: %v\n",
+		p.Shards, p.Iterate, p.Evaluate, p.FillMatches, p.GatherBranches)
+	for _, n := range p.Nodes {
+		fmt.Fprintf(&b, "%s%s (time=%v evals=%d docs=%d matched=%d content=%dB candidates=%d)\n",
+			strings.Repeat("  ", n.Depth), n.Node, n.Time, n.Evals, n.Docs, n.Matched, n.ContentBytesLoaded, n.Candidates)
+	}
+	return b.String()
 }
 
 // RepositoryBranch describes an indexed branch, which is a name
@@ -272,6 +397,11 @@ type Repository struct {
 	// IndexMetadata. However, we store it here since the Sourcegraph frontend
 	// can read this structure but not IndexMetadata.
 	HasSymbols bool
+
+	// FileTombstones holds the names of files in this shard that were
+	// replaced or deleted by a later delta shard. It is set through the
+	// ".meta" file, and tombstoned files are not searched.
+	FileTombstones map[string]struct{} `json:",omitempty"`
 }
 
 func (r *Repository) UnmarshalJSON(data []byte) error {
@@ -427,9 +557,27 @@ type SearchOptions struct {
 	MaxWallTime time.Duration
 
 	// Trim the number of results after collating and sorting the
-	// results
+	// results. Shards then only fill in the matches of the files
+	// that may be among the best, and count the non-overlapping
+	// matches of the other files in Stats.MatchCount.
 	MaxDocDisplayCount int
 
+	// ShardParallelism is the maximum number of goroutines used to
+	// search a single shard. Only shards with many documents or much
+	// content are split. Values below 2 search each shard
+	// sequentially.
+	ShardParallelism int
+
+	// NoCopy returns results which reference the memory mapped index
+	// files rather than copies. Results passed to a Sender are then
+	// only valid during Send. Callers of Search must call the
+	// result's Release once they are done with it.
+	NoCopy bool
+
+	// Profile records the cost of each node of the match tree in
+	// SearchResult.Profile. It slows down the search.
+	Profile bool
+
 	// Trace turns on opentracing for this request if true and if the Jaeger address was provided as
 	// a command-line flag
 	Trace bool
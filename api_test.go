@@ -17,6 +17,7 @@ package zoekt // import "github.com/google/zoekt"
 import (
 	"bytes"
 	"encoding/gob"
+	"fmt"
 	"strings"
 	"testing"
 )
@@ -75,3 +76,29 @@ func benchmarkEncoding(data interface{}) func(*testing.B) {
 		}
 	}
 }
+
+func TestQueryProfileAdd(t *testing.T) {
+	p := &QueryProfile{Shards: 1, Iterate: 1, Nodes: []ProfileNode{
+		{Depth: 0, Node: "and", Docs: 1},
+		{Depth: 1, Node: `substr("a")`, Docs: 1},
+		{Depth: 1, Node: `substr("b")`, Docs: 1},
+	}}
+	// The other shard simplified one child away.
+	p.Add(&QueryProfile{Shards: 1, Iterate: 2, Nodes: []ProfileNode{
+		{Depth: 0, Node: "and", Docs: 2},
+		{Depth: 1, Node: `substr("b")`, Docs: 2},
+		{Depth: 1, Node: `substr("c")`, Docs: 2},
+	}})
+
+	if p.Shards != 2 || p.Iterate != 3 {
+		t.Errorf("got shards %d, iterate %v", p.Shards, p.Iterate)
+	}
+	var got []string
+	for _, n := range p.Nodes {
+		got = append(got, fmt.Sprintf("%d %s %d", n.Depth, n.Node, n.Docs))
+	}
+	want := []string{`0 and 3`, `1 substr("a") 1`, `1 substr("b") 3`, `1 substr("c") 2`}
+	if strings.Join(got, ",") != strings.Join(want, ",") {
+		t.Errorf("got %v, want %v", got, want)
+	}
+}
@@ -16,7 +16,7 @@ package zoekt
 
 import (
 	"encoding/binary"
-	"sort"
+	"math/bits"
 	"unicode"
 	"unicode/utf8"
 )
@@ -268,6 +268,125 @@ func fromDeltas(data []byte, buf []uint32) []uint32 {
 	return buf
 }
 
+// packPFOR appends vals to dst in a patched frame-of-reference
+// encoding: all values are bit-packed at a common width, and the few
+// values that don't fit are patched with their high bits afterwards.
+// The layout is
+//
+//	byte width, byte exception count
+//	len(vals) values of width bits, least significant bit first
+//	per exception: byte index, uvarint(value >> width)
+//
+// len(vals) must not exceed 255; the count is not stored.
+func packPFOR(dst []byte, vals []uint32) []byte {
+	var lens [33]int
+	for _, v := range vals {
+		lens[bits.Len32(v)]++
+	}
+
+	// Pick the width that minimizes the encoded size. Exceptions are
+	// costed at 2 bytes, which is exact for small overflows. Patching
+	// is slow compared to unpacking, so at most 1/8th of the values
+	// may be exceptions.
+	width, best := 0, -1
+	exceptions := len(vals)
+	for w := 0; w <= 32; w++ {
+		exceptions -= lens[w]
+		if 8*exceptions > len(vals) {
+			continue
+		}
+		cost := (len(vals)*w+7)/8 + 2*exceptions
+		if best < 0 || cost < best {
+			width, best = w, cost
+		}
+	}
+
+	var n int
+	for _, v := range vals {
+		if bits.Len32(v) > width {
+			n++
+		}
+	}
+	dst = append(dst, byte(width), byte(n))
+
+	var acc uint64
+	var nbits uint
+	mask := uint64(1)<<uint(width) - 1
+	for _, v := range vals {
+		acc |= (uint64(v) & mask) << nbits
+		nbits += uint(width)
+		for nbits >= 8 {
+			dst = append(dst, byte(acc))
+			acc >>= 8
+			nbits -= 8
+		}
+	}
+	if nbits > 0 {
+		dst = append(dst, byte(acc))
+	}
+
+	var enc [binary.MaxVarintLen32]byte
+	for i, v := range vals {
+		if bits.Len32(v) > width {
+			dst = append(dst, byte(i))
+			dst = append(dst, enc[:binary.PutUvarint(enc[:], uint64(v>>uint(width)))]...)
+		}
+	}
+	return dst
+}
+
+// unpackPFOR decodes len(dst) values written by packPFOR into dst. It
+// returns the number of bytes consumed from src.
+func unpackPFOR(src []byte, dst []uint32) int {
+	width := uint(src[0])
+	n := int(src[1])
+	p := 2
+
+	if width == 0 {
+		for i := range dst {
+			dst[i] = 0
+		}
+	} else {
+		mask := uint64(1)<<width - 1
+		var acc uint64
+		var nbits uint
+		i := 0
+		// Refill 32 bits at a time while possible, which leaves room
+		// for at least one value of any width in acc.
+		for ; i < len(dst) && p+4 <= len(src); i++ {
+			if nbits < width {
+				acc |= uint64(binary.LittleEndian.Uint32(src[p:])) << nbits
+				p += 4
+				nbits += 32
+			}
+			dst[i] = uint32(acc & mask)
+			acc >>= width
+			nbits -= width
+		}
+		for ; i < len(dst); i++ {
+			for nbits < width {
+				acc |= uint64(src[p]) << nbits
+				p++
+				nbits += 8
+			}
+			dst[i] = uint32(acc & mask)
+			acc >>= width
+			nbits -= width
+		}
+		// Bytes that were loaded into acc but not used belong to
+		// the exceptions.
+		p -= int(nbits / 8)
+	}
+
+	for ; n > 0; n-- {
+		idx := src[p]
+		high, m := binary.Uvarint(src[p+1:])
+		dst[idx] |= uint32(high) << width
+		p += 1 + m
+	}
+	return p
+}
+
 type runeOffsetCorrection struct {
 	runeOffset, byteOffset uint32
 }
@@ -308,26 +427,56 @@ func makeRuneOffsetMap(off []uint32) runeOffsetMap {
 //
 // It does this by finding the nearest point to interpolate from in the map.
 func (m runeOffsetMap) lookup(runeOffset uint32) (uint32, uint32) {
-	left := runeOffset % runeOffsetFrequency
+	byteOff, left, _ := m.lookupFrom(runeOffset, -1)
+	return byteOff, left
+}
+
+// runeOffsetScan is the number of corrections lookupFrom steps over
+// before it falls back to a binary search.
+const runeOffsetScan = 4
+
+// lookupFrom is lookup, starting from the correction at hint, as
+// returned by the previous call. Matches are found in increasing
+// order, so the correction to use is usually at or shortly after the
+// hint.
+func (m runeOffsetMap) lookupFrom(runeOffset uint32, hint int) (byteOff, left uint32, idx int) {
+	left = runeOffset % runeOffsetFrequency
 	runeOffset -= left
-	slen := len(m)
-	if slen == 0 {
-		return runeOffset, left
+	if len(m) == 0 {
+		return runeOffset, left, -1
+	}
+
+	// idx is the last correction at or before runeOffset, or -1 if
+	// the offset is before the first, so no correction is necessary.
+	idx = -1
+	if hint >= len(m) || (hint >= 0 && m[hint].runeOffset > runeOffset) {
+		hint = -1
+	}
+	found := false
+	for i := hint; i < hint+runeOffsetScan; i++ {
+		if i+1 == len(m) || m[i+1].runeOffset > runeOffset {
+			idx, found = i, true
+			break
+		}
 	}
-	// sort.Search finds the *first* index for which the predicate is true,
-	// but we want to find the *last* index for which the predicate is true.
-	// This involves some work to reverse the index directions.
-	idx := sort.Search(slen, func(i int) bool {
-		return runeOffset >= m[slen-1-i].runeOffset
-	})
-	idx = slen - 1 - idx
-	// idx is now in the range [-1, len(m))-- -1 indicates that the offset is smaller
-	// than the first entry in the map, so no correction is necessary.
-	byteOff := runeOffset
+	if !found {
+		lo, hi := hint+runeOffsetScan, len(m)-1
+		for lo < hi {
+			mid := int(uint(lo+hi+1) >> 1)
+			if m[mid].runeOffset <= runeOffset {
+				lo = mid
+			} else {
+				hi = mid - 1
+			}
+		}
+		idx = lo
+	}
+
+	byteOff = runeOffset
 	if idx >= 0 {
 		byteOff = m[idx].byteOffset + runeOffset - m[idx].runeOffset
 	}
-	return byteOff, left
+	return byteOff, left, idx
 }
 
 func (m runeOffsetMap) sizeBytes() int {
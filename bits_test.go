@@ -148,6 +148,42 @@ func TestCompressedPostingIterator(t *testing.T) {
 	testIncreasingIntCoder(t, toDeltas, decode)
 }
 
+func TestPFOR(t *testing.T) {
+	f := func(vals []uint32, shift uint8, trailer []byte) bool {
+		if len(vals) > 255 {
+			vals = vals[:255]
+		}
+		// Mostly small values, with the occasional exception.
+		for i := range vals {
+			if i%17 != 0 {
+				vals[i] >>= shift % 33
+			}
+		}
+
+		if len(vals) == 0 {
+			return true
+		}
+
+		b := packPFOR(nil, vals)
+		n := len(b)
+		b = append(b, trailer...)
+
+		got := make([]uint32, len(vals))
+		if m := unpackPFOR(b, got); m != n {
+			t.Logf("consumed %d bytes, want %d", m, n)
+			return false
+		}
+		if !reflect.DeepEqual(got, vals) {
+			t.Log(cmp.Diff(vals, got))
+			return false
+		}
+		return true
+	}
+	if err := quick.Check(f, nil); err != nil {
+		t.Error(err)
+	}
+}
+
 func toDeltas(offsets []uint32) []byte {
 	var enc [8]byte
 
@@ -251,3 +287,31 @@ func TestRuneOffsetLookup(t *testing.T) {
 		}
 	}
 }
+
+func TestRuneOffsetLookupFrom(t *testing.T) {
+	var m runeOffsetMap
+	for i := uint32(1); i <= 40; i++ {
+		m = append(m, runeOffsetCorrection{i * i * runeOffsetFrequency, i * i * 2 * runeOffsetFrequency})
+	}
+	want := func(r uint32) uint32 {
+		r -= r % runeOffsetFrequency
+		for i := len(m) - 1; i >= 0; i-- {
+			if m[i].runeOffset <= r {
+				return m[i].byteOffset + r - m[i].runeOffset
+			}
+		}
+		return r
+	}
+
+	for hint := -1; hint <= len(m); hint++ {
+		for r := uint32(0); r < 1700*runeOffsetFrequency; r += 37 {
+			got, left, idx := m.lookupFrom(r, hint)
+			if got != want(r) || left != r%runeOffsetFrequency {
+				t.Fatalf("lookupFrom(%d, %d): got %d, %d, want %d", r, hint, got, left, want(r))
+			}
+			if idx >= 0 && m[idx].runeOffset > r {
+				t.Fatalf("lookupFrom(%d, %d): got correction %d at %d", r, hint, idx, m[idx].runeOffset)
+			}
+		}
+	}
+}
@@ -84,6 +84,10 @@ type Options struct {
 	// If set, ctags must succeed.
 	CTagsMustSucceed bool
 
+	// SymbolCacheDir is a directory that holds the ctags output of
+	// files from previous builds. Unchanged files are not parsed again.
+	SymbolCacheDir string
+
 	// Write memory profiles to this file.
 	MemProfile string
 
@@ -92,6 +96,22 @@ type Options struct {
 	// regardless of their size. The full pattern syntax is here:
 	// https://github.com/bmatcuk/doublestar/tree/v1#patterns.
 	LargeFiles []string
+
+	// IsDelta is true if the builder adds shards with the changed files
+	// to the repository's existing shards, instead of replacing them.
+	// The names of added files, and those passed to MarkFileDeleted,
+	// are tombstoned in the existing shards through their ".meta" file.
+	IsDelta bool
+
+	// PostingsMemoryBudget is the number of bytes of posting lists a
+	// shard holds in memory while building. Beyond it, they are spilled
+	// to temporary files in IndexDir. Zero means no limit.
+	PostingsMemoryBudget int
+
+	// DeltaShardNumberFallbackThreshold is the number of shards a
+	// repository may have before DeltaBase refuses delta builds. The
+	// next full build then compacts the deltas.
+	DeltaShardNumberFallbackThreshold int
 }
 
 // HashOptions creates a hash of the options that affect an index.
@@ -136,6 +156,10 @@ func (o *Options) Flags(fs *flag.FlagSet) {
 	fs.IntVar(&o.Parallelism, "parallelism", x.Parallelism, "maximum number of parallel indexing processes.")
 	fs.StringVar(&o.IndexDir, "index", x.IndexDir, "directory for search indices")
 	fs.BoolVar(&o.CTagsMustSucceed, "require_ctags", x.CTagsMustSucceed, "If set, ctags calls must succeed.")
+	fs.StringVar(&o.SymbolCacheDir, "symbol_cache_dir", x.SymbolCacheDir, "directory for caching ctags output across builds")
+	fs.IntVar(&o.PostingsMemoryBudget, "postings_memory_budget", x.PostingsMemoryBudget, "maximum bytes of posting lists held in memory per shard, 0 for no limit")
+	fs.BoolVar(&o.IsDelta, "delta", x.IsDelta, "If set, only index the files changed since the last build into delta shards.")
+	fs.IntVar(&o.DeltaShardNumberFallbackThreshold, "delta_threshold", x.DeltaShardNumberFallbackThreshold, "number of shards above which a delta build becomes a full build")
 	fs.Var(largeFilesFlag{o}, "large_file", "A glob pattern where matching files are to be index regardless of their size. You can add multiple patterns by setting this more than once.")
 
 	// Sourcegraph specific
@@ -170,6 +194,22 @@ func (o *Options) Args() []string {
 		args = append(args, "-require_ctags")
 	}
 
+	if o.SymbolCacheDir != "" {
+		args = append(args, "-symbol_cache_dir", o.SymbolCacheDir)
+	}
+
+	if o.PostingsMemoryBudget != 0 {
+		args = append(args, "-postings_memory_budget", strconv.Itoa(o.PostingsMemoryBudget))
+	}
+
+	if o.IsDelta {
+		args = append(args, "-delta")
+	}
+
+	if o.DeltaShardNumberFallbackThreshold != 0 {
+		args = append(args, "-delta_threshold", strconv.Itoa(o.DeltaShardNumberFallbackThreshold))
+	}
+
 	for _, a := range o.LargeFiles {
 		args = append(args, "-large_file", a)
 	}
@@ -193,7 +233,8 @@ type Builder struct {
 	todo         []*zoekt.Document
 	size         int
 
-	parser ctags.Parser
+	parser      ctags.Parser
+	symbolCache *symbolCache
 
 	building sync.WaitGroup
 
@@ -205,6 +246,11 @@ type Builder struct {
 	finishedShards map[string]string
 
 	shardLogger io.WriteCloser
+
+	// For delta builds, the number of existing shards and the names
+	// of the files to tombstone in them.
+	baseShards int
+	tombstones map[string]struct{}
 }
 
 type finishedShard struct {
@@ -245,6 +291,9 @@ func (o *Options) SetDefaults() {
 	if o.TrigramMax == 0 {
 		o.TrigramMax = 20000
 	}
+	if o.DeltaShardNumberFallbackThreshold == 0 {
+		o.DeltaShardNumberFallbackThreshold = 150
+	}
 
 	if o.RepositoryDescription.Name == "" && o.RepositoryDescription.URL != "" {
 		parsed, _ := url.Parse(o.RepositoryDescription.URL)
@@ -270,46 +319,60 @@ func (o *Options) shardName(n int) string {
 		fmt.Sprintf("%s_v%d.%05d.zoekt", abs, zoekt.IndexFormatVersion, n))
 }
 
+// FindAllShards returns the paths of the simple shards of the
+// repository on disk. Repositories in compound shards have none.
+func (o *Options) FindAllShards() []string {
+	var shards []string
+	for n := 0; ; n++ {
+		fn := o.shardName(n)
+		if _, err := os.Stat(fn); err != nil {
+			return shards
+		}
+		shards = append(shards, fn)
+	}
+}
+
 // IncrementalSkipIndexing returns true if the index present on disk matches
 // the build options.
 func (o *Options) IncrementalSkipIndexing() bool {
-	fn := o.shardName(0)
-
-	f, err := os.Open(fn)
+	repo, err := o.compatibleIndex()
 	if err != nil {
 		return false
 	}
+	return reflect.DeepEqual(repo.Branches, o.RepositoryDescription.Branches)
+}
 
-	iFile, err := zoekt.NewIndexFile(f)
-	if err != nil {
-		return false
+// compatibleIndex returns the repository metadata of the index on
+// disk, or an error if there is none or it was built with different
+// options.
+func (o *Options) compatibleIndex() (*zoekt.Repository, error) {
+	repo, index, err := readShardMetadata(o.shardName(0))
+	if os.IsNotExist(err) {
+		repo, index, err = findCompoundShard(o.IndexDir, o.RepositoryDescription.Name)
 	}
-	defer iFile.Close()
-
-	repo, index, err := zoekt.ReadMetadata(iFile)
 	if err != nil {
-		return false
+		return nil, err
 	}
 
 	if index.IndexFeatureVersion != zoekt.FeatureVersion {
-		return false
+		return nil, fmt.Errorf("index has feature version %d, want %d", index.IndexFeatureVersion, zoekt.FeatureVersion)
 	}
 
 	if repo.IndexOptions != o.HashOptions() {
-		return false
+		return nil, fmt.Errorf("index was built with different options")
 	}
 
 	// Sourcegraph specific. Ensure we have the correct repository ID set.
 	if !rawConfigEqual(repo.RawConfig, o.RepositoryDescription.RawConfig, "repoid") {
-		return false
+		return nil, fmt.Errorf("index has a different repository ID")
 	}
 
 	// Sourcegraph specific. Ensure we have public set correctly.
 	if !rawConfigEqual(repo.RawConfig, o.RepositoryDescription.RawConfig, "public") {
-		return false
+		return nil, fmt.Errorf("index has a different public setting")
 	}
 
-	return reflect.DeepEqual(repo.Branches, o.RepositoryDescription.Branches)
+	return repo, nil
 }
 
 func rawConfigEqual(m1, m2 map[string]string, key string) bool {
@@ -349,6 +412,12 @@ func NewBuilder(opts Options) (*Builder, error) {
 		finishedShards: map[string]string{},
 	}
 
+	if opts.IsDelta {
+		b.baseShards = opts.shardCount()
+		b.nextShardNum = b.baseShards
+		b.tombstones = map[string]struct{}{}
+	}
+
 	if b.opts.DisableCTags {
 		b.opts.CTags = ""
 	}
@@ -358,14 +427,20 @@ func NewBuilder(opts Options) (*Builder, error) {
 	}
 
 	if strings.Contains(opts.CTags, "universal-ctags") {
-		parser, err := ctags.NewParser(opts.CTags)
+		// Up to Parallelism shards are built at once, and each parses
+		// its files in parallel on the same processes.
+		parser, err := ctags.NewParserPool(opts.CTags, opts.Parallelism)
 		if err != nil && opts.CTagsMustSucceed {
-			return nil, fmt.Errorf("ctags.NewParser: %v", err)
+			return nil, fmt.Errorf("ctags.NewParserPool: %v", err)
 		}
 
 		b.parser = parser
 	}
 
+	if b.opts.CTags != "" && opts.SymbolCacheDir != "" {
+		b.symbolCache = &symbolCache{dir: opts.SymbolCacheDir}
+	}
+
 	b.shardLogger = &lumberjack.Logger{
 		Filename:   filepath.Join(opts.IndexDir, "zoekt-builder-shard-log.tsv"),
 		MaxSize:    100, // Megabyte
@@ -404,6 +479,10 @@ func (b *Builder) Add(doc zoekt.Document) error {
 		doc.Language = "binary"
 	}
 
+	if b.opts.IsDelta {
+		b.tombstones[doc.Name] = struct{}{}
+	}
+
 	b.todo = append(b.todo, &doc)
 	b.size += len(doc.Name) + len(doc.Content)
 	if b.size > b.opts.ShardMax {
@@ -422,6 +501,10 @@ func (b *Builder) Finish() error {
 	b.flush()
 	b.building.Wait()
 
+	if b.parser != nil {
+		b.parser.Close()
+	}
+
 	if b.buildError != nil {
 		for tmp := range b.finishedShards {
 			log.Printf("Builder.Finish %s", tmp)
@@ -432,6 +515,14 @@ func (b *Builder) Finish() error {
 	}
 
 	for tmp, final := range b.finishedShards {
+		// A full build replaces the shard, so tombstones from earlier
+		// delta builds no longer apply.
+		if !b.opts.IsDelta {
+			if err := os.Remove(final + ".meta"); err != nil && !os.IsNotExist(err) {
+				b.buildError = err
+				continue
+			}
+		}
 		if err := os.Rename(tmp, final); err != nil {
 			b.buildError = err
 		} else {
@@ -440,11 +531,25 @@ func (b *Builder) Finish() error {
 	}
 	b.finishedShards = map[string]string{}
 
+	// Tombstone the old versions only after the new ones are in
+	// place, so files are at worst briefly found twice.
+	if b.opts.IsDelta && b.buildError == nil {
+		b.buildError = b.writeTombstones()
+	}
+
 	if b.nextShardNum > 0 {
 		if err := b.deleteRemainingShards(); err != nil {
 			log.Printf("failed to delete some old shards: %v", err)
 		}
 	}
+
+	// The new shards replace the repository's copy in compound shards.
+	if b.buildError == nil && !b.opts.IsDelta {
+		name := b.opts.RepositoryDescription.Name
+		if err := EvictFromCompoundShards(b.opts.IndexDir, func(r *zoekt.Repository) bool { return r.Name == name }); err != nil {
+			log.Printf("failed to evict %s from compound shards: %v", name, err)
+		}
+	}
 	return b.buildError
 }
 
@@ -534,6 +639,13 @@ func (b *Builder) shardLog(action, shard string) {
 	_, _ = fmt.Fprintf(b.shardLogger, "%d\t%s\t%s\t%d\n", time.Now().UTC().Unix(), action, shard, shardSize)
 }
 
+// shardLogSymbolCache records how many of the files of a shard were
+// found in the symbol cache.
+func (b *Builder) shardLogSymbolCache(shard string, stats symbolCacheStats) {
+	log.Printf("symbol cache %s: %d of %d files", filepath.Base(shard), stats.hits, stats.lookups)
+	_, _ = fmt.Fprintf(b.shardLogger, "%d\t%s\t%s\t%d\t%d\n", time.Now().UTC().Unix(), "symbol_cache", filepath.Base(shard), stats.hits, stats.lookups)
+}
+
 var profileNumber int
 
 func (b *Builder) writeMemProfile(name string) {
@@ -618,22 +730,28 @@ func sortDocuments(todo []*zoekt.Document) {
 }
 
 func (b *Builder) buildShard(todo []*zoekt.Document, nextShardNum int) (*finishedShard, error) {
+	var cacheStats symbolCacheStats
 	if b.opts.CTags != "" {
-		err := ctagsAddSymbols(todo, b.parser, b.opts.CTags)
+		stats, err := ctagsAddSymbols(todo, b.parser, b.opts.CTags, b.opts.Parallelism, b.symbolCache)
 		if b.opts.CTagsMustSucceed && err != nil {
 			return nil, err
 		}
 		if err != nil {
 			log.Printf("ignoring %s error: %v", b.opts.CTags, err)
 		}
+		cacheStats = stats
 	}
 
 	name := b.opts.shardName(nextShardNum)
+	if b.symbolCache != nil {
+		b.shardLogSymbolCache(name, cacheStats)
+	}
 
 	shardBuilder, err := b.newShardBuilder()
 	if err != nil {
 		return nil, err
 	}
+	defer shardBuilder.Close()
 	sortDocuments(todo)
 	for _, t := range todo {
 		if err := shardBuilder.Add(*t); err != nil {
@@ -654,6 +772,9 @@ func (b *Builder) newShardBuilder() (*zoekt.IndexBuilder, error) {
 	if err != nil {
 		return nil, err
 	}
+	if b.opts.PostingsMemoryBudget > 0 {
+		shardBuilder.SpillPostings(b.opts.IndexDir, b.opts.PostingsMemoryBudget)
+	}
 	return shardBuilder, nil
 }
 
@@ -27,6 +27,22 @@ func TestFlags(t *testing.T) {
 		want: Options{
 			LargeFiles: []string{"*.md"},
 		},
+	}, {
+		args: []string{"-symbol_cache_dir", "/tmp/symbols"},
+		want: Options{
+			SymbolCacheDir: "/tmp/symbols",
+		},
+	}, {
+		args: []string{"-postings_memory_budget", "1000"},
+		want: Options{
+			PostingsMemoryBudget: 1000,
+		},
+	}, {
+		args: []string{"-delta", "-delta_threshold", "10"},
+		want: Options{
+			IsDelta:                           true,
+			DeltaShardNumberFallbackThreshold: 10,
+		},
 	}, {
 		// multiple large file pattern
 		args: []string{"-large_file", "*.md", "-large_file", "*.yaml"},
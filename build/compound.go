@@ -0,0 +1,303 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package build
+
+import (
+	"log"
+	"os"
+	"path/filepath"
+	"sort"
+	"strings"
+
+	"github.com/google/zoekt"
+)
+
+// compoundLockFile is locked in an index directory while its compound
+// shards are rewritten.
+const compoundLockFile = ".compound.lock"
+
+// CompactOptions configures packing small shards into compound
+// shards.
+type CompactOptions struct {
+	// IndexDir holds the shards to compact.
+	IndexDir string
+
+	// MaxInputSize is the size above which shards are left alone.
+	MaxInputSize int64
+
+	// TargetSize is the size of the shards built. A compound shard
+	// holds input shards up to this total size.
+	TargetSize int64
+}
+
+// SetDefaults sets reasonable defaults.
+func (o *CompactOptions) SetDefaults() {
+	if o.MaxInputSize == 0 {
+		o.MaxInputSize = 2 << 20
+	}
+	if o.TargetSize == 0 {
+		o.TargetSize = 100 << 20
+	}
+}
+
+// Compact merges the single-shard repositories in IndexDir that are
+// smaller than MaxInputSize into compound shards, and returns the
+// names of the compound shards written. It must not run concurrently
+// with an indexer writing to IndexDir.
+func Compact(opts CompactOptions) ([]string, error) {
+	opts.SetDefaults()
+
+	unlock, err := lockCompoundShards(opts.IndexDir)
+	if err != nil {
+		return nil, err
+	}
+	defer unlock()
+
+	candidates, err := compactCandidates(opts.IndexDir, opts.MaxInputSize)
+	if err != nil {
+		return nil, err
+	}
+
+	var written []string
+	for _, group := range packShards(candidates, opts.TargetSize) {
+		if len(group) < 2 {
+			continue
+		}
+		fn, err := mergeShards(opts.IndexDir, group...)
+		if err != nil {
+			return written, err
+		}
+		written = append(written, fn)
+	}
+	return written, nil
+}
+
+type shardSize struct {
+	path string
+	size int64
+}
+
+// compactCandidates returns the shards in dir of repositories with a
+// single shard smaller than maxSize, in name order.
+func compactCandidates(dir string, maxSize int64) ([]shardSize, error) {
+	names, err := filepath.Glob(filepath.Join(dir, "*.zoekt"))
+	if err != nil {
+		return nil, err
+	}
+
+	var shards []shardSize
+	for _, fn := range names {
+		if strings.HasPrefix(filepath.Base(fn), zoekt.CompoundShardPrefix) {
+			continue
+		}
+		// Only the first shard of a repository is taken, and only if
+		// there is no second one.
+		if !strings.HasSuffix(fn, ".00000.zoekt") {
+			continue
+		}
+		if _, err := os.Stat(strings.TrimSuffix(fn, "00000.zoekt") + "00001.zoekt"); err == nil {
+			continue
+		}
+
+		fi, err := os.Stat(fn)
+		if err != nil {
+			return nil, err
+		}
+		if fi.Size() < maxSize {
+			shards = append(shards, shardSize{fn, fi.Size()})
+		}
+	}
+	sort.Slice(shards, func(i, j int) bool { return shards[i].path < shards[j].path })
+	return shards, nil
+}
+
+// packShards groups shards in order, so each group is at most
+// targetSize in total, or has a single shard.
+func packShards(shards []shardSize, targetSize int64) [][]string {
+	var groups [][]string
+	var cur []string
+	var size int64
+	for _, s := range shards {
+		if len(cur) > 0 && size+s.size > targetSize {
+			groups = append(groups, cur)
+			cur, size = nil, 0
+		}
+		cur = append(cur, s.path)
+		size += s.size
+	}
+	if len(cur) > 0 {
+		groups = append(groups, cur)
+	}
+	return groups
+}
+
+// MergeShards merges the given shards into a compound shard in dir,
+// and removes them. It returns the name of the compound shard.
+func MergeShards(dir string, paths ...string) (string, error) {
+	unlock, err := lockCompoundShards(dir)
+	if err != nil {
+		return "", err
+	}
+	defer unlock()
+	return mergeShards(dir, paths...)
+}
+
+func mergeShards(dir string, paths ...string) (string, error) {
+	tmp, dst, err := mergeFiles(dir, nil, paths)
+	if err != nil {
+		return "", err
+	}
+	if err := os.Rename(tmp, dst); err != nil {
+		os.Remove(tmp)
+		return "", err
+	}
+
+	for _, p := range paths {
+		if p == dst {
+			continue
+		}
+		if err := removeShard(p); err != nil {
+			return dst, err
+		}
+	}
+	return dst, nil
+}
+
+// mergeFiles opens the shards and merges them with zoekt.Merge.
+func mergeFiles(dir string, exclude func(*zoekt.Repository) bool, paths []string) (tmp, dst string, err error) {
+	var files []zoekt.IndexFile
+	defer func() {
+		for _, f := range files {
+			f.Close()
+		}
+	}()
+	for _, p := range paths {
+		f, err := os.Open(p)
+		if err != nil {
+			return "", "", err
+		}
+		iFile, err := zoekt.NewIndexFile(f)
+		if err != nil {
+			return "", "", err
+		}
+		files = append(files, iFile)
+	}
+	return zoekt.Merge(dir, exclude, files...)
+}
+
+// removeShard removes a shard and its ".meta" file.
+func removeShard(fn string) error {
+	paths, err := zoekt.IndexFilePaths(fn)
+	if err != nil {
+		return err
+	}
+	for _, p := range paths {
+		if err := os.Remove(p); err != nil {
+			return err
+		}
+	}
+	return nil
+}
+
+// compoundShards returns the compound shards in dir.
+func compoundShards(dir string) ([]string, error) {
+	return filepath.Glob(filepath.Join(dir, zoekt.CompoundShardPrefix+"*.zoekt"))
+}
+
+// readCompoundMetadata returns the repositories of a compound shard.
+func readCompoundMetadata(fn string) ([]*zoekt.Repository, *zoekt.IndexMetadata, error) {
+	f, err := os.Open(fn)
+	if err != nil {
+		return nil, nil, err
+	}
+	iFile, err := zoekt.NewIndexFile(f)
+	if err != nil {
+		return nil, nil, err
+	}
+	defer iFile.Close()
+
+	return zoekt.ReadMetadataAll(iFile)
+}
+
+// findCompoundShard returns the metadata of the named repository from
+// the compound shards in dir, or a not exist error if none holds it.
+func findCompoundShard(dir, name string) (*zoekt.Repository, *zoekt.IndexMetadata, error) {
+	shards, err := compoundShards(dir)
+	if err != nil {
+		return nil, nil, err
+	}
+	for _, fn := range shards {
+		repos, md, err := readCompoundMetadata(fn)
+		if err != nil {
+			return nil, nil, err
+		}
+		for _, r := range repos {
+			if r.Name == name {
+				return r, md, nil
+			}
+		}
+	}
+	return nil, nil, &os.PathError{Op: "find " + name, Path: filepath.Join(dir, zoekt.CompoundShardPrefix+"*"), Err: os.ErrNotExist}
+}
+
+// EvictFromCompoundShards rewrites the compound shards in dir that
+// hold repositories for which exclude returns true, leaving those
+// out. Compound shards left without repositories are removed.
+func EvictFromCompoundShards(dir string, exclude func(*zoekt.Repository) bool) error {
+	unlock, err := lockCompoundShards(dir)
+	if err != nil {
+		return err
+	}
+	defer unlock()
+
+	shards, err := compoundShards(dir)
+	if err != nil {
+		return err
+	}
+	for _, fn := range shards {
+		repos, _, err := readCompoundMetadata(fn)
+		if err != nil {
+			return err
+		}
+		keep := 0
+		for _, r := range repos {
+			if !exclude(r) {
+				keep++
+			}
+		}
+		if keep == len(repos) {
+			continue
+		}
+
+		log.Printf("evicting %d repositories from %s", len(repos)-keep, fn)
+		if keep > 0 {
+			tmp, dst, err := mergeFiles(dir, exclude, []string{fn})
+			if err != nil {
+				return err
+			}
+			if err := os.Rename(tmp, dst); err != nil {
+				os.Remove(tmp)
+				return err
+			}
+			if dst == fn {
+				continue
+			}
+		}
+		if err := removeShard(fn); err != nil {
+			return err
+		}
+	}
+	return nil
+}
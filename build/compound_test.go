@@ -0,0 +1,170 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package build
+
+import (
+	"context"
+	"path/filepath"
+	"reflect"
+	"runtime"
+	"sort"
+	"testing"
+	"time"
+
+	"github.com/google/zoekt"
+	"github.com/google/zoekt/query"
+	"github.com/google/zoekt/shards"
+)
+
+func TestCompact(t *testing.T) {
+	dir := t.TempDir()
+
+	opts := func(name, version string) Options {
+		o := Options{
+			IndexDir: dir,
+			RepositoryDescription: zoekt.Repository{
+				Name:     name,
+				Branches: []zoekt.RepositoryBranch{{Name: "main", Version: version}},
+			},
+		}
+		o.SetDefaults()
+		return o
+	}
+	build := func(o Options, content string) {
+		t.Helper()
+		b, err := NewBuilder(o)
+		if err != nil {
+			t.Fatalf("NewBuilder: %v", err)
+		}
+		if err := b.AddFile("f", []byte(content)); err != nil {
+			t.Fatal(err)
+		}
+		if err := b.Finish(); err != nil {
+			t.Fatalf("Finish: %v", err)
+		}
+	}
+	searchQuery := func(q query.Q) []string {
+		t.Helper()
+		ss, err := shards.NewDirectorySearcher(dir)
+		if err != nil {
+			t.Fatalf("NewDirectorySearcher: %v", err)
+		}
+		defer ss.Close()
+
+		res, err := ss.Search(context.Background(), q, &zoekt.SearchOptions{})
+		if err != nil {
+			t.Fatal(err)
+		}
+		var got []string
+		for _, f := range res.Files {
+			got = append(got, f.Repository+":"+string(f.LineMatches[0].Line))
+		}
+		sort.Strings(got)
+		return got
+	}
+	search := func() []string {
+		t.Helper()
+		return searchQuery(&query.Substring{Pattern: "needle"})
+	}
+	glob := func(pattern string) int {
+		t.Helper()
+		fs, err := filepath.Glob(filepath.Join(dir, pattern))
+		if err != nil {
+			t.Fatal(err)
+		}
+		return len(fs)
+	}
+
+	for _, name := range []string{"a", "b", "c"} {
+		build(opts(name, "v1"), "needle "+name+"1")
+	}
+
+	written, err := Compact(CompactOptions{IndexDir: dir})
+	if err != nil {
+		t.Fatalf("Compact: %v", err)
+	}
+	if len(written) != 1 || glob("*.zoekt") != 1 {
+		t.Fatalf("got compound shards %v, want all repositories in one", written)
+	}
+	if want := []string{"a:needle a1", "b:needle b1", "c:needle c1"}; !reflect.DeepEqual(search(), want) {
+		t.Errorf("after compaction got %v, want %v", search(), want)
+	}
+	q := query.NewAnd(&query.RepoSet{Set: map[string]bool{"c": true}}, &query.Substring{Pattern: "needle"})
+	if got, want := searchQuery(q), []string{"c:needle c1"}; !reflect.DeepEqual(got, want) {
+		t.Errorf("repo set search got %v, want %v", got, want)
+	}
+
+	if o := opts("b", "v1"); !o.IncrementalSkipIndexing() {
+		t.Errorf("IncrementalSkipIndexing false for a compacted repository")
+	}
+	if o := opts("b", "v2"); o.IncrementalSkipIndexing() {
+		t.Errorf("IncrementalSkipIndexing true for a new version")
+	}
+
+	// Reindexing b evicts it from the compound shard.
+	build(opts("b", "v2"), "needle b2")
+	if want := []string{"a:needle a1", "b:needle b2", "c:needle c1"}; !reflect.DeepEqual(search(), want) {
+		t.Errorf("after reindex got %v, want %v", search(), want)
+	}
+	if n := glob(zoekt.CompoundShardPrefix + "*.zoekt"); n != 1 {
+		t.Errorf("got %d compound shards, want 1", n)
+	}
+
+	if err := EvictFromCompoundShards(dir, func(*zoekt.Repository) bool { return true }); err != nil {
+		t.Fatal(err)
+	}
+	if want := []string{"b:needle b2"}; !reflect.DeepEqual(search(), want) {
+		t.Errorf("after evicting all got %v, want %v", search(), want)
+	}
+	if n := glob(zoekt.CompoundShardPrefix + "*"); n != 0 {
+		t.Errorf("got %d compound shard files, want 0", n)
+	}
+}
+
+func TestEvictWaitsForCompoundLock(t *testing.T) {
+	if runtime.GOOS == "windows" {
+		t.Skip("compound shards aren't locked on windows")
+	}
+	dir := t.TempDir()
+
+	unlock, err := lockCompoundShards(dir)
+	if err != nil {
+		t.Fatal(err)
+	}
+	done := make(chan error, 1)
+	go func() {
+		done <- EvictFromCompoundShards(dir, func(*zoekt.Repository) bool { return true })
+	}()
+
+	select {
+	case err := <-done:
+		t.Fatalf("EvictFromCompoundShards returned %v while the lock was held", err)
+	case <-time.After(100 * time.Millisecond):
+	}
+
+	unlock()
+	if err := <-done; err != nil {
+		t.Fatal(err)
+	}
+}
+
+func TestPackShards(t *testing.T) {
+	shards := []shardSize{{"a", 4}, {"b", 4}, {"c", 3}, {"d", 20}, {"e", 1}}
+	got := packShards(shards, 10)
+	want := [][]string{{"a", "b"}, {"c"}, {"d"}, {"e"}}
+	if !reflect.DeepEqual(got, want) {
+		t.Errorf("got %v, want %v", got, want)
+	}
+}
@@ -139,44 +139,117 @@ func runCTagsChunked(bin string, in map[string][]byte) ([]*ctags.Entry, error) {
 	return res, nil
 }
 
-func ctagsAddSymbolsParser(todo []*zoekt.Document, parser ctags.Parser) error {
+// ctagsAddSymbolsParser parses the documents on up to workers
+// goroutines, which take turns using the processes of parser.
+func ctagsAddSymbolsParser(todo []*zoekt.Document, parser ctags.Parser, workers int) error {
+	if workers < 1 {
+		workers = 1
+	}
+	docs := make(chan *zoekt.Document, len(todo))
 	for _, doc := range todo {
-		if doc.Symbols != nil {
-			continue
-		}
+		docs <- doc
+	}
+	close(docs)
+
+	errs := make(chan error, workers)
+	for i := 0; i < workers; i++ {
+		go func() {
+			for doc := range docs {
+				if err := ctagsParseDocument(doc, parser); err != nil {
+					errs <- err
+					// Make the other workers stop early.
+					for range docs {
+					}
+					return
+				}
+			}
+			errs <- nil
+		}()
+	}
 
-		es, err := parser.Parse(doc.Name, doc.Content)
-		if err != nil {
-			return err
+	var firstErr error
+	for i := 0; i < workers; i++ {
+		if err := <-errs; err != nil && firstErr == nil {
+			firstErr = err
 		}
-		if len(es) == 0 {
-			continue
-		}
-		doc.Language = strings.ToLower(es[0].Language)
+	}
+	return firstErr
+}
 
-		symOffsets, symMetaData, err := tagsToSections(doc.Content, es)
-		if err != nil {
-			return fmt.Errorf("%s: %v", doc.Name, err)
-		}
-		doc.Symbols = symOffsets
-		doc.SymbolsMetaData = symMetaData
+func ctagsParseDocument(doc *zoekt.Document, parser ctags.Parser) error {
+	es, err := parser.Parse(doc.Name, doc.Content)
+	if err != nil {
+		return err
 	}
+	if len(es) == 0 {
+		return nil
+	}
+	doc.Language = strings.ToLower(es[0].Language)
 
+	symOffsets, symMetaData, err := tagsToSections(doc.Content, es)
+	if err != nil {
+		return fmt.Errorf("%s: %v", doc.Name, err)
+	}
+	doc.Symbols = symOffsets
+	doc.SymbolsMetaData = symMetaData
 	return nil
 }
 
-func ctagsAddSymbols(todo []*zoekt.Document, parser ctags.Parser, bin string) error {
+// ctagsAddSymbols adds symbols to the documents that have none. If
+// cache is set, documents are looked up there first, and the results
+// for the others are stored.
+func ctagsAddSymbols(todo []*zoekt.Document, parser ctags.Parser, bin string, workers int, cache *symbolCache) (symbolCacheStats, error) {
+	var stats symbolCacheStats
+	var misses []*zoekt.Document
+	for _, doc := range todo {
+		if doc.Symbols != nil {
+			continue
+		}
+		if cache != nil {
+			stats.lookups++
+			if cache.get(doc) {
+				stats.hits++
+				continue
+			}
+		}
+		misses = append(misses, doc)
+	}
+	if len(misses) == 0 {
+		return stats, nil
+	}
+
+	// Parsing overwrites the language only if ctags knows it.
+	languages := make([]string, len(misses))
+	for i, doc := range misses {
+		languages[i] = doc.Language
+	}
+
+	var err error
 	if parser != nil {
-		return ctagsAddSymbolsParser(todo, parser)
+		err = ctagsAddSymbolsParser(misses, parser, workers)
+	} else {
+		err = ctagsAddSymbolsExec(misses, bin)
 	}
+	if err != nil {
+		return stats, err
+	}
+
+	if cache != nil {
+		for i, doc := range misses {
+			var language string
+			if doc.Language != languages[i] {
+				language = doc.Language
+			}
+			cache.put(doc, language)
+		}
+	}
+	return stats, nil
+}
 
+func ctagsAddSymbolsExec(todo []*zoekt.Document, bin string) error {
 	pathIndices := map[string]int{}
 	contents := map[string][]byte{}
 	for i, t := range todo {
-		if t.Symbols != nil {
-			continue
-		}
-
 		_, ok := pathIndices[t.Name]
 		if ok {
 			continue
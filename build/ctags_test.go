@@ -15,7 +15,12 @@
 package build
 
 import (
+	"fmt"
+	"io/ioutil"
+	"os"
 	"reflect"
+	"strings"
+	"sync"
 	"testing"
 
 	"github.com/google/zoekt"
@@ -92,3 +97,81 @@ func TestTagsToSectionsEOF(t *testing.T) {
 		t.Fatalf("got %#v, want 1 section (17,20)", secs)
 	}
 }
+
+// countingParser tags every "func" line, and counts its calls.
+type countingParser struct {
+	mu    sync.Mutex
+	calls int
+}
+
+func (p *countingParser) Parse(name string, content []byte) ([]*ctags.Entry, error) {
+	p.mu.Lock()
+	p.calls++
+	p.mu.Unlock()
+
+	var es []*ctags.Entry
+	for i, l := range strings.Split(string(content), "\n") {
+		if strings.HasPrefix(l, "func ") {
+			es = append(es, &ctags.Entry{
+				Name:     strings.TrimSuffix(strings.Fields(l)[1], "()"),
+				Line:     i + 1,
+				Kind:     "function",
+				Language: "Go",
+			})
+		}
+	}
+	return es, nil
+}
+
+func (p *countingParser) Close() {}
+
+func TestCTagsSymbolCache(t *testing.T) {
+	dir, err := ioutil.TempDir("", "symbolcache")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer os.RemoveAll(dir)
+
+	docs := func() []*zoekt.Document {
+		var todo []*zoekt.Document
+		for i := 0; i < 20; i++ {
+			todo = append(todo, &zoekt.Document{
+				Name:    fmt.Sprintf("f%d.go", i),
+				Content: []byte(fmt.Sprintf("package foo\nfunc bar%d() {}\n", i)),
+			})
+		}
+		// A file without symbols is cached too.
+		todo = append(todo, &zoekt.Document{Name: "README", Content: []byte("hello")})
+		return todo
+	}
+
+	cache := &symbolCache{dir: dir}
+	parser := &countingParser{}
+	first := docs()
+	stats, err := ctagsAddSymbols(first, parser, "", 4, cache)
+	if err != nil {
+		t.Fatal(err)
+	}
+	if want := (symbolCacheStats{lookups: 21}); stats != want || parser.calls != 21 {
+		t.Fatalf("first build: got %+v with %d calls, want %+v with 21", stats, parser.calls, want)
+	}
+
+	parser = &countingParser{}
+	second := docs()
+	// A renamed file may have another language.
+	second[0].Name = "f0.js"
+	stats, err = ctagsAddSymbols(second, parser, "", 4, cache)
+	if err != nil {
+		t.Fatal(err)
+	}
+	if want := (symbolCacheStats{hits: 20, lookups: 21}); stats != want || parser.calls != 1 {
+		t.Fatalf("second build: got %+v with %d calls, want %+v with 1", stats, parser.calls, want)
+	}
+	second[0].Name = first[0].Name
+	if !reflect.DeepEqual(first, second) {
+		t.Errorf("cached documents differ:\n%v\n%v", first, second)
+	}
+	if got := second[1]; got.Language != "go" || len(got.Symbols) != 1 || got.SymbolsMetaData[0].Sym != "bar1" {
+		t.Errorf("got %+v, want symbol bar1", got)
+	}
+}
@@ -0,0 +1,144 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package build
+
+import (
+	"encoding/json"
+	"fmt"
+	"io/ioutil"
+	"os"
+	"path/filepath"
+	"runtime"
+
+	"github.com/google/zoekt"
+)
+
+// readShardMetadata reads the repository metadata of a shard,
+// including the changes from its ".meta" file.
+func readShardMetadata(fn string) (*zoekt.Repository, *zoekt.IndexMetadata, error) {
+	f, err := os.Open(fn)
+	if err != nil {
+		return nil, nil, err
+	}
+
+	iFile, err := zoekt.NewIndexFile(f)
+	if err != nil {
+		return nil, nil, err
+	}
+	defer iFile.Close()
+
+	return zoekt.ReadMetadata(iFile)
+}
+
+// shardCount returns the number of shards on disk for the repository.
+func (o *Options) shardCount() int {
+	n := 0
+	for {
+		if _, err := os.Stat(o.shardName(n)); err != nil {
+			return n
+		}
+		n++
+	}
+}
+
+// DeltaBase returns the repository metadata of the index on disk, if
+// a delta build can be added to it. This requires an index built with
+// the same options, for the same branches in the same order, with at
+// most DeltaShardNumberFallbackThreshold shards.
+func (o *Options) DeltaBase() (*zoekt.Repository, error) {
+	repo, err := o.compatibleIndex()
+	if err != nil {
+		return nil, err
+	}
+
+	if o.shardCount() == 0 {
+		return nil, fmt.Errorf("index is in a compound shard")
+	}
+
+	if len(repo.Branches) != len(o.RepositoryDescription.Branches) {
+		return nil, fmt.Errorf("index has %d branches, want %d", len(repo.Branches), len(o.RepositoryDescription.Branches))
+	}
+	for i, b := range repo.Branches {
+		if want := o.RepositoryDescription.Branches[i].Name; b.Name != want {
+			return nil, fmt.Errorf("index has branch %q, want %q", b.Name, want)
+		}
+	}
+
+	if n := o.shardCount(); o.DeltaShardNumberFallbackThreshold > 0 && n > o.DeltaShardNumberFallbackThreshold {
+		return nil, fmt.Errorf("index has %d shards, more than the delta threshold %d", n, o.DeltaShardNumberFallbackThreshold)
+	}
+	return repo, nil
+}
+
+// MarkFileDeleted tombstones a file in the existing shards of a delta
+// build. Files passed to Add are tombstoned too.
+func (b *Builder) MarkFileDeleted(name string) {
+	b.tombstones[name] = struct{}{}
+}
+
+// writeTombstones adds the tombstones of this delta build to the
+// ".meta" files of the shards it builds on, and updates their branch
+// versions.
+func (b *Builder) writeTombstones() error {
+	for n := 0; n < b.baseShards; n++ {
+		fn := b.opts.shardName(n)
+		repo, _, err := readShardMetadata(fn)
+		if err != nil {
+			return err
+		}
+
+		if repo.FileTombstones == nil {
+			repo.FileTombstones = make(map[string]struct{}, len(b.tombstones))
+		}
+		for name := range b.tombstones {
+			repo.FileTombstones[name] = struct{}{}
+		}
+		repo.Branches = b.opts.RepositoryDescription.Branches
+
+		if err := writeMetaFile(fn, repo); err != nil {
+			return err
+		}
+		b.shardLog("tombstone", fn)
+	}
+	return nil
+}
+
+// writeMetaFile atomically replaces the ".meta" file of shard fn.
+func writeMetaFile(fn string, repo *zoekt.Repository) error {
+	blob, err := json.Marshal(repo)
+	if err != nil {
+		return err
+	}
+
+	f, err := ioutil.TempFile(filepath.Dir(fn), filepath.Base(fn)+".meta.*.tmp")
+	if err != nil {
+		return err
+	}
+	defer os.Remove(f.Name())
+	defer f.Close()
+
+	if runtime.GOOS != "windows" {
+		if err := f.Chmod(0o666 &^ umask); err != nil {
+			return err
+		}
+	}
+	if _, err := f.Write(blob); err != nil {
+		return err
+	}
+	if err := f.Close(); err != nil {
+		return err
+	}
+	return os.Rename(f.Name(), fn+".meta")
+}
@@ -0,0 +1,185 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package build
+
+import (
+	"context"
+	"os"
+	"path/filepath"
+	"reflect"
+	"sort"
+	"testing"
+
+	"github.com/google/zoekt"
+	"github.com/google/zoekt/query"
+	"github.com/google/zoekt/shards"
+)
+
+func TestDeltaBuild(t *testing.T) {
+	dir := t.TempDir()
+
+	opts := func(version string, delta bool) Options {
+		o := Options{
+			IndexDir: dir,
+			RepositoryDescription: zoekt.Repository{
+				Name:     "repo",
+				Branches: []zoekt.RepositoryBranch{{Name: "main", Version: version}},
+			},
+			IsDelta: delta,
+		}
+		o.SetDefaults()
+		return o
+	}
+	build := func(o Options, docs map[string]string, deleted ...string) {
+		t.Helper()
+		b, err := NewBuilder(o)
+		if err != nil {
+			t.Fatalf("NewBuilder: %v", err)
+		}
+		for name, content := range docs {
+			if err := b.AddFile(name, []byte(content)); err != nil {
+				t.Fatal(err)
+			}
+		}
+		for _, name := range deleted {
+			b.MarkFileDeleted(name)
+		}
+		if err := b.Finish(); err != nil {
+			t.Fatalf("Finish: %v", err)
+		}
+	}
+	search := func() []string {
+		t.Helper()
+		ss, err := shards.NewDirectorySearcher(dir)
+		if err != nil {
+			t.Fatalf("NewDirectorySearcher: %v", err)
+		}
+		defer ss.Close()
+
+		res, err := ss.Search(context.Background(), &query.Substring{Pattern: "needle"}, &zoekt.SearchOptions{})
+		if err != nil {
+			t.Fatal(err)
+		}
+		var got []string
+		for _, f := range res.Files {
+			got = append(got, f.FileName+":"+string(f.LineMatches[0].Line))
+		}
+		sort.Strings(got)
+		return got
+	}
+
+	documents := func() int {
+		t.Helper()
+		ss, err := shards.NewDirectorySearcher(dir)
+		if err != nil {
+			t.Fatalf("NewDirectorySearcher: %v", err)
+		}
+		defer ss.Close()
+
+		rl, err := ss.List(context.Background(), &query.Const{Value: true}, nil)
+		if err != nil {
+			t.Fatal(err)
+		}
+		res, err := ss.Search(context.Background(), &query.Const{Value: true}, &zoekt.SearchOptions{EstimateDocCount: true})
+		if err != nil {
+			t.Fatal(err)
+		}
+		n := 0
+		for _, r := range rl.Repos {
+			n += r.Stats.Documents
+		}
+		if res.Stats.ShardFilesConsidered != n {
+			t.Errorf("estimated %d documents, listed %d", res.Stats.ShardFilesConsidered, n)
+		}
+		return n
+	}
+
+	build(opts("v1", false), map[string]string{
+		"a": "needle a1",
+		"b": "needle b1",
+		"c": "needle c1",
+	})
+
+	o := opts("v2", true)
+	if _, err := o.DeltaBase(); err != nil {
+		t.Fatalf("DeltaBase: %v", err)
+	}
+	build(o, map[string]string{
+		"b": "needle b2",
+		"d": "needle d2",
+	}, "c")
+
+	fs, _ := filepath.Glob(filepath.Join(dir, "*.zoekt"))
+	if len(fs) != 2 {
+		t.Fatalf("got shards %v, want a base and a delta shard", fs)
+	}
+	if got, want := search(), []string{"a:needle a1", "b:needle b2", "d:needle d2"}; !reflect.DeepEqual(got, want) {
+		t.Errorf("after delta got %v, want %v", got, want)
+	}
+	if got := documents(); got != 3 {
+		t.Errorf("after delta got %d documents, want 3", got)
+	}
+	if o := opts("v2", false); !o.IncrementalSkipIndexing() {
+		t.Error("IncrementalSkipIndexing is false after the delta build")
+	}
+
+	o = opts("v3", true)
+	o.DeltaShardNumberFallbackThreshold = 1
+	if _, err := o.DeltaBase(); err == nil {
+		t.Error("DeltaBase allowed a delta build over the shard threshold")
+	}
+
+	// A full build compacts the deltas and drops the tombstones.
+	build(opts("v3", false), map[string]string{
+		"a": "needle a3",
+		"c": "needle c3",
+	})
+	fs, _ = filepath.Glob(filepath.Join(dir, "*.zoekt*"))
+	if len(fs) != 1 {
+		t.Fatalf("got files %v after full build, want one shard", fs)
+	}
+	if got, want := search(), []string{"a:needle a3", "c:needle c3"}; !reflect.DeepEqual(got, want) {
+		t.Errorf("after full build got %v, want %v", got, want)
+	}
+}
+
+func TestDeltaBaseBranches(t *testing.T) {
+	dir := t.TempDir()
+	o := Options{
+		IndexDir: dir,
+		RepositoryDescription: zoekt.Repository{
+			Name:     "repo",
+			Branches: []zoekt.RepositoryBranch{{Name: "main", Version: "v1"}},
+		},
+	}
+	o.SetDefaults()
+	if _, err := o.DeltaBase(); !os.IsNotExist(err) {
+		t.Errorf("got %v without an index, want a not exist error", err)
+	}
+
+	b, err := NewBuilder(o)
+	if err != nil {
+		t.Fatal(err)
+	}
+	b.AddFile("a", []byte("a"))
+	if err := b.Finish(); err != nil {
+		t.Fatal(err)
+	}
+
+	o.RepositoryDescription.Branches = []zoekt.RepositoryBranch{{Name: "dev", Version: "v2"}}
+	if _, err := o.DeltaBase(); err == nil {
+		t.Error("DeltaBase allowed a delta build for other branches")
+	}
+}
@@ -378,6 +378,9 @@ func TestDeleteOldShards(t *testing.T) {
 	} else if len(fs) != 4 {
 		t.Fatalf("Glob(%s): got %v, want 4 shards", glob, fs)
 	}
+	if got := opts.FindAllShards(); !reflect.DeepEqual(got, fs) {
+		t.Errorf("FindAllShards: got %v, want %v", got, fs)
+	}
 
 	if fi, err := os.Lstat(fs[0]); err != nil {
 		t.Fatalf("Lstat: %v", err)
@@ -406,6 +409,9 @@ func TestDeleteOldShards(t *testing.T) {
 	} else if len(fs) != 1 {
 		t.Fatalf("Glob(%s): got %v, want 1 shard", glob, fs)
 	}
+	if got := opts.FindAllShards(); !reflect.DeepEqual(got, fs) {
+		t.Errorf("FindAllShards: got %v, want %v", got, fs)
+	}
 
 	// Again, but don't index anything; should leave old shards intact.
 	b, err = NewBuilder(opts)
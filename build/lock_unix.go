@@ -0,0 +1,40 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// +build !windows
+
+package build
+
+import (
+	"os"
+	"path/filepath"
+	"syscall"
+)
+
+// lockCompoundShards takes an exclusive lock on the compound shards of
+// dir, which indexers in other processes also rewrite. It returns a
+// function that releases the lock.
+func lockCompoundShards(dir string) (func(), error) {
+	f, err := os.OpenFile(filepath.Join(dir, compoundLockFile), os.O_CREATE|os.O_RDWR, 0o666&^umask)
+	if err != nil {
+		return nil, err
+	}
+	if err := syscall.Flock(int(f.Fd()), syscall.LOCK_EX); err != nil {
+		f.Close()
+		return nil, err
+	}
+	return func() {
+		syscall.Flock(int(f.Fd()), syscall.LOCK_UN)
+		f.Close()
+	}, nil
+}
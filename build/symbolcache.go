@@ -0,0 +1,118 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package build
+
+import (
+	"crypto/sha1"
+	"encoding/gob"
+	"fmt"
+	"hash/fnv"
+	"io/ioutil"
+	"log"
+	"os"
+	"path/filepath"
+
+	"github.com/google/zoekt"
+)
+
+// symbolCache stores the ctags output of files on disk, so unchanged
+// files need not be parsed again by the next build.
+//
+// Entries are keyed by the git blob hash of the content, and the base
+// name of the file, which ctags uses to pick the language. Files
+// without symbols are stored too. The cache is never pruned; remove
+// the directory when upgrading ctags.
+type symbolCache struct {
+	dir string
+}
+
+// cachedSymbols is the on-disk value of a cache entry.
+type cachedSymbols struct {
+	Language        string
+	Symbols         []zoekt.DocumentSection
+	SymbolsMetaData []*zoekt.Symbol
+}
+
+// symbolCacheStats counts the lookups for one shard.
+type symbolCacheStats struct {
+	hits, lookups int
+}
+
+func (c *symbolCache) path(doc *zoekt.Document) string {
+	h := sha1.New()
+	fmt.Fprintf(h, "blob %d\x00", len(doc.Content))
+	h.Write(doc.Content)
+	blob := fmt.Sprintf("%x", h.Sum(nil))
+
+	n := fnv.New32a()
+	n.Write([]byte(filepath.Base(doc.Name)))
+	return filepath.Join(c.dir, blob[:2], fmt.Sprintf("%s-%08x", blob, n.Sum32()))
+}
+
+// get fills in the symbols of doc from the cache. It returns false if
+// doc is not in the cache.
+func (c *symbolCache) get(doc *zoekt.Document) bool {
+	f, err := os.Open(c.path(doc))
+	if err != nil {
+		return false
+	}
+	defer f.Close()
+
+	var e cachedSymbols
+	if err := gob.NewDecoder(f).Decode(&e); err != nil {
+		log.Printf("symbol cache: %s: %v", f.Name(), err)
+		return false
+	}
+	if e.Language != "" {
+		doc.Language = e.Language
+	}
+	doc.Symbols = e.Symbols
+	doc.SymbolsMetaData = e.SymbolsMetaData
+	return true
+}
+
+// put stores the symbols of doc. Errors are logged, as the cache only
+// saves work.
+func (c *symbolCache) put(doc *zoekt.Document, language string) {
+	if err := c.write(c.path(doc), &cachedSymbols{
+		Language:        language,
+		Symbols:         doc.Symbols,
+		SymbolsMetaData: doc.SymbolsMetaData,
+	}); err != nil {
+		log.Printf("symbol cache: %v", err)
+	}
+}
+
+func (c *symbolCache) write(path string, e *cachedSymbols) error {
+	dir := filepath.Dir(path)
+	if err := os.MkdirAll(dir, 0o700); err != nil {
+		return err
+	}
+	f, err := ioutil.TempFile(dir, filepath.Base(path)+".*.tmp")
+	if err != nil {
+		return err
+	}
+	defer os.Remove(f.Name())
+	defer f.Close()
+
+	if err := gob.NewEncoder(f).Encode(e); err != nil {
+		return err
+	}
+	if err := f.Close(); err != nil {
+		return err
+	}
+	// Concurrent builders write the same value, so either wins.
+	return os.Rename(f.Name(), path)
+}
@@ -0,0 +1,473 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// zoekt-bench replays a query log against an index directory, and
+// reports latencies, allocations and search statistics.
+//
+// The query log has one JSON object per line, with the query in the
+// zoekt query language and optional search options:
+//
+//	{"Query": "needle lang:go", "Options": {"ShardMaxMatchCount": 100}}
+//
+// A report saved with -out can be compared with a later run, for
+// example of another build, by passing it as -baseline.
+package main
+
+import (
+	"bufio"
+	"context"
+	"encoding/json"
+	"errors"
+	"flag"
+	"fmt"
+	"io"
+	"log"
+	"os"
+	"path/filepath"
+	"runtime"
+	"sort"
+	"sync"
+	"text/tabwriter"
+	"time"
+
+	"github.com/google/zoekt"
+	"github.com/google/zoekt/query"
+	"github.com/google/zoekt/shards"
+)
+
+// benchQuery is a line of the query log.
+type benchQuery struct {
+	Query   string
+	Options *zoekt.SearchOptions
+}
+
+// queryReport has the measurements for one query of the log.
+type queryReport struct {
+	Query string
+
+	// Latencies of every measured search, in order of completion.
+	Latencies []time.Duration
+
+	// Allocs and AllocBytes are per search. They are only measured
+	// with a concurrency of 1, where they can be attributed.
+	Allocs     uint64 `json:",omitempty"`
+	AllocBytes uint64 `json:",omitempty"`
+
+	Errors int
+	Stats  zoekt.Stats
+}
+
+// report is the result of a benchmark run.
+type report struct {
+	IndexDir    string
+	Concurrency int
+	Iterations  int
+
+	Wall       time.Duration
+	Searches   int
+	Allocs     uint64
+	AllocBytes uint64
+
+	Queries []*queryReport
+}
+
+func readQueries(r io.Reader) ([]benchQuery, error) {
+	var qs []benchQuery
+	scanner := bufio.NewScanner(r)
+	scanner.Buffer(nil, 1<<20)
+	for line := 1; scanner.Scan(); line++ {
+		if len(scanner.Bytes()) == 0 {
+			continue
+		}
+		var q benchQuery
+		if err := json.Unmarshal(scanner.Bytes(), &q); err != nil {
+			return nil, fmt.Errorf("line %d: %v", line, err)
+		}
+		if q.Options == nil {
+			q.Options = &zoekt.SearchOptions{}
+		}
+		qs = append(qs, q)
+	}
+	return qs, scanner.Err()
+}
+
+type searchJob struct {
+	idx int
+	q   query.Q
+}
+
+// replay searches every query iterations times, on concurrency
+// goroutines.
+func replay(searcher zoekt.Searcher, qs []benchQuery, concurrency, iterations int, warmup bool) (*report, error) {
+	parsed := make([]query.Q, len(qs))
+	rep := &report{
+		Concurrency: concurrency,
+		Iterations:  iterations,
+		Queries:     make([]*queryReport, len(qs)),
+	}
+	for i, bq := range qs {
+		q, err := query.Parse(bq.Query)
+		if err != nil {
+			return nil, fmt.Errorf("query %q: %v", bq.Query, err)
+		}
+		parsed[i] = q
+		rep.Queries[i] = &queryReport{Query: bq.Query}
+	}
+
+	ctx := context.Background()
+	if warmup {
+		for i, q := range parsed {
+			searcher.Search(ctx, q, qs[i].Options)
+		}
+	}
+
+	jobs := make(chan searchJob)
+	go func() {
+		defer close(jobs)
+		for it := 0; it < iterations; it++ {
+			for i, q := range parsed {
+				jobs <- searchJob{i, q}
+			}
+		}
+	}()
+
+	var before runtime.MemStats
+	runtime.ReadMemStats(&before)
+	start := time.Now()
+
+	var mu sync.Mutex
+	var wg sync.WaitGroup
+	for w := 0; w < concurrency; w++ {
+		wg.Add(1)
+		go func() {
+			defer wg.Done()
+			var ms runtime.MemStats
+			for j := range jobs {
+				if concurrency == 1 {
+					runtime.ReadMemStats(&ms)
+				}
+				mallocs, allocBytes := ms.Mallocs, ms.TotalAlloc
+
+				t := time.Now()
+				sr, err := searcher.Search(ctx, j.q, qs[j.idx].Options)
+				latency := time.Since(t)
+
+				if concurrency == 1 {
+					runtime.ReadMemStats(&ms)
+					mallocs, allocBytes = ms.Mallocs-mallocs, ms.TotalAlloc-allocBytes
+				}
+
+				mu.Lock()
+				qr := rep.Queries[j.idx]
+				qr.Latencies = append(qr.Latencies, latency)
+				if err != nil {
+					qr.Errors++
+				} else {
+					qr.Stats.Add(sr.Stats)
+				}
+				if concurrency == 1 {
+					qr.Allocs += mallocs
+					qr.AllocBytes += allocBytes
+				}
+				rep.Searches++
+				mu.Unlock()
+			}
+		}()
+	}
+	wg.Wait()
+
+	rep.Wall = time.Since(start)
+	var after runtime.MemStats
+	runtime.ReadMemStats(&after)
+	if rep.Searches > 0 {
+		rep.Allocs = (after.Mallocs - before.Mallocs) / uint64(rep.Searches)
+		rep.AllocBytes = (after.TotalAlloc - before.TotalAlloc) / uint64(rep.Searches)
+	}
+	if concurrency == 1 {
+		for _, qr := range rep.Queries {
+			if n := uint64(len(qr.Latencies)); n > 0 {
+				qr.Allocs /= n
+				qr.AllocBytes /= n
+			}
+		}
+	}
+	return rep, nil
+}
+
+// percentile returns the p-th percentile (0 <= p <= 1) of sorted.
+func percentile(sorted []time.Duration, p float64) time.Duration {
+	if len(sorted) == 0 {
+		return 0
+	}
+	return sorted[int(p*float64(len(sorted)-1)+0.5)]
+}
+
+func sortedLatencies(ds []time.Duration) []time.Duration {
+	s := append([]time.Duration(nil), ds...)
+	sort.Slice(s, func(i, j int) bool { return s[i] < s[j] })
+	return s
+}
+
+// histogramBucket counts the latencies below Max, and at least the
+// Max of the previous bucket.
+type histogramBucket struct {
+	Max   time.Duration
+	Count int
+}
+
+// latencyHistogram buckets latencies by powers of 2, starting at
+// 100µs.
+func latencyHistogram(latencies []time.Duration) []histogramBucket {
+	var buckets []histogramBucket
+	for _, l := range latencies {
+		i := 0
+		for limit := 100 * time.Microsecond; l >= limit; limit *= 2 {
+			i++
+		}
+		for len(buckets) <= i {
+			buckets = append(buckets, histogramBucket{Max: 100 * time.Microsecond << uint(len(buckets))})
+		}
+		buckets[i].Count++
+	}
+	return buckets
+}
+
+func (r *report) allLatencies() []time.Duration {
+	var all []time.Duration
+	for _, qr := range r.Queries {
+		all = append(all, qr.Latencies...)
+	}
+	return sortedLatencies(all)
+}
+
+func (r *report) totalStats() zoekt.Stats {
+	var s zoekt.Stats
+	for _, qr := range r.Queries {
+		s.Add(qr.Stats)
+	}
+	return s
+}
+
+func printReport(w io.Writer, r *report, histograms bool) {
+	tw := tabwriter.NewWriter(w, 0, 8, 2, ' ', 0)
+	fmt.Fprintf(tw, "query\tp50\tp90\tp99\tmax\tallocs\terrors\n")
+	for _, qr := range r.Queries {
+		s := sortedLatencies(qr.Latencies)
+		fmt.Fprintf(tw, "%s\t%v\t%v\t%v\t%v\t%d\t%d\n", qr.Query,
+			percentile(s, 0.5), percentile(s, 0.9), percentile(s, 0.99), percentile(s, 1), qr.Allocs, qr.Errors)
+	}
+	tw.Flush()
+
+	all := r.allLatencies()
+	fmt.Fprintf(w, "\n%d searches in %v (%.1f qps) with concurrency %d\n",
+		r.Searches, r.Wall, float64(r.Searches)/r.Wall.Seconds(), r.Concurrency)
+	fmt.Fprintf(w, "latency p50 %v p90 %v p99 %v max %v\n",
+		percentile(all, 0.5), percentile(all, 0.9), percentile(all, 0.99), percentile(all, 1))
+	fmt.Fprintf(w, "%d allocs, %d bytes allocated per search\n", r.Allocs, r.AllocBytes)
+
+	fmt.Fprintf(w, "\nlatency histogram:\n")
+	printHistogram(w, latencyHistogram(all))
+	if histograms {
+		for _, qr := range r.Queries {
+			fmt.Fprintf(w, "\n%s:\n", qr.Query)
+			printHistogram(w, latencyHistogram(qr.Latencies))
+		}
+	}
+
+	s := r.totalStats()
+	fmt.Fprintf(w, "\nstats: %+v\n", s)
+}
+
+func printHistogram(w io.Writer, buckets []histogramBucket) {
+	most := 0
+	for _, b := range buckets {
+		if b.Count > most {
+			most = b.Count
+		}
+	}
+	tw := tabwriter.NewWriter(w, 0, 8, 1, ' ', tabwriter.AlignRight)
+	for _, b := range buckets {
+		bar := 0
+		if most > 0 {
+			bar = len(bars) * b.Count / most
+		}
+		fmt.Fprintf(tw, "< %v\t%d\t %s\n", b.Max, b.Count, bars[:bar])
+	}
+	tw.Flush()
+}
+
+const bars = "########################################"
+
+// delta formats the relative change from base to cand.
+func delta(base, cand float64) string {
+	if base == 0 {
+		return "~"
+	}
+	return fmt.Sprintf("%+.1f%%", 100*(cand-base)/base)
+}
+
+// compareReports prints the change of latencies, allocations and work
+// from base to cand. Queries are matched by their text.
+func compareReports(w io.Writer, base, cand *report) {
+	baseQueries := map[string]*queryReport{}
+	for _, qr := range base.Queries {
+		baseQueries[qr.Query] = qr
+	}
+
+	tw := tabwriter.NewWriter(w, 0, 8, 2, ' ', 0)
+	fmt.Fprintf(tw, "query\tbase p50\tcand p50\tdelta\tbase p99\tcand p99\tdelta\tallocs delta\n")
+	for _, cq := range cand.Queries {
+		bq, ok := baseQueries[cq.Query]
+		if !ok {
+			continue
+		}
+		bs, cs := sortedLatencies(bq.Latencies), sortedLatencies(cq.Latencies)
+		b50, c50 := percentile(bs, 0.5), percentile(cs, 0.5)
+		b99, c99 := percentile(bs, 0.99), percentile(cs, 0.99)
+		fmt.Fprintf(tw, "%s\t%v\t%v\t%s\t%v\t%v\t%s\t%s\n", cq.Query,
+			b50, c50, delta(float64(b50), float64(c50)),
+			b99, c99, delta(float64(b99), float64(c99)),
+			delta(float64(bq.Allocs), float64(cq.Allocs)))
+	}
+	tw.Flush()
+
+	ba, ca := base.allLatencies(), cand.allLatencies()
+	fmt.Fprintf(w, "\n")
+	tw = tabwriter.NewWriter(w, 0, 8, 2, ' ', 0)
+	fmt.Fprintf(tw, "total\tbase\tcand\tdelta\n")
+	row := func(name string, b, c float64, unit string) {
+		fmt.Fprintf(tw, "%s\t%.0f%s\t%.0f%s\t%s\n", name, b, unit, c, unit, delta(b, c))
+	}
+	row("p50", float64(percentile(ba, 0.5).Microseconds()), float64(percentile(ca, 0.5).Microseconds()), "µs")
+	row("p90", float64(percentile(ba, 0.9).Microseconds()), float64(percentile(ca, 0.9).Microseconds()), "µs")
+	row("p99", float64(percentile(ba, 0.99).Microseconds()), float64(percentile(ca, 0.99).Microseconds()), "µs")
+	row("allocs/search", float64(base.Allocs), float64(cand.Allocs), "")
+	row("bytes/search", float64(base.AllocBytes), float64(cand.AllocBytes), "")
+
+	bs, cs := base.totalStats(), cand.totalStats()
+	row("FilesConsidered", float64(bs.FilesConsidered), float64(cs.FilesConsidered), "")
+	row("FilesLoaded", float64(bs.FilesLoaded), float64(cs.FilesLoaded), "")
+	row("ContentBytesLoaded", float64(bs.ContentBytesLoaded), float64(cs.ContentBytesLoaded), "")
+	row("IndexBytesLoaded", float64(bs.IndexBytesLoaded), float64(cs.IndexBytesLoaded), "")
+	row("NgramMatches", float64(bs.NgramMatches), float64(cs.NgramMatches), "")
+	row("RegexpsConsidered", float64(bs.RegexpsConsidered), float64(cs.RegexpsConsidered), "")
+	row("MatchCount", float64(bs.MatchCount), float64(cs.MatchCount), "")
+	row("FileCount", float64(bs.FileCount), float64(cs.FileCount), "")
+	tw.Flush()
+}
+
+func readReport(fn string) (*report, error) {
+	f, err := os.Open(fn)
+	if err != nil {
+		return nil, err
+	}
+	defer f.Close()
+
+	var r report
+	if err := json.NewDecoder(f).Decode(&r); err != nil {
+		return nil, fmt.Errorf("%s: %v", fn, err)
+	}
+	return &r, nil
+}
+
+func writeReport(fn string, r *report) error {
+	f, err := os.Create(fn)
+	if err != nil {
+		return err
+	}
+	if err := json.NewEncoder(f).Encode(r); err != nil {
+		f.Close()
+		return err
+	}
+	return f.Close()
+}
+
+func main() {
+	if err := run(); err != nil {
+		log.Fatal(err)
+	}
+}
+
+// run replays or compares reports as the flags say. It returns
+// instead of exiting, so deferred cleanups run.
+func run() error {
+	index := flag.String("index_dir",
+		filepath.Join(os.Getenv("HOME"), ".zoekt"), "search for index files in `directory`")
+	queries := flag.String("queries", "", "JSON lines `file` of queries to replay")
+	concurrency := flag.Int("concurrency", 1, "number of concurrent searches. Allocations per query are only measured with 1.")
+	iterations := flag.Int("iterations", 10, "number of times to search each query")
+	warmup := flag.Bool("warmup", true, "search each query once before measuring")
+	out := flag.String("out", "", "write the report as JSON to `file`")
+	baseline := flag.String("baseline", "", "compare with the report in `file`")
+	candidate := flag.String("candidate", "", "compare the report in `file` with -baseline, instead of running queries")
+	histograms := flag.Bool("histograms", false, "print a latency histogram for every query")
+	flag.Parse()
+
+	var rep *report
+	if *candidate != "" {
+		if *baseline == "" {
+			return errors.New("-candidate requires -baseline")
+		}
+		var err error
+		rep, err = readReport(*candidate)
+		if err != nil {
+			return err
+		}
+	} else {
+		if *queries == "" {
+			return errors.New("must set -queries")
+		}
+		if *concurrency < 1 || *iterations < 1 {
+			return errors.New("-concurrency and -iterations must be positive")
+		}
+		f, err := os.Open(*queries)
+		if err != nil {
+			return err
+		}
+		qs, err := readQueries(f)
+		f.Close()
+		if err != nil {
+			return fmt.Errorf("%s: %v", *queries, err)
+		}
+
+		searcher, err := shards.NewDirectorySearcher(*index)
+		if err != nil {
+			return err
+		}
+		defer searcher.Close()
+
+		rep, err = replay(searcher, qs, *concurrency, *iterations, *warmup)
+		if err != nil {
+			return err
+		}
+		rep.IndexDir = *index
+
+		printReport(os.Stdout, rep, *histograms)
+		if *out != "" {
+			if err := writeReport(*out, rep); err != nil {
+				return err
+			}
+		}
+	}
+
+	if *baseline != "" {
+		base, err := readReport(*baseline)
+		if err != nil {
+			return err
+		}
+		fmt.Printf("\ncompared with %s:\n", *baseline)
+		compareReports(os.Stdout, base, rep)
+	}
+	return nil
+}
@@ -0,0 +1,97 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package main
+
+import (
+	"bytes"
+	"strings"
+	"testing"
+	"time"
+
+	"github.com/google/go-cmp/cmp"
+	"github.com/google/zoekt"
+	"github.com/google/zoekt/internal/mockSearcher"
+	"github.com/google/zoekt/query"
+)
+
+func TestReadQueries(t *testing.T) {
+	qs, err := readQueries(strings.NewReader(`{"Query": "needle"}
+
+{"Query": "lang:go x", "Options": {"ShardMaxMatchCount": 5}}
+`))
+	if err != nil {
+		t.Fatal(err)
+	}
+	want := []benchQuery{
+		{Query: "needle", Options: &zoekt.SearchOptions{}},
+		{Query: "lang:go x", Options: &zoekt.SearchOptions{ShardMaxMatchCount: 5}},
+	}
+	if d := cmp.Diff(want, qs); d != "" {
+		t.Errorf("mismatch (-want +got):\n%s", d)
+	}
+
+	if _, err := readQueries(strings.NewReader("needle\n")); err == nil {
+		t.Error("want error for a line that isn't JSON")
+	}
+}
+
+func TestLatencyHistogram(t *testing.T) {
+	got := latencyHistogram([]time.Duration{
+		50 * time.Microsecond,
+		150 * time.Microsecond,
+		199 * time.Microsecond,
+		time.Millisecond,
+	})
+	want := []histogramBucket{
+		{Max: 100 * time.Microsecond, Count: 1},
+		{Max: 200 * time.Microsecond, Count: 2},
+		{Max: 400 * time.Microsecond},
+		{Max: 800 * time.Microsecond},
+		{Max: 1600 * time.Microsecond, Count: 1},
+	}
+	if d := cmp.Diff(want, got); d != "" {
+		t.Errorf("mismatch (-want +got):\n%s", d)
+	}
+}
+
+func TestRun(t *testing.T) {
+	searcher := &mockSearcher.MockSearcher{
+		WantSearch: &query.Substring{Pattern: "needle"},
+		SearchResult: &zoekt.SearchResult{
+			Stats: zoekt.Stats{FileCount: 2, MatchCount: 3},
+		},
+	}
+	qs := []benchQuery{{Query: "needle", Options: &zoekt.SearchOptions{}}}
+
+	for _, concurrency := range []int{1, 4} {
+		rep, err := replay(searcher, qs, concurrency, 5, true)
+		if err != nil {
+			t.Fatal(err)
+		}
+		if rep.Searches != 5 || len(rep.Queries[0].Latencies) != 5 {
+			t.Errorf("got %d searches, %d latencies, want 5", rep.Searches, len(rep.Queries[0].Latencies))
+		}
+		if got := rep.Queries[0].Stats; got.FileCount != 10 || got.MatchCount != 15 {
+			t.Errorf("got stats %+v, want aggregate of 5 searches", got)
+		}
+
+		var buf bytes.Buffer
+		printReport(&buf, rep, true)
+		compareReports(&buf, rep, rep)
+		if !strings.Contains(buf.String(), "needle") {
+			t.Errorf("report doesn't mention the query:\n%s", buf.String())
+		}
+	}
+}
@@ -0,0 +1,65 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// This binary packs small shards into compound shards holding several
+// repositories. Without arguments, it compacts the index directory.
+// Given shard files, it merges those into one compound shard. It
+// should not run while an indexer writes to the same directory.
+package main
+
+import (
+	"flag"
+	"log"
+	"path/filepath"
+
+	"github.com/google/zoekt"
+	"github.com/google/zoekt/build"
+)
+
+func main() {
+	index := flag.String("index", build.DefaultDir, "directory holding index shards.")
+	targetSize := flag.Int64("target_size", 100<<20, "size of the compound shards to build.")
+	maxInputSize := flag.Int64("max_input_size", 2<<20, "shards larger than this are not merged.")
+	evict := flag.String("evict", "", "remove this repository from the compound shards.")
+	flag.Parse()
+
+	if *evict != "" {
+		name := *evict
+		if err := build.EvictFromCompoundShards(*index, func(r *zoekt.Repository) bool { return r.Name == name }); err != nil {
+			log.Fatal(err)
+		}
+		return
+	}
+
+	if flag.NArg() > 0 {
+		fn, err := build.MergeShards(*index, flag.Args()...)
+		if err != nil {
+			log.Fatal(err)
+		}
+		log.Printf("merged %d shards into %s", flag.NArg(), filepath.Base(fn))
+		return
+	}
+
+	written, err := build.Compact(build.CompactOptions{
+		IndexDir:     *index,
+		TargetSize:   *targetSize,
+		MaxInputSize: *maxInputSize,
+	})
+	for _, fn := range written {
+		log.Printf("wrote %s", filepath.Base(fn))
+	}
+	if err != nil {
+		log.Fatal(err)
+	}
+}
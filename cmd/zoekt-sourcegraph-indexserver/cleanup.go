@@ -160,6 +160,42 @@ func shardRepoName(path string) (string, error) {
 	return repo.Name, nil
 }
 
+// compoundRepoNames returns the names of the repositories in the
+// compound shards in dir. getShards skips compound shards, so cleanup
+// doesn't trash them with one of their repositories.
+func compoundRepoNames(dir string) []string {
+	paths, err := filepath.Glob(filepath.Join(dir, zoekt.CompoundShardPrefix+"*.zoekt"))
+	if err != nil {
+		debug.Printf("Glob: %v", err)
+		return nil
+	}
+
+	var names []string
+	for _, path := range paths {
+		f, err := os.Open(path)
+		if err != nil {
+			debug.Printf("failed to read shard: %v", err)
+			continue
+		}
+		ifile, err := zoekt.NewIndexFile(f)
+		if err != nil {
+			f.Close()
+			debug.Printf("failed to read shard: %v", err)
+			continue
+		}
+		repos, _, err := zoekt.ReadMetadataAll(ifile)
+		ifile.Close()
+		if err != nil {
+			debug.Printf("failed to read shard: %v", err)
+			continue
+		}
+		for _, r := range repos {
+			names = append(names, r.Name)
+		}
+	}
+	return names
+}
+
 var incompleteRE = regexp.MustCompile(`\.zoekt[0-9]+(\.\w+)?$`)
 
 func removeIncompleteShards(dir string) {
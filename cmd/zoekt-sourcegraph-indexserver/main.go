@@ -99,6 +99,12 @@ var (
 		Help: "Counts indexings (indexing activity, should be used with rate())",
 	})
 
+	metricMergeDuration = promauto.NewHistogram(prometheus.HistogramOpts{
+		Name:    "index_merge_duration_seconds",
+		Help:    "A histogram of durations for merging small shards into compound shards.",
+		Buckets: prometheus.ExponentialBuckets(1, 2, 12), // 1s -> 68min
+	})
+
 	metricsEnqueueRepoForIndex = promauto.NewCounter(prometheus.CounterOpts{
 		Name: "enqueue_repo_for_index_total",
 		Help: "Counts the number of time /enqueueforindex is called",
@@ -131,16 +137,37 @@ type Server struct {
 	// list of repositories to index.
 	Hostname string
 
-	// CPUCount is the amount of parallelism to use when indexing a
-	// repository.
+	// CPUCount is the number of CPUs the index jobs share.
 	CPUCount int
 
+	// IndexConcurrency is the number of repositories indexed at once,
+	// besides the fast lane. Repositories not known to be small are given
+	// an equal share of CPUCount. Defaults to 1.
+	IndexConcurrency int
+
+	// FastLane indexes the repositories of laneFast on a job of its own,
+	// which takes one of CPUCount.
+	FastLane bool
+
+	// MemoryBudget bounds the summed shard size of the repositories being
+	// indexed, as an estimate of the memory of their index jobs. Zero is
+	// unlimited.
+	MemoryBudget int64
+
 	// Indexer is the indexer to use. Either archiveIndex (default) or the
 	// experimental gitIndex.
 	Indexer func(*indexArgs, func(*exec.Cmd) error) error
 
+	// MergeInterval is how often we pack small shards into compound
+	// shards. Zero disables merging.
+	MergeInterval time.Duration
+
 	mu            sync.Mutex
 	lastListRepos []string
+
+	// indexMu is held for reading by index jobs, and for writing by
+	// merges.
+	indexMu sync.RWMutex
 }
 
 var client = retryablehttp.NewClient()
@@ -321,6 +348,14 @@ func (s *Server) Run(queue *Queue) {
 					if opt.Public {
 						public = append(public, name)
 					}
+					if queue.Cost(name) == (jobCost{}) {
+						// Until it is indexed, the shards on disk tell
+						// whether the repo is small.
+						args := s.defaultArgs()
+						args.Name = name
+						args.IndexOptions = opt.IndexOptions
+						queue.SetCost(name, jobCost{shardBytes: shardBytes(args)})
+					}
 					queue.AddOrUpdate(name, opt.IndexOptions)
 				}
 			}
@@ -338,26 +373,53 @@ func (s *Server) Run(queue *Queue) {
 		}
 	}()
 
+	// Merging runs between index jobs, as it rewrites shards the
+	// indexers evict repositories from.
+	if s.MergeInterval > 0 {
+		go func() {
+			for range jitterTicker(s.MergeInterval) {
+				s.indexMu.Lock()
+				s.merge()
+				s.indexMu.Unlock()
+			}
+		}()
+	}
+
 	// In the current goroutine process the queue forever.
-	for {
-		name, opts, ok := queue.Pop()
-		if !ok {
-			time.Sleep(time.Second)
-			continue
-		}
-		start := time.Now()
-		args := s.defaultArgs()
-		args.Name = name
-		args.IndexOptions = opts
-		state, err := s.Index(args)
-		metricIndexDuration.WithLabelValues(string(state)).Observe(time.Since(start).Seconds())
-		if err != nil {
-			log.Printf("error indexing %s: %s", args.String(), err)
-		}
-		if state == indexStateSuccess {
-			log.Printf("updated index %s in %v", args.String(), time.Since(start))
-		}
-		queue.SetIndexed(name, opts, state)
+	s.runJobs(queue)
+}
+
+// merge evicts repositories we no longer track from compound shards,
+// and packs small shards into new ones.
+func (s *Server) merge() {
+	s.mu.Lock()
+	repos := s.lastListRepos
+	s.mu.Unlock()
+	if repos == nil {
+		return
+	}
+
+	tracked := make(map[string]struct{}, len(repos))
+	for _, name := range repos {
+		tracked[name] = struct{}{}
+	}
+	err := build.EvictFromCompoundShards(s.IndexDir, func(r *zoekt.Repository) bool {
+		_, ok := tracked[r.Name]
+		return !ok
+	})
+	if err != nil {
+		log.Printf("error evicting from compound shards: %v", err)
+		return
+	}
+
+	start := time.Now()
+	written, err := build.Compact(build.CompactOptions{IndexDir: s.IndexDir})
+	if err != nil {
+		log.Printf("error merging shards: %v", err)
+	}
+	if len(written) > 0 {
+		metricMergeDuration.Observe(time.Since(start).Seconds())
+		log.Printf("merged shards into %d compound shards in %v", len(written), time.Since(start))
 	}
 }
 
@@ -622,6 +684,12 @@ func (s *Server) forceIndex(name string) (string, error) {
 
 func listIndexed(indexDir string) []string {
 	index := getShards(indexDir)
+	if index == nil {
+		index = map[string][]shard{}
+	}
+	for _, name := range compoundRepoNames(indexDir) {
+		index[name] = nil
+	}
 	repoNames := make([]string, 0, len(index))
 	countsByHost := make(map[string]int)
 	for name := range index {
@@ -787,10 +855,14 @@ func main() {
 
 	root := flag.String("sourcegraph_url", os.Getenv("SRC_FRONTEND_INTERNAL"), "http://sourcegraph-frontend-internal or http://localhost:3090")
 	interval := flag.Duration("interval", time.Minute, "sync with sourcegraph this often")
+	mergeInterval := flag.Duration("merge_interval", 0, "pack small shards into compound shards this often. 0 disables merging.")
 	index := flag.String("index", defaultIndexDir, "set index directory to use")
 	listen := flag.String("listen", ":6072", "listen on this address.")
 	hostname := flag.String("hostname", hostnameBestEffort(), "the name we advertise to Sourcegraph when asking for the list of repositories to index. Can also be set via the NODE_NAME environment variable.")
 	cpuFraction := flag.Float64("cpu_fraction", 1.0, "use this fraction of the cores for indexing.")
+	indexConcurrency := flag.Int("index_concurrency", 1, "the number of repositories to index at once, sharing the cores.")
+	fastLane := flag.Bool("fast_lane", false, "index small repositories on a core of their own, so they don't wait for large ones.")
+	memoryBudget := flag.Int64("index_memory_budget_bytes", 0, "bound the summed shard size of the repositories indexed at once. 0 is unlimited.")
 	dbg := flag.Bool("debug", false, "turn on more verbose logging.")
 
 	// non daemon mode for debugging/testing
@@ -850,6 +922,12 @@ func main() {
 		Interval: *interval,
 		CPUCount: cpuCount,
 		Hostname: *hostname,
+
+		IndexConcurrency: *indexConcurrency,
+		FastLane:         *fastLane,
+		MemoryBudget:     *memoryBudget,
+
+		MergeInterval: *mergeInterval,
 	}
 
 	if *expGitIndex {
@@ -4,6 +4,7 @@ import (
 	"container/heap"
 	"reflect"
 	"sync"
+	"time"
 
 	"github.com/prometheus/client_golang/prometheus"
 	"github.com/prometheus/client_golang/prometheus/promauto"
@@ -24,6 +25,60 @@ type queueItem struct {
 	// seq is a sequence number used as a tie breaker. This is to ensure we
 	// act like a FIFO queue.
 	seq int64
+	// cost is the expected cost of indexing repoName, which decides its
+	// lane.
+	cost jobCost
+	// lane is the lane of the heap the item is on.
+	lane lane
+	// added is when the item was last pushed on a heap.
+	added time.Time
+	// running is true between popping the item and SetIndexed. Updates in
+	// the meantime requeue the item once it is done, so a repository is
+	// only indexed by one job at a time.
+	running bool
+	requeue bool
+}
+
+// lane is one of the queues of a Queue.
+type lane int
+
+const (
+	// laneDefault holds the repositories not known to be small.
+	laneDefault lane = iota
+	// laneFast holds the repositories which index quickly, so they can
+	// be indexed while large repositories are, see PopLane.
+	laneFast
+	numLanes
+)
+
+func (l lane) String() string {
+	if l == laneFast {
+		return "fast"
+	}
+	return "default"
+}
+
+// Repositories in laneFast took at most fastLaneMaxDuration to index, and
+// their shards take at most fastLaneMaxBytes.
+const (
+	fastLaneMaxDuration = 30 * time.Second
+	fastLaneMaxBytes    = 16 << 20
+)
+
+// jobCost is the cost of indexing a repository, from its last index job.
+// A zero field is unknown.
+type jobCost struct {
+	// duration is how long the last index job took.
+	duration time.Duration
+	// shardBytes is the size of the shards on disk.
+	shardBytes int64
+}
+
+func (c jobCost) lane() lane {
+	if c == (jobCost{}) || c.duration > fastLaneMaxDuration || c.shardBytes > fastLaneMaxBytes {
+		return laneDefault
+	}
+	return laneFast
 }
 
 // Queue is a priority queue which returns the next repo to index. It is safe
@@ -35,38 +90,112 @@ type queueItem struct {
 //
 // * We rather index a repo sooner if we know the commit is stale.
 // * The order of repos returned by Sourcegraph API are ordered by importance.
+//
+// Repos are split into lanes by their cost, so small repos can be popped
+// separately with PopLane.
 type Queue struct {
 	mu    sync.Mutex
 	items map[string]*queueItem
-	pq    pqueue
+	lanes [numLanes]pqueue
 	seq   int64
 }
 
-// Pop returns the repoName and opts of the next repo to index. If the queue
-// is empty ok is false.
+// Pop returns the repoName and opts of the next repo to index, from any
+// lane. If the queue is empty ok is false.
 func (q *Queue) Pop() (repoName string, opts IndexOptions, ok bool) {
 	q.mu.Lock()
-	if len(q.pq) == 0 {
-		q.mu.Unlock()
+	defer q.mu.Unlock()
+	next := -1
+	for l := range q.lanes {
+		if len(q.lanes[l]) == 0 {
+			continue
+		}
+		if next < 0 || less(q.lanes[l][0], q.lanes[next][0]) {
+			next = l
+		}
+	}
+	if next < 0 {
 		return "", IndexOptions{}, false
 	}
-	item := heap.Pop(&q.pq).(*queueItem)
-	repoName = item.repoName
-	opts = item.opts
+	return q.pop(lane(next))
+}
 
-	metricQueueLen.Set(float64(len(q.pq)))
-	metricQueueCap.Set(float64(len(q.items)))
+// PopLane is like Pop, but only returns repos of lane l.
+func (q *Queue) PopLane(l lane) (repoName string, opts IndexOptions, ok bool) {
+	q.mu.Lock()
+	defer q.mu.Unlock()
+	if len(q.lanes[l]) == 0 {
+		return "", IndexOptions{}, false
+	}
+	return q.pop(l)
+}
 
-	q.mu.Unlock()
-	return repoName, opts, true
+// pop pops the next item of a non-empty lane.
+//
+// Note: pop requires that q.mu is held.
+func (q *Queue) pop(l lane) (repoName string, opts IndexOptions, ok bool) {
+	item := heap.Pop(&q.lanes[l]).(*queueItem)
+	item.running = true
+	metricQueueWait.WithLabelValues(l.String()).Observe(time.Since(item.added).Seconds())
+
+	q.updateMetrics()
+	return item.repoName, item.opts, true
 }
 
 // Len returns the number of items in the queue.
 func (q *Queue) Len() int {
 	q.mu.Lock()
-	l := len(q.pq)
-	q.mu.Unlock()
-	return l
+	defer q.mu.Unlock()
+	return q.len()
+}
+
+func (q *Queue) len() int {
+	n := 0
+	for _, pq := range q.lanes {
+		n += len(pq)
+	}
+	return n
+}
+
+// Cost returns the cost set for repoName.
+func (q *Queue) Cost(repoName string) jobCost {
+	q.mu.Lock()
+	defer q.mu.Unlock()
+	if item, ok := q.items[repoName]; ok {
+		return item.cost
+	}
+	return jobCost{}
+}
+
+// SetCost sets the cost of indexing repoName, which may move it to another
+// lane.
+func (q *Queue) SetCost(repoName string, cost jobCost) {
+	q.mu.Lock()
+	defer q.mu.Unlock()
+	item := q.get(repoName)
+	item.cost = cost
+	if item.heapIdx >= 0 && item.lane != cost.lane() {
+		heap.Remove(&q.lanes[item.lane], item.heapIdx)
+		q.push(item)
+	}
+}
+
+// push pushes an item on the heap of its lane.
+//
+// Note: push requires that q.mu is held.
+func (q *Queue) push(item *queueItem) {
+	item.lane = item.cost.lane()
+	heap.Push(&q.lanes[item.lane], item)
+	q.updateMetrics()
+}
+
+// updateMetrics requires that q.mu is held.
+func (q *Queue) updateMetrics() {
+	metricQueueLen.Set(float64(q.len()))
+	metricQueueCap.Set(float64(len(q.items)))
+	for l, pq := range q.lanes {
+		metricQueueLaneLen.WithLabelValues(lane(l).String()).Set(float64(len(pq)))
+	}
 }
 
 // AddOrUpdate sets which opts to index next for repoName. If repoName is
@@ -78,14 +207,15 @@ func (q *Queue) AddOrUpdate(repoName string, opts IndexOptions) {
 		item.indexed = false
 		item.opts = opts
 	}
-	if item.heapIdx < 0 {
+	if item.running {
+		item.requeue = true
+	} else if item.heapIdx < 0 {
 		q.seq++
 		item.seq = q.seq
-		heap.Push(&q.pq, item)
-		metricQueueLen.Set(float64(len(q.pq)))
-		metricQueueCap.Set(float64(len(q.items)))
+		item.added = time.Now()
+		q.push(item)
 	} else {
-		heap.Fix(&q.pq, item.heapIdx)
+		heap.Fix(&q.lanes[item.lane], item.heapIdx)
 	}
 	q.mu.Unlock()
 }
@@ -100,8 +230,15 @@ func (q *Queue) SetIndexed(repoName string, opts IndexOptions, state indexState)
 	}
 	if item.heapIdx >= 0 {
 		// We only update the position in the queue, never add it.
-		heap.Fix(&q.pq, item.heapIdx)
+		heap.Fix(&q.lanes[item.lane], item.heapIdx)
+	} else if item.running && item.requeue {
+		// Unless it was updated while being indexed.
+		q.seq++
+		item.seq = q.seq
+		item.added = time.Now()
+		q.push(item)
 	}
+	item.running, item.requeue = false, false
 	q.mu.Unlock()
 }
 
@@ -139,15 +276,14 @@ func (q *Queue) MaybeRemoveMissing(names []string) int {
 		}
 
 		if item.heapIdx >= 0 {
-			heap.Remove(&q.pq, item.heapIdx)
+			heap.Remove(&q.lanes[item.lane], item.heapIdx)
 		}
 		item.setIndexState("")
 		delete(q.items, name)
 		count++
 	}
 
-	metricQueueLen.Set(float64(len(q.pq)))
-	metricQueueCap.Set(float64(len(q.items)))
+	q.updateMetrics()
 
 	return count
 }
@@ -159,7 +295,6 @@ func (q *Queue) MaybeRemoveMissing(names []string) int {
 func (q *Queue) get(repoName string) *queueItem {
 	if q.items == nil {
 		q.items = map[string]*queueItem{}
-		q.pq = make(pqueue, 0)
 	}
 
 	item, ok := q.items[repoName]
@@ -195,10 +330,13 @@ type pqueue []*queueItem
 func (pq pqueue) Len() int { return len(pq) }
 
 func (pq pqueue) Less(i, j int) bool {
+	return less(pq[i], pq[j])
+}
+
+// less returns whether x is more urgent to index than y.
+func less(x, y *queueItem) bool {
 	// If we know x needs an update and y doesn't, then return true. Otherwise
 	// they are either equal priority or y is more urgent.
-	x := pq[i]
-	y := pq[j]
 	if x.indexed != y.indexed {
 		return !x.indexed
 	}
@@ -244,6 +382,15 @@ var (
 		Name: "index_queue_cap",
 		Help: "The number of repositories tracked by the index queue, including popped items. Should be the same as index_num_assigned.",
 	})
+	metricQueueLaneLen = promauto.NewGaugeVec(prometheus.GaugeOpts{
+		Name: "index_queue_lane_len",
+		Help: "The number of repositories in each lane of the index queue.",
+	}, []string{"lane"})
+	metricQueueWait = promauto.NewHistogramVec(prometheus.HistogramOpts{
+		Name:    "index_queue_wait_seconds",
+		Help:    "A histogram of the time repositories wait in the index queue, per lane.",
+		Buckets: prometheus.ExponentialBuckets(1, 4, 8), // 1s -> 4.5h
+	}, []string{"lane"})
 	metricIndexState = promauto.NewGaugeVec(prometheus.GaugeOpts{
 		Name: "index_state_count",
 		Help: "The count of repositories per the state of the last index.",
@@ -2,8 +2,10 @@ package main
 
 import (
 	"fmt"
+	"reflect"
 	"strconv"
 	"testing"
+	"time"
 
 	"github.com/google/zoekt"
 )
@@ -88,6 +90,63 @@ func TestQueue_MaybeRemoveMissing(t *testing.T) {
 	}
 }
 
+func TestQueueLanes(t *testing.T) {
+	queue := &Queue{}
+
+	queue.SetCost("small", jobCost{duration: time.Second, shardBytes: 1 << 20})
+	queue.SetCost("large", jobCost{duration: time.Hour})
+	queue.AddOrUpdate("unknown", mkHEADIndexOptions("unknown"))
+	queue.AddOrUpdate("large", mkHEADIndexOptions("large"))
+	queue.AddOrUpdate("small", mkHEADIndexOptions("small"))
+	queue.AddOrUpdate("later", mkHEADIndexOptions("later"))
+
+	// Growing moves a queued repository out of the fast lane.
+	queue.SetCost("later", jobCost{duration: time.Second})
+	queue.SetCost("later", jobCost{duration: time.Minute})
+
+	if name, _, _ := queue.PopLane(laneFast); name != "small" {
+		t.Errorf("fast lane popped %q, want small", name)
+	}
+	if _, _, ok := queue.PopLane(laneFast); ok {
+		t.Errorf("fast lane should be empty")
+	}
+
+	var got []string
+	for {
+		name, _, ok := queue.Pop()
+		if !ok {
+			break
+		}
+		got = append(got, name)
+	}
+	if want := []string{"unknown", "large", "later"}; !reflect.DeepEqual(got, want) {
+		t.Errorf("got %v, want %v", got, want)
+	}
+}
+
+func TestQueueUpdateWhileIndexing(t *testing.T) {
+	queue := &Queue{}
+
+	queue.AddOrUpdate("foo", mkHEADIndexOptions("1"))
+	name, opts, _ := queue.Pop()
+
+	// A new commit while foo is indexed must not start a second job.
+	queue.AddOrUpdate("foo", mkHEADIndexOptions("2"))
+	if _, _, ok := queue.Pop(); ok {
+		t.Fatal("popped foo while it is indexed")
+	}
+
+	queue.SetIndexed(name, opts, indexStateSuccess)
+	_, opts, ok := queue.Pop()
+	if !ok || opts.Branches[0].Version != "2" {
+		t.Fatalf("got %v %v, want foo requeued at the new commit", ok, opts)
+	}
+	queue.SetIndexed(name, opts, indexStateSuccess)
+	if queue.Len() != 0 {
+		t.Errorf("got %d queued, want 0", queue.Len())
+	}
+}
+
 func mkHEADIndexOptions(version string) IndexOptions {
 	return IndexOptions{
 		Branches: []zoekt.RepositoryBranch{{Name: "HEAD", Version: version}},
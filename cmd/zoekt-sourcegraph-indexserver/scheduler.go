@@ -0,0 +1,182 @@
+package main
+
+import (
+	"log"
+	"os"
+	"sync"
+	"time"
+
+	"github.com/prometheus/client_golang/prometheus"
+	"github.com/prometheus/client_golang/prometheus/promauto"
+)
+
+var metricIndexJobsRunning = promauto.NewGaugeVec(prometheus.GaugeOpts{
+	Name: "index_jobs_running",
+	Help: "The number of index jobs running, per lane of the repository.",
+}, []string{"lane"})
+
+// jobBudget admits index jobs while the CPUs and memory they are expected
+// to take fit. A job that doesn't fit on its own runs once nothing else
+// does, so large repositories are still indexed. Jobs are admitted in
+// the order they arrive, so a stream of small jobs can't starve a large
+// one waiting for the others to finish.
+type jobBudget struct {
+	mu   sync.Mutex
+	cond *sync.Cond
+
+	// next is the ticket of the next job to arrive, and serving the
+	// ticket of the oldest job waiting.
+	next, serving uint64
+
+	cpus   int
+	memory int64 // 0 is unlimited
+
+	usedCPUs   int
+	usedMemory int64
+	running    int
+}
+
+func newJobBudget(cpus int, memory int64) *jobBudget {
+	b := &jobBudget{cpus: cpus, memory: memory}
+	b.cond = sync.NewCond(&b.mu)
+	return b
+}
+
+func (b *jobBudget) fits(cpus int, memory int64) bool {
+	if b.running == 0 {
+		return true
+	}
+	if b.usedCPUs+cpus > b.cpus {
+		return false
+	}
+	return b.memory == 0 || b.usedMemory+memory <= b.memory
+}
+
+// acquire blocks until the jobs that arrived before are admitted, and
+// a job taking cpus and memory fits.
+func (b *jobBudget) acquire(cpus int, memory int64) {
+	b.mu.Lock()
+	defer b.mu.Unlock()
+	ticket := b.next
+	b.next++
+	for ticket != b.serving || !b.fits(cpus, memory) {
+		b.cond.Wait()
+	}
+	b.serving++
+	b.usedCPUs += cpus
+	b.usedMemory += memory
+	b.running++
+	// The next job may fit too.
+	b.cond.Broadcast()
+}
+
+func (b *jobBudget) release(cpus int, memory int64) {
+	b.mu.Lock()
+	defer b.mu.Unlock()
+	b.usedCPUs -= cpus
+	b.usedMemory -= memory
+	b.running--
+	b.cond.Broadcast()
+}
+
+// laneAny makes a worker pop from all lanes.
+const laneAny = numLanes
+
+// runJobs indexes the repositories of queue forever. IndexConcurrency
+// workers pop from all lanes, sharing the CPUs and MemoryBudget. With
+// FastLane, another worker only indexes the repositories of laneFast on a
+// CPU of its own, so small updates aren't stuck behind large ones.
+func (s *Server) runJobs(queue *Queue) {
+	concurrency := s.IndexConcurrency
+	if concurrency < 1 {
+		concurrency = 1
+	}
+
+	cpus := s.CPUCount
+	budget := newJobBudget(cpus, s.MemoryBudget)
+	if s.FastLane {
+		fast := budget
+		if cpus > 1 {
+			budget = newJobBudget(cpus-1, s.MemoryBudget)
+			fast = newJobBudget(1, 0)
+		}
+		go s.worker(queue, laneFast, fast, 1)
+	}
+
+	// Repositories not known to be small get an equal share of the CPUs.
+	share := budget.cpus / concurrency
+	if share < 1 {
+		share = 1
+	}
+	for i := 1; i < concurrency; i++ {
+		go s.worker(queue, laneAny, budget, share)
+	}
+	s.worker(queue, laneAny, budget, share)
+}
+
+// worker runs the index jobs of lane l, with up to share CPUs each.
+func (s *Server) worker(queue *Queue, l lane, budget *jobBudget, share int) {
+	for {
+		var name string
+		var opts IndexOptions
+		var ok bool
+		if l == laneAny {
+			name, opts, ok = queue.Pop()
+		} else {
+			name, opts, ok = queue.PopLane(l)
+		}
+		if !ok {
+			time.Sleep(time.Second)
+			continue
+		}
+		s.runJob(queue, name, opts, budget, share)
+	}
+}
+
+// runJob indexes name within budget, and updates its cost in queue.
+func (s *Server) runJob(queue *Queue, name string, opts IndexOptions, budget *jobBudget, share int) {
+	cost := queue.Cost(name)
+	cpus := share
+	if cost.lane() == laneFast {
+		// Small repositories don't gain from more CPUs.
+		cpus = 1
+	}
+	budget.acquire(cpus, cost.shardBytes)
+	defer budget.release(cpus, cost.shardBytes)
+
+	// Merges rewrite the shards index jobs write.
+	s.indexMu.RLock()
+	defer s.indexMu.RUnlock()
+
+	running := metricIndexJobsRunning.WithLabelValues(cost.lane().String())
+	running.Inc()
+	defer running.Dec()
+
+	start := time.Now()
+	args := s.defaultArgs()
+	args.Name = name
+	args.IndexOptions = opts
+	args.Parallelism = cpus
+	state, err := s.Index(args)
+	elapsed := time.Since(start)
+	metricIndexDuration.WithLabelValues(string(state)).Observe(elapsed.Seconds())
+	if err != nil {
+		log.Printf("error indexing %s: %s", args.String(), err)
+	}
+	if state == indexStateSuccess {
+		log.Printf("updated index %s in %v", args.String(), elapsed)
+		queue.SetCost(name, jobCost{duration: elapsed, shardBytes: shardBytes(args)})
+	}
+	queue.SetIndexed(name, opts, state)
+}
+
+// shardBytes returns the size of the shards of the repository of args.
+func shardBytes(args *indexArgs) int64 {
+	var n int64
+	for _, fn := range args.BuildOptions().FindAllShards() {
+		if fi, err := os.Stat(fn); err == nil {
+			n += fi.Size()
+		}
+	}
+	return n
+}
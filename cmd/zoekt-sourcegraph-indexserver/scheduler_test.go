@@ -0,0 +1,77 @@
+package main
+
+import (
+	"testing"
+	"time"
+)
+
+func TestJobBudget(t *testing.T) {
+	b := newJobBudget(4, 100)
+
+	b.acquire(2, 60)
+	b.acquire(2, 40)
+
+	admitted := make(chan struct{})
+	go func() {
+		b.acquire(1, 0)
+		close(admitted)
+	}()
+	select {
+	case <-admitted:
+		t.Fatal("admitted a job exceeding the CPUs")
+	case <-time.After(10 * time.Millisecond):
+	}
+
+	b.release(2, 40)
+	<-admitted
+	b.release(1, 0)
+
+	// A job larger than the budget runs alone.
+	b.release(2, 60)
+	b.acquire(8, 1000)
+	b.release(8, 1000)
+}
+
+func TestJobBudgetFIFO(t *testing.T) {
+	b := newJobBudget(4, 0)
+	b.acquire(2, 0)
+
+	// The large job waits for the running one to finish.
+	large := make(chan struct{})
+	go func() {
+		b.acquire(4, 0)
+		close(large)
+	}()
+	for {
+		b.mu.Lock()
+		waiting := b.next == 2
+		b.mu.Unlock()
+		if waiting {
+			break
+		}
+		time.Sleep(time.Millisecond)
+	}
+
+	// A small job that arrives later fits, but waits its turn.
+	small := make(chan struct{})
+	go func() {
+		b.acquire(1, 0)
+		close(small)
+	}()
+	select {
+	case <-small:
+		t.Fatal("admitted a small job ahead of an older large one")
+	case <-time.After(10 * time.Millisecond):
+	}
+
+	b.release(2, 0)
+	<-large
+	select {
+	case <-small:
+		t.Fatal("admitted a small job next to a job taking all CPUs")
+	case <-time.After(10 * time.Millisecond):
+	}
+	b.release(4, 0)
+	<-small
+	b.release(1, 0)
+}
@@ -137,6 +137,13 @@ func main() {
 	templateDir := flag.String("template_dir", "", "set directory from which to load custom .html.tpl template files")
 	dumpTemplates := flag.Bool("dump_templates", false, "dump templates into --template_dir and exit.")
 	version := flag.Bool("version", false, "Print version number")
+	resultCacheBytes := flag.Int64("result_cache_bytes", 0, "memory budget in bytes for caching per shard search results. 0 disables the cache.")
+	intraShardParallelism := flag.Bool("intra_shard_parallelism", false, "search large shards on multiple goroutines when there are fewer shards than CPUs.")
+	loadParallelism := flag.Int("load_parallelism", 0, "number of shards to load concurrently. 0 uses the number of CPUs.")
+	loadInBackground := flag.Bool("load_in_background", false, "serve while loading the shards on startup. /readyz reports the progress.")
+	lockHotSectionsBytes := flag.Int64("lock_hot_sections_bytes", 0, "memory budget in bytes for locking the file name, symbol and checksum sections of the shards into RAM. Needs RLIMIT_MEMLOCK to allow it. 0 locks nothing.")
+	contentCacheBytes := flag.Int64("content_cache_bytes", zoekt.DefaultContentCacheBytes, "memory budget in bytes for caching the decompressed content of shards with compressed content.")
+	readyFraction := flag.Float64("ready_fraction", 1.0, "fraction of the shards on startup that must be loaded before /readyz succeeds.")
 	flag.Parse()
 
 	if *version {
@@ -172,11 +179,19 @@ func main() {
 	}
 
 	mustRegisterDiskMonitor(*index)
-
-	searcher, err := shards.NewDirectorySearcher(*index)
+	zoekt.SetContentCacheSize(*contentCacheBytes)
+
+	searcher, err := shards.NewDirectorySearcherWithOptions(*index, shards.DirectorySearcherOptions{
+		ResultCacheBytes:      *resultCacheBytes,
+		IntraShardParallelism: *intraShardParallelism,
+		LoadParallelism:       *loadParallelism,
+		LoadInBackground:      *loadInBackground,
+		LockHotSectionsBytes:  *lockHotSectionsBytes,
+	})
 	if err != nil {
 		log.Fatal(err)
 	}
+	readiness, _ := searcher.(readier)
 
 	// Sourcegraph: Add logging if debug logging enabled
 	logLvl := os.Getenv("SRC_LOG_LEVEL")
@@ -223,6 +238,7 @@ func main() {
 
 	debugserver.AddHandlers(handler, *enablePprof)
 	handler.HandleFunc("/healthz", healthz)
+	handler.HandleFunc("/readyz", readyz(readiness, *readyFraction))
 
 	// Sourcegraph: We use environment variables to configure watchdog since
 	// they are more convenient than flags in containerized environments.
@@ -323,6 +339,30 @@ func healthz(w http.ResponseWriter, req *http.Request) {
 	w.Write([]byte("OK"))
 }
 
+// readier is implemented by searchers that load shards in the
+// background.
+type readier interface {
+	// Ready returns the fraction of the shards that are loaded.
+	Ready() float64
+}
+
+// readyz returns 200 OK once the fraction of loaded shards reaches
+// minReady, and 503 before. Used for readiness checks, so load
+// balancers skip replicas that are still loading.
+func readyz(r readier, minReady float64) http.HandlerFunc {
+	return func(w http.ResponseWriter, req *http.Request) {
+		ready := 1.0
+		if r != nil {
+			ready = r.Ready()
+		}
+		w.Header().Set("Content-Type", "text/plain; charset=utf-8")
+		if ready < minReady {
+			w.WriteHeader(http.StatusServiceUnavailable)
+		}
+		fmt.Fprintf(w, "%.3f\n", ready)
+	}
+}
+
 func watchdogOnce(ctx context.Context, client *http.Client, addr string) error {
 	defer metricWatchdogTotal.Inc()
 
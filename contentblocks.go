@@ -0,0 +1,298 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package zoekt
+
+import (
+	"bytes"
+	"compress/flate"
+	"container/list"
+	"fmt"
+	"io"
+	"sync"
+	"sync/atomic"
+)
+
+// contentEncoding identifies how the content of NextIndexFormatVersion
+// shards is stored. It is recorded in the contentEncoding section of
+// the TOC.
+type contentEncoding byte
+
+const (
+	// contentEncodingRaw stores the documents as they are.
+	contentEncodingRaw contentEncoding = iota
+	// contentEncodingDeflate stores the concatenated documents in
+	// blocks of contentBlockSize, each compressed with DEFLATE.
+	contentEncodingDeflate
+)
+
+// contentBlockSize is the uncompressed size of a content block. The
+// last block of a shard may be shorter.
+const contentBlockSize = 64 << 10
+
+// writeContentBlocks writes the content of the documents as blocks
+// compressed according to enc. Each block is an item of contents, and
+// boundaries holds the offset of each document in the uncompressed
+// content, plus the end of the last.
+func writeContentBlocks(w *writer, contents *compoundSection, boundaries *simpleSection, docs []*searchableString, enc contentEncoding) error {
+	if enc != contentEncodingDeflate {
+		return fmt.Errorf("unknown content encoding %d", enc)
+	}
+
+	var buf bytes.Buffer
+	fw, err := flate.NewWriter(&buf, flate.DefaultCompression)
+	if err != nil {
+		return err
+	}
+
+	block := make([]byte, 0, contentBlockSize)
+	flush := func() {
+		buf.Reset()
+		fw.Reset(&buf)
+		fw.Write(block)
+		fw.Close()
+		contents.addItem(w, buf.Bytes())
+		block = block[:0]
+	}
+
+	contents.start(w)
+	for _, d := range docs {
+		data := d.data
+		for len(data) > 0 {
+			n := copy(block[len(block):contentBlockSize], data)
+			block = block[:len(block)+n]
+			data = data[n:]
+			if len(block) == contentBlockSize {
+				flush()
+			}
+		}
+	}
+	if len(block) > 0 {
+		flush()
+	}
+	contents.end(w)
+
+	boundaries.start(w)
+	var off uint32
+	for _, d := range docs {
+		w.U32(off)
+		off += uint32(len(d.data))
+	}
+	w.U32(off)
+	boundaries.end(w)
+	return w.err
+}
+
+// flateReaders holds DEFLATE readers for reuse.
+var flateReaders sync.Pool
+
+// contentBlock returns uncompressed content block j. Blocks not in
+// contentCache are read and decompressed, counting the compressed
+// bytes read in stats, if it is not nil.
+func (d *indexData) contentBlock(j uint32, stats *Stats) ([]byte, error) {
+	key := blockKey{shard: d.contentCacheID, block: j}
+	if b, ok := contentCache.get(key); ok {
+		return b, nil
+	}
+
+	compressed, err := d.readSectionBlob(simpleSection{
+		off: d.contentStart + d.contentBlocks[j],
+		sz:  d.contentBlocks[j+1] - d.contentBlocks[j],
+	})
+	if err != nil {
+		return nil, err
+	}
+	if stats != nil {
+		stats.CompressedContentBytesLoaded += int64(len(compressed))
+	}
+
+	sz := d.boundaries[len(d.boundaries)-1] - j*contentBlockSize
+	if sz > contentBlockSize {
+		sz = contentBlockSize
+	}
+	block := make([]byte, sz)
+
+	src := bytes.NewReader(compressed)
+	fr, _ := flateReaders.Get().(io.ReadCloser)
+	if fr == nil {
+		fr = flate.NewReader(src)
+	} else if err := fr.(flate.Resetter).Reset(src, nil); err != nil {
+		// A failed Reset leaves the reader reusable.
+		flateReaders.Put(fr)
+		return nil, err
+	}
+	_, err = io.ReadFull(fr, block)
+	flateReaders.Put(fr)
+	if err != nil {
+		return nil, fmt.Errorf("content block %d of %s: %v", j, d.file.Name(), err)
+	}
+
+	contentCache.add(key, block)
+	return block, nil
+}
+
+// readCompressedContent returns sz bytes of the uncompressed content
+// from off, or up to its end. Slices within a block share the memory
+// of the cached block, which is never modified.
+func (d *indexData) readCompressedContent(off, sz uint32, stats *Stats) ([]byte, error) {
+	end := d.boundaries[len(d.boundaries)-1]
+	if off >= end || sz == 0 {
+		return []byte{}, nil
+	}
+	if off+sz > end {
+		sz = end - off
+	}
+
+	first, last := off/contentBlockSize, (off+sz-1)/contentBlockSize
+	if first == last {
+		block, err := d.contentBlock(first, stats)
+		if err != nil {
+			return nil, err
+		}
+		start := off - first*contentBlockSize
+		return block[start : start+sz], nil
+	}
+
+	out := make([]byte, 0, sz)
+	for j := first; j <= last; j++ {
+		block, err := d.contentBlock(j, stats)
+		if err != nil {
+			return nil, err
+		}
+		start, end := uint32(0), uint32(len(block))
+		if j == first {
+			start = off - j*contentBlockSize
+		}
+		if j == last {
+			end = off + sz - j*contentBlockSize
+		}
+		out = append(out, block[start:end]...)
+	}
+	return out, nil
+}
+
+// DefaultContentCacheBytes is the initial size of the cache of
+// decompressed content blocks, see SetContentCacheSize.
+const DefaultContentCacheBytes = 256 << 20
+
+// contentCache holds the decompressed content blocks of all shards.
+var contentCache = newBlockCache(DefaultContentCacheBytes)
+
+// contentCacheIDs numbers the shards with compressed content, for
+// their keys in contentCache.
+var contentCacheIDs uint64
+
+func nextContentCacheID() uint64 {
+	return atomic.AddUint64(&contentCacheIDs, 1)
+}
+
+// SetContentCacheSize sets the number of bytes of decompressed
+// content kept across the shards with compressed content. A size of
+// 0 turns off caching.
+func SetContentCacheSize(n int64) {
+	contentCache.setMax(n)
+}
+
+type blockKey struct {
+	shard uint64
+	block uint32
+}
+
+type cachedBlock struct {
+	key  blockKey
+	data []byte
+}
+
+// blockCache is a size bounded LRU cache of blocks.
+type blockCache struct {
+	mu   sync.Mutex
+	max  int64
+	size int64
+	lru  *list.List
+	// blocks holds the blocks by shard, so a shard's blocks can be
+	// purged without visiting the others.
+	blocks map[uint64]map[uint32]*list.Element
+}
+
+func newBlockCache(max int64) *blockCache {
+	return &blockCache{
+		max:    max,
+		lru:    list.New(),
+		blocks: map[uint64]map[uint32]*list.Element{},
+	}
+}
+
+func (c *blockCache) get(k blockKey) ([]byte, bool) {
+	c.mu.Lock()
+	defer c.mu.Unlock()
+	e, ok := c.blocks[k.shard][k.block]
+	if !ok {
+		return nil, false
+	}
+	c.lru.MoveToFront(e)
+	return e.Value.(*cachedBlock).data, true
+}
+
+func (c *blockCache) add(k blockKey, data []byte) {
+	c.mu.Lock()
+	defer c.mu.Unlock()
+	if int64(len(data)) > c.max {
+		return
+	}
+	shard := c.blocks[k.shard]
+	if shard == nil {
+		shard = map[uint32]*list.Element{}
+		c.blocks[k.shard] = shard
+	}
+	if e, ok := shard[k.block]; ok {
+		// Decompressed concurrently.
+		c.lru.MoveToFront(e)
+		return
+	}
+	shard[k.block] = c.lru.PushFront(&cachedBlock{key: k, data: data})
+	c.size += int64(len(data))
+	c.evict()
+}
+
+// purge drops the blocks of a shard.
+func (c *blockCache) purge(shard uint64) {
+	c.mu.Lock()
+	defer c.mu.Unlock()
+	for _, e := range c.blocks[shard] {
+		c.remove(e)
+	}
+}
+
+func (c *blockCache) setMax(n int64) {
+	c.mu.Lock()
+	defer c.mu.Unlock()
+	c.max = n
+	c.evict()
+}
+
+func (c *blockCache) evict() {
+	for c.size > c.max {
+		c.remove(c.lru.Back())
+	}
+}
+
+func (c *blockCache) remove(e *list.Element) {
+	b := c.lru.Remove(e).(*cachedBlock)
+	shard := c.blocks[b.key.shard]
+	delete(shard, b.key.block)
+	if len(shard) == 0 {
+		delete(c.blocks, b.key.shard)
+	}
+	c.size -= int64(len(b.data))
+}
@@ -0,0 +1,146 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package zoekt
+
+import (
+	"bytes"
+	"context"
+	"fmt"
+	"reflect"
+	"strings"
+	"testing"
+
+	"github.com/google/zoekt/query"
+)
+
+func TestCompressedContent(t *testing.T) {
+	var docs []Document
+	for i := 0; i < 100; i++ {
+		// Documents of about 3kb, so some straddle blocks.
+		content := strings.Repeat(fmt.Sprintf("line %d of file %d ünïcode\n", i, i), 100)
+		if i%10 == 0 {
+			content += "needle\n"
+		}
+		docs = append(docs, Document{Name: fmt.Sprintf("f%d", i), Content: []byte(content)})
+	}
+	docs = append(docs, Document{Name: "empty"})
+
+	build := func(enc contentEncoding) []byte {
+		b := testIndexBuilder(t, nil, docs...)
+		b.indexFormatVersion = NextIndexFormatVersion
+		b.contentEncoding = enc
+		var buf bytes.Buffer
+		if err := b.Write(&buf); err != nil {
+			t.Fatalf("Write: %v", err)
+		}
+		return buf.Bytes()
+	}
+	raw, compressed := build(contentEncodingRaw), build(contentEncodingDeflate)
+	if len(compressed) >= len(raw) {
+		t.Errorf("compressed shard has %d bytes, raw %d", len(compressed), len(raw))
+	}
+
+	search := func(shard []byte, q query.Q) *SearchResult {
+		s, err := NewSearcher(&memSeeker{shard})
+		if err != nil {
+			t.Fatalf("NewSearcher: %v", err)
+		}
+		defer s.Close()
+		res, err := s.Search(context.Background(), q, &SearchOptions{Whole: true})
+		if err != nil {
+			t.Fatalf("Search: %v", err)
+		}
+		return res
+	}
+
+	for _, q := range []query.Q{
+		&query.Substring{Pattern: "needle", Content: true},
+		&query.Substring{Pattern: "ïcode\nline 7", Content: true},
+		&query.Regexp{Regexp: mustParseRE("file 5[0-9] ü"), Content: true},
+	} {
+		want, got := search(raw, q), search(compressed, q)
+		if len(want.Files) == 0 {
+			t.Fatalf("%s: no matches", q)
+		}
+		if !reflect.DeepEqual(got.Files, want.Files) {
+			t.Errorf("%s: got %v, want %v", q, got.Files, want.Files)
+		}
+		if want.Stats.CompressedContentBytesLoaded != 0 {
+			t.Errorf("%s: got %d compressed bytes for raw content", q, want.Stats.CompressedContentBytesLoaded)
+		}
+		if got.Stats.CompressedContentBytesLoaded == 0 {
+			t.Errorf("%s: got no compressed bytes loaded", q)
+		}
+	}
+}
+
+func TestCompressedContentCache(t *testing.T) {
+	docs := []Document{{Name: "f", Content: bytes.Repeat([]byte("abc needle\n"), 20000)}}
+	b := testIndexBuilder(t, nil, docs...)
+	b.indexFormatVersion = NextIndexFormatVersion
+	b.contentEncoding = contentEncodingDeflate
+	s := searcherForTest(t, b)
+
+	q := &query.Substring{Pattern: "needle", Content: true}
+	var loaded []int64
+	for i := 0; i < 2; i++ {
+		res, err := s.Search(context.Background(), q, &SearchOptions{})
+		if err != nil {
+			t.Fatalf("Search: %v", err)
+		}
+		if len(res.Files) != 1 || len(res.Files[0].LineMatches) != 20000 {
+			t.Fatalf("got %v, want 20000 line matches in f", res.Files)
+		}
+		loaded = append(loaded, res.Stats.CompressedContentBytesLoaded)
+	}
+	if loaded[0] == 0 || loaded[1] != 0 {
+		t.Errorf("got compressed bytes loaded %v, want %d then 0 from the cache", loaded, loaded[0])
+	}
+
+	id := s.(*indexData).contentCacheID
+	s.Close()
+	if _, ok := contentCache.get(blockKey{shard: id}); ok {
+		t.Errorf("blocks of closed shard still cached")
+	}
+}
+
+func TestBlockCache(t *testing.T) {
+	c := newBlockCache(10)
+	block := func(n int) []byte { return make([]byte, n) }
+
+	c.add(blockKey{block: 1}, block(4))
+	c.add(blockKey{block: 2}, block(4))
+	c.get(blockKey{block: 1})
+	c.add(blockKey{block: 3}, block(4))
+	c.add(blockKey{block: 4}, block(11))
+
+	for k, want := range map[uint32]bool{1: true, 2: false, 3: true, 4: false} {
+		if _, ok := c.get(blockKey{block: k}); ok != want {
+			t.Errorf("block %d: got cached %v, want %v", k, ok, want)
+		}
+	}
+	if c.size != 8 {
+		t.Errorf("got size %d, want 8", c.size)
+	}
+
+	c.add(blockKey{shard: 1, block: 1}, block(1))
+	c.purge(0)
+	if c.size != 1 || c.lru.Len() != 1 {
+		t.Errorf("got size %d and %d blocks after purge, want 1 and 1", c.size, c.lru.Len())
+	}
+	if _, ok := c.blocks[0]; ok {
+		t.Error("purged shard still indexed")
+	}
+}
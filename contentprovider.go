@@ -33,11 +33,26 @@ type contentProvider struct {
 	err      error
 	idx      uint32
 	_data    []byte
-	_nl      []uint32
-	_nlBuf   []uint32
+	_nl      newlineIndex
+	_nlValid bool
 	_sects   []DocumentSection
 	_sectBuf []DocumentSection
 	fileSize uint32
+
+	// The corrections of the last findOffset, where the next one
+	// starts looking.
+	runeOffsetHint     int
+	nameRuneOffsetHint int
+
+	// Per document scratch space, reused across documents.
+	cands      candidateArena
+	_gatherBuf []*candidateMatch
+	_breakBuf  []*candidateMatch
+	_lineBuf   []*candidateMatch
+	_masksBuf  []uint64
+
+	// profiler is set if the search is profiled.
+	profiler *matchProfiler
 }
 
 // setDocument skips to the given document.
@@ -47,9 +62,10 @@ func (p *contentProvider) setDocument(docID uint32) {
 	p.idx = docID
 	p.fileSize = p.id.boundaries[docID+1] - fileStart
 
-	p._nl = nil
+	p._nlValid = false
 	p._sects = nil
 	p._data = nil
+	p.cands.reset()
 }
 
 func (p *contentProvider) docSections() []DocumentSection {
@@ -62,14 +78,14 @@ func (p *contentProvider) docSections() []DocumentSection {
 	return p._sects
 }
 
-func (p *contentProvider) newlines() []uint32 {
-	if p._nl == nil {
-		var sz uint32
-		p._nl, sz, p.err = p.id.readNewlines(p.idx, p._nlBuf)
-		p._nlBuf = p._nl
-		p.stats.ContentBytesLoaded += int64(sz)
+func (p *contentProvider) newlines() *newlineIndex {
+	if !p._nlValid {
+		var section, checkpoints []byte
+		section, checkpoints, p.err = p.id.readNewlines(p.idx)
+		p._nl.reset(section, checkpoints, &p.stats.ContentBytesLoaded)
+		p._nlValid = true
 	}
-	return p._nl
+	return &p._nl
 }
 
 func (p *contentProvider) data(fileName bool) []byte {
@@ -78,7 +94,7 @@ func (p *contentProvider) data(fileName bool) []byte {
 	}
 
 	if p._data == nil {
-		p._data, p.err = p.id.readContents(p.idx)
+		p._data, p.err = p.id.readContents(p.idx, p.stats)
 		p.stats.FilesLoaded++
 		p.stats.ContentBytesLoaded += int64(len(p._data))
 	}
@@ -107,14 +123,19 @@ func (p *contentProvider) findOffset(filename bool, r uint32) uint32 {
 		absR += runeEnds[p.idx-1]
 	}
 
-	byteOff, left := sample.lookup(absR)
+	hint := &p.runeOffsetHint
+	if filename {
+		hint = &p.nameRuneOffsetHint
+	}
+	byteOff, left, idx := sample.lookupFrom(absR, *hint)
+	*hint = idx
 
 	var data []byte
 
 	if filename {
 		data = p.id.fileNameContent[byteOff:]
 	} else {
-		data, p.err = p.id.readContentSlice(byteOff, 3*runeOffsetFrequency)
+		data, p.err = p.id.readContentSlice(byteOff, 3*runeOffsetFrequency, p.stats)
 		if p.err != nil {
 			return 0
 		}
@@ -135,8 +156,9 @@ func (p *contentProvider) fillMatches(ms []*candidateMatch) []LineMatch {
 	if ms[0].fileName {
 		// There is only "line" in a filename.
 		res := LineMatch{
-			Line:     p.id.fileName(p.idx),
-			FileName: true,
+			Line:          p.id.fileName(p.idx),
+			FileName:      true,
+			LineFragments: make([]LineFragmentMatch, 0, len(ms)),
 		}
 
 		for _, m := range ms {
@@ -145,11 +167,11 @@ func (p *contentProvider) fillMatches(ms []*candidateMatch) []LineMatch {
 				MatchLength: int(m.byteMatchSz),
 				Offset:      m.byteOffset,
 			})
-
-			result = []LineMatch{res}
 		}
+		result = []LineMatch{res}
 	} else {
-		ms = breakMatchesOnNewlines(ms, p.data(false))
+		ms = breakMatchesOnNewlines(p._breakBuf[:0], ms, p.data(false), &p.cands)
+		p._breakBuf = ms
 		result = p.fillContentMatches(ms)
 	}
 
@@ -166,7 +188,7 @@ func (p *contentProvider) fillContentMatches(ms []*candidateMatch) []LineMatch {
 		m := ms[0]
 		num, lineStart, lineEnd := m.line(p.newlines(), p.fileSize)
 
-		var lineCands []*candidateMatch
+		lineCands := p._lineBuf[:0]
 
 		endMatch := m.byteOffset + m.byteMatchSz
 
@@ -180,6 +202,7 @@ func (p *contentProvider) fillContentMatches(ms []*candidateMatch) []LineMatch {
 				break
 			}
 		}
+		p._lineBuf = lineCands
 
 		if len(lineCands) == 0 {
 			log.Panicf(
@@ -205,9 +228,10 @@ func (p *contentProvider) fillContentMatches(ms []*candidateMatch) []LineMatch {
 		}
 
 		finalMatch := LineMatch{
-			LineStart:  lineStart,
-			LineEnd:    lineEnd,
-			LineNumber: num,
+			LineStart:     lineStart,
+			LineEnd:       lineEnd,
+			LineNumber:    num,
+			LineFragments: make([]LineFragmentMatch, 0, len(lineCands)),
 		}
 		finalMatch.Line = data[lineStart:lineEnd]
 
@@ -246,6 +270,14 @@ const (
 	scoreLineOrderFactor    = 1.0
 )
 
+// MaxFileScore returns an upper bound of FileMatch.Score for the
+// documents of a repository with the given rank.
+func MaxFileScore(rank uint16) float64 {
+	// The fragment score is the best matchScore of a line.
+	return scoreWordMatch + scoreFactorAtomMatch + scoreFileOrderFactor +
+		scoreShardRankFactor*float64(rank)/maxUInt16
+}
+
 func findSection(secs []DocumentSection, off, sz uint32) *DocumentSection {
 	j := sort.Search(len(secs), func(i int) bool {
 		return secs[i].End >= off+sz
@@ -264,17 +296,7 @@ func findSection(secs []DocumentSection, off, sz uint32) *DocumentSection {
 func matchScore(secs []DocumentSection, m *LineMatch) float64 {
 	var maxScore float64
 	for _, f := range m.LineFragments {
-		startBoundary := f.LineOffset < len(m.Line) && (f.LineOffset == 0 || byteClass(m.Line[f.LineOffset-1]) != byteClass(m.Line[f.LineOffset]))
-
-		end := int(f.LineOffset) + f.MatchLength
-		endBoundary := end > 0 && (end == len(m.Line) || byteClass(m.Line[end-1]) != byteClass(m.Line[end]))
-
-		score := 0.0
-		if startBoundary && endBoundary {
-			score = scoreWordMatch
-		} else if startBoundary || endBoundary {
-			score = scorePartialWordMatch
-		}
+		score := fragmentScore(m.Line, f.LineOffset, f.MatchLength)
 
 		// We removed scoring based on symbol boundaries. This is due
 		// to not having a use for result scores at the moment on the
@@ -289,6 +311,84 @@ func matchScore(secs []DocumentSection, m *LineMatch) float64 {
 	return maxScore
 }
 
+// fragmentScore scores a match of size bytes at offset off of line
+// by whether it starts and ends on word boundaries.
+func fragmentScore(line []byte, off, size int) float64 {
+	startBoundary := off < len(line) && (off == 0 || byteClass(line[off-1]) != byteClass(line[off]))
+
+	end := off + size
+	endBoundary := end > 0 && (end == len(line) || byteClass(line[end-1]) != byteClass(line[end]))
+
+	if startBoundary && endBoundary {
+		return scoreWordMatch
+	} else if startBoundary || endBoundary {
+		return scorePartialWordMatch
+	}
+	return 0
+}
+
+// fragmentBound returns an upper bound of the fragment score that
+// fillMatches gives the candidates of the document, reading only the
+// bytes around them. The bound is exact unless a candidate spans
+// lines.
+func (p *contentProvider) fragmentBound(ms []*candidateMatch) (score float64, exact bool) {
+	if len(ms) == 0 {
+		// The file name is the match.
+		return scoreWordMatch, true
+	}
+	for _, m := range ms {
+		s, ok := p.candidateScore(m)
+		if !ok {
+			return maxFragmentScore, false
+		}
+		if s > score {
+			score = s
+		}
+	}
+	return score, true
+}
+
+// candidateScore returns the fragment score of m, if it doesn't span
+// lines.
+func (p *contentProvider) candidateScore(m *candidateMatch) (float64, bool) {
+	off, size := int(m.byteOffset), int(m.byteMatchSz)
+	if m.fileName {
+		return fragmentScore(p.data(true), off, size), true
+	}
+
+	// The line around m, as far as it matters for the score.
+	start, end := m.byteOffset, m.byteOffset+m.byteMatchSz
+	if start > 0 {
+		start--
+	}
+	if end < p.fileSize {
+		end++
+	}
+	off = int(m.byteOffset - start)
+	var line []byte
+	if p._data != nil {
+		line = p._data[start:end]
+	} else {
+		line, p.err = p.id.readContentSlice(p.id.boundaries[p.idx]+start, end-start, p.stats)
+		if p.err != nil {
+			return 0, false
+		}
+		p.stats.ContentBytesLoaded += int64(len(line))
+	}
+
+	if off > 0 && line[0] == '\n' {
+		line = line[1:]
+		off--
+	}
+	if n := len(line); n > off+size && line[n-1] == '\n' {
+		line = line[:n-1]
+	}
+	if bytes.IndexByte(line[off:off+size], '\n') >= 0 {
+		return 0, false
+	}
+	return fragmentScore(line, off, size), true
+}
+
 type matchScoreSlice []LineMatch
 
 func (m matchScoreSlice) Len() int           { return len(m) }
@@ -17,7 +17,6 @@ package ctags
 import (
 	"log"
 	"strings"
-	"sync"
 
 	goctags "github.com/sourcegraph/go-ctags"
 )
@@ -33,35 +32,95 @@ func newProcess(bin string) (Parser, error) {
 	})
 }
 
-type lockedParser struct {
-	p Parser
-	l sync.Mutex
+// parserPool runs up to size universal-ctags processes, which are
+// started on demand and reused. A process that fails is dropped, and
+// replaced by the next Parse that needs one.
+type parserPool struct {
+	bin string
+
+	// idle holds the processes not in use. tokens holds one element
+	// per running process.
+	idle   chan Parser
+	tokens chan struct{}
 }
 
-func (lp *lockedParser) Parse(name string, content []byte) ([]*Entry, error) {
-	lp.l.Lock()
-	defer lp.l.Unlock()
-	return lp.p.Parse(name, content)
+func (p *parserPool) get() (Parser, error) {
+	select {
+	case proc := <-p.idle:
+		return proc, nil
+	default:
+	}
+
+	select {
+	case proc := <-p.idle:
+		return proc, nil
+	case p.tokens <- struct{}{}:
+		proc, err := newProcess(p.bin)
+		if err != nil {
+			<-p.tokens
+			return nil, err
+		}
+		return proc, nil
+	}
 }
 
-func (lp *lockedParser) Close() {
-	lp.l.Lock()
-	defer lp.l.Unlock()
-	lp.p.Close()
+func (p *parserPool) Parse(name string, content []byte) ([]*Entry, error) {
+	proc, err := p.get()
+	if err != nil {
+		return nil, err
+	}
+	es, err := proc.Parse(name, content)
+	if err != nil {
+		// The process may be stuck or dead, start afresh.
+		proc.Close()
+		<-p.tokens
+		return nil, err
+	}
+	p.idle <- proc
+	return es, nil
+}
+
+// Close stops the idle processes.
+func (p *parserPool) Close() {
+	for {
+		select {
+		case proc := <-p.idle:
+			proc.Close()
+			<-p.tokens
+		default:
+			return
+		}
+	}
 }
 
 // NewParser creates a parser that is implemented by the given
 // universal-ctags binary. The parser is safe for concurrent use.
 func NewParser(bin string) (Parser, error) {
-	if strings.Contains(bin, "universal-ctags") {
-		// todo: restart, parallelization.
-		proc, err := newProcess(bin)
-		if err != nil {
-			return nil, err
-		}
-		return &lockedParser{p: proc}, nil
+	return NewParserPool(bin, 1)
+}
+
+// NewParserPool creates a parser that runs up to size processes of the
+// given universal-ctags binary, so up to size files are parsed in
+// parallel. The parser is safe for concurrent use.
+func NewParserPool(bin string, size int) (Parser, error) {
+	if !strings.Contains(bin, "universal-ctags") {
+		log.Fatal("not implemented")
+	}
+	if size < 1 {
+		size = 1
 	}
 
-	log.Fatal("not implemented")
-	return nil, nil
+	// Start one process, so a broken binary is reported here.
+	proc, err := newProcess(bin)
+	if err != nil {
+		return nil, err
+	}
+	p := &parserPool{
+		bin:    bin,
+		idle:   make(chan Parser, size),
+		tokens: make(chan struct{}, size),
+	}
+	p.tokens <- struct{}{}
+	p.idle <- proc
+	return p, nil
 }
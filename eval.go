@@ -21,6 +21,7 @@ import (
 	"regexp/syntax"
 	"sort"
 	"strings"
+	"time"
 
 	"github.com/google/zoekt/query"
 	"golang.org/x/net/trace"
@@ -109,7 +110,6 @@ func (d *indexData) Search(ctx context.Context, q query.Q, opts *SearchOptions)
 	copyOpts := *opts
 	opts = &copyOpts
 	opts.SetDefaults()
-	importantMatchCount := 0
 
 	var res SearchResult
 	if len(d.fileNameIndex) == 0 {
@@ -144,16 +144,61 @@ func (d *indexData) Search(ctx context.Context, q query.Q, opts *SearchOptions)
 	}
 
 	if opts.EstimateDocCount {
-		res.Stats.ShardFilesConsidered = len(d.fileBranchMasks)
+		res.Stats.ShardFilesConsidered = d.numLiveDocs()
 		return &res, nil
 	}
 
 	q = query.Map(q, query.ExpandFileContent)
 
-	mt, err := d.newMatchTree(q)
+	// Results beyond MaxDocDisplayCount are thrown away, so only
+	// the files that can make the cut get their line matches.
+	var top *topFiles
+	if opts.MaxDocDisplayCount > 0 {
+		top = newTopFiles(opts.MaxDocDisplayCount)
+	}
+
+	if n := d.shardParallelism(opts); n > 1 {
+		err = d.searchParallel(ctx, q, opts, n, &res, top)
+	} else {
+		err = d.searchDocs(ctx, q, opts, 0, uint32(len(d.fileBranchMasks)), &res, top)
+	}
 	if err != nil {
 		return nil, err
 	}
+	if top != nil {
+		d.fillTopFiles(top, opts, &res)
+	}
+	SortFilesByScore(res.Files)
+
+	for _, md := range d.repoMetaData {
+		r := md
+		addRepo(&res, &r)
+		for _, v := range r.SubRepoMap {
+			addRepo(&res, v)
+		}
+	}
+
+	if opts.NoCopy && len(res.Files) > 0 {
+		res.Release = d.pin()
+	}
+	return &res, nil
+}
+
+// searchDocs evaluates q on the documents in [start, end), appending
+// the matches in doc order to res.Files and counting the work in
+// res.Stats. opts.ShardMaxMatchCount and opts.ShardMaxImportantMatch
+// apply to the matches found in the range.
+//
+// If top is set, the matches are added to top instead, and left for
+// fillTopFiles to fill in.
+func (d *indexData) searchDocs(ctx context.Context, q query.Q, opts *SearchOptions, start, end uint32, res *SearchResult, top *topFiles) error {
+	mt, err := d.newMatchTree(q)
+	if err != nil {
+		return err
+	}
+	if start > 0 {
+		skipTo(mt, start)
+	}
 
 	totalAtomCount := 0
 	visitMatchTree(mt, func(t matchTree) {
@@ -164,9 +209,20 @@ func (d *indexData) Search(ctx context.Context, q query.Q, opts *SearchOptions)
 		id:    d,
 		stats: &res.Stats,
 	}
+	// prof collects the time of the search phases. It is only
+	// returned if the search is profiled.
+	prof := &QueryProfile{}
+	var timer phaseTimer
+	if opts.Profile {
+		cp.profiler = newMatchProfiler(mt)
+		prof = &cp.profiler.profile
+		timer.on = true
+	}
+	phase := timer.phase
 
-	docCount := uint32(len(d.fileBranchMasks))
-	lastDoc := int(-1)
+	known := newKnownMatches(mt)
+	importantMatchCount := 0
+	lastDoc := int(start) - 1
 
 nextFileMatch:
 	for {
@@ -177,33 +233,44 @@ nextFileMatch:
 		default:
 		}
 
+		timer.start()
 		nextDoc := mt.nextDoc()
 		if int(nextDoc) <= lastDoc {
 			nextDoc = uint32(lastDoc + 1)
 		}
-		if nextDoc >= docCount {
+		if nextDoc >= end {
 			break
 		}
 		lastDoc = int(nextDoc)
 
 		if canceled || (res.Stats.MatchCount >= opts.ShardMaxMatchCount && opts.ShardMaxMatchCount > 0) ||
 			(opts.ShardMaxImportantMatch > 0 && importantMatchCount >= opts.ShardMaxImportantMatch) {
-			res.Stats.FilesSkipped += d.repoListEntry[d.repos[nextDoc]].Stats.Documents - lastDoc
+			res.Stats.FilesSkipped += int(end) - lastDoc
 			break
 		}
-
+		if d.tombstoned(nextDoc) {
+			// Move the iterators past all tombstoned documents at
+			// once, rather than preparing each of them.
+			live := d.nextLive(nextDoc)
+			skipTo(mt, live)
+			lastDoc = int(live) - 1
+			phase(&prof.Iterate)
+			continue
+		}
 		res.Stats.FilesConsidered++
 		mt.prepare(nextDoc)
+		phase(&prof.Iterate)
 
 		cp.setDocument(nextDoc)
 
-		known := make(map[matchTree]bool)
+		known.reset()
 
 		md := d.repoMetaData[d.repos[nextDoc]]
 
 		for cost := costMin; cost <= costMax; cost++ {
-			v, ok := mt.matches(cp, cost, known)
+			v, ok := callMatches(cp, cost, known, mt)
 			if ok && !v {
+				phase(&prof.Evaluate)
 				continue nextFileMatch
 			}
 
@@ -213,103 +280,166 @@ nextFileMatch:
 			}
 		}
 
-		fileMatch := FileMatch{
-			Repository:   md.Name,
-			RepositoryID: md.ID,
-			FileName:     string(d.fileName(nextDoc)),
-			Checksum:     d.getChecksum(nextDoc),
-			Language:     d.languageMap[d.languages[nextDoc]],
-		}
-
-		if s := d.subRepos[nextDoc]; s > 0 {
-			if s >= uint32(len(d.subRepoPaths[d.repos[nextDoc]])) {
-				log.Panicf("corrupt index: subrepo %d beyond %v", s, d.subRepoPaths)
-			}
-			path := d.subRepoPaths[d.repos[nextDoc]][s]
-			fileMatch.SubRepositoryPath = path
-			sr := md.SubRepoMap[path]
-			fileMatch.SubRepositoryName = sr.Name
-			if idx := d.branchIndex(nextDoc); idx >= 0 {
-				fileMatch.Version = sr.Branches[idx].Version
-			}
-		} else {
-			idx := d.branchIndex(nextDoc)
-			if idx >= 0 {
-				fileMatch.Version = md.Branches[idx].Version
-			}
-		}
+		phase(&prof.Evaluate)
 
 		atomMatchCount := 0
 		visitMatches(mt, known, func(mt matchTree) {
 			atomMatchCount++
 		})
-		finalCands := gatherMatches(mt, known)
-
-		if len(finalCands) == 0 {
-			nm := d.fileName(nextDoc)
-			finalCands = append(finalCands,
-				&candidateMatch{
-					caseSensitive: false,
-					fileName:      true,
-					substrBytes:   nm,
-					substrLowered: nm,
-					file:          nextDoc,
-					runeOffset:    0,
-					byteOffset:    0,
-					byteMatchSz:   uint32(len(nm)),
-				})
-		}
-		fileMatch.LineMatches = cp.fillMatches(finalCands)
-
-		maxFileScore := 0.0
-		for i := range fileMatch.LineMatches {
-			if maxFileScore < fileMatch.LineMatches[i].Score {
-				maxFileScore = fileMatch.LineMatches[i].Score
+		atoms := float64(atomMatchCount) / float64(totalAtomCount)
+		finalCands := gatherMatches(cp._gatherBuf, mt, known)
+		cp._gatherBuf = finalCands
+		cp._masksBuf = d.branchQueryMasks(cp._masksBuf[:0], nextDoc, mt, known)
+
+		if top != nil {
+			var scored FileMatch
+			d.addFileScores(&scored, nextDoc, atoms)
+			score, bound := scored.Score, scored.Score+maxFragmentScore
+			if fragment, exact := cp.fragmentBound(finalCands); exact {
+				score, bound = score+fragment, score+fragment
 			}
-
-			// Order by ordering in file.
-			fileMatch.LineMatches[i].Score += scoreLineOrderFactor * (1.0 - (float64(i) / float64(len(fileMatch.LineMatches))))
+			if score > scoreImportantThreshold {
+				importantMatchCount++
+			}
+			matches := top.add(nextDoc, score, bound, atoms, finalCands, cp._masksBuf)
+			res.Stats.MatchCount += matches
+			res.Stats.FileCount++
+			continue
 		}
 
-		// Maintain ordering of input files. This
-		// strictly dominates the in-file ordering of
-		// the matches.
-		fileMatch.addScore("fragment", maxFileScore)
-		fileMatch.addScore("atom", float64(atomMatchCount)/float64(totalAtomCount)*scoreFactorAtomMatch)
-
-		// Prefer earlier docs.
-		fileMatch.addScore("doc-order", scoreFileOrderFactor*(1.0-float64(nextDoc)/float64(len(d.boundaries))))
-		fileMatch.addScore("shard-order", scoreShardRankFactor*float64(md.Rank)/maxUInt16)
-
+		fileMatch := d.newFileMatch(nextDoc)
+		d.addFileScores(&fileMatch, nextDoc, atoms)
+		d.fillFileMatch(cp, &fileMatch, finalCands, cp._masksBuf, opts, phase, prof)
 		if fileMatch.Score > scoreImportantThreshold {
 			importantMatchCount++
 		}
-		fileMatch.Branches = d.gatherBranches(nextDoc, mt, known)
-		sortMatchesByScore(fileMatch.LineMatches)
-		if opts.Whole {
-			fileMatch.Content = cp.data(false)
-		}
 
 		res.Files = append(res.Files, fileMatch)
 		res.Stats.MatchCount += len(fileMatch.LineMatches)
 		res.Stats.FileCount++
 	}
-	SortFilesByScore(res.Files)
-
-	for _, md := range d.repoMetaData {
-		r := md
-		addRepo(&res, &r)
-		for _, v := range r.SubRepoMap {
-			addRepo(&res, v)
-		}
-	}
 
 	visitMatchTree(mt, func(mt matchTree) {
 		if atom, ok := mt.(interface{ updateStats(*Stats) }); ok {
 			atom.updateStats(&res.Stats)
 		}
 	})
-	return &res, nil
+	if cp.profiler != nil {
+		res.Profile = prof
+	}
+	return nil
+}
+
+// newFileMatch returns the FileMatch for doc, without matches and
+// scores.
+func (d *indexData) newFileMatch(doc uint32) FileMatch {
+	md := d.repoMetaData[d.repos[doc]]
+	fileMatch := FileMatch{
+		Repository:   md.Name,
+		RepositoryID: md.ID,
+		FileName:     string(d.fileName(doc)),
+		Checksum:     d.getChecksum(doc),
+		Language:     d.languageMap[d.languages[doc]],
+	}
+
+	if s := d.subRepos[doc]; s > 0 {
+		if s >= uint32(len(d.subRepoPaths[d.repos[doc]])) {
+			log.Panicf("corrupt index: subrepo %d beyond %v", s, d.subRepoPaths)
+		}
+		path := d.subRepoPaths[d.repos[doc]][s]
+		fileMatch.SubRepositoryPath = path
+		sr := md.SubRepoMap[path]
+		fileMatch.SubRepositoryName = sr.Name
+		if idx := d.branchIndex(doc); idx >= 0 {
+			fileMatch.Version = sr.Branches[idx].Version
+		}
+	} else {
+		idx := d.branchIndex(doc)
+		if idx >= 0 {
+			fileMatch.Version = md.Branches[idx].Version
+		}
+	}
+	return fileMatch
+}
+
+// addFileScores adds the scores of doc that don't depend on its line
+// matches. atoms is the fraction of the atoms of the match tree that
+// matched.
+func (d *indexData) addFileScores(fileMatch *FileMatch, doc uint32, atoms float64) {
+	md := &d.repoMetaData[d.repos[doc]]
+	fileMatch.addScore("atom", atoms*scoreFactorAtomMatch)
+
+	// Prefer earlier docs.
+	fileMatch.addScore("doc-order", scoreFileOrderFactor*(1.0-float64(doc)/float64(len(d.boundaries))))
+	fileMatch.addScore("shard-order", scoreShardRankFactor*float64(md.Rank)/maxUInt16)
+}
+
+// fillFileMatch fills in the line matches of the document cp is on
+// from its candidates, and adds their score. cands and branchMasks
+// are as returned by gatherMatches and branchQueryMasks.
+func (d *indexData) fillFileMatch(cp *contentProvider, fileMatch *FileMatch, cands []*candidateMatch, branchMasks []uint64, opts *SearchOptions, phase func(*time.Duration), prof *QueryProfile) {
+	if len(cands) == 0 {
+		nm := d.fileName(cp.idx)
+		cm := cp.cands.alloc()
+		*cm = candidateMatch{
+			caseSensitive: false,
+			fileName:      true,
+			substrBytes:   nm,
+			substrLowered: nm,
+			file:          cp.idx,
+			runeOffset:    0,
+			byteOffset:    0,
+			byteMatchSz:   uint32(len(nm)),
+		}
+		cands = append(cands, cm)
+	}
+	fileMatch.LineMatches = cp.fillMatches(cands)
+	phase(&prof.FillMatches)
+
+	maxFileScore := 0.0
+	for i := range fileMatch.LineMatches {
+		if maxFileScore < fileMatch.LineMatches[i].Score {
+			maxFileScore = fileMatch.LineMatches[i].Score
+		}
+
+		// Order by ordering in file.
+		fileMatch.LineMatches[i].Score += scoreLineOrderFactor * (1.0 - (float64(i) / float64(len(fileMatch.LineMatches))))
+	}
+
+	// Maintain ordering of input files. This
+	// strictly dominates the in-file ordering of
+	// the matches.
+	fileMatch.addScore("fragment", maxFileScore)
+
+	phase(&prof.FillMatches)
+	fileMatch.Branches = d.gatherBranches(cp.idx, branchMasks)
+	phase(&prof.GatherBranches)
+	sortMatchesByScore(fileMatch.LineMatches)
+	if opts.Whole {
+		fileMatch.Content = cp.data(false)
+	}
+}
+
+// phaseTimer adds the time spent in the phases of a search to a
+// QueryProfile, if on is set.
+type phaseTimer struct {
+	on    bool
+	begin time.Time
+}
+
+func (t *phaseTimer) start() {
+	if t.on {
+		t.begin = time.Now()
+	}
+}
+
+// phase adds the time since the last phase to d.
+func (t *phaseTimer) phase(d *time.Duration) {
+	if t.on {
+		now := time.Now()
+		*d += now.Sub(t.begin)
+		t.begin = now
+	}
 }
 
 func addRepo(res *SearchResult, repo *Repository) {
@@ -336,8 +466,11 @@ func (m sortByOffsetSlice) Less(i, j int) bool {
 // filename/content matches: if there are content matches, all
 // filename matches are trimmed from the result. The matches are
 // returned in document order and are non-overlapping.
-func gatherMatches(mt matchTree, known map[matchTree]bool) []*candidateMatch {
-	var cands []*candidateMatch
+//
+// The candidates are appended to dst, which may be reused across
+// documents.
+func gatherMatches(dst []*candidateMatch, mt matchTree, known *knownMatches) []*candidateMatch {
+	cands := dst[:0]
 	visitMatches(mt, known, func(mt matchTree) {
 		if smt, ok := mt.(*substrMatchTree); ok {
 			cands = append(cands, smt.current...)
@@ -348,6 +481,9 @@ func gatherMatches(mt matchTree, known map[matchTree]bool) []*candidateMatch {
 		if smt, ok := mt.(*symbolRegexpMatchTree); ok {
 			cands = append(cands, smt.found...)
 		}
+		if smt, ok := mt.(*symbolDictMatchTree); ok {
+			cands = append(cands, smt.found...)
+		}
 	})
 
 	foundContentMatch := false
@@ -404,21 +540,28 @@ func (d *indexData) branchIndex(docID uint32) int {
 	return -1
 }
 
-// gatherBranches returns a list of branch names.
-func (d *indexData) gatherBranches(docID uint32, mt matchTree, known map[matchTree]bool) []string {
-	foundBranchQuery := false
-	var branches []string
+// branchQueryMasks appends the masks of the matching branch queries
+// to dst.
+func (d *indexData) branchQueryMasks(dst []uint64, docID uint32, mt matchTree, known *knownMatches) []uint64 {
 	repoIdx := d.repos[docID]
 	visitMatches(mt, known, func(mt matchTree) {
-		bq, ok := mt.(*branchQueryMatchTree)
-		if ok {
-			foundBranchQuery = true
-			branches = append(branches,
-				d.branchNames[repoIdx][uint(bq.masks[repoIdx])])
+		if bq, ok := mt.(*branchQueryMatchTree); ok {
+			dst = append(dst, bq.masks[repoIdx])
 		}
 	})
+	return dst
+}
+
+// gatherBranches returns a list of branch names. Without branch query
+// masks, these are all branches the document is on.
+func (d *indexData) gatherBranches(docID uint32, branchQueryMasks []uint64) []string {
+	var branches []string
+	repoIdx := d.repos[docID]
+	for _, m := range branchQueryMasks {
+		branches = append(branches, d.branchNames[repoIdx][uint(m)])
+	}
 
-	if !foundBranchQuery {
+	if len(branchQueryMasks) == 0 {
 		mask := d.fileBranchMasks[docID]
 		id := uint32(1)
 		for mask != 0 {
@@ -571,7 +714,7 @@ func (d *indexData) regexpToMatchTreeRecursive(r *syntax.Regexp, minTextSize int
 			if singleLine {
 				return &andLineMatchTree{andMatchTree{children: newQs}}, isEq, singleLine, nil
 			}
-			return &andMatchTree{newQs}, isEq, singleLine, nil
+			return &andMatchTree{children: newQs}, isEq, singleLine, nil
 		}
 		for _, q := range qs {
 			if _, ok := q.(*bruteForceMatchTree); ok {
@@ -579,9 +722,9 @@ func (d *indexData) regexpToMatchTreeRecursive(r *syntax.Regexp, minTextSize int
 			}
 		}
 		if len(qs) == 0 {
-			return &noMatchTree{"const"}, isEq, false, nil
+			return &noMatchTree{Why: "const"}, isEq, false, nil
 		}
-		return &orMatchTree{qs}, isEq, false, nil
+		return &orMatchTree{children: qs}, isEq, false, nil
 	case syntax.OpStar:
 		if r.Sub[0].Op == syntax.OpAnyCharNotNL {
 			return &bruteForceMatchTree{}, false, true, nil
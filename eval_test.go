@@ -15,6 +15,7 @@
 package zoekt
 
 import (
+	"context"
 	"reflect"
 	"regexp/syntax"
 	"strings"
@@ -71,8 +72,8 @@ func TestRegexpParse(t *testing.T) {
 	cases := []testcase{
 		{"(foo|)bar", substrMT("bar"), false},
 		{"(foo|)", &bruteForceMatchTree{}, false},
-		{"(foo|bar)baz.*bla", &andMatchTree{[]matchTree{
-			&orMatchTree{[]matchTree{
+		{"(foo|bar)baz.*bla", &andMatchTree{children: []matchTree{
+			&orMatchTree{children: []matchTree{
 				substrMT("foo"),
 				substrMT("bar"),
 			}},
@@ -81,24 +82,24 @@ func TestRegexpParse(t *testing.T) {
 		}}, false},
 		{
 			"^[a-z](People)+barrabas$",
-			&andMatchTree{[]matchTree{
+			&andMatchTree{children: []matchTree{
 				substrMT("People"),
 				substrMT("barrabas"),
 			}}, false,
 		},
 		{"foo", substrMT("foo"), true},
 		{"^foo", substrMT("foo"), false},
-		{"(foo) (bar)", &andMatchTree{[]matchTree{substrMT("foo"), substrMT("bar")}}, false},
-		{"(thread|needle|haystack)", &orMatchTree{[]matchTree{
+		{"(foo) (bar)", &andMatchTree{children: []matchTree{substrMT("foo"), substrMT("bar")}}, false},
+		{"(thread|needle|haystack)", &orMatchTree{children: []matchTree{
 			substrMT("thread"),
 			substrMT("needle"),
 			substrMT("haystack"),
 		}}, true},
-		{"(foo)(?-s:.)*?(bar)", &andLineMatchTree{andMatchTree{[]matchTree{
+		{"(foo)(?-s:.)*?(bar)", &andLineMatchTree{andMatchTree{children: []matchTree{
 			substrMT("foo"),
 			substrMT("bar"),
 		}}}, false},
-		{"(foo)(?-s:.)*?[[:space:]](?-s:.)*?(bar)", &andMatchTree{[]matchTree{
+		{"(foo)(?-s:.)*?[[:space:]](?-s:.)*?(bar)", &andMatchTree{children: []matchTree{
 			substrMT("foo"),
 			substrMT("bar"),
 		}}, false},
@@ -213,3 +214,60 @@ func TestSimplifyRepoBranchSimple(t *testing.T) {
 		t.Fatalf("-want, +got:\n%s", d)
 	}
 }
+
+func TestProfile(t *testing.T) {
+	b := testIndexBuilder(t, &Repository{Name: "repo"},
+		Document{Name: "f1", Content: []byte("needle in a haystack")},
+		Document{Name: "f2", Content: []byte("needle and thread")},
+		Document{Name: "f3", Content: []byte("just hay")})
+	d := searcherForTest(t, b)
+
+	q := query.NewAnd(
+		&query.Substring{Pattern: "needle", Content: true},
+		&query.Not{Child: &query.Substring{Pattern: "haystack", Content: true}})
+	for _, parallelism := range []int{0, 4} {
+		res, err := d.Search(context.Background(), q, &SearchOptions{Profile: true, ShardParallelism: parallelism})
+		if err != nil {
+			t.Fatal(err)
+		}
+		if len(res.Files) != 1 || res.Files[0].FileName != "f2" {
+			t.Fatalf("got %v, want f2", res.Files)
+		}
+		p := res.Profile
+		if p == nil {
+			t.Fatal("no profile")
+		}
+		if p.Shards != 1 {
+			t.Errorf("got %d shards, want 1", p.Shards)
+		}
+
+		type node struct {
+			Depth      int
+			Node       string
+			Docs       int
+			Matched    int
+			Candidates int
+		}
+		var got []node
+		for _, n := range p.Nodes {
+			got = append(got, node{n.Depth, n.Node, n.Docs, n.Matched, n.Candidates})
+		}
+		want := []node{
+			{0, "and", 2, 1, 0},
+			{1, `substr("needle")`, 2, 2, 2},
+			{1, "not", 2, 1, 0},
+			{2, `substr("haystack")`, 2, 1, 1},
+		}
+		if d := cmp.Diff(want, got); d != "" {
+			t.Errorf("parallelism %d: nodes mismatch (-want +got):\n%s\n%s", parallelism, d, p)
+		}
+	}
+
+	res, err := d.Search(context.Background(), q, &SearchOptions{})
+	if err != nil {
+		t.Fatal(err)
+	}
+	if res.Profile != nil {
+		t.Errorf("got a profile without SearchOptions.Profile")
+	}
+}
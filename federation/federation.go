@@ -0,0 +1,523 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Package federation searches a corpus that is partitioned across
+// zoekt-webservers, as if it were on one.
+package federation
+
+import (
+	"context"
+	"errors"
+	"fmt"
+	"math"
+	"sync"
+	"time"
+
+	"github.com/google/zoekt"
+	"github.com/google/zoekt/query"
+	"github.com/google/zoekt/rpc"
+	"github.com/google/zoekt/stream"
+	"github.com/google/zoekt/trace"
+	"github.com/prometheus/client_golang/prometheus"
+	"github.com/prometheus/client_golang/prometheus/promauto"
+)
+
+var (
+	metricPartitionDuration = promauto.NewHistogram(prometheus.HistogramOpts{
+		Name:    "zoekt_federation_partition_duration_seconds",
+		Help:    "The duration the search of a partition took in seconds",
+		Buckets: prometheus.DefBuckets,
+	})
+	metricPartitionFirstResult = promauto.NewHistogram(prometheus.HistogramOpts{
+		Name:    "zoekt_federation_partition_first_result_seconds",
+		Help:    "The time until a partition sent its first result in seconds",
+		Buckets: prometheus.DefBuckets,
+	})
+	metricHedgedTotal = promauto.NewCounter(prometheus.CounterOpts{
+		Name: "zoekt_federation_hedged_requests_total",
+		Help: "The total number of searches sent to another replica because the first was slow",
+	})
+	metricReplicaFailedTotal = promauto.NewCounter(prometheus.CounterOpts{
+		Name: "zoekt_federation_replica_failed_total",
+		Help: "The total number of replica searches that failed before sending results",
+	})
+	metricPartitionTimeoutTotal = promauto.NewCounter(prometheus.CounterOpts{
+		Name: "zoekt_federation_partition_timeout_total",
+		Help: "The total number of partition searches canceled at the partition timeout",
+	})
+)
+
+// Replica is a zoekt-webserver serving a partition.
+type Replica interface {
+	StreamSearch(ctx context.Context, q query.Q, opts *zoekt.SearchOptions, sender zoekt.Sender) error
+	List(ctx context.Context, q query.Q, opts *zoekt.ListOptions) (*zoekt.RepoList, error)
+}
+
+type remote struct {
+	*stream.Client
+	zoekt.Searcher
+	address string
+}
+
+func (r *remote) StreamSearch(ctx context.Context, q query.Q, opts *zoekt.SearchOptions, sender zoekt.Sender) error {
+	return r.Client.StreamSearch(ctx, q, opts, sender)
+}
+
+func (r *remote) String() string {
+	return r.address
+}
+
+// NewReplica returns a Replica that searches the zoekt-webserver at
+// address, which must serve streaming search and RPC.
+func NewReplica(address string) Replica {
+	return &remote{
+		Client:   stream.NewClient(address, nil),
+		Searcher: rpc.Client(address),
+		address:  address,
+	}
+}
+
+// Partition is a part of the corpus. Partitions must not hold the same
+// repositories. Every replica of a partition serves all of it.
+type Partition struct {
+	Name     string
+	Replicas []Replica
+}
+
+// Options configures the federated searcher.
+type Options struct {
+	// HedgeDelay is how long a partition search waits for results
+	// from a replica before it also asks the next replica. The replica
+	// that sends results first is used, and the others are canceled.
+	// Zero disables hedging. Replicas that fail before sending results
+	// are always retried on the next replica.
+	HedgeDelay time.Duration
+
+	// PartitionTimeout is the time after which the search of a
+	// partition is canceled, keeping the results sent so far. It is
+	// counted as a crash in the stats. Zero means no timeout.
+	PartitionTimeout time.Duration
+}
+
+type federatedSearcher struct {
+	partitions []Partition
+	opts       Options
+}
+
+// NewSearcher returns a zoekt.Streamer that searches all partitions,
+// and applies the limits of the search options across them.
+func NewSearcher(partitions []Partition, opts Options) zoekt.Streamer {
+	return &federatedSearcher{
+		partitions: partitions,
+		opts:       opts,
+	}
+}
+
+func (s *federatedSearcher) String() string {
+	return fmt.Sprintf("federation(%d partitions)", len(s.partitions))
+}
+
+func (s *federatedSearcher) Close() {
+	for _, p := range s.partitions {
+		for _, r := range p.Replicas {
+			if c, ok := r.(interface{ Close() }); ok {
+				c.Close()
+			}
+		}
+	}
+}
+
+func (s *federatedSearcher) Search(ctx context.Context, q query.Q, opts *zoekt.SearchOptions) (*zoekt.SearchResult, error) {
+	if opts == nil {
+		opts = &zoekt.SearchOptions{}
+	}
+	start := time.Now()
+	aggregate := &zoekt.SearchResult{
+		RepoURLs:      map[string]string{},
+		LineFragments: map[string]string{},
+	}
+	var mu sync.Mutex
+	err := s.StreamSearch(ctx, q, opts, stream.SenderFunc(func(r *zoekt.SearchResult) {
+		mu.Lock()
+		defer mu.Unlock()
+		aggregate.Stats.Add(r.Stats)
+		if r.Profile != nil {
+			if aggregate.Profile == nil {
+				aggregate.Profile = &zoekt.QueryProfile{}
+			}
+			aggregate.Profile.Add(r.Profile)
+		}
+		aggregate.Files = append(aggregate.Files, r.Files...)
+		for k, v := range r.RepoURLs {
+			aggregate.RepoURLs[k] = v
+		}
+		for k, v := range r.LineFragments {
+			aggregate.LineFragments[k] = v
+		}
+	}))
+	if err != nil {
+		return nil, err
+	}
+
+	zoekt.SortFilesByScore(aggregate.Files)
+	if max := opts.MaxDocDisplayCount; max > 0 && len(aggregate.Files) > max {
+		aggregate.Files = aggregate.Files[:max]
+	}
+	aggregate.Duration = time.Since(start)
+	return aggregate, nil
+}
+
+// StreamSearch searches all partitions in parallel, and sends their
+// results as they come in.
+//
+// Once TotalMaxMatchCount matches are found in total, all partitions
+// are canceled. Once MaxDocDisplayCount files were sent, files that
+// score lower than all of them are dropped, as they can't make it into
+// the top files. The MaxPendingPriority of events is the highest of
+// all partitions still searching, so consumers can tell which results
+// are final across partitions.
+func (s *federatedSearcher) StreamSearch(ctx context.Context, q query.Q, opts *zoekt.SearchOptions, sender zoekt.Sender) (err error) {
+	tr, ctx := trace.New(ctx, "federatedSearcher.StreamSearch", "")
+	defer func() {
+		if err != nil {
+			tr.LazyPrintf("error: %v", err)
+			tr.SetError(err)
+		}
+		tr.Finish()
+	}()
+
+	if opts == nil {
+		opts = &zoekt.SearchOptions{}
+	}
+	ctx, cancel := context.WithCancel(ctx)
+	defer cancel()
+
+	// Results are copied by the replicas, they come over the wire.
+	replicaOpts := *opts
+	replicaOpts.NoCopy = false
+
+	m := newMerger(len(s.partitions), opts, sender, cancel)
+	errs := make(chan error, len(s.partitions))
+	for i := range s.partitions {
+		go func(i int) {
+			errs <- s.searchPartition(ctx, tr, i, q, &replicaOpts, m)
+		}(i)
+	}
+
+	var firstErr error
+	for range s.partitions {
+		if err := <-errs; err != nil && firstErr == nil {
+			firstErr = err
+			cancel()
+		}
+	}
+	if m.limitReached() {
+		// Partitions fail with context errors once we cancel them.
+		return nil
+	}
+	return firstErr
+}
+
+func (s *federatedSearcher) searchPartition(ctx context.Context, tr *trace.Trace, i int, q query.Q, opts *zoekt.SearchOptions, m *merger) error {
+	p := s.partitions[i]
+	start := time.Now()
+	defer func() {
+		m.done(i)
+		metricPartitionDuration.Observe(time.Since(start).Seconds())
+	}()
+
+	pctx := ctx
+	if s.opts.PartitionTimeout > 0 {
+		var cancel context.CancelFunc
+		pctx, cancel = context.WithTimeout(ctx, s.opts.PartitionTimeout)
+		defer cancel()
+	}
+
+	first := true
+	err := s.searchReplicas(pctx, p, q, opts, func(r *zoekt.SearchResult) {
+		if first {
+			first = false
+			metricPartitionFirstResult.Observe(time.Since(start).Seconds())
+			tr.LazyPrintf("partition %s: first result after %v", p.Name, time.Since(start))
+		}
+		m.send(i, r)
+	})
+	tr.LazyPrintf("partition %s: done after %v", p.Name, time.Since(start))
+
+	if err != nil && ctx.Err() == nil && pctx.Err() == context.DeadlineExceeded {
+		metricPartitionTimeoutTotal.Inc()
+		tr.LazyPrintf("partition %s: timed out", p.Name)
+		m.send(i, &zoekt.SearchResult{Stats: zoekt.Stats{Crashes: 1}})
+		return nil
+	}
+	if err != nil {
+		return fmt.Errorf("partition %s: %w", p.Name, err)
+	}
+	return nil
+}
+
+type replicaResult struct {
+	replica int
+	err     error
+}
+
+// searchReplicas searches the replicas of p, one after the other if
+// they fail, and hedged if they are slow. The results of the first
+// replica to send results are passed to send.
+func (s *federatedSearcher) searchReplicas(ctx context.Context, p Partition, q query.Q, opts *zoekt.SearchOptions, send func(*zoekt.SearchResult)) error {
+	if len(p.Replicas) == 0 {
+		return errors.New("no replicas")
+	}
+
+	var (
+		mu      sync.Mutex
+		winner  = -1
+		cancels = make([]context.CancelFunc, len(p.Replicas))
+	)
+	defer func() {
+		mu.Lock()
+		defer mu.Unlock()
+		for _, c := range cancels {
+			if c != nil {
+				c()
+			}
+		}
+	}()
+
+	results := make(chan replicaResult, len(p.Replicas))
+	next := 0
+	start := func() {
+		i := next
+		next++
+		rctx, cancel := context.WithCancel(ctx)
+		mu.Lock()
+		cancels[i] = cancel
+		mu.Unlock()
+		go func() {
+			err := p.Replicas[i].StreamSearch(rctx, q, opts, stream.SenderFunc(func(r *zoekt.SearchResult) {
+				// Sends of one replica are sequential, so only the
+				// winner check needs the lock.
+				mu.Lock()
+				if winner < 0 {
+					winner = i
+					for j, c := range cancels {
+						if j != i && c != nil {
+							c()
+						}
+					}
+				}
+				won := winner == i
+				mu.Unlock()
+				if won {
+					send(r)
+				}
+			}))
+			results <- replicaResult{replica: i, err: err}
+		}()
+	}
+
+	var hedge <-chan time.Time
+	resetHedge := func() {
+		if s.opts.HedgeDelay > 0 && next < len(p.Replicas) {
+			hedge = time.After(s.opts.HedgeDelay)
+		} else {
+			hedge = nil
+		}
+	}
+
+	start()
+	resetHedge()
+	running := 1
+	var lastErr error
+	for {
+		select {
+		case <-hedge:
+			mu.Lock()
+			decided := winner >= 0
+			mu.Unlock()
+			if !decided {
+				metricHedgedTotal.Inc()
+				start()
+				running++
+			}
+			resetHedge()
+
+		case r := <-results:
+			running--
+			mu.Lock()
+			if winner < 0 && r.err == nil {
+				// It finished without results, which is an answer.
+				winner = r.replica
+			}
+			w := winner
+			mu.Unlock()
+
+			switch {
+			case r.replica == w:
+				return r.err
+			case w >= 0:
+				// A canceled loser.
+				continue
+			}
+
+			lastErr = r.err
+			if ctx.Err() != nil {
+				return ctx.Err()
+			}
+			metricReplicaFailedTotal.Inc()
+			if next < len(p.Replicas) {
+				start()
+				running++
+				resetHedge()
+			} else if running == 0 {
+				return lastErr
+			}
+		}
+	}
+}
+
+// merger combines the results of the partitions into one stream.
+type merger struct {
+	mu     sync.Mutex
+	sender zoekt.Sender
+	opts   *zoekt.SearchOptions
+	cancel context.CancelFunc
+
+	// pending has the MaxPendingPriority last reported by each
+	// partition that is still searching. Partitions that haven't
+	// reported may still find anything.
+	pending []float64
+	running []bool
+
+	matchCount int
+	limit      bool
+	top        zoekt.TopScores
+}
+
+func newMerger(n int, opts *zoekt.SearchOptions, sender zoekt.Sender, cancel context.CancelFunc) *merger {
+	m := &merger{
+		sender:  sender,
+		opts:    opts,
+		cancel:  cancel,
+		pending: make([]float64, n),
+		running: make([]bool, n),
+		top:     zoekt.TopScores{K: opts.MaxDocDisplayCount},
+	}
+	for i := range m.pending {
+		m.pending[i] = math.Inf(1)
+		m.running[i] = true
+	}
+	return m
+}
+
+func (m *merger) send(partition int, r *zoekt.SearchResult) {
+	m.mu.Lock()
+	defer m.mu.Unlock()
+
+	if len(r.Files) > 0 || r.Progress != (zoekt.Progress{}) {
+		m.pending[partition] = r.Progress.MaxPendingPriority
+	}
+	r.Progress.MaxPendingPriority = m.maxPending()
+
+	if m.top.K > 0 {
+		files := r.Files[:0]
+		for _, f := range r.Files {
+			if m.top.Full() && f.Score <= m.top.Threshold() {
+				continue
+			}
+			m.top.Add(f.Score)
+			files = append(files, f)
+		}
+		r.Files = files
+	}
+
+	m.matchCount += r.Stats.MatchCount
+	if !m.limit && m.opts.TotalMaxMatchCount > 0 && m.matchCount > m.opts.TotalMaxMatchCount {
+		m.limit = true
+		m.cancel()
+	}
+
+	m.sender.Send(r)
+}
+
+// done marks a partition as finished.
+func (m *merger) done(partition int) {
+	m.mu.Lock()
+	defer m.mu.Unlock()
+	m.running[partition] = false
+}
+
+func (m *merger) maxPending() float64 {
+	max := math.Inf(-1)
+	for i, p := range m.pending {
+		if m.running[i] && p > max {
+			max = p
+		}
+	}
+	return max
+}
+
+func (m *merger) limitReached() bool {
+	m.mu.Lock()
+	defer m.mu.Unlock()
+	return m.limit
+}
+
+func (s *federatedSearcher) List(ctx context.Context, q query.Q, opts *zoekt.ListOptions) (*zoekt.RepoList, error) {
+	type listResult struct {
+		rl  *zoekt.RepoList
+		err error
+	}
+	results := make(chan listResult, len(s.partitions))
+	for _, p := range s.partitions {
+		go func(p Partition) {
+			var lr listResult
+			lr.err = errors.New("no replicas")
+			for _, r := range p.Replicas {
+				lr.rl, lr.err = r.List(ctx, q, opts)
+				if lr.err == nil || ctx.Err() != nil {
+					break
+				}
+			}
+			if lr.err != nil {
+				lr.err = fmt.Errorf("partition %s: %w", p.Name, lr.err)
+			}
+			results <- lr
+		}(p)
+	}
+
+	agg := &zoekt.RepoList{}
+	var firstErr error
+	for range s.partitions {
+		lr := <-results
+		if lr.err != nil {
+			if firstErr == nil {
+				firstErr = lr.err
+			}
+			continue
+		}
+		agg.Repos = append(agg.Repos, lr.rl.Repos...)
+		agg.Crashes += lr.rl.Crashes
+		for id, e := range lr.rl.Minimal {
+			if agg.Minimal == nil {
+				agg.Minimal = map[uint32]*zoekt.MinimalRepoListEntry{}
+			}
+			agg.Minimal[id] = e
+		}
+	}
+	if firstErr != nil {
+		return nil, firstErr
+	}
+	return agg, nil
+}
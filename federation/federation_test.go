@@ -0,0 +1,306 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package federation
+
+import (
+	"context"
+	"errors"
+	"math"
+	"reflect"
+	"sort"
+	"sync"
+	"testing"
+	"time"
+
+	"github.com/google/zoekt"
+	"github.com/google/zoekt/query"
+	"github.com/google/zoekt/stream"
+)
+
+// fakeReplica sends its events after delay. If block is set, it then
+// waits for the search to be canceled.
+type fakeReplica struct {
+	events []zoekt.SearchResult
+	delay  time.Duration
+	block  bool
+	err    error
+	repos  []string
+
+	mu       sync.Mutex
+	searches int
+	canceled int
+}
+
+func (r *fakeReplica) StreamSearch(ctx context.Context, q query.Q, opts *zoekt.SearchOptions, sender zoekt.Sender) error {
+	r.mu.Lock()
+	r.searches++
+	r.mu.Unlock()
+
+	select {
+	case <-time.After(r.delay):
+	case <-ctx.Done():
+		r.mu.Lock()
+		r.canceled++
+		r.mu.Unlock()
+		return ctx.Err()
+	}
+	if r.err != nil {
+		return r.err
+	}
+	for i := range r.events {
+		ev := r.events[i]
+		ev.Files = append([]zoekt.FileMatch{}, ev.Files...)
+		sender.Send(&ev)
+	}
+	if r.block {
+		<-ctx.Done()
+		r.mu.Lock()
+		r.canceled++
+		r.mu.Unlock()
+		return ctx.Err()
+	}
+	return nil
+}
+
+func (r *fakeReplica) canceledSearches() int {
+	r.mu.Lock()
+	defer r.mu.Unlock()
+	return r.canceled
+}
+
+func (r *fakeReplica) List(ctx context.Context, q query.Q, opts *zoekt.ListOptions) (*zoekt.RepoList, error) {
+	if r.err != nil {
+		return nil, r.err
+	}
+	rl := &zoekt.RepoList{}
+	for _, name := range r.repos {
+		rl.Repos = append(rl.Repos, &zoekt.RepoListEntry{Repository: zoekt.Repository{Name: name}})
+	}
+	return rl, nil
+}
+
+func files(names ...string) []zoekt.FileMatch {
+	var fs []zoekt.FileMatch
+	for _, n := range names {
+		fs = append(fs, zoekt.FileMatch{FileName: n})
+	}
+	return fs
+}
+
+func event(priority, maxPending float64, fs ...zoekt.FileMatch) zoekt.SearchResult {
+	return zoekt.SearchResult{
+		Files:    fs,
+		Stats:    zoekt.Stats{MatchCount: len(fs)},
+		Progress: zoekt.Progress{Priority: priority, MaxPendingPriority: maxPending},
+	}
+}
+
+func scored(name string, score float64) zoekt.FileMatch {
+	return zoekt.FileMatch{FileName: name, Score: score}
+}
+
+func partition(name string, replicas ...Replica) Partition {
+	return Partition{Name: name, Replicas: replicas}
+}
+
+func fileNames(res *zoekt.SearchResult) []string {
+	var names []string
+	for _, f := range res.Files {
+		names = append(names, f.FileName)
+	}
+	return names
+}
+
+func TestSearch(t *testing.T) {
+	s := NewSearcher([]Partition{
+		partition("a", &fakeReplica{events: []zoekt.SearchResult{
+			event(2, 1, scored("a1", 10), scored("a2", 1)),
+		}}),
+		partition("b", &fakeReplica{events: []zoekt.SearchResult{
+			event(3, 2, scored("b1", 5)),
+			event(2, 1, scored("b2", 20)),
+		}}),
+	}, Options{})
+
+	res, err := s.Search(context.Background(), &query.Const{Value: true}, &zoekt.SearchOptions{MaxDocDisplayCount: 3})
+	if err != nil {
+		t.Fatal(err)
+	}
+	if got, want := fileNames(res), []string{"b2", "a1", "b1"}; !reflect.DeepEqual(got, want) {
+		t.Errorf("got %v, want %v", got, want)
+	}
+	if res.Stats.MatchCount != 4 {
+		t.Errorf("got MatchCount %d, want 4", res.Stats.MatchCount)
+	}
+}
+
+func TestStreamSearchProgress(t *testing.T) {
+	slow := &fakeReplica{
+		events: []zoekt.SearchResult{event(5, 3, scored("b1", 1))},
+		delay:  50 * time.Millisecond,
+	}
+	s := NewSearcher([]Partition{
+		partition("a", &fakeReplica{events: []zoekt.SearchResult{
+			event(4, 2, scored("a1", 1)),
+			event(2, math.Inf(-1), scored("a2", 1)),
+		}}),
+		partition("b", slow),
+	}, Options{})
+
+	var mu sync.Mutex
+	got := map[string]float64{}
+	err := s.StreamSearch(context.Background(), &query.Const{Value: true}, nil, stream.SenderFunc(func(r *zoekt.SearchResult) {
+		mu.Lock()
+		defer mu.Unlock()
+		for _, f := range r.Files {
+			got[f.FileName] = r.Progress.MaxPendingPriority
+		}
+	}))
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	// b hasn't reported while a streams, so anything may be pending.
+	// When b reports, a is done.
+	want := map[string]float64{"a1": math.Inf(1), "a2": math.Inf(1), "b1": 3}
+	if !reflect.DeepEqual(got, want) {
+		t.Errorf("got MaxPendingPriority %v, want %v", got, want)
+	}
+}
+
+func TestStreamSearchMaxDocDisplayCount(t *testing.T) {
+	s := NewSearcher([]Partition{
+		partition("a", &fakeReplica{events: []zoekt.SearchResult{
+			event(1, 0, scored("a1", 10), scored("a2", 5)),
+		}}),
+		partition("b", &fakeReplica{
+			events: []zoekt.SearchResult{event(1, 0, scored("b1", 4), scored("b2", 11))},
+			delay:  20 * time.Millisecond,
+		}),
+	}, Options{})
+
+	var got []string
+	err := s.StreamSearch(context.Background(), &query.Const{Value: true}, &zoekt.SearchOptions{MaxDocDisplayCount: 2}, stream.SenderFunc(func(r *zoekt.SearchResult) {
+		got = append(got, fileNames(r)...)
+	}))
+	if err != nil {
+		t.Fatal(err)
+	}
+	// b1 scores below the two files sent before it.
+	if want := []string{"a1", "a2", "b2"}; !reflect.DeepEqual(got, want) {
+		t.Errorf("got %v, want %v", got, want)
+	}
+}
+
+func TestTotalMaxMatchCount(t *testing.T) {
+	blocked := &fakeReplica{block: true}
+	s := NewSearcher([]Partition{
+		partition("a", &fakeReplica{events: []zoekt.SearchResult{
+			event(1, 0, files("a1", "a2", "a3")...),
+		}}),
+		partition("b", blocked),
+	}, Options{})
+
+	res, err := s.Search(context.Background(), &query.Const{Value: true}, &zoekt.SearchOptions{TotalMaxMatchCount: 2})
+	if err != nil {
+		t.Fatal(err)
+	}
+	if len(res.Files) != 3 {
+		t.Errorf("got %d files, want 3", len(res.Files))
+	}
+	if blocked.canceledSearches() != 1 {
+		t.Errorf("the blocked partition was not canceled")
+	}
+}
+
+func TestFailover(t *testing.T) {
+	broken := &fakeReplica{err: errors.New("broken")}
+	s := NewSearcher([]Partition{
+		partition("a", broken, &fakeReplica{
+			events: []zoekt.SearchResult{event(1, 0, files("a1")...)},
+			repos:  []string{"r"},
+		}),
+	}, Options{})
+
+	res, err := s.Search(context.Background(), &query.Const{Value: true}, nil)
+	if err != nil {
+		t.Fatal(err)
+	}
+	if got := fileNames(res); !reflect.DeepEqual(got, []string{"a1"}) {
+		t.Errorf("got %v, want the files of the second replica", got)
+	}
+
+	rl, err := s.List(context.Background(), &query.Const{Value: true}, nil)
+	if err != nil {
+		t.Fatal(err)
+	}
+	if len(rl.Repos) != 1 {
+		t.Errorf("got %d repos, want 1", len(rl.Repos))
+	}
+
+	s = NewSearcher([]Partition{partition("a", broken, broken)}, Options{})
+	if _, err := s.Search(context.Background(), &query.Const{Value: true}, nil); err == nil {
+		t.Error("got no error with all replicas broken")
+	}
+}
+
+func TestHedge(t *testing.T) {
+	slow := &fakeReplica{
+		events: []zoekt.SearchResult{event(1, 0, files("slow")...)},
+		delay:  time.Minute,
+	}
+	fast := &fakeReplica{events: []zoekt.SearchResult{event(1, 0, files("fast")...)}}
+	s := NewSearcher([]Partition{partition("a", slow, fast)}, Options{HedgeDelay: 10 * time.Millisecond})
+
+	res, err := s.Search(context.Background(), &query.Const{Value: true}, nil)
+	if err != nil {
+		t.Fatal(err)
+	}
+	if got := fileNames(res); !reflect.DeepEqual(got, []string{"fast"}) {
+		t.Errorf("got %v, want the hedged replica's files", got)
+	}
+
+	// Give the canceled replica time to notice.
+	for i := 0; i < 100; i++ {
+		if slow.canceledSearches() == 1 {
+			return
+		}
+		time.Sleep(time.Millisecond)
+	}
+	t.Error("the slow replica was not canceled")
+}
+
+func TestPartitionTimeout(t *testing.T) {
+	s := NewSearcher([]Partition{
+		partition("a", &fakeReplica{events: []zoekt.SearchResult{event(1, 0, files("a1")...)}}),
+		partition("b", &fakeReplica{
+			events: []zoekt.SearchResult{event(1, 0, files("b1")...)},
+			block:  true,
+		}),
+	}, Options{PartitionTimeout: 10 * time.Millisecond})
+
+	res, err := s.Search(context.Background(), &query.Const{Value: true}, nil)
+	if err != nil {
+		t.Fatal(err)
+	}
+	got := fileNames(res)
+	sort.Strings(got)
+	if want := []string{"a1", "b1"}; !reflect.DeepEqual(got, want) {
+		t.Errorf("got %v, want %v", got, want)
+	}
+	if res.Stats.Crashes != 1 {
+		t.Errorf("got %d crashes, want 1 for the timed out partition", res.Stats.Crashes)
+	}
+}
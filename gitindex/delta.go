@@ -0,0 +1,94 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package gitindex
+
+import (
+	"sort"
+	"strings"
+
+	"github.com/google/zoekt/build"
+
+	"github.com/go-git/go-git/v5/plumbing"
+
+	git "github.com/go-git/go-git/v5"
+)
+
+// deltaFiles compares the files to index, given as fileKey =>
+// branches, with those of the commits in the index on disk. It
+// returns the names of the files that are new or changed on any
+// branch, and of those that no longer exist.
+func deltaFiles(repo *git.Repository, opts *build.Options, branchMap map[fileKey][]string, repoCache *RepoCache) (map[string]struct{}, []string, error) {
+	prev, err := opts.DeltaBase()
+	if err != nil {
+		return nil, nil, err
+	}
+
+	prevBranchMap := map[fileKey][]string{}
+	for _, b := range prev.Branches {
+		commit, err := repo.CommitObject(plumbing.NewHash(b.Version))
+		if err != nil {
+			return nil, nil, err
+		}
+		files, _, err := commitFiles(repo, commit, opts.RepositoryDescription.URL, repoCache)
+		if err != nil {
+			return nil, nil, err
+		}
+		for k := range files {
+			prevBranchMap[k] = append(prevBranchMap[k], b.Name)
+		}
+	}
+
+	changed, deleted := diffFileVersions(prevBranchMap, branchMap)
+	return changed, deleted, nil
+}
+
+// diffFileVersions returns the names of the files whose blobs differ
+// on any branch between prev and cur, and those only in prev.
+func diffFileVersions(prev, cur map[fileKey][]string) (map[string]struct{}, []string) {
+	prevVersions := fileVersions(prev)
+	changed := map[string]struct{}{}
+	for name, v := range fileVersions(cur) {
+		if prevVersions[name] != v {
+			changed[name] = struct{}{}
+		}
+		delete(prevVersions, name)
+	}
+
+	var deleted []string
+	for name := range prevVersions {
+		deleted = append(deleted, name)
+	}
+	sort.Strings(deleted)
+	return changed, deleted
+}
+
+// fileVersions summarizes fileKey => branches as file name => the
+// blob on each branch.
+func fileVersions(branchMap map[fileKey][]string) map[string]string {
+	versions := map[string][]string{}
+	for k, branches := range branchMap {
+		name := k.FullPath()
+		for _, b := range branches {
+			versions[name] = append(versions[name], b+":"+k.ID.String())
+		}
+	}
+
+	result := make(map[string]string, len(versions))
+	for name, vs := range versions {
+		sort.Strings(vs)
+		result[name] = strings.Join(vs, ",")
+	}
+	return result
+}
@@ -0,0 +1,52 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package gitindex
+
+import (
+	"reflect"
+	"testing"
+
+	"github.com/go-git/go-git/v5/plumbing"
+)
+
+func TestDiffFileVersions(t *testing.T) {
+	blob := func(s string) plumbing.Hash {
+		return plumbing.ComputeHash(plumbing.BlobObject, []byte(s))
+	}
+	prev := map[fileKey][]string{
+		{Path: "same", ID: blob("1")}:                     {"main", "dev"},
+		{Path: "edited", ID: blob("2")}:                   {"main"},
+		{Path: "branched", ID: blob("3")}:                 {"main", "dev"},
+		{Path: "gone", ID: blob("4")}:                     {"main"},
+		{SubRepoPath: "sub", Path: "file", ID: blob("5")}: {"main"},
+	}
+	cur := map[fileKey][]string{
+		{Path: "same", ID: blob("1")}:                     {"dev", "main"},
+		{Path: "edited", ID: blob("2b")}:                  {"main"},
+		{Path: "branched", ID: blob("3")}:                 {"main"},
+		{Path: "branched", ID: blob("3b")}:                {"dev"},
+		{Path: "new", ID: blob("6")}:                      {"main"},
+		{SubRepoPath: "sub", Path: "file", ID: blob("5")}: {"main"},
+	}
+
+	changed, deleted := diffFileVersions(prev, cur)
+	wantChanged := map[string]struct{}{"edited": {}, "branched": {}, "new": {}}
+	if !reflect.DeepEqual(changed, wantChanged) {
+		t.Errorf("got changed %v, want %v", changed, wantChanged)
+	}
+	if want := []string{"gone"}; !reflect.DeepEqual(deleted, want) {
+		t.Errorf("got deleted %v, want %v", deleted, want)
+	}
+}
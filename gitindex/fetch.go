@@ -0,0 +1,192 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package gitindex
+
+import (
+	"fmt"
+	"sync"
+
+	"github.com/google/zoekt"
+	"github.com/google/zoekt/build"
+
+	git "github.com/go-git/go-git/v5"
+	"github.com/go-git/go-git/v5/storage/filesystem"
+)
+
+// blobSource reads blobs for one fetch worker. It has its own
+// repository handles, as go-git repositories share packfile state
+// and can't be used from several goroutines.
+type blobSource struct {
+	repoDir string
+	repo    *git.Repository
+	cache   *RepoCache
+
+	// repos holds the handles opened by directory, for the
+	// repositories that have no URL.
+	repos map[string]*git.Repository
+}
+
+func newBlobSource(repoDir, repoCacheDir string) *blobSource {
+	return &blobSource{
+		repoDir: repoDir,
+		cache:   NewRepoCache(repoCacheDir),
+		repos:   map[string]*git.Repository{},
+	}
+}
+
+// open returns this source's handle for the repository holding key.
+func (s *blobSource) open(key fileKey, loc BlobLocation) (*git.Repository, error) {
+	if key.SubRepoPath == "" {
+		if s.repo == nil {
+			repo, err := git.PlainOpen(s.repoDir)
+			if err != nil {
+				return nil, err
+			}
+			s.repo = repo
+		}
+		return s.repo, nil
+	}
+	if loc.URL != nil {
+		return s.cache.Open(loc.URL)
+	}
+
+	// Without a URL, reopen the directory loc.Repo is stored in.
+	st, ok := loc.Repo.Storer.(*filesystem.Storage)
+	if !ok {
+		return nil, fmt.Errorf("submodule %s: no URL or directory to open it from", key.SubRepoPath)
+	}
+	dir := st.Filesystem().Root()
+	if repo := s.repos[dir]; repo != nil {
+		return repo, nil
+	}
+	repo, err := git.PlainOpen(dir)
+	if err != nil {
+		return nil, err
+	}
+	s.repos[dir] = repo
+	return repo, nil
+}
+
+// document reads the blob for key into a document. Blobs over the
+// size limit are skipped by their size alone, without inflating
+// them.
+func (s *blobSource) document(opts *build.Options, key fileKey, loc BlobLocation, branches []string) (zoekt.Document, error) {
+	repo, err := s.open(key, loc)
+	if err != nil {
+		return zoekt.Document{}, err
+	}
+	blob, err := repo.BlobObject(key.ID)
+	if err != nil {
+		return zoekt.Document{}, err
+	}
+
+	if blob.Size > int64(opts.SizeMax) && !opts.IgnoreSizeMax(key.FullPath()) {
+		return zoekt.Document{
+			SkipReason:        fmt.Sprintf("file size %d exceeds maximum size %d", blob.Size, opts.SizeMax),
+			Name:              key.FullPath(),
+			Branches:          branches,
+			SubRepositoryPath: key.SubRepoPath,
+		}, nil
+	}
+
+	contents, err := blobContents(blob)
+	if err != nil {
+		return zoekt.Document{}, err
+	}
+	return zoekt.Document{
+		SubRepositoryPath: key.SubRepoPath,
+		Name:              key.FullPath(),
+		Content:           contents,
+		Branches:          branches,
+	}, nil
+}
+
+// fetchWindow returns how many documents may be fetched ahead of the
+// builder. Each document holds at most SizeMax bytes of content, so
+// this keeps the buffered content within about one shard. Files
+// exempt from SizeMax can exceed it.
+func fetchWindow(opts *build.Options, workers int) int {
+	window := workers
+	if opts.SizeMax > 0 {
+		if w := opts.ShardMax / opts.SizeMax; w > window {
+			window = w
+		}
+	}
+	return window
+}
+
+// fetchInOrder calls fetch for 0..n-1 on the given number of workers,
+// and add with the results in order. At most window results are
+// fetched but not yet added. It stops at the first error.
+func fetchInOrder(n, workers, window int, fetch func(worker, i int) (zoekt.Document, error), add func(zoekt.Document) error) error {
+	if window < 1 {
+		window = 1
+	}
+	type result struct {
+		doc zoekt.Document
+		err error
+	}
+
+	// Document i goes into slot i%window. It is only fetched after
+	// document i-window was added, so each slot holds at most one
+	// result.
+	slots := make([]chan result, window)
+	for i := range slots {
+		slots[i] = make(chan result, 1)
+	}
+	tokens := make(chan struct{}, window)
+	jobs := make(chan int)
+	done := make(chan struct{})
+
+	var wg sync.WaitGroup
+	for w := 0; w < workers; w++ {
+		wg.Add(1)
+		go func(w int) {
+			defer wg.Done()
+			for i := range jobs {
+				doc, err := fetch(w, i)
+				slots[i%window] <- result{doc, err}
+			}
+		}(w)
+	}
+
+	go func() {
+		defer close(jobs)
+		for i := 0; i < n; i++ {
+			select {
+			case tokens <- struct{}{}:
+			case <-done:
+				return
+			}
+			select {
+			case jobs <- i:
+			case <-done:
+				return
+			}
+		}
+	}()
+
+	var err error
+	for i := 0; i < n && err == nil; i++ {
+		r := <-slots[i%window]
+		if err = r.err; err == nil {
+			err = add(r.doc)
+		}
+		<-tokens
+	}
+	close(done)
+	wg.Wait()
+	return err
+}
@@ -0,0 +1,129 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package gitindex
+
+import (
+	"errors"
+	"fmt"
+	"path/filepath"
+	"sync/atomic"
+	"testing"
+
+	"github.com/google/zoekt"
+	"github.com/google/zoekt/build"
+
+	git "github.com/go-git/go-git/v5"
+)
+
+func TestFetchInOrder(t *testing.T) {
+	const n, workers, window = 100, 4, 6
+
+	var pending, maxPending int64
+	var got []string
+	fetch := func(worker, i int) (zoekt.Document, error) {
+		p := atomic.AddInt64(&pending, 1)
+		for {
+			m := atomic.LoadInt64(&maxPending)
+			if p <= m || atomic.CompareAndSwapInt64(&maxPending, m, p) {
+				break
+			}
+		}
+		return zoekt.Document{Name: fmt.Sprint(i)}, nil
+	}
+	add := func(doc zoekt.Document) error {
+		atomic.AddInt64(&pending, -1)
+		got = append(got, doc.Name)
+		return nil
+	}
+	if err := fetchInOrder(n, workers, window, fetch, add); err != nil {
+		t.Fatal(err)
+	}
+
+	if len(got) != n {
+		t.Fatalf("got %d documents, want %d", len(got), n)
+	}
+	for i, name := range got {
+		if name != fmt.Sprint(i) {
+			t.Fatalf("document %d is %q, want in order", i, name)
+		}
+	}
+	if maxPending > window {
+		t.Errorf("%d documents pending, want at most %d", maxPending, window)
+	}
+}
+
+func TestFetchInOrderError(t *testing.T) {
+	want := errors.New("fetch failed")
+	fetch := func(worker, i int) (zoekt.Document, error) {
+		if i == 10 {
+			return zoekt.Document{}, want
+		}
+		return zoekt.Document{}, nil
+	}
+	added := 0
+	add := func(zoekt.Document) error {
+		added++
+		return nil
+	}
+	if err := fetchInOrder(1000, 4, 8, fetch, add); err != want {
+		t.Fatalf("got error %v, want %v", err, want)
+	}
+	if added != 10 {
+		t.Errorf("added %d documents before the error, want 10", added)
+	}
+}
+
+func TestBlobSourceOpensOwnHandle(t *testing.T) {
+	dir := t.TempDir()
+	if err := createSubmoduleRepo(dir); err != nil {
+		t.Fatalf("createSubmoduleRepo: %v", err)
+	}
+
+	shared, err := git.PlainOpen(filepath.Join(dir, "gerrit.googlesource.com", "bdir.git"))
+	if err != nil {
+		t.Fatal(err)
+	}
+	head, err := shared.Head()
+	if err != nil {
+		t.Fatal(err)
+	}
+	commit, err := shared.CommitObject(head.Hash())
+	if err != nil {
+		t.Fatal(err)
+	}
+	f, err := commit.File("bfile")
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	s := newBlobSource(filepath.Join(dir, "gerrit.googlesource.com", "adir.git"), dir)
+	key := fileKey{SubRepoPath: "bname", Path: "bfile", ID: f.Hash}
+	loc := BlobLocation{Repo: shared}
+	repo, err := s.open(key, loc)
+	if err != nil {
+		t.Fatalf("open: %v", err)
+	}
+	if repo == shared {
+		t.Error("open returned the shared handle of a repository without a URL")
+	}
+
+	doc, err := s.document(&build.Options{SizeMax: 1 << 20}, key, loc, []string{"master"})
+	if err != nil {
+		t.Fatalf("document: %v", err)
+	}
+	if got, want := string(doc.Content), "bcont\n"; got != want {
+		t.Errorf("got content %q, want %q", got, want)
+	}
+}
@@ -394,24 +394,11 @@ func IndexGitRepo(opts Options) error {
 			Version: commit.Hash.String(),
 		})
 
-		tree, err := commit.Tree()
-		if err != nil {
-			return err
-		}
-
-		ig, err := newIgnoreMatcher(tree)
-		if err != nil {
-			return err
-		}
-
-		files, subVersions, err := TreeToFiles(repo, tree, opts.BuildOptions.RepositoryDescription.URL, repoCache)
+		files, subVersions, err := commitFiles(repo, commit, opts.BuildOptions.RepositoryDescription.URL, repoCache)
 		if err != nil {
 			return err
 		}
 		for k, v := range files {
-			if ig.Match(k.Path) {
-				continue
-			}
 			repos[k] = v
 			branchMap[k] = append(branchMap[k], b)
 		}
@@ -423,6 +410,17 @@ func IndexGitRepo(opts Options) error {
 		return nil
 	}
 
+	// changed is nil for a full build.
+	var changed map[string]struct{}
+	var deleted []string
+	if opts.BuildOptions.IsDelta {
+		changed, deleted, err = deltaFiles(repo, &opts.BuildOptions, branchMap, repoCache)
+		if err != nil {
+			log.Printf("delta build of %s not possible, doing a full build: %v", opts.RepoDir, err)
+			opts.BuildOptions.IsDelta = false
+		}
+	}
+
 	reposByPath := map[string]BlobLocation{}
 	for key, location := range repos {
 		reposByPath[key.SubRepoPath] = location
@@ -455,10 +453,17 @@ func IndexGitRepo(opts Options) error {
 	}
 	defer builder.Finish()
 
+	for _, name := range deleted {
+		builder.MarkFileDeleted(name)
+	}
+
 	var names []string
 	fileKeys := map[string][]fileKey{}
 	for key := range repos {
 		n := key.FullPath()
+		if _, ok := changed[n]; changed != nil && !ok {
+			continue
+		}
 		fileKeys[n] = append(fileKeys[n], key)
 		names = append(names, n)
 	}
@@ -466,43 +471,56 @@ func IndexGitRepo(opts Options) error {
 	sort.Strings(names)
 	names = uniq(names)
 
+	var keys []fileKey
 	for _, name := range names {
-		keys := fileKeys[name]
+		keys = append(keys, fileKeys[name]...)
+	}
 
-		for _, key := range keys {
-			brs := branchMap[key]
-			blob, err := repos[key].Repo.BlobObject(key.ID)
-			if err != nil {
-				return err
-			}
+	// go-git repositories can't be read concurrently, so each worker
+	// opens its own.
+	workers := opts.BuildOptions.Parallelism
+	if workers < 1 {
+		workers = 1
+	}
+	sources := make([]*blobSource, workers)
+	for i := range sources {
+		sources[i] = newBlobSource(opts.RepoDir, opts.RepoCacheDir)
+	}
 
-			if blob.Size > int64(opts.BuildOptions.SizeMax) && !opts.BuildOptions.IgnoreSizeMax(key.FullPath()) {
-				if err := builder.Add(zoekt.Document{
-					SkipReason:        fmt.Sprintf("file size %d exceeds maximum size %d", blob.Size, opts.BuildOptions.SizeMax),
-					Name:              key.FullPath(),
-					Branches:          brs,
-					SubRepositoryPath: key.SubRepoPath,
-				}); err != nil {
-					return err
-				}
-				continue
-			}
+	fetch := func(worker, i int) (zoekt.Document, error) {
+		key := keys[i]
+		return sources[worker].document(&opts.BuildOptions, key, repos[key], branchMap[key])
+	}
+	if err := fetchInOrder(len(keys), workers, fetchWindow(&opts.BuildOptions, workers), fetch, builder.Add); err != nil {
+		return err
+	}
+	return builder.Finish()
+}
 
-			contents, err := blobContents(blob)
-			if err != nil {
-				return err
-			}
-			if err := builder.Add(zoekt.Document{
-				SubRepositoryPath: key.SubRepoPath,
-				Name:              key.FullPath(),
-				Content:           contents,
-				Branches:          brs,
-			}); err != nil {
-				return err
-			}
+// commitFiles returns the files to index from a commit, i.e. those
+// not excluded by its ignore file, and the versions of its
+// submodules.
+func commitFiles(repo *git.Repository, commit *object.Commit, repoURL string, repoCache *RepoCache) (map[fileKey]BlobLocation, map[string]plumbing.Hash, error) {
+	tree, err := commit.Tree()
+	if err != nil {
+		return nil, nil, err
+	}
+
+	ig, err := newIgnoreMatcher(tree)
+	if err != nil {
+		return nil, nil, err
+	}
+
+	files, subVersions, err := TreeToFiles(repo, tree, repoURL, repoCache)
+	if err != nil {
+		return nil, nil, err
+	}
+	for k := range files {
+		if ig.Match(k.Path) {
+			delete(files, k)
 		}
 	}
-	return builder.Finish()
+	return files, subVersions, nil
 }
 
 func newIgnoreMatcher(tree *object.Tree) (*ignore.Matcher, error) {
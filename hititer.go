@@ -17,6 +17,7 @@ package zoekt
 import (
 	"encoding/binary"
 	"fmt"
+	"sort"
 )
 
 // hitIterator finds potential search matches, measured in offsets of
@@ -118,9 +119,9 @@ func (d *indexData) trigramHitIterator(ng ngram, caseSensitive, fileName bool) (
 	iters := make([]hitIterator, 0, len(variants))
 	for _, v := range variants {
 		if fileName {
-			blob := d.fileNameNgrams[v]
+			blob := d.fileNameNgrams.Get(v)
 			if len(blob) > 0 {
-				iters = append(iters, newCompressedPostingIterator(blob, v))
+				iters = append(iters, d.newPostingIterator(blob, v))
 			}
 			continue
 		}
@@ -131,7 +132,7 @@ func (d *indexData) trigramHitIterator(ng ngram, caseSensitive, fileName bool) (
 			return nil, err
 		}
 		if len(blob) > 0 {
-			iters = append(iters, newCompressedPostingIterator(blob, v))
+			iters = append(iters, d.newPostingIterator(blob, v))
 		}
 	}
 
@@ -221,6 +222,254 @@ func (i *compressedPostingIterator) updateStats(s *Stats) {
 	s.IndexBytesLoaded += int64(len(i.orig) - len(i.blob))
 }
 
+// newPostingIterator returns an iterator for a posting list in the
+// encoding of the shard's format version.
+func (d *indexData) newPostingIterator(b []byte, w ngram) hitIterator {
+	if d.metaData.IndexFormatVersion >= NextIndexFormatVersion {
+		return newBlockPostingIterator(b, w, d.postingEncoding)
+	}
+	return newCompressedPostingIterator(b, w)
+}
+
+// postingSkipTable is the skip table of a posting list written by
+// encodePostingBlocks.
+type postingSkipTable struct {
+	// skips holds (first posting, data offset) pairs, one per block.
+	skips  []byte
+	data   []byte
+	count  int
+	blocks int
+}
+
+func (t *postingSkipTable) blockFirst(j int) uint32 {
+	return binary.BigEndian.Uint32(t.skips[8*j:])
+}
+
+func (t *postingSkipTable) blockData(j int) []byte {
+	start := binary.BigEndian.Uint32(t.skips[8*j+4:])
+	end := uint32(len(t.data))
+	if j+1 < t.blocks {
+		end = binary.BigEndian.Uint32(t.skips[8*(j+1)+4:])
+	}
+	return t.data[start:end]
+}
+
+// nextFirst returns the first posting of the block after block j, or
+// maxUInt32 if j is the last block.
+func (t *postingSkipTable) nextFirst(j int) uint32 {
+	if j+1 >= t.blocks {
+		return maxUInt32
+	}
+	return t.blockFirst(j + 1)
+}
+
+// seek returns the last block after block j that starts at or before
+// limit. The blocks in between are skipped without decoding them. The
+// block after j must start at or before limit.
+func (t *postingSkipTable) seek(j int, limit uint32) int {
+	k := j + 2
+	return k - 1 + sort.Search(t.blocks-k, func(n int) bool {
+		return t.blockFirst(k+n) > limit
+	})
+}
+
+// newBlockPostingIterator returns an iterator for a blocked posting
+// list. Lists that fit in a single block have no skip table, so they
+// are iterated by compressedPostingIterator.
+func newBlockPostingIterator(b []byte, w ngram, enc postingEncoding) hitIterator {
+	count, sz := binary.Uvarint(b)
+	b = b[sz:]
+	if count <= postingBlockSize {
+		return newCompressedPostingIterator(b, w)
+	}
+
+	blocks := int((count + postingBlockSize - 1) / postingBlockSize)
+	t := postingSkipTable{
+		skips:  b[:8*blocks],
+		data:   b[8*blocks:],
+		count:  int(count),
+		blocks: blocks,
+	}
+
+	if enc == postingEncodingPFOR {
+		i := &pforPostingIterator{
+			postingSkipTable: t,
+			buf:              make([]uint32, 0, postingBlockSize),
+			what:             w,
+			bytesRead:        int64(sz),
+		}
+		i.loadBlock(0)
+		return i
+	}
+
+	i := &blockPostingIterator{
+		postingSkipTable: t,
+		what:             w,
+		bytesRead:        int64(sz),
+	}
+	i.loadBlock(0)
+	return i
+}
+
+// blockPostingIterator goes over a blocked posting list with varint
+// encoded blocks.
+type blockPostingIterator struct {
+	postingSkipTable
+
+	// block is the index of the block that blob belongs to.
+	block int
+	// blob holds the undecoded deltas of the current block.
+	blob []byte
+	// nextBlockFirst is the first posting of the next block.
+	nextBlockFirst uint32
+	_first         uint32
+	what           ngram
+
+	bytesRead int64
+}
+
+func (i *blockPostingIterator) String() string {
+	return fmt.Sprintf("blocked(%s, %d, block %d/%d)", i.what, i._first, i.block, i.blocks)
+}
+
+// loadBlock positions the iterator at the first posting of block j.
+func (i *blockPostingIterator) loadBlock(j int) {
+	i.block = j
+	i.blob = i.blockData(j)
+	i._first = i.blockFirst(j)
+	i.nextBlockFirst = i.nextFirst(j)
+	i.bytesRead += 8
+}
+
+func (i *blockPostingIterator) first() uint32 {
+	return i._first
+}
+
+func (i *blockPostingIterator) next(limit uint32) {
+	if limit == maxUInt32 {
+		i.blob = nil
+		i.block = i.blocks
+		i._first = maxUInt32
+		return
+	}
+	if i._first > limit {
+		return
+	}
+
+	if i.nextBlockFirst <= limit {
+		i.loadBlock(i.seek(i.block, limit))
+	}
+
+	for {
+		for i._first <= limit && len(i.blob) > 0 {
+			delta, sz := binary.Uvarint(i.blob)
+			i._first += uint32(delta)
+			i.blob = i.blob[sz:]
+			i.bytesRead += int64(sz)
+		}
+		if i._first > limit {
+			return
+		}
+		if i.block+1 >= i.blocks {
+			i._first = maxUInt32
+			return
+		}
+		i.loadBlock(i.block + 1)
+	}
+}
+
+func (i *blockPostingIterator) updateStats(s *Stats) {
+	s.IndexBytesLoaded += i.bytesRead
+}
+
+// pforPostingIterator goes over a blocked posting list with bit-packed
+// blocks. Blocks are decoded as a whole into buf, which is reused
+// across blocks.
+type pforPostingIterator struct {
+	postingSkipTable
+
+	block int
+	// buf holds the postings of the current block, and buf[pos] is
+	// the current posting.
+	buf []uint32
+	pos int
+	// nextBlockFirst is the first posting of the next block.
+	nextBlockFirst uint32
+	_first         uint32
+	what           ngram
+
+	bytesRead int64
+}
+
+func (i *pforPostingIterator) String() string {
+	return fmt.Sprintf("pfor(%s, %d, block %d/%d)", i.what, i._first, i.block, i.blocks)
+}
+
+// loadBlock decodes block j and positions the iterator at its first
+// posting.
+func (i *pforPostingIterator) loadBlock(j int) {
+	n := postingBlockSize
+	if j == i.blocks-1 {
+		n = i.count - j*postingBlockSize
+	}
+
+	first := i.blockFirst(j)
+	buf := i.buf[:n]
+	buf[0] = first
+	i.bytesRead += 8 + int64(unpackPFOR(i.blockData(j), buf[1:]))
+	for k := 1; k < len(buf); k++ {
+		buf[k] += buf[k-1]
+	}
+
+	i.block = j
+	i.buf = buf
+	i.pos = 0
+	i.nextBlockFirst = i.nextFirst(j)
+	i._first = first
+}
+
+func (i *pforPostingIterator) first() uint32 {
+	return i._first
+}
+
+func (i *pforPostingIterator) next(limit uint32) {
+	if limit == maxUInt32 {
+		i.block = i.blocks
+		i.pos = len(i.buf)
+		i._first = maxUInt32
+		return
+	}
+	if i._first > limit {
+		return
+	}
+
+	if i.nextBlockFirst <= limit {
+		i.loadBlock(i.seek(i.block, limit))
+	}
+
+	for {
+		k := i.pos
+		for k < len(i.buf) && i.buf[k] <= limit {
+			k++
+		}
+		if k < len(i.buf) {
+			i.pos = k
+			i._first = i.buf[k]
+			return
+		}
+		if i.block+1 >= i.blocks {
+			i.pos = k
+			i._first = maxUInt32
+			return
+		}
+		i.loadBlock(i.block + 1)
+	}
+}
+
+func (i *pforPostingIterator) updateStats(s *Stats) {
+	s.IndexBytesLoaded += i.bytesRead
+}
+
 // mergingIterator forms the merge of a set of hitIterators, to
 // implement an OR operation at the hit level.
 type mergingIterator struct {
@@ -49,6 +49,63 @@ func TestCompressedPostingIterator_limit(t *testing.T) {
 	}
 }
 
+func TestBlockPostingIterator_limit(t *testing.T) {
+	for _, enc := range []postingEncoding{postingEncodingVarint, postingEncodingPFOR} {
+		f := func(seed int64, size uint16, nLimits uint8) bool {
+			// Span several blocks, with limits that land both inside
+			// and between postings.
+			r := rand.New(rand.NewSource(seed))
+			n := int(size%2000) + 1
+			nums := make([]uint32, n)
+			for i := range nums {
+				nums[i] = r.Uint32() % uint32(4*n)
+			}
+			limits := make([]uint32, int(nLimits)+1)
+			for i := range limits {
+				limits[i] = r.Uint32() % uint32(5*n)
+			}
+
+			nums = sortedUnique(nums)
+			sort.Slice(limits, func(i, j int) bool { return limits[i] < limits[j] })
+
+			want := doHitIterator(&inMemoryIterator{postings: nums}, limits)
+
+			it := newBlockPostingIterator(encodePostingBlocks(toDeltas(nums), enc), stringToNGram("abc"), enc)
+			got := doHitIterator(it, limits)
+			if !reflect.DeepEqual(want, got) {
+				t.Log(cmp.Diff(want, got))
+				return false
+			}
+			return true
+		}
+		if err := quick.Check(f, nil); err != nil {
+			t.Errorf("encoding %d: %v", enc, err)
+		}
+	}
+}
+
+func TestBlockPostingIterator_skipsBlocks(t *testing.T) {
+	nums := make([]uint32, 100*postingBlockSize)
+	for i := range nums {
+		nums[i] = uint32(i)
+	}
+	deltas := toDeltas(nums)
+
+	for _, enc := range []postingEncoding{postingEncodingVarint, postingEncodingPFOR} {
+		it := newBlockPostingIterator(encodePostingBlocks(deltas, enc), stringToNGram("abc"), enc)
+		it.next(uint32(len(nums) - 2))
+		if got, want := it.first(), uint32(len(nums)-1); got != want {
+			t.Fatalf("encoding %d: got %d, want %d", enc, got, want)
+		}
+
+		var s Stats
+		it.updateStats(&s)
+		if s.IndexBytesLoaded >= int64(len(deltas))/10 {
+			t.Errorf("encoding %d: loaded %d bytes of %d, want block skipping", enc, s.IndexBytesLoaded, len(deltas))
+		}
+	}
+}
+
 func doHitIterator(it hitIterator, limits []uint32) []uint32 {
 	var nums []uint32
 	for _, limit := range limits {
@@ -100,6 +157,51 @@ func benchmarkCompressedPostingIterator(b *testing.B, size, limitsSize int) {
 	}
 }
 
+func BenchmarkBlockPostingIterator(b *testing.B) {
+	cases := []struct{ size, limitSize int }{
+		{100, 50},
+		{10000, 100},
+		{10000, 1000},
+		{10000, 10000},
+		{100000, 100},
+		{100000, 1000},
+		{100000, 10000},
+		{100000, 100000},
+	}
+	for _, tt := range cases {
+		b.Run(fmt.Sprintf("varint_%d_%d", tt.size, tt.limitSize), func(b *testing.B) {
+			benchmarkBlockPostingIterator(b, tt.size, tt.limitSize, postingEncodingVarint)
+		})
+		b.Run(fmt.Sprintf("pfor_%d_%d", tt.size, tt.limitSize), func(b *testing.B) {
+			benchmarkBlockPostingIterator(b, tt.size, tt.limitSize, postingEncodingPFOR)
+		})
+	}
+}
+
+func benchmarkBlockPostingIterator(b *testing.B, size, limitsSize int, enc postingEncoding) {
+	nums := genUints32(size)
+	limits := genUints32(limitsSize)
+
+	nums = sortedUnique(nums)
+	sort.Slice(limits, func(i, j int) bool { return limits[i] < limits[j] })
+
+	ng := stringToNGram("abc")
+	blob := encodePostingBlocks(toDeltas(nums), enc)
+
+	b.ResetTimer()
+
+	for n := 0; n < b.N; n++ {
+		it := newBlockPostingIterator(blob, ng, enc)
+		for _, limit := range limits {
+			it.next(limit)
+			_ = it.first()
+		}
+		var s Stats
+		it.updateStats(&s)
+		b.SetBytes(s.IndexBytesLoaded)
+	}
+}
+
 func genUints32(size int) []uint32 {
 	// Deterministic for benchmarks
 	r := rand.New(rand.NewSource(int64(size)))
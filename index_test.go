@@ -210,7 +210,7 @@ func searchForTest(t *testing.T, b *IndexBuilder, q query.Q, o ...SearchOptions)
 	return res
 }
 
-func searcherForTest(t *testing.T, b *IndexBuilder) Searcher {
+func searcherForTest(t testing.TB, b *IndexBuilder) Searcher {
 	var buf bytes.Buffer
 	b.Write(&buf)
 	f := &memSeeker{buf.Bytes()}
@@ -307,16 +307,44 @@ func TestAndSearch(t *testing.T) {
 		FilesLoaded:        1,
 		ContentBytesLoaded: 17,
 		IndexBytesLoaded:   8,
-		NgramMatches:       3, // we look at doc 1, because it's max(0,1) due to AND
+		NgramMatches:       2, // doc 1 is skipped by the leapfrog intersection
 		MatchCount:         1,
 		FileCount:          1,
-		FilesConsidered:    2,
+		FilesConsidered:    1,
 	}
 	if diff := pretty.Compare(wantStats, sres.Stats); diff != "" {
 		t.Errorf("got stats diff %s", diff)
 	}
 }
 
+func TestAndSearchLeapfrog(t *testing.T) {
+	var docs []Document
+	for i := 0; i < 100; i++ {
+		// The dense and sparse terms are interleaved, so a lock-step
+		// intersection would consider every document.
+		content := "apple"
+		if i%10 == 0 {
+			content = "banana"
+		}
+		if i%50 == 49 {
+			content = "apple banana"
+		}
+		docs = append(docs, Document{Name: fmt.Sprintf("f%d", i), Content: []byte(content)})
+	}
+	b := testIndexBuilder(t, nil, docs...)
+
+	res := searchForTest(t, b, query.NewAnd(
+		&query.Substring{Pattern: "apple", Content: true},
+		&query.Substring{Pattern: "banana", Content: true},
+	))
+	if len(res.Files) != 2 {
+		t.Fatalf("got %v, want 2 files", res.Files)
+	}
+	if got, want := res.Stats.FilesConsidered, 2; got != want {
+		t.Errorf("got FilesConsidered %d, want %d", got, want)
+	}
+}
+
 func TestAndNegateSearch(t *testing.T) {
 	b, err := NewIndexBuilder(nil)
 	if err != nil {
@@ -605,6 +633,29 @@ func TestFileNameBoundary(t *testing.T) {
 	}
 }
 
+func TestMaxFileScore(t *testing.T) {
+	const rank = 1000
+	b := testIndexBuilder(t, &Repository{Name: "repo", Rank: rank},
+		Document{Name: "f1", Content: []byte("byte")},
+		Document{Name: "byte", Content: []byte("byte xbyte\nbyte")})
+
+	q := query.NewOr(
+		&query.Substring{Pattern: "byte"},
+		&query.Substring{Pattern: "byte", FileName: true})
+	res, err := searcherForTest(t, b).Search(context.Background(), q, &SearchOptions{})
+	if err != nil {
+		t.Fatal(err)
+	}
+	if len(res.Files) != 2 {
+		t.Fatalf("got %v, want 2 files", res.Files)
+	}
+	for _, f := range res.Files {
+		if max := MaxFileScore(rank); f.Score > max {
+			t.Errorf("%s: got score %f, want at most %f", f.FileName, f.Score, max)
+		}
+	}
+}
+
 func TestWordBoundaryRanking(t *testing.T) {
 	b := testIndexBuilder(t, nil,
 		Document{Name: "f1", Content: []byte("xbytex xbytex")},
@@ -1598,6 +1649,39 @@ func TestIOStats(t *testing.T) {
 	}
 }
 
+func TestIOStatsBlockedPostings(t *testing.T) {
+	var docs []Document
+	for i := 0; i < 2000; i++ {
+		docs = append(docs, Document{Name: fmt.Sprintf("f%d", i), Content: []byte("abc abc")})
+	}
+	docs = append(docs, Document{Name: "needle", Content: []byte("xyzabc")})
+
+	q := query.NewAnd(
+		&query.Substring{Pattern: "xyz", CaseSensitive: true, Content: true},
+		&query.Substring{Pattern: "abc", CaseSensitive: true, Content: true})
+
+	b := testIndexBuilder(t, nil, docs...)
+	b.indexFormatVersion = IndexFormatVersion
+	want := searchForTest(t, b, q)
+
+	for _, enc := range []postingEncoding{postingEncodingVarint, postingEncodingPFOR} {
+		b = testIndexBuilder(t, nil, docs...)
+		b.indexFormatVersion = NextIndexFormatVersion
+		b.postingEncoding = enc
+		got := searchForTest(t, b, q)
+
+		if len(got.Files) != 1 || got.Files[0].FileName != "needle" {
+			t.Fatalf("encoding %d: got %v, want match in needle", enc, got.Files)
+		}
+		if !reflect.DeepEqual(got.Files, want.Files) {
+			t.Errorf("encoding %d: got %v, want %v", enc, got.Files, want.Files)
+		}
+		if got.Stats.IndexBytesLoaded >= want.Stats.IndexBytesLoaded {
+			t.Errorf("encoding %d: got index I/O %d for blocked postings, want less than %d", enc, got.Stats.IndexBytesLoaded, want.Stats.IndexBytesLoaded)
+		}
+	}
+}
+
 func TestStartLineAnchor(t *testing.T) {
 	b := testIndexBuilder(t, nil,
 		Document{
@@ -2191,3 +2275,180 @@ func TestSearchTypeFileName(t *testing.T) {
 		})
 	wantSingleMatch(res, "f2")
 }
+
+func TestSearchParallel(t *testing.T) {
+	defer func(docs int) { parallelMinDocs = docs }(parallelMinDocs)
+	parallelMinDocs = 1
+
+	var docs []Document
+	for i := 0; i < 500; i++ {
+		content := fmt.Sprintf("doc %d apple", i)
+		if i%7 == 0 {
+			content += " banana"
+		}
+		if i%3 == 0 {
+			content = strings.Repeat(content+"\n", i%20+1)
+		}
+		docs = append(docs, Document{Name: fmt.Sprintf("f%d", i), Content: []byte(content)})
+	}
+	searcher := searcherForTest(t, testIndexBuilder(t, nil, docs...))
+
+	for _, q := range []query.Q{
+		&query.Substring{Pattern: "apple"},
+		query.NewAnd(&query.Substring{Pattern: "apple"}, &query.Substring{Pattern: "banana"}),
+		&query.Regexp{Regexp: mustParseRE("doc [0-9]*5 "), Content: true},
+		&query.Substring{Pattern: "f1", FileName: true},
+	} {
+		for _, opts := range []SearchOptions{
+			{},
+			{ShardMaxMatchCount: 30},
+			{ShardMaxImportantMatch: 3},
+			{Whole: true},
+		} {
+			want, err := searcher.Search(context.Background(), q, &opts)
+			if err != nil {
+				t.Fatal(err)
+			}
+
+			opts.ShardParallelism = 4
+			got, err := searcher.Search(context.Background(), q, &opts)
+			if err != nil {
+				t.Fatal(err)
+			}
+
+			if d := cmp.Diff(want.Files, got.Files); d != "" {
+				t.Errorf("%s %+v: parallel result differs (-want +got):\n%s", q, opts, d)
+			}
+			if want.Stats.MatchCount != got.Stats.MatchCount || want.Stats.FileCount != got.Stats.FileCount {
+				t.Errorf("%s %+v: got stats %+v, want %+v", q, opts, got.Stats, want.Stats)
+			}
+		}
+	}
+}
+
+func TestMaxDocDisplayCount(t *testing.T) {
+	defer func(docs int) { parallelMinDocs = docs }(parallelMinDocs)
+	parallelMinDocs = 1
+
+	var docs []Document
+	for i := 0; i < 500; i++ {
+		// Whole word matches score higher than the doc order,
+		// so the best files are spread over the shard.
+		content := fmt.Sprintf("doc %d pineapples\n", i)
+		if i%37 == 5 {
+			content += "an apple a day\n"
+		}
+		docs = append(docs, Document{Name: fmt.Sprintf("f%d", i), Content: []byte(content)})
+	}
+	searcher := searcherForTest(t, testIndexBuilder(t, nil, docs...))
+
+	const k = 5
+	for _, tc := range []struct {
+		q query.Q
+		// saves is set if the search loads less content for the
+		// top files.
+		saves bool
+	}{
+		{&query.Substring{Pattern: "apple"}, true},
+		{&query.Substring{Pattern: "f1", FileName: true}, false},
+		// Matches across lines only have a bound of their score,
+		// and the regexp loads all content it matches.
+		{&query.Regexp{Regexp: mustParseRE(`apples\nan`), Content: true}, false},
+	} {
+		q := tc.q
+		for _, opts := range []SearchOptions{{}, {Whole: true}, {ShardParallelism: 4}} {
+			want, err := searcher.Search(context.Background(), q, &opts)
+			if err != nil {
+				t.Fatal(err)
+			}
+
+			opts.MaxDocDisplayCount = k
+			got, err := searcher.Search(context.Background(), q, &opts)
+			if err != nil {
+				t.Fatal(err)
+			}
+
+			if d := cmp.Diff(want.Files[:k], got.Files); d != "" {
+				t.Errorf("%s %+v: top files differ (-want +got):\n%s", q, opts, d)
+			}
+			if got.Stats.FileCount != want.Stats.FileCount {
+				t.Errorf("%s %+v: got FileCount %d, want %d", q, opts, got.Stats.FileCount, want.Stats.FileCount)
+			}
+			if tc.saves && got.Stats.ContentBytesLoaded >= want.Stats.ContentBytesLoaded {
+				t.Errorf("%s %+v: loaded %d bytes of content, want less than %d", q, opts, got.Stats.ContentBytesLoaded, want.Stats.ContentBytesLoaded)
+			}
+		}
+	}
+}
+
+func BenchmarkSearch(b *testing.B) {
+	builder, err := NewIndexBuilder(nil)
+	if err != nil {
+		b.Fatal(err)
+	}
+	for i := 0; i < 1000; i++ {
+		var content strings.Builder
+		for j := 0; j < 20; j++ {
+			fmt.Fprintf(&content, "line %d of file %d calls needle(%d)\n", j, i, i*j)
+		}
+		if err := builder.Add(Document{Name: fmt.Sprintf("f%d.go", i), Content: []byte(content.String())}); err != nil {
+			b.Fatal(err)
+		}
+	}
+	var buf bytes.Buffer
+	builder.Write(&buf)
+	searcher, err := NewSearcher(&memSeeker{buf.Bytes()})
+	if err != nil {
+		b.Fatal(err)
+	}
+
+	for _, bm := range []struct {
+		name string
+		q    query.Q
+		opts SearchOptions
+	}{
+		{"substring", &query.Substring{Pattern: "needle", Content: true}, SearchOptions{}},
+		{"regexp", &query.Regexp{Regexp: mustParseRE("needle\\([0-9]+\\)"), Content: true}, SearchOptions{}},
+		{"and", query.NewAnd(&query.Substring{Pattern: "needle"}, &query.Substring{Pattern: "file 1"}), SearchOptions{}},
+		{"substring_top10", &query.Substring{Pattern: "needle", Content: true}, SearchOptions{MaxDocDisplayCount: 10}},
+	} {
+		b.Run(bm.name, func(b *testing.B) {
+			b.ReportAllocs()
+			for n := 0; n < b.N; n++ {
+				if _, err := searcher.Search(context.Background(), bm.q, &bm.opts); err != nil {
+					b.Fatal(err)
+				}
+			}
+		})
+	}
+}
+
+func TestNextLive(t *testing.T) {
+	d := &indexData{
+		fileBranchMasks: make([]uint64, 130),
+		tombstones:      make([]uint64, 3),
+	}
+	// Tombstone documents 1 and 3 to 128.
+	for i := 1; i <= 128; i++ {
+		if i != 2 {
+			d.tombstones[i/64] |= 1 << (i % 64)
+		}
+	}
+
+	for _, tc := range []struct{ idx, want uint32 }{
+		{0, 0},
+		{1, 2},
+		{2, 2},
+		{3, 129},
+		{64, 129},
+		{129, 129},
+		{130, 130},
+	} {
+		if got := d.nextLive(tc.idx); got != tc.want {
+			t.Errorf("nextLive(%d) = %d, want %d", tc.idx, got, tc.want)
+		}
+	}
+	if got, want := d.numLiveDocs(), 3; got != want {
+		t.Errorf("numLiveDocs = %d, want %d", got, want)
+	}
+}
@@ -21,6 +21,8 @@ import (
 	"hash/crc64"
 	"html/template"
 	"log"
+	"math"
+	"os"
 	"path/filepath"
 	"sort"
 	"unicode/utf8"
@@ -44,6 +46,11 @@ type postingsBuilder struct {
 	postings    map[ngram][]byte
 	lastOffsets map[ngram]uint32
 
+	// postingsSize estimates the memory used by postings. If spill is
+	// set, postings are written to disk when this exceeds its budget.
+	postingsSize int
+	spill        *postingSpill
+
 	// To support UTF-8 searching, we must map back runes to byte
 	// offsets. As a first attempt, we sample regularly. The
 	// precise offset can be found by walking from the recorded
@@ -115,7 +122,12 @@ func (s *postingsBuilder) newSearchableString(data []byte, byteSections []Docume
 		newOff := endRune + uint32(runeIndex) - 2
 
 		m := binary.PutUvarint(buf[:], uint64(newOff-lastOff))
-		s.postings[ng] = append(s.postings[ng], buf[:m]...)
+		p, ok := s.postings[ng]
+		if !ok {
+			s.postingsSize += postingEntryOverhead
+		}
+		s.postings[ng] = append(p, buf[:m]...)
+		s.postingsSize += m
 		s.lastOffsets[ng] = newOff
 	}
 	s.runeCount += runeIndex
@@ -142,6 +154,12 @@ func (s *postingsBuilder) newSearchableString(data []byte, byteSections []Docume
 
 	s.endRunes = append(s.endRunes, s.runeCount)
 	s.endByte += dataSz
+
+	if s.spill != nil && s.postingsSize > s.spill.budget {
+		if err := s.spillRun(); err != nil {
+			return nil, nil, err
+		}
+	}
 	return &dest, runeSecs, nil
 }
 
@@ -168,10 +186,15 @@ type IndexBuilder struct {
 	contentPostings *postingsBuilder
 	namePostings    *postingsBuilder
 
-	// root repository
-	repo Repository
+	// repoList holds the repositories of the shard. There is more
+	// than one for compound shards. Documents belong to the last
+	// repository set when they are added.
+	repoList []Repository
 
-	// name to index.
+	// repos holds the index in repoList of each document.
+	repos []uint16
+
+	// name to index, for the subrepositories of the last repository.
 	subRepoIndices map[string]uint32
 
 	// language => language code
@@ -179,6 +202,18 @@ type IndexBuilder struct {
 
 	// languages codes
 	languages []byte
+
+	// indexFormatVersion is the format version written by Write. It is
+	// either IndexFormatVersion or NextIndexFormatVersion.
+	indexFormatVersion int
+
+	// postingEncoding is the encoding of posting list blocks, if
+	// writing NextIndexFormatVersion.
+	postingEncoding postingEncoding
+
+	// contentEncoding is the encoding of the file contents, if
+	// writing NextIndexFormatVersion.
+	contentEncoding contentEncoding
 }
 
 func (d *Repository) verify() error {
@@ -200,6 +235,20 @@ func (b *IndexBuilder) ContentSize() uint32 {
 // NewIndexBuilder creates a fresh IndexBuilder. The passed in
 // Repository contains repo metadata, and may be set to nil.
 func NewIndexBuilder(r *Repository) (*IndexBuilder, error) {
+	b := newIndexBuilder()
+
+	if r == nil {
+		r = &Repository{}
+	}
+	if err := b.setRepository(r); err != nil {
+		return nil, err
+	}
+	return b, nil
+}
+
+// newIndexBuilder returns an IndexBuilder without a repository. One
+// must be set before adding documents.
+func newIndexBuilder() *IndexBuilder {
 	b := &IndexBuilder{
 		contentPostings: newPostingsBuilder(),
 		namePostings:    newPostingsBuilder(),
@@ -207,21 +256,44 @@ func NewIndexBuilder(r *Repository) (*IndexBuilder, error) {
 		symIndex:        make(map[string]uint32),
 		symKindIndex:    make(map[string]uint32),
 		languageMap:     map[string]byte{},
+
+		indexFormatVersion: IndexFormatVersion,
 	}
 
-	if r == nil {
-		r = &Repository{}
+	if os.Getenv("ZOEKT_ENABLE_NEXT_INDEX_FORMAT") != "" {
+		b.indexFormatVersion = NextIndexFormatVersion
 	}
-	if err := b.setRepository(r); err != nil {
-		return nil, err
+	if os.Getenv("ZOEKT_POSTING_ENCODING") == "pfor" {
+		b.postingEncoding = postingEncodingPFOR
 	}
-	return b, nil
+	if os.Getenv("ZOEKT_CONTENT_ENCODING") == "deflate" {
+		b.contentEncoding = contentEncodingDeflate
+	}
+	return b
 }
 
-func (b *IndexBuilder) setRepository(desc *Repository) error {
-	if len(b.contentStrings) > 0 {
-		return fmt.Errorf("setRepository called after adding files")
+// SpillPostings makes the builder write posting lists to temporary
+// files in dir whenever the ones in memory take more than budget
+// bytes, for the content and file names each. Write merges them back
+// into the same shard as without spilling.
+func (b *IndexBuilder) SpillPostings(dir string, budget int) {
+	b.contentPostings.spill = &postingSpill{dir: dir, budget: budget}
+	b.namePostings.spill = &postingSpill{dir: dir, budget: budget}
+}
+
+// Close removes the postings spilled to temporary files. Write removes
+// them as well, so Close is only needed if Write is not called.
+func (b *IndexBuilder) Close() {
+	for _, s := range []*postingsBuilder{b.contentPostings, b.namePostings} {
+		if s.spill != nil {
+			s.spill.remove()
+		}
 	}
+}
+
+// setRepository starts a new repository. Documents added afterwards
+// belong to it.
+func (b *IndexBuilder) setRepository(desc *Repository) error {
 	if err := desc.verify(); err != nil {
 		return err
 	}
@@ -238,20 +310,30 @@ func (b *IndexBuilder) setRepository(desc *Repository) error {
 	if len(desc.Branches) > 64 {
 		return fmt.Errorf("too many branches")
 	}
+	if len(b.repoList) > math.MaxUint16 {
+		return fmt.Errorf("too many repositories")
+	}
 
-	b.repo = *desc
+	repo := *desc
 	repoCopy := *desc
 	repoCopy.SubRepoMap = nil
 
-	if b.repo.SubRepoMap == nil {
-		b.repo.SubRepoMap = map[string]*Repository{}
+	if repo.SubRepoMap == nil {
+		repo.SubRepoMap = map[string]*Repository{}
 	}
-	b.repo.SubRepoMap[""] = &repoCopy
+	repo.SubRepoMap[""] = &repoCopy
+	b.repoList = append(b.repoList, repo)
 
+	b.subRepoIndices = nil
 	b.populateSubRepoIndices()
 	return nil
 }
 
+// repo returns the repository documents are added to.
+func (b *IndexBuilder) repo() *Repository {
+	return &b.repoList[len(b.repoList)-1]
+}
+
 type DocumentSection struct {
 	Start, End uint32
 }
@@ -337,7 +419,7 @@ func (b *IndexBuilder) populateSubRepoIndices() {
 		return
 	}
 	var paths []string
-	for k := range b.repo.SubRepoMap {
+	for k := range b.repo().SubRepoMap {
 		paths = append(paths, k)
 	}
 	sort.Strings(paths)
@@ -442,6 +524,7 @@ func (b *IndexBuilder) Add(doc Document) error {
 	}
 
 	b.subRepos = append(b.subRepos, subRepoIdx)
+	b.repos = append(b.repos, uint16(len(b.repoList)-1))
 
 	hasher.Write(doc.Content)
 
@@ -468,7 +551,7 @@ func (b *IndexBuilder) Add(doc Document) error {
 }
 
 func (b *IndexBuilder) branchMask(br string) uint64 {
-	for i, b := range b.repo.Branches {
+	for i, b := range b.repo().Branches {
 		if b.Name == br {
 			return uint64(1) << uint(i)
 		}
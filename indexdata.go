@@ -31,6 +31,9 @@ import (
 type indexData struct {
 	symbols symbolData
 
+	// symbolDict finds symbols by name, see newSymbolDictMatchTree.
+	symbolDict symbolDict
+
 	file IndexFile
 
 	ngrams arrayNgramOffset
@@ -38,6 +41,10 @@ type indexData struct {
 	newlinesStart uint32
 	newlinesIndex []uint32
 
+	// newlineCheckpointsIndex is empty for shards without checkpoints.
+	newlineCheckpointsStart uint32
+	newlineCheckpointsIndex []uint32
+
 	docSectionsStart uint32
 	docSectionsIndex []uint32
 
@@ -46,16 +53,40 @@ type indexData struct {
 	// rune offset=>byte offset mapping, relative to the start of the content corpus
 	runeOffsets runeOffsetMap
 
+	// contentStart is the offset of the file contents section in
+	// the index file.
+	contentStart uint32
+
 	// offsets of file contents; includes end of last file
-	boundariesStart uint32
-	boundaries      []uint32
+	boundaries []uint32
+
+	// contentEncoding is the encoding of the file contents. For
+	// compressed contents, boundaries are offsets into the
+	// uncompressed content, and contentBlocks are the offsets of the
+	// compressed blocks relative to contentStart, including the
+	// end of the last. Their decompressed blocks are cached in
+	// contentCache under contentCacheID.
+	contentEncoding contentEncoding
+	contentBlocks   []uint32
+	contentCacheID  uint64
 
 	// rune offsets for the file content boundaries
 	fileEndRunes []uint32
 
 	fileNameContent []byte
 	fileNameIndex   []uint32
-	fileNameNgrams  map[ngram][]byte
+	fileNameNgrams  sortedNgramPostings
+
+	// ngramFilter summarizes ngrams and fileNameNgrams.
+	ngramFilter *NgramFilter
+
+	// hotSections are the sections that searches read through the
+	// file, besides postings and content.
+	hotSections []simpleSection
+
+	// postingEncoding is the encoding of posting list blocks in
+	// NextIndexFormatVersion shards.
+	postingEncoding postingEncoding
 
 	// fileEndSymbol[i] is the index of the first symbol for document i.
 	fileEndSymbol []uint32
@@ -93,6 +124,14 @@ type indexData struct {
 
 	// repository indexes for all the files
 	repos []uint16
+
+	// tombstones is a bitmap of the documents named in their
+	// repository's FileTombstones. It is nil if there are none.
+	// Tombstoned documents are left out of searches and stats, but
+	// stay in the shard until the repository is fully rebuilt, which
+	// gitindex does once it has DeltaShardNumberFallbackThreshold
+	// shards, or the shard is merged into a compound shard.
+	tombstones []uint64
 }
 
 type symbolData struct {
@@ -152,6 +191,37 @@ func (d *symbolData) data(i uint32) *Symbol {
 	return sym
 }
 
+// tombstoned returns whether document idx was superseded by a delta
+// shard.
+func (d *indexData) tombstoned(idx uint32) bool {
+	return d.tombstones != nil && d.tombstones[idx/64]&(1<<(idx%64)) != 0
+}
+
+// nextLive returns the first document from idx on that isn't
+// tombstoned.
+func (d *indexData) nextLive(idx uint32) uint32 {
+	if d.tombstones == nil {
+		return idx
+	}
+	for int(idx/64) < len(d.tombstones) {
+		live := ^d.tombstones[idx/64] >> (idx % 64)
+		if live != 0 {
+			return idx + uint32(bits.TrailingZeros64(live))
+		}
+		idx += 64 - idx%64
+	}
+	return idx
+}
+
+// numLiveDocs returns the number of documents that aren't tombstoned.
+func (d *indexData) numLiveDocs() int {
+	n := len(d.fileBranchMasks)
+	for _, w := range d.tombstones {
+		n -= bits.OnesCount64(w)
+	}
+	return n
+}
+
 func (d *indexData) getChecksum(idx uint32) []byte {
 	start := crc64.Size * idx
 	return d.checksums[start : start+crc64.Size]
@@ -178,6 +248,18 @@ func (d *indexData) calculateStatsForFileRange(start, end uint32) RepoStats {
 
 	count, defaultCount, otherCount := d.calculateNewLinesStats(start, end)
 
+	documents := int(end - start)
+	contentBytes := int64(int(last) + int(lastFN))
+	if d.tombstones != nil {
+		for i := start; i < end; i++ {
+			if d.tombstoned(i) {
+				documents--
+				contentBytes -= int64(d.boundaries[i+1] - d.boundaries[i])
+				contentBytes -= int64(d.fileNameIndex[i+1] - d.fileNameIndex[i])
+			}
+		}
+	}
+
 	// CR keegan for stefan: I think we may want to restructure RepoListEntry so
 	// that we don't change anything, except we have
 	// []Repository. Alternatively, things we can divide up we do (like
@@ -190,8 +272,8 @@ func (d *indexData) calculateStatsForFileRange(start, end uint32) RepoStats {
 		// information, so it may surprise some admins that a small repo uses a
 		// lot of memory.
 		IndexBytes:   int64(d.memoryUse()),
-		ContentBytes: int64(int(last) + int(lastFN)),
-		Documents:    int(end - start),
+		ContentBytes: contentBytes,
+		Documents:    documents,
 		// CR keegan for stefan: our shard count is going to go out of whack,
 		// since we will aggregate these. So we will report more shards than are
 		// present on disk. What should we do?
@@ -235,6 +317,10 @@ func (d *indexData) calculateStats() error {
 // outside of load time introduces a lot of complexity.
 func (d *indexData) calculateNewLinesStats(start, end uint32) (count, defaultCount, otherCount uint64) {
 	for i := start; i < end; i++ {
+		if d.tombstoned(i) {
+			continue
+		}
+
 		// branchMask is a bitmask of the branches for a document. Zoekt by
 		// convention represents the default branch as the lowest bit.
 		branchMask := d.fileBranchMasks[i]
@@ -283,6 +369,7 @@ func (d *indexData) memoryUse() int {
 		d.boundaries, d.fileNameIndex,
 		d.fileEndRunes, d.fileNameEndRunes,
 		d.fileEndSymbol, d.symbols.symKindIndex,
+		d.symbolDict.namesIndex, d.symbolDict.postingsIndex,
 		d.subRepos,
 	} {
 		sz += 4 * len(a)
@@ -294,8 +381,10 @@ func (d *indexData) memoryUse() int {
 	sz += 2 * len(d.repos)
 	sz += 8 * len(d.runeDocSections)
 	sz += 8 * len(d.fileBranchMasks)
+	sz += 8 * len(d.tombstones)
 	sz += d.ngrams.SizeBytes()
-	sz += 12 * len(d.fileNameNgrams) // these slices reference mmap-ed memory
+	sz += d.fileNameNgrams.SizeBytes()
+	sz += d.ngramFilter.SizeBytes()
 	return sz
 }
 
@@ -327,12 +416,64 @@ func lastMinarg(xs []uint32) uint32 {
 
 func (data *indexData) ngramFrequency(ng ngram, filename bool) uint32 {
 	if filename {
-		return uint32(len(data.fileNameNgrams[ng]))
+		return uint32(len(data.fileNameNgrams.Get(ng)))
 	}
 
 	return data.ngrams.Get(ng).sz
 }
 
+// ngramFrequencies returns the frequency of each ngram, summed over
+// its case variants unless caseSensitive. The content ngrams are
+// looked up in one batch.
+func (d *indexData) ngramFrequencies(ngramOffs []runeNgramOff, caseSensitive, filename bool) []uint32 {
+	grams := make([]ngram, 0, len(ngramOffs))
+	ends := make([]int, 0, len(ngramOffs))
+	for _, o := range ngramOffs {
+		if caseSensitive {
+			grams = append(grams, o.ngram)
+		} else {
+			grams = append(grams, generateCaseNgrams(o.ngram)...)
+		}
+		ends = append(ends, len(grams))
+	}
+
+	counts := make([]uint32, len(grams))
+	if filename {
+		for i, g := range grams {
+			counts[i] = d.ngramFrequency(g, true)
+		}
+	} else {
+		secs := make([]simpleSection, len(grams))
+		d.ngrams.GetMany(grams, secs)
+		for i, sec := range secs {
+			counts[i] = sec.sz
+		}
+	}
+
+	freqs := make([]uint32, len(ngramOffs))
+	start := 0
+	for i, end := range ends {
+		for _, c := range counts[start:end] {
+			freqs[i] += c
+		}
+		start = end
+	}
+	return freqs
+}
+
+// substringFrequency returns the frequency of the rarest ngram of
+// the substring query.
+func (d *indexData) substringFrequency(query *query.Substring) uint32 {
+	min := uint32(maxUInt32)
+	ngramOffs := splitNGrams([]byte(query.Pattern))
+	for _, freq := range d.ngramFrequencies(ngramOffs, query.CaseSensitive, query.FileName) {
+		if freq < min {
+			min = freq
+		}
+	}
+	return min
+}
+
 type ngramIterationResults struct {
 	matchIterator
 
@@ -346,6 +487,10 @@ func (r *ngramIterationResults) String() string {
 	return fmt.Sprintf("wrapper(%v)", r.matchIterator)
 }
 
+func (r *ngramIterationResults) skipTo(doc uint32) {
+	skipTo(r.matchIterator, doc)
+}
+
 func (r *ngramIterationResults) candidates() []*candidateMatch {
 	cs := r.matchIterator.candidates()
 	for _, c := range cs {
@@ -362,17 +507,8 @@ func (d *indexData) iterateNgrams(query *query.Substring) (*ngramIterationResult
 
 	// Find the 2 least common ngrams from the string.
 	ngramOffs := splitNGrams([]byte(query.Pattern))
-	frequencies := make([]uint32, 0, len(ngramOffs))
-	for _, o := range ngramOffs {
-		var freq uint32
-		if query.CaseSensitive {
-			freq = d.ngramFrequency(o.ngram, query.FileName)
-		} else {
-			for _, v := range generateCaseNgrams(o.ngram) {
-				freq += d.ngramFrequency(v, query.FileName)
-			}
-		}
-
+	frequencies := d.ngramFrequencies(ngramOffs, query.CaseSensitive, query.FileName)
+	for _, freq := range frequencies {
 		if freq == 0 {
 			return &ngramIterationResults{
 				matchIterator: &noMatchTree{
@@ -380,8 +516,6 @@ func (d *indexData) iterateNgrams(query *query.Substring) (*ngramIterationResult
 				},
 			}, nil
 		}
-
-		frequencies = append(frequencies, freq)
 	}
 	firstI := firstMinarg(frequencies)
 	frequencies[firstI] = maxUInt32
@@ -392,6 +526,13 @@ func (d *indexData) iterateNgrams(query *query.Substring) (*ngramIterationResult
 
 	firstNG := ngramOffs[firstI].ngram
 	lastNG := ngramOffs[lastI].ngram
+	if !query.FileName {
+		// Read both posting lists at once.
+		d.prefetchPostings(firstNG, query.CaseSensitive)
+		if firstI != lastI {
+			d.prefetchPostings(lastNG, query.CaseSensitive)
+		}
+	}
 	iter := &ngramDocIterator{
 		leftPad:  firstI,
 		rightPad: uint32(utf8.RuneCountInString(str)) - firstI,
@@ -437,6 +578,19 @@ func (d *indexData) numDocs() uint32 {
 	return uint32(len(d.fileBranchMasks))
 }
 
+// pin keeps the memory results reference valid, also after Close,
+// until the returned function is called. It returns nil if results
+// don't reference the index file.
+func (s *indexData) pin() func() {
+	if p, ok := s.file.(interface{ pin() func() }); ok {
+		return p.pin()
+	}
+	return nil
+}
+
 func (s *indexData) Close() {
+	if s.contentEncoding != contentEncodingRaw {
+		contentCache.purge(s.contentCacheID)
+	}
 	s.file.Close()
 }
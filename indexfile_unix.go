@@ -19,13 +19,28 @@ package zoekt
 import (
 	"fmt"
 	"os"
+	"sync"
+	"sync/atomic"
 	"syscall"
+	"unsafe"
 )
 
 type mmapedIndexFile struct {
 	name string
 	size uint32
 	data []byte
+
+	// refs counts the owner and the pins. The file is unmapped when
+	// it drops to zero.
+	refs int32
+
+	// locked is the part of the mapping locked into memory, which is
+	// returned to budget when the file is unmapped. mu is held while
+	// unmapping, so holding it with refs above zero keeps the file
+	// mapped.
+	mu     sync.Mutex
+	locked int64
+	budget *LockBudget
 }
 
 func (f *mmapedIndexFile) Read(off, sz uint32) ([]byte, error) {
@@ -43,8 +58,143 @@ func (f *mmapedIndexFile) Size() (uint32, error) {
 	return f.size, nil
 }
 
+// Close drops the owner's reference. The file stays mapped while it
+// is pinned.
 func (f *mmapedIndexFile) Close() {
-	syscall.Munmap(f.data)
+	f.unref()
+}
+
+// pin keeps the file mapped, also after Close, until the returned
+// function is called.
+func (f *mmapedIndexFile) pin() func() {
+	atomic.AddInt32(&f.refs, 1)
+	var once sync.Once
+	return func() { once.Do(f.unref) }
+}
+
+func (f *mmapedIndexFile) unref() {
+	if atomic.AddInt32(&f.refs, -1) == 0 {
+		f.mu.Lock()
+		syscall.Munmap(f.data)
+		if f.budget != nil {
+			f.budget.release(f.locked)
+		}
+		f.locked = 0
+		f.mu.Unlock()
+	}
+}
+
+// pages returns the pages of the mapping that hold [off, off+sz).
+func (f *mmapedIndexFile) pages(off, sz uint32) []byte {
+	ps := uint32(os.Getpagesize())
+	start := off &^ (ps - 1)
+	end := uint64(off) + uint64(sz)
+	if end > uint64(len(f.data)) {
+		end = uint64(len(f.data))
+	}
+	if uint64(start) >= end {
+		return nil
+	}
+	return f.data[start:end]
+}
+
+func (f *mmapedIndexFile) advise(off, sz uint32, hint accessHint) {
+	advice := syscall.MADV_RANDOM
+	if hint == accessWillNeed {
+		advice = syscall.MADV_WILLNEED
+	}
+	// The hints only affect performance.
+	madvise(f.pages(off, sz), advice)
+}
+
+func (f *mmapedIndexFile) lock(off, sz uint32, budget *LockBudget) int64 {
+	f.mu.Lock()
+	defer f.mu.Unlock()
+	if atomic.LoadInt32(&f.refs) == 0 {
+		// Unmapped, or about to be.
+		return 0
+	}
+
+	b := f.pages(off, sz)
+	n := int64(len(b))
+	if n == 0 || !budget.reserve(n) {
+		return 0
+	}
+	if err := syscall.Mlock(b); err != nil {
+		budget.release(n)
+		return 0
+	}
+	f.locked += n
+	f.budget = budget
+	return n
+}
+
+// residency counts the resident pages of the mapping, and of the
+// given ranges of it.
+func (f *mmapedIndexFile) residency(ranges []simpleSection) (ShardResidency, error) {
+	f.mu.Lock()
+	defer f.mu.Unlock()
+	if atomic.LoadInt32(&f.refs) == 0 {
+		return ShardResidency{}, fmt.Errorf("%s is closed", f.name)
+	}
+
+	ps := os.Getpagesize()
+	vec := make([]byte, (len(f.data)+ps-1)/ps)
+	if err := mincore(f.data, vec); err != nil {
+		return ShardResidency{}, fmt.Errorf("mincore %s: %v", f.name, err)
+	}
+
+	r := ShardResidency{
+		MappedBytes: int64(len(f.data)),
+		LockedBytes: f.locked,
+	}
+	for _, v := range vec {
+		if v&1 != 0 {
+			r.ResidentBytes += int64(ps)
+		}
+	}
+	// The ranges are sorted, but may share pages.
+	next := 0
+	for _, sec := range ranges {
+		b := f.pages(sec.off, sec.sz)
+		if len(b) == 0 {
+			continue
+		}
+		first := int(sec.off) / ps
+		if first < next {
+			first = next
+		}
+		next = int(sec.off)/ps + (len(b)+ps-1)/ps
+		for i := first; i < next; i++ {
+			r.HotBytes += int64(ps)
+			if vec[i]&1 != 0 {
+				r.HotResidentBytes += int64(ps)
+			}
+		}
+	}
+	return r, nil
+}
+
+func madvise(b []byte, advice int) error {
+	if len(b) == 0 {
+		return nil
+	}
+	_, _, errno := syscall.Syscall(syscall.SYS_MADVISE, uintptr(unsafe.Pointer(&b[0])), uintptr(len(b)), uintptr(advice))
+	if errno != 0 {
+		return errno
+	}
+	return nil
+}
+
+func mincore(b []byte, vec []byte) error {
+	if len(b) == 0 {
+		return nil
+	}
+	_, _, errno := syscall.Syscall(syscall.SYS_MINCORE, uintptr(unsafe.Pointer(&b[0])), uintptr(len(b)), uintptr(unsafe.Pointer(&vec[0])))
+	if errno != 0 {
+		return errno
+	}
+	return nil
 }
 
 // NewIndexFile returns a new index file. The index file takes
@@ -64,6 +214,7 @@ func NewIndexFile(f *os.File) (IndexFile, error) {
 	r := &mmapedIndexFile{
 		name: f.Name(),
 		size: uint32(sz),
+		refs: 1,
 	}
 
 	rounded := (r.size + 4095) &^ 4095
@@ -71,6 +222,9 @@ func NewIndexFile(f *os.File) (IndexFile, error) {
 	if err != nil {
 		return nil, err
 	}
+	// Searches jump around the postings and content, so read ahead
+	// only where NewSearcher asks for it.
+	r.advise(0, r.size, accessRandom)
 
 	return r, err
 }
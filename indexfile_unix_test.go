@@ -0,0 +1,142 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// +build linux darwin
+
+package zoekt
+
+import (
+	"context"
+	"fmt"
+	"os"
+	"path/filepath"
+	"strings"
+	"testing"
+
+	"github.com/google/zoekt/query"
+)
+
+func TestNoCopyPinsFile(t *testing.T) {
+	b, err := NewIndexBuilder(&Repository{Name: "repo"})
+	if err != nil {
+		t.Fatal(err)
+	}
+	if err := b.AddFile("f", []byte("needle in a haystack")); err != nil {
+		t.Fatal(err)
+	}
+	fn := filepath.Join(t.TempDir(), "repo_v16.00000.zoekt")
+	tmp, err := writeShardFile(fn, b)
+	if err != nil {
+		t.Fatal(err)
+	}
+	if err := os.Rename(tmp, fn); err != nil {
+		t.Fatal(err)
+	}
+
+	s, err := loadShard(fn)
+	if err != nil {
+		t.Fatal(err)
+	}
+	file := s.(*indexData).file.(*mmapedIndexFile)
+
+	res, err := s.Search(context.Background(), &query.Substring{Pattern: "needle"}, &SearchOptions{Whole: true, NoCopy: true})
+	if err != nil {
+		t.Fatal(err)
+	}
+	if res.Release == nil {
+		t.Fatal("NoCopy result has no Release")
+	}
+
+	// The result stays valid after the shard is closed.
+	s.Close()
+	if got := string(res.Files[0].Content); got != "needle in a haystack" {
+		t.Errorf("got content %q after Close", got)
+	}
+
+	res.Release()
+	res.Release()
+	if file.refs != 0 {
+		t.Errorf("got %d references after Release, want 0", file.refs)
+	}
+}
+
+func TestResidencyAndLocking(t *testing.T) {
+	b, err := NewIndexBuilder(&Repository{Name: "repo"})
+	if err != nil {
+		t.Fatal(err)
+	}
+	for i := 0; i < 100; i++ {
+		if err := b.AddFile(fmt.Sprintf("dir/file%d.go", i), []byte(strings.Repeat("needle in a haystack\n", 100))); err != nil {
+			t.Fatal(err)
+		}
+	}
+	fn := filepath.Join(t.TempDir(), "repo_v16.00000.zoekt")
+	tmp, err := writeShardFile(fn, b)
+	if err != nil {
+		t.Fatal(err)
+	}
+	if err := os.Rename(tmp, fn); err != nil {
+		t.Fatal(err)
+	}
+
+	s, err := loadShard(fn)
+	if err != nil {
+		t.Fatal(err)
+	}
+	d := s.(*indexData)
+
+	r, err := d.Residency()
+	if err != nil {
+		t.Fatal(err)
+	}
+	fi, err := os.Stat(fn)
+	if err != nil {
+		t.Fatal(err)
+	}
+	if r.MappedBytes < fi.Size() || r.ResidentBytes > r.MappedBytes {
+		t.Errorf("got %+v for a file of %d bytes", r, fi.Size())
+	}
+	if r.HotBytes == 0 || r.HotBytes >= r.MappedBytes || r.HotResidentBytes > r.HotBytes {
+		t.Errorf("got %+v, want some hot sections", r)
+	}
+
+	if n := d.LockHotSections(NewLockBudget(1)); n != 0 {
+		t.Errorf("locked %d bytes with a budget of 1", n)
+	}
+	budget := NewLockBudget(r.MappedBytes)
+	n := d.LockHotSections(budget)
+	if n == 0 {
+		// RLIMIT_MEMLOCK may not allow it.
+		t.Log("locked nothing")
+	}
+	if n != budget.Used() || n > r.HotBytes+int64(len(d.hotSections)*os.Getpagesize()) {
+		t.Errorf("locked %d bytes, budget used %d, hot sections %d bytes", n, budget.Used(), r.HotBytes)
+	}
+	if r, err := d.Residency(); err != nil || r.LockedBytes != n {
+		t.Errorf("got %+v, %v, want %d bytes locked", r, err, n)
+	}
+
+	s.Close()
+	if budget.Used() != 0 {
+		t.Errorf("got %d bytes of the budget used after Close", budget.Used())
+	}
+
+	// Locking a closed shard does nothing.
+	if n := d.LockHotSections(budget); n != 0 || budget.Used() != 0 {
+		t.Errorf("locked %d bytes after Close, budget used %d", n, budget.Used())
+	}
+	if _, err := d.Residency(); err == nil {
+		t.Error("got the residency of a closed shard")
+	}
+}
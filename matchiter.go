@@ -17,7 +17,6 @@ package zoekt
 import (
 	"bytes"
 	"fmt"
-	"sort"
 )
 
 // candidateMatch is a candidate match for a substring.
@@ -38,6 +37,42 @@ type candidateMatch struct {
 	byteMatchSz uint32
 }
 
+// candidateSlabSize is the number of candidateMatches allocated at
+// once by a candidateArena.
+const candidateSlabSize = 256
+
+// candidateArena allocates candidateMatches in slabs which are reused
+// after reset. It is reset for every document, so it may only hold
+// candidates that don't outlive the document.
+type candidateArena struct {
+	slabs [][]candidateMatch
+	slab  int
+	used  int
+}
+
+// alloc returns a zeroed candidateMatch. A nil arena allocates on the
+// heap.
+func (a *candidateArena) alloc() *candidateMatch {
+	if a == nil {
+		return &candidateMatch{}
+	}
+	if a.slab == len(a.slabs) {
+		a.slabs = append(a.slabs, make([]candidateMatch, candidateSlabSize))
+	}
+	m := &a.slabs[a.slab][a.used]
+	*m = candidateMatch{}
+	if a.used++; a.used == candidateSlabSize {
+		a.slab++
+		a.used = 0
+	}
+	return m
+}
+
+// reset releases all candidates allocated so far.
+func (a *candidateArena) reset() {
+	a.slab, a.used = 0, 0
+}
+
 // Matches content against the substring, and populates byteMatchSz on success
 func (m *candidateMatch) matchContent(content []byte) bool {
 	if m.caseSensitive {
@@ -64,22 +99,8 @@ func (m *candidateMatch) matchContent(content []byte) bool {
 // by its linenumber (base-1, byte index of line start, byte index of
 // line end).  The line end is the index of a newline, or the filesize
 // (if matching the last line of the file.)
-func (m *candidateMatch) line(newlines []uint32, fileSize uint32) (lineNum, lineStart, lineEnd int) {
-	idx := sort.Search(len(newlines), func(n int) bool {
-		return newlines[n] >= m.byteOffset
-	})
-
-	end := int(fileSize)
-	if idx < len(newlines) {
-		end = int(newlines[idx])
-	}
-
-	start := 0
-	if idx > 0 {
-		start = int(newlines[idx-1] + 1)
-	}
-
-	return idx + 1, start, end
+func (m *candidateMatch) line(newlines *newlineIndex, fileSize uint32) (lineNum, lineStart, lineEnd int) {
+	return newlines.line(m.byteOffset, fileSize)
 }
 
 // matchIterator is a docIterator that produces candidateMatches for a given document
@@ -92,6 +113,8 @@ type matchIterator interface {
 
 // noMatchTree is both matchIterator and matchTree that matches nothing.
 type noMatchTree struct {
+	matchNode
+
 	Why string
 }
 
@@ -109,7 +132,7 @@ func (t *noMatchTree) nextDoc() uint32 {
 
 func (t *noMatchTree) prepare(uint32) {}
 
-func (t *noMatchTree) matches(cp *contentProvider, cost int, known map[matchTree]bool) (bool, bool) {
+func (t *noMatchTree) matches(cp *contentProvider, cost int, known *knownMatches) (bool, bool) {
 	return false, true
 }
 
@@ -129,6 +152,11 @@ type ngramDocIterator struct {
 	// mutable
 	fileIdx    uint32
 	matchCount int
+
+	// Buffers for the result of candidates, which is only valid
+	// until the next call.
+	candBuf []candidateMatch
+	candPtr []*candidateMatch
 }
 
 // nextFileIndex returns the smallest index j of ends such that
@@ -156,6 +184,16 @@ func (i *ngramDocIterator) nextDoc() uint32 {
 	return i.fileIdx
 }
 
+func (i *ngramDocIterator) skipTo(doc uint32) {
+	if doc >= uint32(len(i.ends)) {
+		i.iter.next(maxUInt32)
+		return
+	}
+	if doc > 0 && i.ends[doc-1] > 0 {
+		i.iter.next(i.ends[doc-1] + i.leftPad - 1)
+	}
+}
+
 func (i *ngramDocIterator) String() string {
 	return fmt.Sprintf("ngram(L=%d,R=%d,%v)", i.leftPad, i.rightPad, i.iter)
 }
@@ -187,7 +225,7 @@ func (i *ngramDocIterator) candidates() []*candidateMatch {
 	}
 	fileEnd := i.ends[i.fileIdx]
 
-	var candidates []*candidateMatch
+	found := i.candBuf[:0]
 	for {
 		p1 := i.iter.first()
 		if p1 == maxUInt32 || p1 >= i.ends[i.fileIdx] {
@@ -199,11 +237,22 @@ func (i *ngramDocIterator) candidates() []*candidateMatch {
 			continue
 		}
 
-		candidates = append(candidates, &candidateMatch{
+		found = append(found, candidateMatch{
 			file:       uint32(i.fileIdx),
 			runeOffset: p1 - fileStart - i.leftPad,
 		})
 	}
-	i.matchCount += len(candidates)
+	i.candBuf = found
+	i.matchCount += len(found)
+	if len(found) == 0 {
+		return nil
+	}
+
+	// Take the pointers after appending, which may move found.
+	candidates := i.candPtr[:0]
+	for j := range found {
+		candidates = append(candidates, &found[j])
+	}
+	i.candPtr = candidates
 	return candidates
 }
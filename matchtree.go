@@ -15,9 +15,12 @@
 package zoekt
 
 import (
+	"bytes"
 	"fmt"
 	"log"
 	"regexp"
+	"regexp/syntax"
+	"sort"
 	"strings"
 	"unicode/utf8"
 
@@ -36,6 +39,23 @@ type docIterator interface {
 	prepare(nextDoc uint32)
 }
 
+// A docSkipper is a docIterator that can advance past documents
+// without evaluating them.
+type docSkipper interface {
+	// skipTo advances the iterator so nextDoc() returns at least
+	// doc. It doesn't consume doc itself, so prepare(doc) remains
+	// valid.
+	skipTo(doc uint32)
+}
+
+// skipTo advances d to doc if it is a docSkipper, and is a no-op
+// otherwise.
+func skipTo(d docIterator, doc uint32) {
+	if s, ok := d.(docSkipper); ok {
+		s.skipTo(doc)
+	}
+}
+
 const (
 	costConst   = 0
 	costMemory  = 1
@@ -70,7 +90,7 @@ const (
 //
 //   - evaluate atoms (leaf expressions that match text)
 //
-//   - evaluate the tree using matches(), storing the result in map.
+//   - evaluate the tree using matches(), storing the result in knownMatches.
 //
 //   - if the complete tree returns (matches() == true) for the document,
 //     collect all text matches by looking at leaf matchTrees
@@ -79,11 +99,119 @@ type matchTree interface {
 	docIterator
 
 	// returns whether this matches, and if we are sure.
-	matches(cp *contentProvider, cost int, known map[matchTree]bool) (match bool, sure bool)
+	matches(cp *contentProvider, cost int, known *knownMatches) (match bool, sure bool)
+
+	// node returns the number of the node, see knownMatches.
+	node() *matchNode
+}
+
+// matchNode numbers a node of a match tree. Match trees embed it.
+type matchNode struct {
+	id int
+}
+
+func (n *matchNode) node() *matchNode {
+	return n
+}
+
+// knownMatches records which nodes of a match tree are decided for
+// the current document, and their values. The nodes are numbered
+// densely when the knownMatches is made, so lookups index a bitset,
+// and moving to the next document only clears it.
+type knownMatches struct {
+	nodes   []matchTree
+	decided []uint64
+	values  []uint64
+}
+
+// newKnownMatches numbers the nodes of mt, and returns a knownMatches
+// for them.
+func newKnownMatches(mt matchTree) *knownMatches {
+	k := &knownMatches{}
+	k.number(mt)
+	n := (len(k.nodes) + 63) / 64
+	k.decided = make([]uint64, n)
+	k.values = make([]uint64, n)
+	return k
+}
+
+// number numbers t and the nodes below it that may be evaluated
+// through evalMatchTree. Unlike walkMatchTree, it enters
+// noVisitMatchTree, whose matches evaluates the children of the
+// wrapped tree.
+func (k *knownMatches) number(t matchTree) {
+	t.node().id = len(k.nodes)
+	k.nodes = append(k.nodes, t)
+
+	switch s := t.(type) {
+	case *andMatchTree:
+		for _, ch := range s.children {
+			k.number(ch)
+		}
+	case *orMatchTree:
+		for _, ch := range s.children {
+			k.number(ch)
+		}
+	case *andLineMatchTree:
+		for _, ch := range s.children {
+			k.number(ch)
+		}
+	case *notMatchTree:
+		k.number(s.child)
+	case *fileNameMatchTree:
+		k.number(s.child)
+	case *noVisitMatchTree:
+		k.number(s.matchTree)
+	}
+}
+
+// reset forgets all decisions, for evaluating the next document.
+func (k *knownMatches) reset() {
+	for i := range k.decided {
+		k.decided[i] = 0
+	}
+}
+
+// get returns the value of mt, and whether it was decided.
+func (k *knownMatches) get(mt matchTree) (v bool, ok bool) {
+	id := mt.node().id
+	if k.decided[id/64]&(1<<(id%64)) == 0 {
+		return false, false
+	}
+	return k.values[id/64]&(1<<(id%64)) != 0, true
+}
+
+// matched returns whether mt is decided to match.
+func (k *knownMatches) matched(mt matchTree) bool {
+	v, ok := k.get(mt)
+	return ok && v
+}
+
+func (k *knownMatches) set(mt matchTree, v bool) {
+	id := mt.node().id
+	k.decided[id/64] |= 1 << (id % 64)
+	if v {
+		k.values[id/64] |= 1 << (id % 64)
+	} else {
+		k.values[id/64] &^= 1 << (id % 64)
+	}
+}
+
+func (k *knownMatches) String() string {
+	var parts []string
+	for _, mt := range k.nodes {
+		if v, ok := k.get(mt); ok {
+			parts = append(parts, fmt.Sprintf("%v:%t", mt, v))
+		}
+	}
+	sort.Strings(parts)
+	return "{" + strings.Join(parts, " ") + "}"
 }
 
 // docMatchTree iterates over documents for which predicate(docID) returns true.
 type docMatchTree struct {
+	matchNode
+
 	// the number of documents in a shard.
 	numDocs uint32
 
@@ -99,6 +227,8 @@ type docMatchTree struct {
 }
 
 type bruteForceMatchTree struct {
+	matchNode
+
 	// mutable
 	firstDone bool
 	docID     uint32
@@ -109,29 +239,41 @@ type andLineMatchTree struct {
 }
 
 type andMatchTree struct {
+	matchNode
 	children []matchTree
 }
 
 type orMatchTree struct {
+	matchNode
 	children []matchTree
 }
 
 type notMatchTree struct {
+	matchNode
 	child matchTree
 }
 
 type fileNameMatchTree struct {
+	matchNode
 	child matchTree
 }
 
 // Don't visit this subtree for collecting matches.
 type noVisitMatchTree struct {
 	matchTree
+	id matchNode
+}
+
+func (t *noVisitMatchTree) node() *matchNode {
+	return &t.id
 }
 
 type regexpMatchTree struct {
 	regexp *regexp.Regexp
 
+	// prefilter skips the text that can't match regexp, if set.
+	prefilter *regexpPrefilter
+
 	fileName bool
 
 	// mutable
@@ -143,6 +285,8 @@ type regexpMatchTree struct {
 }
 
 type substrMatchTree struct {
+	matchNode
+
 	matchIterator
 
 	query         *query.Substring
@@ -155,6 +299,8 @@ type substrMatchTree struct {
 }
 
 type branchQueryMatchTree struct {
+	matchNode
+
 	fileMasks []uint64
 	masks     []uint64
 	repos     []uint16
@@ -166,6 +312,8 @@ type branchQueryMatchTree struct {
 
 type symbolRegexpMatchTree struct {
 	matchTree
+	id matchNode
+
 	regexp *regexp.Regexp
 	all    bool // skips regex match if .*
 
@@ -173,11 +321,15 @@ type symbolRegexpMatchTree struct {
 	found       []*candidateMatch
 }
 
+func (t *symbolRegexpMatchTree) node() *matchNode {
+	return &t.id
+}
+
 func (t *symbolRegexpMatchTree) prepare(doc uint32) {
 	t.reEvaluated = false
 }
 
-func (t *symbolRegexpMatchTree) matches(cp *contentProvider, cost int, known map[matchTree]bool) (bool, bool) {
+func (t *symbolRegexpMatchTree) matches(cp *contentProvider, cost int, known *knownMatches) (bool, bool) {
 	if t.reEvaluated {
 		return len(t.found) > 0, true
 	}
@@ -201,12 +353,11 @@ func (t *symbolRegexpMatchTree) matches(cp *contentProvider, cost int, known map
 			}
 		}
 
-		cm := &candidateMatch{
-			byteOffset:  sec.Start + uint32(idx[0]),
-			byteMatchSz: uint32(idx[1] - idx[0]),
-			symbol:      true,
-			symbolIdx:   uint32(i),
-		}
+		cm := cp.cands.alloc()
+		cm.byteOffset = sec.Start + uint32(idx[0])
+		cm.byteMatchSz = uint32(idx[1] - idx[0])
+		cm.symbol = true
+		cm.symbolIdx = uint32(i)
 		found = append(found, cm)
 	}
 	t.found = found
@@ -353,15 +504,31 @@ func (t *bruteForceMatchTree) nextDoc() uint32 {
 	return t.docID + 1
 }
 
+// nextDoc intersects the children leapfrog style: the candidate is
+// the furthest nextDoc of any child, and the other children are
+// skipped ahead to it until they all agree. Children are ordered
+// sparsest first (see newMatchTree), so the leading child quickly
+// moves the candidate past documents the dense children have.
+// Children that can't skip agree with any later candidate.
 func (t *andMatchTree) nextDoc() uint32 {
-	var max uint32
-	for _, c := range t.children {
-		m := c.nextDoc()
-		if m > max {
-			max = m
+	var target uint32
+	for {
+		agree := true
+		for _, c := range t.children {
+			m := c.nextDoc()
+			if m < target {
+				skipTo(c, target)
+				m = c.nextDoc()
+			}
+			if m > target {
+				target = m
+				agree = false
+			}
+		}
+		if agree || target == maxUInt32 {
+			return target
 		}
 	}
-	return max
 }
 
 func (t *orMatchTree) nextDoc() uint32 {
@@ -397,6 +564,53 @@ func (t *branchQueryMatchTree) nextDoc() uint32 {
 	return maxUInt32
 }
 
+// skipTo
+
+func (t *bruteForceMatchTree) skipTo(doc uint32) {
+	if doc > 0 && (!t.firstDone || t.docID+1 < doc) {
+		t.firstDone = true
+		t.docID = doc - 1
+	}
+}
+
+func (t *docMatchTree) skipTo(doc uint32) {
+	if doc > 0 && (!t.firstDone || t.docID+1 < doc) {
+		t.firstDone = true
+		t.docID = doc - 1
+	}
+}
+
+func (t *branchQueryMatchTree) skipTo(doc uint32) {
+	if doc > 0 && (!t.firstDone || t.docID+1 < doc) {
+		t.firstDone = true
+		t.docID = doc - 1
+	}
+}
+
+func (t *andMatchTree) skipTo(doc uint32) {
+	for _, c := range t.children {
+		skipTo(c, doc)
+	}
+}
+
+func (t *orMatchTree) skipTo(doc uint32) {
+	for _, c := range t.children {
+		skipTo(c, doc)
+	}
+}
+
+func (t *fileNameMatchTree) skipTo(doc uint32) {
+	skipTo(t.child, doc)
+}
+
+func (t *noVisitMatchTree) skipTo(doc uint32) {
+	skipTo(t.matchTree, doc)
+}
+
+func (t *substrMatchTree) skipTo(doc uint32) {
+	skipTo(t.matchIterator, doc)
+}
+
 // all String methods
 
 func (t *bruteForceMatchTree) String() string {
@@ -479,11 +693,11 @@ func visitMatchTree(t matchTree, f func(matchTree)) {
 
 // visitMatches visits all atoms which can contribute matches. Note: This
 // skips noVisitMatchTree.
-func visitMatches(t matchTree, known map[matchTree]bool, f func(matchTree)) {
+func visitMatches(t matchTree, known *knownMatches, f func(matchTree)) {
 	switch s := t.(type) {
 	case *andMatchTree:
 		for _, ch := range s.children {
-			if known[ch] {
+			if known.matched(ch) {
 				visitMatches(ch, known, f)
 			}
 		}
@@ -491,7 +705,7 @@ func visitMatches(t matchTree, known map[matchTree]bool, f func(matchTree)) {
 		visitMatches(&s.andMatchTree, known, f)
 	case *orMatchTree:
 		for _, ch := range s.children {
-			if known[ch] {
+			if known.matched(ch) {
 				visitMatches(ch, known, f)
 			}
 		}
@@ -509,18 +723,18 @@ func visitMatches(t matchTree, known map[matchTree]bool, f func(matchTree)) {
 
 // all matches() methods.
 
-func (t *docMatchTree) matches(cp *contentProvider, cost int, known map[matchTree]bool) (bool, bool) {
+func (t *docMatchTree) matches(cp *contentProvider, cost int, known *knownMatches) (bool, bool) {
 	return t.predicate(cp.idx), true
 }
 
-func (t *bruteForceMatchTree) matches(cp *contentProvider, cost int, known map[matchTree]bool) (bool, bool) {
+func (t *bruteForceMatchTree) matches(cp *contentProvider, cost int, known *knownMatches) (bool, bool) {
 	return true, true
 }
 
 // andLineMatchTree is a performance optimization of andMatchTree. For content
 // searches we don't want to run the regex engine if there is no line that
 // contains matches from all terms.
-func (t *andLineMatchTree) matches(cp *contentProvider, cost int, known map[matchTree]bool) (bool, bool) {
+func (t *andLineMatchTree) matches(cp *contentProvider, cost int, known *knownMatches) (bool, bool) {
 	matches, sure := t.andMatchTree.matches(cp, cost, known)
 	if !(sure && matches) {
 		return matches, sure
@@ -599,7 +813,7 @@ nextLine:
 	return false, true
 }
 
-func (t *andMatchTree) matches(cp *contentProvider, cost int, known map[matchTree]bool) (bool, bool) {
+func (t *andMatchTree) matches(cp *contentProvider, cost int, known *knownMatches) (bool, bool) {
 	sure := true
 
 	for _, ch := range t.children {
@@ -615,7 +829,7 @@ func (t *andMatchTree) matches(cp *contentProvider, cost int, known map[matchTre
 	return true, sure
 }
 
-func (t *orMatchTree) matches(cp *contentProvider, cost int, known map[matchTree]bool) (bool, bool) {
+func (t *orMatchTree) matches(cp *contentProvider, cost int, known *knownMatches) (bool, bool) {
 	matches := false
 	sure := true
 	for _, ch := range t.children {
@@ -632,11 +846,11 @@ func (t *orMatchTree) matches(cp *contentProvider, cost int, known map[matchTree
 	return matches, sure
 }
 
-func (t *branchQueryMatchTree) matches(cp *contentProvider, cost int, known map[matchTree]bool) (bool, bool) {
+func (t *branchQueryMatchTree) matches(cp *contentProvider, cost int, known *knownMatches) (bool, bool) {
 	return t.fileMasks[t.docID]&t.masks[t.repos[t.docID]] != 0, true
 }
 
-func (t *regexpMatchTree) matches(cp *contentProvider, cost int, known map[matchTree]bool) (bool, bool) {
+func (t *regexpMatchTree) matches(cp *contentProvider, cost int, known *knownMatches) (bool, bool) {
 	if t.reEvaluated {
 		return len(t.found) > 0, true
 	}
@@ -645,15 +859,23 @@ func (t *regexpMatchTree) matches(cp *contentProvider, cost int, known map[match
 		return false, false
 	}
 
-	cp.stats.RegexpsConsidered++
-	idxs := t.regexp.FindAllIndex(cp.data(t.fileName), -1)
+	var idxs [][]int
+	if t.prefilter != nil {
+		var ran bool
+		idxs, ran = t.prefilter.findAllIndex(t.regexp, cp.data(t.fileName))
+		if ran {
+			cp.stats.RegexpsConsidered++
+		}
+	} else {
+		cp.stats.RegexpsConsidered++
+		idxs = t.regexp.FindAllIndex(cp.data(t.fileName), -1)
+	}
 	found := t.found[:0]
 	for _, idx := range idxs {
-		cm := &candidateMatch{
-			byteOffset:  uint32(idx[0]),
-			byteMatchSz: uint32(idx[1] - idx[0]),
-			fileName:    t.fileName,
-		}
+		cm := cp.cands.alloc()
+		cm.byteOffset = uint32(idx[0])
+		cm.byteMatchSz = uint32(idx[1] - idx[0])
+		cm.fileName = t.fileName
 
 		found = append(found, cm)
 	}
@@ -663,64 +885,80 @@ func (t *regexpMatchTree) matches(cp *contentProvider, cost int, known map[match
 	return len(t.found) > 0, true
 }
 
-// breakMatchesOnNewlines returns matches resulting from breaking each element
-// of cms on newlines within text.
-func breakMatchesOnNewlines(cms []*candidateMatch, text []byte) []*candidateMatch {
-	var lineCMs []*candidateMatch
+// breakMatchesOnNewlines appends to dst the matches resulting from
+// breaking each element of cms on newlines within text. New
+// candidates are allocated from a.
+func breakMatchesOnNewlines(dst, cms []*candidateMatch, text []byte, a *candidateArena) []*candidateMatch {
 	for _, cm := range cms {
-		lineCMs = append(lineCMs, breakOnNewlines(cm, text)...)
+		dst = appendBreakOnNewlines(dst, cm, text, a)
 	}
-	return lineCMs
+	return dst
 }
 
 // breakOnNewlines returns matches resulting from breaking cm on newlines
 // within text.
 func breakOnNewlines(cm *candidateMatch, text []byte) []*candidateMatch {
-	var cms []*candidateMatch
-	addMe := &candidateMatch{}
-	*addMe = *cm
-	for i := uint32(cm.byteOffset); i < cm.byteOffset+cm.byteMatchSz; i++ {
-		if text[i] == '\n' {
-			addMe.byteMatchSz = i - addMe.byteOffset
-			if addMe.byteMatchSz != 0 {
-				cms = append(cms, addMe)
-			}
+	return appendBreakOnNewlines(nil, cm, text, nil)
+}
 
-			addMe = &candidateMatch{}
-			*addMe = *cm
-			addMe.byteOffset = i + 1
+func appendBreakOnNewlines(dst []*candidateMatch, cm *candidateMatch, text []byte, a *candidateArena) []*candidateMatch {
+	end := cm.byteOffset + cm.byteMatchSz
+	if bytes.IndexByte(text[cm.byteOffset:end], '\n') < 0 {
+		if cm.byteMatchSz == 0 {
+			return dst
 		}
+		return append(dst, cm)
 	}
-	addMe.byteMatchSz = cm.byteOffset + cm.byteMatchSz - addMe.byteOffset
-	if addMe.byteMatchSz != 0 {
-		cms = append(cms, addMe)
+
+	start := cm.byteOffset
+	for i := cm.byteOffset; i <= end; i++ {
+		if i < end && text[i] != '\n' {
+			continue
+		}
+		if i > start {
+			addMe := a.alloc()
+			*addMe = *cm
+			addMe.byteOffset = start
+			addMe.byteMatchSz = i - start
+			dst = append(dst, addMe)
+		}
+		start = i + 1
 	}
-	return cms
+	return dst
 }
 
-func evalMatchTree(cp *contentProvider, cost int, known map[matchTree]bool, mt matchTree) (bool, bool) {
-	if v, ok := known[mt]; ok {
+func evalMatchTree(cp *contentProvider, cost int, known *knownMatches, mt matchTree) (bool, bool) {
+	if v, ok := known.get(mt); ok {
 		return v, true
 	}
 
-	v, ok := mt.matches(cp, cost, known)
+	v, ok := callMatches(cp, cost, known, mt)
 	if ok {
-		known[mt] = v
+		known.set(mt, v)
 	}
 
 	return v, ok
 }
 
-func (t *notMatchTree) matches(cp *contentProvider, cost int, known map[matchTree]bool) (bool, bool) {
+// callMatches calls mt.matches, through the profiler if the search is
+// profiled.
+func callMatches(cp *contentProvider, cost int, known *knownMatches, mt matchTree) (bool, bool) {
+	if cp.profiler != nil {
+		return cp.profiler.matches(cp, cost, known, mt)
+	}
+	return mt.matches(cp, cost, known)
+}
+
+func (t *notMatchTree) matches(cp *contentProvider, cost int, known *knownMatches) (bool, bool) {
 	v, ok := evalMatchTree(cp, cost, known, t.child)
 	return !v, ok
 }
 
-func (t *fileNameMatchTree) matches(cp *contentProvider, cost int, known map[matchTree]bool) (bool, bool) {
+func (t *fileNameMatchTree) matches(cp *contentProvider, cost int, known *knownMatches) (bool, bool) {
 	return evalMatchTree(cp, cost, known, t.child)
 }
 
-func (t *substrMatchTree) matches(cp *contentProvider, cost int, known map[matchTree]bool) (bool, bool) {
+func (t *substrMatchTree) matches(cp *contentProvider, cost int, known *knownMatches) (bool, bool) {
 	if t.contEvaluated {
 		return len(t.current) > 0, true
 	}
@@ -752,6 +990,61 @@ func (t *substrMatchTree) matches(cp *contentProvider, cost int, known map[match
 	return len(t.current) > 0, true
 }
 
+// byCardinality sorts match trees by their estimated cardinality.
+type byCardinality struct {
+	trees []matchTree
+	est   []uint32
+}
+
+func (s byCardinality) Len() int           { return len(s.trees) }
+func (s byCardinality) Less(i, j int) bool { return s.est[i] < s.est[j] }
+func (s byCardinality) Swap(i, j int) {
+	s.trees[i], s.trees[j] = s.trees[j], s.trees[i]
+	s.est[i], s.est[j] = s.est[j], s.est[i]
+}
+
+// estimateCardinality returns a rough measure of how many documents t
+// visits, for ordering intersections. Substrings are estimated by the
+// size of their rarest ngram posting list. Trees that don't skip
+// through the index are estimated as visiting everything.
+func (d *indexData) estimateCardinality(t matchTree) uint32 {
+	switch t := t.(type) {
+	case *substrMatchTree:
+		return d.substringFrequency(t.query)
+	case *symbolSubstrMatchTree:
+		return d.substringFrequency(t.query)
+	case *symbolDictMatchTree:
+		return uint32(len(t.syms))
+	case *andMatchTree:
+		est := uint32(maxUInt32)
+		for _, c := range t.children {
+			if e := d.estimateCardinality(c); e < est {
+				est = e
+			}
+		}
+		return est
+	case *andLineMatchTree:
+		return d.estimateCardinality(&t.andMatchTree)
+	case *orMatchTree:
+		var est uint32
+		for _, c := range t.children {
+			e := d.estimateCardinality(c)
+			if est+e < est {
+				return maxUInt32
+			}
+			est += e
+		}
+		return est
+	case *fileNameMatchTree:
+		return d.estimateCardinality(t.child)
+	case *noVisitMatchTree:
+		return d.estimateCardinality(t.matchTree)
+	case *noMatchTree:
+		return 0
+	}
+	return maxUInt32
+}
+
 func (d *indexData) newMatchTree(q query.Q) (matchTree, error) {
 	if q == nil {
 		return nil, fmt.Errorf("got nil (sub)query")
@@ -778,14 +1071,11 @@ func (d *indexData) newMatchTree(q query.Q) (matchTree, error) {
 			prefix = "(?i)"
 		}
 
-		tr := &regexpMatchTree{
-			regexp:   regexp.MustCompile(prefix + s.Regexp.String()),
-			fileName: s.FileName,
-		}
+		tr := newRegexpMatchTree(prefix+s.Regexp.String(), s.FileName)
 
 		return &andMatchTree{
 			children: []matchTree{
-				tr, &noVisitMatchTree{subMT},
+				tr, &noVisitMatchTree{matchTree: subMT},
 			},
 		}, nil
 	case *query.And:
@@ -797,7 +1087,14 @@ func (d *indexData) newMatchTree(q query.Q) (matchTree, error) {
 			}
 			r = append(r, ct)
 		}
-		return &andMatchTree{r}, nil
+		// The sparsest child leads the intersection in
+		// andMatchTree.nextDoc.
+		est := make([]uint32, len(r))
+		for i, ct := range r {
+			est[i] = d.estimateCardinality(ct)
+		}
+		sort.Stable(byCardinality{r, est})
+		return &andMatchTree{children: r}, nil
 	case *query.Or:
 		var r []matchTree
 		for _, ch := range s.Children {
@@ -807,7 +1104,7 @@ func (d *indexData) newMatchTree(q query.Q) (matchTree, error) {
 			}
 			r = append(r, ct)
 		}
-		return &orMatchTree{r}, nil
+		return &orMatchTree{children: r}, nil
 	case *query.Not:
 		ct, err := d.newMatchTree(s.Child)
 		return &notMatchTree{
@@ -858,12 +1155,12 @@ func (d *indexData) newMatchTree(q query.Q) (matchTree, error) {
 		if s.Value {
 			return &bruteForceMatchTree{}, nil
 		} else {
-			return &noMatchTree{"const"}, nil
+			return &noMatchTree{Why: "const"}, nil
 		}
 	case *query.Language:
 		code, ok := d.metaData.LanguageMap[s.Language]
 		if !ok {
-			return &noMatchTree{"lang"}, nil
+			return &noMatchTree{Why: "lang"}, nil
 		}
 		return &docMatchTree{
 			reason:  "language",
@@ -874,6 +1171,10 @@ func (d *indexData) newMatchTree(q query.Q) (matchTree, error) {
 		}, nil
 
 	case *query.Symbol:
+		if mt, err := d.newSymbolDictMatchTree(s.Expr); mt != nil || err != nil {
+			return mt, err
+		}
+
 		subMT, err := d.newMatchTree(s.Expr)
 		if err != nil {
 			return nil, err
@@ -987,6 +1288,19 @@ func (d *indexData) filterDocs(predicate func(docID uint32) bool) []uint32 {
 	return docs
 }
 
+// newRegexpMatchTree returns a regexpMatchTree for the regular
+// expression expr in Perl syntax.
+func newRegexpMatchTree(expr string, fileName bool) *regexpMatchTree {
+	t := &regexpMatchTree{
+		regexp:   regexp.MustCompile(expr),
+		fileName: fileName,
+	}
+	if r, err := syntax.Parse(expr, syntax.Perl); err == nil {
+		t.prefilter = newRegexpPrefilter(r)
+	}
+	return t
+}
+
 func (d *indexData) newSubstringMatchTree(s *query.Substring) (matchTree, error) {
 	st := &substrMatchTree{
 		query:         s,
@@ -999,11 +1313,7 @@ func (d *indexData) newSubstringMatchTree(s *query.Substring) (matchTree, error)
 		if !s.CaseSensitive {
 			prefix = "(?i)"
 		}
-		t := &regexpMatchTree{
-			regexp:   regexp.MustCompile(prefix + regexp.QuoteMeta(s.Pattern)),
-			fileName: s.FileName,
-		}
-		return t, nil
+		return newRegexpMatchTree(prefix+regexp.QuoteMeta(s.Pattern), s.FileName), nil
 	}
 
 	result, err := d.iterateNgrams(s)
@@ -0,0 +1,174 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package zoekt
+
+import (
+	"crypto/sha1"
+	"fmt"
+	"io"
+	"io/ioutil"
+	"os"
+	"path/filepath"
+	"runtime"
+)
+
+// CompoundShardPrefix starts the file names of compound shards, which
+// hold several repositories.
+const CompoundShardPrefix = "compound-"
+
+// Merge writes a compound shard to dstDir holding the repositories of
+// the given shards, except those for which exclude returns true.
+// exclude may be nil. Tombstoned files are left out. The shard is
+// written to tmpName, which the caller should rename to dstName once
+// the inputs can be removed.
+func Merge(dstDir string, exclude func(*Repository) bool, files ...IndexFile) (tmpName, dstName string, err error) {
+	var ds []*indexData
+	for _, f := range files {
+		d, err := loadIndexData(f)
+		if err != nil {
+			return "", "", fmt.Errorf("%s: %w", f.Name(), err)
+		}
+		ds = append(ds, d)
+	}
+
+	b := newIndexBuilder()
+	b.indexFormatVersion = NextIndexFormatVersion
+
+	hasher := sha1.New()
+	for _, d := range ds {
+		if err := b.addShard(d, exclude, hasher); err != nil {
+			return "", "", fmt.Errorf("%s: %w", d.file.Name(), err)
+		}
+	}
+	if len(b.repoList) == 0 {
+		return "", "", fmt.Errorf("no repositories to merge")
+	}
+
+	dstName = filepath.Join(dstDir, fmt.Sprintf("%s%x_v%d.%05d.zoekt", CompoundShardPrefix, hasher.Sum(nil), IndexFormatVersion, 0))
+	tmpName, err = writeShardFile(dstName, b)
+	return tmpName, dstName, err
+}
+
+// addShard adds the repositories and live documents of d.
+func (b *IndexBuilder) addShard(d *indexData, exclude func(*Repository) bool, hasher io.Writer) error {
+	var start uint32
+	for repoID := range d.repoMetaData {
+		end := start
+		for end < uint32(len(d.repos)) && d.repos[end] == uint16(repoID) {
+			end++
+		}
+
+		repo := d.repoMetaData[repoID]
+		docs := start
+		start = end
+		if exclude != nil && exclude(&repo) {
+			continue
+		}
+
+		// The merged shard leaves out tombstoned files, so the
+		// tombstones would only hide live ones.
+		repo.FileTombstones = nil
+		if err := b.setRepository(&repo); err != nil {
+			return err
+		}
+		fmt.Fprintf(hasher, "%s\x00", repo.Name)
+		for _, br := range repo.Branches {
+			fmt.Fprintf(hasher, "%s\x00%s\x00", br.Name, br.Version)
+		}
+
+		for i := docs; i < end; i++ {
+			if d.tombstoned(i) {
+				continue
+			}
+			doc, err := d.document(i)
+			if err != nil {
+				return err
+			}
+			if err := b.Add(doc); err != nil {
+				return err
+			}
+		}
+	}
+	return nil
+}
+
+// document reconstructs the Document for file i, as it was added to
+// the index.
+func (d *indexData) document(i uint32) (Document, error) {
+	content, err := d.readContents(i, nil)
+	if err != nil {
+		return Document{}, err
+	}
+	secs, _, err := d.readDocSections(i, nil)
+	if err != nil {
+		return Document{}, err
+	}
+
+	repo := d.repos[i]
+	doc := Document{
+		Name:     string(d.fileName(i)),
+		Content:  content,
+		Language: d.languageMap[d.languages[i]],
+		Symbols:  secs,
+	}
+	if s := d.subRepos[i]; s > 0 {
+		doc.SubRepositoryPath = d.subRepoPaths[repo][s]
+	}
+	for mask := d.fileBranchMasks[i]; mask != 0; mask &= mask - 1 {
+		bit := mask & -mask
+		doc.Branches = append(doc.Branches, d.branchNames[repo][uint(bit)])
+	}
+
+	if len(secs) > 0 {
+		first := d.fileEndSymbol[i]
+		doc.SymbolsMetaData = make([]*Symbol, len(secs))
+		for j := range secs {
+			sym := d.symbols.data(first + uint32(j))
+			if sym == nil {
+				// Shards built without ctags metadata.
+				doc.SymbolsMetaData = nil
+				break
+			}
+			doc.SymbolsMetaData[j] = sym
+		}
+	}
+	return doc, nil
+}
+
+// writeShardFile writes the shard to a temporary file next to fn, and
+// returns its name.
+func writeShardFile(fn string, b *IndexBuilder) (string, error) {
+	f, err := ioutil.TempFile(filepath.Dir(fn), filepath.Base(fn)+".*.tmp")
+	if err != nil {
+		return "", err
+	}
+	if runtime.GOOS != "windows" {
+		if err := f.Chmod(0o644); err != nil {
+			f.Close()
+			os.Remove(f.Name())
+			return "", err
+		}
+	}
+	if err := b.Write(f); err != nil {
+		f.Close()
+		os.Remove(f.Name())
+		return "", err
+	}
+	if err := f.Close(); err != nil {
+		os.Remove(f.Name())
+		return "", err
+	}
+	return f.Name(), nil
+}
@@ -0,0 +1,189 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package zoekt
+
+import (
+	"bytes"
+	"context"
+	"os"
+	"path/filepath"
+	"reflect"
+	"sort"
+	"strings"
+	"testing"
+
+	"github.com/google/zoekt/query"
+)
+
+func writeTestShard(t *testing.T, dir string, b *IndexBuilder) IndexFile {
+	t.Helper()
+	var buf bytes.Buffer
+	if err := b.Write(&buf); err != nil {
+		t.Fatal(err)
+	}
+	fn := filepath.Join(dir, b.repo().Name+".zoekt")
+	if err := os.WriteFile(fn, buf.Bytes(), 0o600); err != nil {
+		t.Fatal(err)
+	}
+	f, err := os.Open(fn)
+	if err != nil {
+		t.Fatal(err)
+	}
+	iFile, err := NewIndexFile(f)
+	if err != nil {
+		t.Fatal(err)
+	}
+	t.Cleanup(iFile.Close)
+	return iFile
+}
+
+func mergeTestShards(t *testing.T, dir string) []IndexFile {
+	repo1 := &Repository{
+		Name:     "repo1",
+		Branches: []RepositoryBranch{{Name: "main", Version: "v1"}, {Name: "dev", Version: "v2"}},
+		SubRepoMap: map[string]*Repository{
+			"sub": {Name: "subrepo", Branches: []RepositoryBranch{{Name: "main", Version: "s1"}, {Name: "dev", Version: "s2"}}},
+		},
+	}
+	b1 := testIndexBuilder(t, repo1,
+		Document{Name: "needle.go", Content: []byte("func needle() {}"), Branches: []string{"main", "dev"},
+			Symbols:         []DocumentSection{{5, 11}},
+			SymbolsMetaData: []*Symbol{{Kind: "function"}}},
+		Document{Name: "sub/f", Content: []byte("needle in sub"), Branches: []string{"dev"}, SubRepositoryPath: "sub"},
+		Document{Name: "big", SkipReason: "too large", Branches: []string{"main"}},
+	)
+	b2 := testIndexBuilder(t, &Repository{Name: "repo2", Branches: []RepositoryBranch{{Name: "main", Version: "v3"}}},
+		Document{Name: "g", Content: []byte("another needle"), Branches: []string{"main"}},
+	)
+	return []IndexFile{writeTestShard(t, dir, b1), writeTestShard(t, dir, b2)}
+}
+
+func openMerged(t *testing.T, tmp, dst string) Searcher {
+	t.Helper()
+	if err := os.Rename(tmp, dst); err != nil {
+		t.Fatal(err)
+	}
+	f, err := os.Open(dst)
+	if err != nil {
+		t.Fatal(err)
+	}
+	iFile, err := NewIndexFile(f)
+	if err != nil {
+		t.Fatal(err)
+	}
+	s, err := NewSearcher(iFile)
+	if err != nil {
+		t.Fatalf("NewSearcher: %v", err)
+	}
+	t.Cleanup(s.Close)
+	return s
+}
+
+func TestMerge(t *testing.T) {
+	dir := t.TempDir()
+	files := mergeTestShards(t, dir)
+
+	tmp, dst, err := Merge(dir, nil, files...)
+	if err != nil {
+		t.Fatalf("Merge: %v", err)
+	}
+	if !strings.HasPrefix(filepath.Base(dst), CompoundShardPrefix) {
+		t.Errorf("got shard name %s, want prefix %s", dst, CompoundShardPrefix)
+	}
+	s := openMerged(t, tmp, dst)
+
+	res, err := s.Search(context.Background(), &query.Substring{Pattern: "needle"}, &SearchOptions{})
+	if err != nil {
+		t.Fatal(err)
+	}
+	var got []string
+	for _, f := range res.Files {
+		got = append(got, f.Repository+":"+f.FileName+":"+strings.Join(f.Branches, ",")+":"+f.SubRepositoryName)
+	}
+	sort.Strings(got)
+	want := []string{
+		"repo1:needle.go:main,dev:",
+		"repo1:sub/f:dev:subrepo",
+		"repo2:g:main:",
+	}
+	if !reflect.DeepEqual(got, want) {
+		t.Errorf("got %v, want %v", got, want)
+	}
+
+	res, err = s.Search(context.Background(), &query.And{Children: []query.Q{
+		&query.Symbol{Expr: &query.Substring{Pattern: "needle"}},
+		&query.Repo{Pattern: "repo1"},
+	}}, &SearchOptions{})
+	if err != nil {
+		t.Fatal(err)
+	}
+	if len(res.Files) != 1 || res.Files[0].LineMatches[0].LineFragments[0].SymbolInfo.Kind != "function" {
+		t.Errorf("got symbol matches %+v, want needle.go with its kind", res.Files)
+	}
+
+	rl, err := s.List(context.Background(), &query.Const{Value: true}, nil)
+	if err != nil {
+		t.Fatal(err)
+	}
+	var repos []string
+	for _, r := range rl.Repos {
+		repos = append(repos, r.Repository.Name)
+	}
+	if want := []string{"repo1", "repo2"}; !reflect.DeepEqual(repos, want) {
+		t.Errorf("got repos %v, want %v", repos, want)
+	}
+	if rl.Repos[0].Stats.Documents != 3 || rl.Repos[1].Stats.Documents != 1 {
+		t.Errorf("got stats %+v, want 3 and 1 documents", rl.Repos)
+	}
+
+	f, err := os.Open(dst)
+	if err != nil {
+		t.Fatal(err)
+	}
+	iFile, err := NewIndexFile(f)
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer iFile.Close()
+	if _, _, err := ReadMetadata(iFile); err == nil {
+		t.Error("ReadMetadata succeeded on a compound shard")
+	}
+	if all, _, err := ReadMetadataAll(iFile); err != nil || len(all) != 2 {
+		t.Errorf("ReadMetadataAll: got %d repos, %v, want 2", len(all), err)
+	}
+}
+
+func TestMergeExclude(t *testing.T) {
+	dir := t.TempDir()
+	files := mergeTestShards(t, dir)
+
+	tmp, dst, err := Merge(dir, func(r *Repository) bool { return r.Name == "repo1" }, files...)
+	if err != nil {
+		t.Fatalf("Merge: %v", err)
+	}
+	s := openMerged(t, tmp, dst)
+
+	res, err := s.Search(context.Background(), &query.Substring{Pattern: "needle"}, &SearchOptions{})
+	if err != nil {
+		t.Fatal(err)
+	}
+	if len(res.Files) != 1 || res.Files[0].Repository != "repo2" {
+		t.Errorf("got %v, want only the file of repo2", res.Files)
+	}
+
+	if _, _, err := Merge(dir, func(*Repository) bool { return true }, files...); err == nil {
+		t.Error("Merge without repositories succeeded")
+	}
+}
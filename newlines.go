@@ -0,0 +1,138 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package zoekt
+
+import (
+	"encoding/binary"
+	"sort"
+)
+
+// newlineBlock is the number of newlines between checkpoints.
+const newlineBlock = 256
+
+// newlineCheckpoints returns the checkpoints into the newline section
+// of a document, which holds toSizedDeltas(offsets). For every block
+// of newlineBlock newlines after the first, it stores the offset of
+// the newline before the block, and where the deltas of the block
+// start, after the count, as big endian uint32s. Documents with a
+// single block have no checkpoints.
+func newlineCheckpoints(offsets []uint32) []byte {
+	if len(offsets) <= newlineBlock {
+		return nil
+	}
+	var enc [binary.MaxVarintLen64]byte
+	out := make([]byte, 0, 8*(len(offsets)/newlineBlock))
+	var last, dataOff uint32
+	for i, o := range offsets {
+		if i > 0 && i%newlineBlock == 0 {
+			binary.BigEndian.PutUint32(enc[:], last)
+			binary.BigEndian.PutUint32(enc[4:], dataOff)
+			out = append(out, enc[:8]...)
+		}
+		dataOff += uint32(binary.PutUvarint(enc[:], uint64(o-last)))
+		last = o
+	}
+	return out
+}
+
+// newlineIndex finds the lines of a document in its newline section.
+// With checkpoints, it only decodes the block of newlines around the
+// offsets asked for.
+type newlineIndex struct {
+	count       int
+	checkpoints []byte
+	data        []byte
+
+	// buf holds the newlines of block.
+	block int
+	buf   []uint32
+
+	// loaded counts the bytes decoded.
+	loaded *int64
+}
+
+// reset starts on the section of another document. checkpoints may
+// be empty, to decode the section in one go.
+func (n *newlineIndex) reset(section, checkpoints []byte, loaded *int64) {
+	count, m := binary.Uvarint(section)
+	n.count = int(count)
+	n.data = section[m:]
+	n.checkpoints = checkpoints
+	n.block = -1
+	n.loaded = loaded
+	*n.loaded += int64(m + len(checkpoints))
+}
+
+func (n *newlineIndex) blocks() int {
+	return len(n.checkpoints)/8 + 1
+}
+
+// base returns the newline before block j > 0.
+func (n *newlineIndex) base(j int) uint32 {
+	return binary.BigEndian.Uint32(n.checkpoints[8*(j-1):])
+}
+
+func (n *newlineIndex) dataOff(j int) int {
+	return int(binary.BigEndian.Uint32(n.checkpoints[8*(j-1)+4:]))
+}
+
+func (n *newlineIndex) load(j int) {
+	if j == n.block {
+		return
+	}
+	start, end := 0, len(n.data)
+	var last uint32
+	if j > 0 {
+		start, last = n.dataOff(j), n.base(j)
+	}
+	if j+1 < n.blocks() {
+		end = n.dataOff(j + 1)
+	}
+
+	data := n.data[start:end]
+	*n.loaded += int64(len(data))
+	buf := n.buf[:0]
+	for len(data) > 0 {
+		delta, m := binary.Uvarint(data)
+		last += uint32(delta)
+		data = data[m:]
+		buf = append(buf, last)
+	}
+	n.buf = buf
+	n.block = j
+}
+
+// line returns the 1-based number and the bounds of the line that
+// holds byte offset off. The last line ends at fileSize.
+func (n *newlineIndex) line(off, fileSize uint32) (lineNum, lineStart, lineEnd int) {
+	// The first newline at or after off is in block j.
+	j := 0
+	if n.blocks() > 1 {
+		j = sort.Search(n.blocks()-1, func(i int) bool { return n.base(i+1) >= off })
+	}
+	n.load(j)
+	i := sort.Search(len(n.buf), func(i int) bool { return n.buf[i] >= off })
+
+	lineEnd = int(fileSize)
+	if i < len(n.buf) {
+		lineEnd = int(n.buf[i])
+	}
+	if i > 0 {
+		lineStart = int(n.buf[i-1] + 1)
+	} else if j > 0 {
+		lineStart = int(n.base(j) + 1)
+	}
+	return j*newlineBlock + i + 1, lineStart, lineEnd
+}
@@ -0,0 +1,70 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package zoekt
+
+import (
+	"bytes"
+	"fmt"
+	"strings"
+	"testing"
+)
+
+func TestNewlineIndex(t *testing.T) {
+	for _, lines := range []int{0, 1, newlineBlock - 1, newlineBlock, newlineBlock + 1, 5*newlineBlock + 17} {
+		var buf bytes.Buffer
+		for i := 0; i < lines; i++ {
+			fmt.Fprintf(&buf, "%s\n", strings.Repeat("x", i%300))
+		}
+		buf.WriteString("tail")
+		content := buf.Bytes()
+		nls := newLinesIndices(content)
+		section := toSizedDeltas(nls)
+
+		for _, checkpoints := range [][]byte{nil, newlineCheckpoints(nls)} {
+			var loaded int64
+			var n newlineIndex
+			n.reset(section, checkpoints, &loaded)
+
+			lineNum, lineStart := 1, 0
+			for off := 0; off < len(content); off++ {
+				lineEnd := bytes.IndexByte(content[lineStart:], '\n')
+				if lineEnd < 0 {
+					lineEnd = len(content)
+				} else {
+					lineEnd += lineStart
+				}
+				gotNum, gotStart, gotEnd := n.line(uint32(off), uint32(len(content)))
+				if gotNum != lineNum || gotStart != lineStart || gotEnd != lineEnd {
+					t.Fatalf("%d lines, checkpoints %v: line(%d) got %d [%d,%d), want %d [%d,%d)",
+						lines, checkpoints != nil, off, gotNum, gotStart, gotEnd, lineNum, lineStart, lineEnd)
+				}
+				if off == lineEnd {
+					lineNum++
+					lineStart = off + 1
+				}
+			}
+		}
+
+		if len(nls) > newlineBlock {
+			var loaded int64
+			var n newlineIndex
+			n.reset(section, newlineCheckpoints(nls), &loaded)
+			n.line(uint32(len(content)-1), uint32(len(content)))
+			if loaded >= int64(len(section))/2 {
+				t.Errorf("%d lines: decoded %d of %d bytes for the last line", lines, loaded, len(section))
+			}
+		}
+	}
+}
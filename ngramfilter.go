@@ -0,0 +1,314 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package zoekt
+
+import (
+	"regexp/syntax"
+	"unicode"
+	"unicode/utf8"
+
+	"github.com/google/zoekt/query"
+)
+
+// The Bloom filter uses ngramFilterBits bits per ngram, and
+// ngramFilterHashes probes, for about 2% false positives.
+const (
+	ngramFilterBits   = 8
+	ngramFilterHashes = 4
+)
+
+// NgramFilter is a Bloom filter over the content and file name ngrams
+// of a shard. It is small enough to keep for every loaded shard, so a
+// searcher can skip shards that can't match a query without setting
+// up their match trees.
+//
+// Ngrams are stored case folded, so the filter answers for case
+// sensitive and insensitive queries alike.
+type NgramFilter struct {
+	bits []uint64
+}
+
+func newNgramFilter(count int) *NgramFilter {
+	words := (count*ngramFilterBits + 63) / 64
+	if words == 0 {
+		words = 1
+	}
+	return &NgramFilter{bits: make([]uint64, words)}
+}
+
+// ngramFilterKey hashes a folded ngram, with a bit for whether it
+// occurs in file names or content.
+func ngramFilterKey(ng ngram, fileName bool) uint64 {
+	h := uint64(foldNgram(ng)) << 1
+	if fileName {
+		h |= 1
+	}
+	// The splitmix64 finalizer.
+	h ^= h >> 30
+	h *= 0xbf58476d1ce4e5b9
+	h ^= h >> 27
+	h *= 0x94d049bb133111eb
+	h ^= h >> 31
+	return h
+}
+
+// probes calls fn with the bit positions of key, until f returns
+// false.
+func (f *NgramFilter) probes(key uint64, fn func(i uint64) bool) bool {
+	m := uint64(len(f.bits)) * 64
+	h1, h2 := key&0xffffffff, key>>32|1
+	for i := uint64(0); i < ngramFilterHashes; i++ {
+		if !fn((h1 + i*h2) % m) {
+			return false
+		}
+	}
+	return true
+}
+
+func (f *NgramFilter) add(key uint64) {
+	f.probes(key, func(i uint64) bool {
+		f.bits[i/64] |= 1 << (i % 64)
+		return true
+	})
+}
+
+func (f *NgramFilter) has(key uint64) bool {
+	return f.probes(key, func(i uint64) bool {
+		return f.bits[i/64]&(1<<(i%64)) != 0
+	})
+}
+
+// SizeBytes returns the memory used by the filter.
+func (f *NgramFilter) SizeBytes() int {
+	return 8 * len(f.bits)
+}
+
+// MayMatch returns false if the shard has no documents matching q.
+// A nil query may match any shard.
+func (f *NgramFilter) MayMatch(q *NgramFilterQuery) bool {
+	if q == nil {
+		return true
+	}
+	switch q.op {
+	case filterAnd:
+		for _, c := range q.children {
+			if !f.MayMatch(c) {
+				return false
+			}
+		}
+		return true
+	case filterOr:
+		for _, c := range q.children {
+			if f.MayMatch(c) {
+				return true
+			}
+		}
+		return false
+	case filterNgrams:
+		for _, k := range q.keys {
+			if !f.has(k) {
+				return false
+			}
+		}
+		return true
+	}
+	// filterNone
+	return false
+}
+
+// buildNgramFilter summarizes the ngrams of d.
+func (d *indexData) buildNgramFilter() {
+	n := d.fileNameNgrams.count()
+	d.ngrams.forEach(func(ngram) { n++ })
+
+	f := newNgramFilter(n)
+	d.ngrams.forEach(func(ng ngram) {
+		f.add(ngramFilterKey(ng, false))
+	})
+	for i := 0; i < d.fileNameNgrams.count(); i++ {
+		f.add(ngramFilterKey(d.fileNameNgrams.ngram(i), true))
+	}
+	d.ngramFilter = f
+}
+
+// NgramFilter returns the ngram summary of the shard.
+func (d *indexData) NgramFilter() *NgramFilter { return d.ngramFilter }
+
+type filterOp int
+
+const (
+	filterNone filterOp = iota
+	filterAnd
+	filterOr
+	filterNgrams
+)
+
+// NgramFilterQuery holds the ngrams a shard must have to match a
+// query, ready to test against any number of NgramFilters.
+type NgramFilterQuery struct {
+	op       filterOp
+	children []*NgramFilterQuery
+	keys     []uint64
+}
+
+// NewNgramFilterQuery returns the ngram requirements of q. It returns
+// nil if q may match any shard.
+func NewNgramFilterQuery(q query.Q) *NgramFilterQuery {
+	switch s := q.(type) {
+	case *query.And:
+		var children []*NgramFilterQuery
+		for _, ch := range s.Children {
+			c := NewNgramFilterQuery(ch)
+			if c != nil && c.op == filterNone {
+				return c
+			}
+			if c != nil {
+				children = append(children, c)
+			}
+		}
+		return newFilterNode(filterAnd, children)
+	case *query.Or:
+		var children []*NgramFilterQuery
+		for _, ch := range s.Children {
+			c := NewNgramFilterQuery(ch)
+			if c == nil {
+				return nil
+			}
+			if c.op != filterNone {
+				children = append(children, c)
+			}
+		}
+		if len(children) == 0 {
+			return &NgramFilterQuery{op: filterNone}
+		}
+		return newFilterNode(filterOr, children)
+	case *query.Const:
+		if !s.Value {
+			return &NgramFilterQuery{op: filterNone}
+		}
+	case *query.Substring:
+		if !s.FileName && !s.Content {
+			return newFilterNode(filterOr, []*NgramFilterQuery{
+				substringFilter(s.Pattern, false), substringFilter(s.Pattern, true),
+			})
+		}
+		return substringFilter(s.Pattern, s.FileName)
+	case *query.Regexp:
+		if !s.FileName && !s.Content {
+			return newFilterNode(filterOr, []*NgramFilterQuery{
+				regexpFilter(s.Regexp, false), regexpFilter(s.Regexp, true),
+			})
+		}
+		return regexpFilter(s.Regexp, s.FileName)
+	case *query.Symbol:
+		return NewNgramFilterQuery(s.Expr)
+	case *query.Type:
+		return NewNgramFilterQuery(s.Child)
+	}
+	// Negations, and queries on metadata, may match any shard.
+	return nil
+}
+
+func newFilterNode(op filterOp, children []*NgramFilterQuery) *NgramFilterQuery {
+	if op == filterOr {
+		for _, c := range children {
+			if c == nil {
+				return nil
+			}
+		}
+	}
+	switch len(children) {
+	case 0:
+		return nil
+	case 1:
+		return children[0]
+	}
+	return &NgramFilterQuery{op: op, children: children}
+}
+
+func substringFilter(pattern string, fileName bool) *NgramFilterQuery {
+	if utf8.RuneCountInString(pattern) < ngramSize {
+		return nil
+	}
+	offs := splitNGrams([]byte(pattern))
+	keys := make([]uint64, 0, len(offs))
+	for _, o := range offs {
+		keys = append(keys, ngramFilterKey(o.ngram, fileName))
+	}
+	return &NgramFilterQuery{op: filterNgrams, keys: keys}
+}
+
+// regexpFilter finds the literals that every match of r contains.
+func regexpFilter(r *syntax.Regexp, fileName bool) *NgramFilterQuery {
+	switch r.Op {
+	case syntax.OpLiteral:
+		return substringFilter(string(r.Rune), fileName)
+	case syntax.OpCapture, syntax.OpPlus:
+		return regexpFilter(r.Sub[0], fileName)
+	case syntax.OpRepeat:
+		if r.Min > 0 {
+			return regexpFilter(r.Sub[0], fileName)
+		}
+	case syntax.OpConcat:
+		var children []*NgramFilterQuery
+		for _, sub := range r.Sub {
+			if c := regexpFilter(sub, fileName); c != nil {
+				children = append(children, c)
+			}
+		}
+		return newFilterNode(filterAnd, children)
+	case syntax.OpAlternate:
+		var children []*NgramFilterQuery
+		for _, sub := range r.Sub {
+			c := regexpFilter(sub, fileName)
+			if c == nil {
+				return nil
+			}
+			children = append(children, c)
+		}
+		return newFilterNode(filterOr, children)
+	}
+	return nil
+}
+
+// foldNgram maps all case variants of an ngram, see
+// generateCaseNgrams, to the same ngram.
+func foldNgram(ng ngram) ngram {
+	rs := ngramToRunes(ng)
+	for i, r := range rs {
+		rs[i] = foldRune(r)
+	}
+	return runesToNGram(rs)
+}
+
+// foldRune returns the smallest rune of the case folding orbit of the
+// lowercase of r. Lowering first agrees with toLower, which maps some
+// runes, such as U+0130, outside their orbit.
+func foldRune(r rune) rune {
+	if r < utf8.RuneSelf {
+		if 'a' <= r && r <= 'z' {
+			r -= 'a' - 'A'
+		}
+		return r
+	}
+	r = unicode.ToLower(r)
+	min := r
+	for f := unicode.SimpleFold(r); f != r; f = unicode.SimpleFold(f) {
+		if f < min {
+			min = f
+		}
+	}
+	return min
+}
@@ -0,0 +1,97 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package zoekt
+
+import (
+	"fmt"
+	"testing"
+
+	"github.com/google/zoekt/query"
+)
+
+func TestNgramFilter(t *testing.T) {
+	b := testIndexBuilder(t, nil,
+		Document{Name: "main.go", Content: []byte("func HandleRequest() {}\nvar straße = 1\nvar İzmir = 2\n")},
+		Document{Name: "README.md", Content: []byte("hello world")},
+	)
+	f := searcherForTest(t, b).(*indexData).NgramFilter()
+
+	regexp := func(s string) query.Q {
+		q, err := query.Parse("regex:" + s)
+		if err != nil {
+			t.Fatal(err)
+		}
+		return q
+	}
+	for _, tc := range []struct {
+		q    query.Q
+		want bool
+	}{
+		{&query.Substring{Pattern: "HandleRequest"}, true},
+		{&query.Substring{Pattern: "handlerequest"}, true},
+		{&query.Substring{Pattern: "HANDLEREQUEST", CaseSensitive: true}, true},
+		{&query.Substring{Pattern: "STRASSE"}, false},
+		{&query.Substring{Pattern: "STRAßE"}, true},
+		{&query.Substring{Pattern: "xyzzy"}, false},
+		{&query.Substring{Pattern: "izmir"}, true},
+		{&query.Substring{Pattern: "İZMIR"}, true},
+		{&query.Substring{Pattern: "xy"}, true},
+		{&query.Substring{Pattern: "readme", FileName: true}, true},
+		{&query.Substring{Pattern: "readme", Content: true}, false},
+		{&query.Substring{Pattern: "readme"}, true},
+		{&query.Substring{Pattern: "hello", FileName: true}, false},
+		{query.NewAnd(&query.Substring{Pattern: "hello"}, &query.Substring{Pattern: "xyzzy"}), false},
+		{query.NewOr(&query.Substring{Pattern: "hello"}, &query.Substring{Pattern: "xyzzy"}), true},
+		{query.NewOr(&query.Substring{Pattern: "plugh"}, &query.Substring{Pattern: "xyzzy"}), false},
+		{&query.Not{Child: &query.Substring{Pattern: "xyzzy"}}, true},
+		{query.NewAnd(&query.Repo{Pattern: "foo"}, &query.Substring{Pattern: "xyzzy"}), false},
+		{&query.Symbol{Expr: &query.Substring{Pattern: "xyzzy"}}, false},
+		{&query.Const{Value: false}, false},
+		{&query.Const{Value: true}, true},
+		{regexp("Handle.*Request"), true},
+		{regexp("Handle.*Response"), false},
+		{regexp("(hello|xyzzy)"), true},
+		{regexp("(plugh|xyzzy)"), false},
+		{regexp("(plugh)?world"), true},
+		{regexp("x.z"), true},
+	} {
+		if got := f.MayMatch(NewNgramFilterQuery(tc.q)); got != tc.want {
+			t.Errorf("%s: got %v, want %v", tc.q, got, tc.want)
+		}
+	}
+}
+
+func TestNgramFilterFalsePositives(t *testing.T) {
+	var docs []Document
+	for i := 0; i < 1000; i++ {
+		docs = append(docs, Document{
+			Name:    fmt.Sprintf("f%d", i),
+			Content: []byte(fmt.Sprintf("%x %d", i*7919, i*104729)),
+		})
+	}
+	f := searcherForTest(t, testIndexBuilder(t, nil, docs...)).(*indexData).NgramFilter()
+
+	hits := 0
+	const n = 10000
+	for i := 0; i < n; i++ {
+		q := &query.Substring{Pattern: fmt.Sprintf("q%dz", i), Content: true}
+		if f.MayMatch(NewNgramFilterQuery(q)) {
+			hits++
+		}
+	}
+	if hits > n/10 {
+		t.Errorf("got %d of %d false positives", hits, n)
+	}
+}
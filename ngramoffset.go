@@ -15,16 +15,39 @@
 package zoekt
 
 import (
+	"encoding/binary"
+	"math/bits"
 	"sort"
+	"unsafe"
 )
 
 type topOffset struct {
 	top, off uint32
+
+	// fence is where the fences for the section of bots start.
+	fence uint32
+}
+
+// ngramBlock is the number of bots in a 64-byte cache line.
+const ngramBlock = 16
+
+// blockFence is the first bot of a block of ngramBlock bots, and the
+// index of the block within its section.
+type blockFence struct {
+	bot, block uint32
 }
 
 // arrayNgramOffset splits ngrams into two 32-bit parts and uses binary search
 // to satisfy requests. A three-level trie (over the runes of an ngram) uses 20%
 // more memory than this simple two-level split.
+//
+// A binary search over a large section of bots misses the cache on
+// most of its steps. Instead, each section is split in cache line
+// sized blocks, and the first bots of the blocks are kept in fences,
+// in Eytzinger (breadth-first) order: the first steps of every search
+// touch the same few lines, and the children of a node are adjacent,
+// so a search misses the cache once per few levels. The block found
+// is scanned linearly.
 type arrayNgramOffset struct {
 	// tops specify where the bottom halves of ngrams with the 32-bit top half begin.
 	// The offset of the next value is used to find where the bottom section ends.
@@ -33,6 +56,10 @@ type arrayNgramOffset struct {
 	// bots are bottom halves of an ngram, referenced by tops
 	bots []uint32
 
+	// fences holds, for every section of more than ngramBlock bots,
+	// the fences of its blocks in Eytzinger order.
+	fences []blockFence
+
 	// offsets is values from simpleSection.off, simpleSection.sz is computed by subtracting
 	// adjacent offsets.
 	offsets []uint32
@@ -51,7 +78,7 @@ func makeArrayNgramOffset(ngrams []ngram, offsets []uint32) arrayNgramOffset {
 		curTop := uint32(v >> 32)
 		if curTop != lastTop {
 			if lastTop != 0xffffffff {
-				arr.tops = append(arr.tops, topOffset{lastTop, lastStart})
+				arr.tops = append(arr.tops, topOffset{top: lastTop, off: lastStart})
 			}
 			lastTop = curTop
 			lastStart = uint32(i)
@@ -59,37 +86,234 @@ func makeArrayNgramOffset(ngrams []ngram, offsets []uint32) arrayNgramOffset {
 		arr.bots = append(arr.bots, uint32(v))
 	}
 	// add a sentinel value to make it simple to compute sizes
-	arr.tops = append(arr.tops, topOffset{lastTop, lastStart}, topOffset{0xffffffff, uint32(len(arr.bots))})
+	arr.tops = append(arr.tops, topOffset{top: lastTop, off: lastStart}, topOffset{top: 0xffffffff, off: uint32(len(arr.bots))})
 
 	// shrink arr.tops to minimal size
 	tops := make([]topOffset, len(arr.tops))
 	copy(tops, arr.tops)
 	arr.tops = tops
 
+	arr.makeFences()
 	return arr
 }
 
+func (a *arrayNgramOffset) makeFences() {
+	n := 0
+	for i := 0; i < len(a.tops)-1; i++ {
+		if sz := a.tops[i+1].off - a.tops[i].off; sz > ngramBlock {
+			n += int(sz+ngramBlock-1) / ngramBlock
+		}
+	}
+	if n == 0 {
+		return
+	}
+
+	a.fences = make([]blockFence, 0, n)
+	var sorted []blockFence
+	for i := 0; i < len(a.tops)-1; i++ {
+		bots := a.bots[a.tops[i].off:a.tops[i+1].off]
+		a.tops[i].fence = uint32(len(a.fences))
+		if len(bots) <= ngramBlock {
+			continue
+		}
+
+		sorted = sorted[:0]
+		for b := 0; b*ngramBlock < len(bots); b++ {
+			sorted = append(sorted, blockFence{bot: bots[b*ngramBlock], block: uint32(b)})
+		}
+		start := len(a.fences)
+		a.fences = a.fences[:start+len(sorted)]
+		eytzinger(sorted, a.fences[start:], 0, 1)
+	}
+	a.tops[len(a.tops)-1].fence = uint32(len(a.fences))
+}
+
+// eytzinger stores sorted in dst in Eytzinger order, where the
+// children of the node at (1-based) k are at 2k and 2k+1. It fills the
+// subtree at k from sorted[i:], and returns the next i.
+func eytzinger(sorted, dst []blockFence, i, k int) int {
+	if k <= len(dst) {
+		i = eytzinger(sorted, dst, i, 2*k)
+		dst[k-1] = sorted[i]
+		i++
+		i = eytzinger(sorted, dst, i, 2*k+1)
+	}
+	return i
+}
+
+// findTop returns the index of the section for top, or -1.
+func (a *arrayNgramOffset) findTop(top uint32) int {
+	// Tops are few, and stay in cache. The search narrows without
+	// branching on the data, so it has no mispredicted branches.
+	tops := a.tops[:len(a.tops)-1]
+	if len(tops) == 0 {
+		return -1
+	}
+	base, n := 0, len(tops)
+	for n > 1 {
+		half := n >> 1
+		if tops[base+half].top <= top {
+			base += half
+		}
+		n -= half
+	}
+	if tops[base].top != top {
+		return -1
+	}
+	return base
+}
+
+// section returns the result for the bot found at idx, or zero for
+// idx < 0.
+func (a *arrayNgramOffset) section(idx int) simpleSection {
+	if idx < 0 {
+		return simpleSection{}
+	}
+	return simpleSection{
+		off: a.offsets[idx],
+		sz:  a.offsets[idx+1] - a.offsets[idx],
+	}
+}
+
+// scanBlock returns the index of bot in a.bots[start:end], which holds
+// at most ngramBlock bots, or -1.
+func (a *arrayNgramOffset) scanBlock(start, end uint32, bot uint32) int {
+	blk := a.bots[start:end]
+	i := 0
+	for _, b := range blk {
+		if b < bot {
+			i++
+		}
+	}
+	if i < len(blk) && blk[i] == bot {
+		return int(start) + i
+	}
+	return -1
+}
+
+// block returns the bounds of the block that the descent to k in the
+// fences of section t ended in, or ok == false if bot is before all.
+func (a *arrayNgramOffset) block(t int, k int) (start, end uint32, ok bool) {
+	lo, hi := a.tops[t].off, a.tops[t+1].off
+	fences := a.fences[a.tops[t].fence:a.tops[t+1].fence]
+
+	// k went right at every fence <= bot. Dropping its trailing right
+	// turns, and the last left turn, gives the first fence > bot.
+	k >>= uint(bits.TrailingZeros(^uint(k))) + 1
+	var b uint32
+	if k == 0 {
+		b = uint32(len(fences)) - 1
+	} else if fences[k-1].block == 0 {
+		return 0, 0, false
+	} else {
+		b = fences[k-1].block - 1
+	}
+
+	start = lo + b*ngramBlock
+	end = start + ngramBlock
+	if end > hi {
+		end = hi
+	}
+	return start, end, true
+}
+
 func (a *arrayNgramOffset) Get(gram ngram) simpleSection {
 	if a.tops == nil {
 		return simpleSection{}
 	}
 
 	top, bot := uint32(uint64(gram)>>32), uint32(gram)
-
-	topIdx := sort.Search(len(a.tops)-1, func(i int) bool { return a.tops[i].top >= top })
-	if topIdx == len(a.tops)-1 || a.tops[topIdx].top != top {
+	t := a.findTop(top)
+	if t < 0 {
 		return simpleSection{}
 	}
 
-	botsSec := a.bots[a.tops[topIdx].off:a.tops[topIdx+1].off]
-	botIdx := sort.Search(len(botsSec), func(i int) bool { return botsSec[i] >= bot })
-	if botIdx == len(botsSec) || botsSec[botIdx] != bot {
+	fences := a.fences[a.tops[t].fence:a.tops[t+1].fence]
+	if len(fences) == 0 {
+		return a.section(a.scanBlock(a.tops[t].off, a.tops[t+1].off, bot))
+	}
+
+	k := 1
+	for k <= len(fences) {
+		k = 2 * k
+		if fences[k/2-1].bot <= bot {
+			k++
+		}
+	}
+	start, end, ok := a.block(t, k)
+	if !ok {
 		return simpleSection{}
 	}
-	idx := botIdx + int(a.tops[topIdx].off)
-	return simpleSection{
-		off: a.offsets[idx],
-		sz:  a.offsets[idx+1] - a.offsets[idx],
+	return a.section(a.scanBlock(start, end, bot))
+}
+
+// ngramBatch is the number of lookups GetMany runs in lockstep.
+const ngramBatch = 8
+
+// GetMany looks up every ngram of grams, and stores the results in
+// out, which must be as long. The fence descents of up to ngramBatch
+// ngrams are interleaved, so their cache misses overlap.
+func (a *arrayNgramOffset) GetMany(grams []ngram, out []simpleSection) {
+	for len(grams) > 0 {
+		n := len(grams)
+		if n > ngramBatch {
+			n = ngramBatch
+		}
+		a.getBatch(grams[:n], out[:n])
+		grams, out = grams[n:], out[n:]
+	}
+}
+
+func (a *arrayNgramOffset) getBatch(grams []ngram, out []simpleSection) {
+	var (
+		ts     [ngramBatch]int
+		ks     [ngramBatch]int
+		fences [ngramBatch][]blockFence
+	)
+
+	depth := 0
+	for i, g := range grams {
+		out[i] = simpleSection{}
+		ts[i] = -1
+		ks[i] = 1
+		if a.tops == nil {
+			continue
+		}
+		ts[i] = a.findTop(uint32(uint64(g) >> 32))
+		if ts[i] < 0 {
+			continue
+		}
+		t := ts[i]
+		fences[i] = a.fences[a.tops[t].fence:a.tops[t+1].fence]
+		if d := bits.Len(uint(len(fences[i]))); d > depth {
+			depth = d
+		}
+	}
+
+	for d := 0; d < depth; d++ {
+		for i, g := range grams {
+			if k := ks[i]; k <= len(fences[i]) {
+				k = 2 * k
+				if fences[i][k/2-1].bot <= uint32(g) {
+					k++
+				}
+				ks[i] = k
+			}
+		}
+	}
+
+	for i, g := range grams {
+		t := ts[i]
+		if t < 0 {
+			continue
+		}
+		if len(fences[i]) == 0 {
+			out[i] = a.section(a.scanBlock(a.tops[t].off, a.tops[t+1].off, uint32(g)))
+			continue
+		}
+		if start, end, ok := a.block(t, ks[i]); ok {
+			out[i] = a.section(a.scanBlock(start, end, uint32(g)))
+		}
 	}
 }
 
@@ -109,6 +333,68 @@ func (a *arrayNgramOffset) DumpMap() map[ngram]simpleSection {
 	return m
 }
 
+// forEach calls f for every ngram, in order.
+func (a *arrayNgramOffset) forEach(f func(ngram)) {
+	for i := 0; i < len(a.tops)-1; i++ {
+		top := uint64(a.tops[i].top) << 32
+		for _, bot := range a.bots[a.tops[i].off:a.tops[i+1].off] {
+			f(ngram(top | uint64(bot)))
+		}
+	}
+}
+
 func (a *arrayNgramOffset) SizeBytes() int {
-	return 8*len(a.tops) + 4*len(a.bots) + 4*len(a.offsets)
+	return 12*len(a.tops) + 4*len(a.bots) + 8*len(a.fences) + 4*len(a.offsets)
+}
+
+// sortedNgramPostings finds posting lists by binary search over the
+// sorted ngram and offset sections of an index file. Entries are
+// decoded on demand, so unlike arrayNgramOffset it needs no memory
+// beyond the (mmap-ed) sections.
+type sortedNgramPostings struct {
+	// ngramText holds the sorted ngrams, as big endian uint64s.
+	ngramText []byte
+
+	// index holds the file offset of each posting list, as big
+	// endian uint32s.
+	index []byte
+
+	// postings holds the posting lists. postingsOff is its file
+	// offset.
+	postings    []byte
+	postingsOff uint32
+}
+
+func (s *sortedNgramPostings) count() int {
+	return len(s.ngramText) / ngramEncoding
+}
+
+func (s *sortedNgramPostings) ngram(i int) ngram {
+	return ngram(binary.BigEndian.Uint64(s.ngramText[i*ngramEncoding:]))
+}
+
+// postingList returns the posting list of the i-th ngram.
+func (s *sortedNgramPostings) postingList(i int) []byte {
+	start := binary.BigEndian.Uint32(s.index[4*i:]) - s.postingsOff
+	end := uint32(len(s.postings))
+	if i+1 < s.count() {
+		end = binary.BigEndian.Uint32(s.index[4*(i+1):]) - s.postingsOff
+	}
+	return s.postings[start:end]
+}
+
+// Get returns the posting list of gram, or nil if it doesn't occur.
+func (s *sortedNgramPostings) Get(gram ngram) []byte {
+	n := s.count()
+	i := sort.Search(n, func(i int) bool { return s.ngram(i) >= gram })
+	if i == n || s.ngram(i) != gram {
+		return nil
+	}
+	return s.postingList(i)
+}
+
+// SizeBytes returns the heap memory used. The sections themselves
+// reference the index file.
+func (s *sortedNgramPostings) SizeBytes() int {
+	return int(unsafe.Sizeof(*s))
 }
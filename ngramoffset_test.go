@@ -15,7 +15,16 @@
 package zoekt
 
 import (
+	"encoding/binary"
+	"errors"
 	"fmt"
+	"io/ioutil"
+	"math/rand"
+	"os"
+	"path/filepath"
+	"runtime"
+	"sort"
+	"strings"
 	"testing"
 )
 
@@ -55,6 +64,170 @@ func TestMakeArrayNgramOffset(t *testing.T) {
 	}
 }
 
+func TestArrayNgramOffsetBlocks(t *testing.T) {
+	rnd := rand.New(rand.NewSource(1))
+	set := map[ngram]bool{}
+	// Few tops, so sections span many blocks.
+	for len(set) < 5000 {
+		set[runesToNGram([ngramSize]rune{rune('a' + rnd.Intn(4)), rune(rnd.Intn(300)), rune(rnd.Intn(300))})] = true
+	}
+	// Sections of one block, and of a single bot.
+	set[stringToNGram("xyz")] = true
+	for i := 0; i < ngramBlock; i++ {
+		set[runesToNGram([ngramSize]rune{'y', 'a', rune('a' + i)})] = true
+	}
+
+	var ngrams ngramSlice
+	for ng := range set {
+		ngrams = append(ngrams, ng)
+	}
+	sort.Sort(ngrams)
+	offsets := make([]uint32, len(ngrams)+1)
+	for i := range ngrams {
+		offsets[i+1] = offsets[i] + uint32(i%7)
+	}
+	a := makeArrayNgramOffset(ngrams, offsets)
+
+	var probes []ngram
+	for i, ng := range ngrams {
+		probes = append(probes, ng, ng-1, ng+1)
+		if got, want := a.Get(ng), (simpleSection{offsets[i], offsets[i+1] - offsets[i]}); got != want {
+			t.Fatalf("Get(%v): got %v, want %v", ng, got, want)
+		}
+	}
+	probes = append(probes, 0, stringToNGram("zzz"), ngram(1<<63-1))
+
+	many := make([]simpleSection, len(probes))
+	a.GetMany(probes, many)
+	for i, ng := range probes {
+		want := simpleSection{}
+		if j := sort.Search(len(ngrams), func(j int) bool { return ngrams[j] >= ng }); j < len(ngrams) && ngrams[j] == ng {
+			want = simpleSection{offsets[j], offsets[j+1] - offsets[j]}
+		}
+		if got := a.Get(ng); got != want {
+			t.Errorf("Get(%v): got %v, want %v", ng, got, want)
+		}
+		if many[i] != want {
+			t.Errorf("GetMany(%v): got %v, want %v", ng, many[i], want)
+		}
+	}
+}
+
+// binarySearchGet is the lookup before blocks and fences, for
+// comparison.
+func (a *arrayNgramOffset) binarySearchGet(gram ngram) simpleSection {
+	if a.tops == nil {
+		return simpleSection{}
+	}
+
+	top, bot := uint32(uint64(gram)>>32), uint32(gram)
+
+	topIdx := sort.Search(len(a.tops)-1, func(i int) bool { return a.tops[i].top >= top })
+	if topIdx == len(a.tops)-1 || a.tops[topIdx].top != top {
+		return simpleSection{}
+	}
+
+	botsSec := a.bots[a.tops[topIdx].off:a.tops[topIdx+1].off]
+	botIdx := sort.Search(len(botsSec), func(i int) bool { return botsSec[i] >= bot })
+	if botIdx == len(botsSec) || botsSec[botIdx] != bot {
+		return simpleSection{}
+	}
+	return a.section(botIdx + int(a.tops[topIdx].off))
+}
+
+// BenchmarkArrayNgramOffset looks up the case variants of ngrams in
+// a shard of up to 32mb of Go source, from GOROOT.
+func BenchmarkArrayNgramOffset(b *testing.B) {
+	ib, err := NewIndexBuilder(nil)
+	if err != nil {
+		b.Fatal(err)
+	}
+	var content []byte
+	errFull := errors.New("full")
+	err = filepath.Walk(filepath.Join(runtime.GOROOT(), "src"), func(path string, info os.FileInfo, err error) error {
+		if err != nil || info.IsDir() || !strings.HasSuffix(path, ".go") {
+			return err
+		}
+		c, err := ioutil.ReadFile(path)
+		if err != nil {
+			return err
+		}
+		if err := ib.AddFile(path, c); err != nil {
+			return err
+		}
+		content = append(content, c...)
+		if len(content) > 32<<20 {
+			return errFull
+		}
+		return nil
+	})
+	if err != nil && err != errFull {
+		b.Fatal(err)
+	}
+	if len(content) < 1<<20 {
+		b.Skipf("found %d bytes of source in GOROOT", len(content))
+	}
+	d := searcherForTest(b, ib).(*indexData)
+	b.Logf("%d ngrams, %d bytes", len(d.ngrams.bots), d.ngrams.SizeBytes())
+
+	rnd := rand.New(rand.NewSource(1))
+	var grams []ngram
+	for len(grams) < 1<<14 {
+		off := rnd.Intn(len(content) - 64)
+		for _, o := range splitNGrams(content[off : off+8]) {
+			grams = append(grams, generateCaseNgrams(o.ngram)...)
+		}
+	}
+
+	b.Run("binary", func(b *testing.B) {
+		for i := 0; i < b.N; i++ {
+			d.ngrams.binarySearchGet(grams[i%len(grams)])
+		}
+	})
+	b.Run("fences", func(b *testing.B) {
+		for i := 0; i < b.N; i++ {
+			d.ngrams.Get(grams[i%len(grams)])
+		}
+	})
+	b.Run("many", func(b *testing.B) {
+		out := make([]simpleSection, 64)
+		for i := 0; i < b.N; i += len(out) {
+			j := i % (len(grams) - len(out))
+			d.ngrams.GetMany(grams[j:j+len(out)], out)
+		}
+	})
+}
+
+func TestSortedNgramPostings(t *testing.T) {
+	grams := []string{"ant", "any", "awl", "big"}
+	offsets := []uint32{100, 102, 105, 105}
+	postings := []byte("abcdefghij")
+
+	var s sortedNgramPostings
+	for i, g := range grams {
+		var buf [8]byte
+		binary.BigEndian.PutUint64(buf[:], uint64(stringToNGram(g)))
+		s.ngramText = append(s.ngramText, buf[:]...)
+		binary.BigEndian.PutUint32(buf[:], offsets[i])
+		s.index = append(s.index, buf[:4]...)
+	}
+	s.postings = postings
+	s.postingsOff = 100
+
+	for g, want := range map[string]string{
+		"ant": "ab",
+		"any": "cde",
+		"awl": "",
+		"big": "fghij",
+		"aaa": "",
+		"zzz": "",
+	} {
+		if got := s.Get(stringToNGram(g)); string(got) != want {
+			t.Errorf("Get(%q): got %q, want %q", g, got, want)
+		}
+	}
+}
+
 func (a *arrayNgramOffset) String() string {
 	o := "arrayNgramOffset{tops:{"
 	for i, p := range a.tops {
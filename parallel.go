@@ -0,0 +1,200 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package zoekt
+
+import (
+	"context"
+	"sort"
+	"sync"
+	"sync/atomic"
+
+	"github.com/google/zoekt/query"
+)
+
+// A shard is only split if it has at least this many documents or
+// bytes of content. Smaller shards are cheaper to search than to set
+// up a match tree per chunk. These are variables for testing.
+var (
+	parallelMinDocs         = 100000
+	parallelMinContentBytes = uint32(256 << 20)
+)
+
+// chunksPerWorker splits a shard into more chunks than workers, so a
+// chunk with many expensive matches doesn't hold up the others.
+const chunksPerWorker = 4
+
+// shardParallelism returns the number of goroutines to search d
+// with.
+func (d *indexData) shardParallelism(opts *SearchOptions) int {
+	n := opts.ShardParallelism
+	if n < 2 {
+		return 1
+	}
+	docCount := len(d.fileBranchMasks)
+	if docCount < parallelMinDocs && d.contentSize() < parallelMinContentBytes {
+		return 1
+	}
+	if n > docCount {
+		n = docCount
+	}
+	return n
+}
+
+// contentSize returns the total size of the file contents.
+func (d *indexData) contentSize() uint32 {
+	if len(d.boundaries) == 0 {
+		return 0
+	}
+	return d.boundaries[len(d.boundaries)-1]
+}
+
+// chunkBoundaries splits the documents into at most m ranges of
+// about the same amount of content. Range i is [b[i], b[i+1]).
+func (d *indexData) chunkBoundaries(m int) []uint32 {
+	docCount := uint32(len(d.fileBranchMasks))
+	total := uint64(d.contentSize())
+
+	bounds := []uint32{0}
+	for i := 1; i < m; i++ {
+		target := uint32(total * uint64(i) / uint64(m))
+		doc := uint32(sort.Search(int(docCount), func(j int) bool {
+			return d.boundaries[j] >= target
+		}))
+		if doc > bounds[len(bounds)-1] && doc < docCount {
+			bounds = append(bounds, doc)
+		}
+	}
+	return append(bounds, docCount)
+}
+
+// searchParallel is like searchDocs over all documents, but evaluates
+// chunks of documents on n goroutines. Each chunk has its own match
+// tree and content provider. The results are merged in doc order, and
+// the shard limits are applied to the merged files as the sequential
+// search would have.
+//
+// If top is set, each chunk collects its own topFiles, which are
+// merged into top. A chunk may drop the candidates of a file in favor
+// of files that the shard limits then drop, so a limited search may
+// miss files the sequential search returns.
+func (d *indexData) searchParallel(ctx context.Context, q query.Q, opts *SearchOptions, n int, res *SearchResult, top *topFiles) error {
+	bounds := d.chunkBoundaries(n * chunksPerWorker)
+	chunks := make([]SearchResult, len(bounds)-1)
+	errs := make([]error, len(chunks))
+	var tops []*topFiles
+	if top != nil {
+		tops = make([]*topFiles, len(chunks))
+		for i := range tops {
+			tops[i] = newTopFiles(top.k)
+		}
+	}
+
+	var (
+		next     = int64(-1)
+		wg       sync.WaitGroup
+		mu       sync.Mutex
+		panicked interface{}
+	)
+	for w := 0; w < n; w++ {
+		wg.Add(1)
+		go func() {
+			defer wg.Done()
+			defer func() {
+				if r := recover(); r != nil {
+					mu.Lock()
+					if panicked == nil {
+						panicked = r
+					}
+					mu.Unlock()
+				}
+			}()
+			for {
+				i := int(atomic.AddInt64(&next, 1))
+				if i >= len(chunks) {
+					return
+				}
+				var chunkTop *topFiles
+				if tops != nil {
+					chunkTop = tops[i]
+				}
+				errs[i] = d.searchDocs(ctx, q, opts, bounds[i], bounds[i+1], &chunks[i], chunkTop)
+			}
+		}()
+	}
+	wg.Wait()
+
+	// Re-panic on the calling goroutine, where the shard searcher
+	// recovers crashes.
+	if panicked != nil {
+		panic(panicked)
+	}
+	for _, err := range errs {
+		if err != nil {
+			return err
+		}
+	}
+
+	limited := func(matchCount, importantMatchCount int) bool {
+		return (opts.ShardMaxMatchCount > 0 && matchCount >= opts.ShardMaxMatchCount) ||
+			(opts.ShardMaxImportantMatch > 0 && importantMatchCount >= opts.ShardMaxImportantMatch)
+	}
+	matchCount, importantMatchCount, fileCount := 0, 0, 0
+	for i := range chunks {
+		c := &chunks[i]
+		res.Stats.Add(c.Stats)
+		if c.Profile != nil {
+			if res.Profile == nil {
+				res.Profile = &QueryProfile{}
+			}
+			res.Profile.Add(c.Profile)
+		}
+
+		if tops != nil {
+			for _, f := range tops[i].files {
+				if limited(matchCount, importantMatchCount) {
+					res.Stats.FilesSkipped++
+					continue
+				}
+				top.addFile(tops[i], f)
+				fileCount++
+				matchCount += f.matches
+				if f.score > scoreImportantThreshold {
+					importantMatchCount++
+				}
+			}
+			continue
+		}
+
+		for _, f := range c.Files {
+			if limited(matchCount, importantMatchCount) {
+				res.Stats.FilesSkipped++
+				continue
+			}
+			res.Files = append(res.Files, f)
+			fileCount++
+			matchCount += len(f.LineMatches)
+			if f.Score > scoreImportantThreshold {
+				importantMatchCount++
+			}
+		}
+	}
+	res.Stats.MatchCount = matchCount
+	res.Stats.FileCount = fileCount
+	if res.Profile != nil {
+		// The chunks are of one shard.
+		res.Profile.Shards = 1
+	}
+	return nil
+}
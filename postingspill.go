@@ -0,0 +1,222 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package zoekt
+
+import (
+	"bufio"
+	"container/heap"
+	"encoding/binary"
+	"fmt"
+	"io"
+	"io/ioutil"
+	"os"
+	"sort"
+)
+
+// postingEntryOverhead estimates the memory of a postings map entry
+// besides its data: the key, the slice header and the map's own
+// bookkeeping.
+const postingEntryOverhead = 48
+
+// postingSpill holds the posting list runs a postingsBuilder wrote to
+// a temporary file to stay within its memory budget. Run i is
+// [runEnds[i-1], runEnds[i]) of the file, and holds
+//
+//	per ngram, sorted: uint64 ngram, uvarint(len(deltas)), deltas
+//
+// for the postings added since the previous run. As the deltas are
+// relative to the last offset across runs, the posting list of an
+// ngram is the concatenation of its deltas in all runs.
+type postingSpill struct {
+	dir    string
+	budget int
+
+	f       *os.File
+	w       *bufio.Writer
+	off     int64
+	runEnds []int64
+}
+
+// spillRun writes the postings held in memory to a new run.
+func (s *postingsBuilder) spillRun() error {
+	sp := s.spill
+	if sp.f == nil {
+		if err := os.MkdirAll(sp.dir, 0o700); err != nil {
+			return err
+		}
+		f, err := ioutil.TempFile(sp.dir, "zoekt-postings.*.tmp")
+		if err != nil {
+			return err
+		}
+		sp.f = f
+		sp.w = bufio.NewWriterSize(f, 1<<20)
+	}
+
+	keys := make(ngramSlice, 0, len(s.postings))
+	for k := range s.postings {
+		keys = append(keys, k)
+	}
+	sort.Sort(keys)
+
+	var buf [8 + binary.MaxVarintLen64]byte
+	for _, k := range keys {
+		p := s.postings[k]
+		binary.BigEndian.PutUint64(buf[:], uint64(k))
+		m := 8 + binary.PutUvarint(buf[8:], uint64(len(p)))
+		sp.w.Write(buf[:m])
+		sp.w.Write(p)
+		sp.off += int64(m + len(p))
+	}
+	if err := sp.w.Flush(); err != nil {
+		return err
+	}
+	sp.runEnds = append(sp.runEnds, sp.off)
+
+	s.postings = make(map[ngram][]byte, len(keys))
+	s.postingsSize = 0
+	return nil
+}
+
+// openRuns returns readers for the spilled runs, positioned at their
+// first ngram.
+func (sp *postingSpill) openRuns() []*postingRunReader {
+	runs := make([]*postingRunReader, 0, len(sp.runEnds))
+	var start int64
+	for _, end := range sp.runEnds {
+		r := &postingRunReader{
+			run: len(runs),
+			r:   bufio.NewReaderSize(io.NewSectionReader(sp.f, start, end-start), 64<<10),
+		}
+		r.next()
+		runs = append(runs, r)
+		start = end
+	}
+	return runs
+}
+
+// remove deletes the temporary file.
+func (sp *postingSpill) remove() {
+	if sp.f != nil {
+		sp.f.Close()
+		os.Remove(sp.f.Name())
+		sp.f = nil
+	}
+	sp.runEnds = nil
+	sp.off = 0
+}
+
+// postingRunReader iterates over the ngrams of a spilled run.
+type postingRunReader struct {
+	run int
+	r   *bufio.Reader
+
+	ng     ngram
+	deltas []byte
+	done   bool
+	err    error
+}
+
+func (r *postingRunReader) next() {
+	var hdr [8]byte
+	if _, err := io.ReadFull(r.r, hdr[:]); err != nil {
+		if err != io.EOF {
+			r.err = err
+		}
+		r.done = true
+		return
+	}
+	r.ng = ngram(binary.BigEndian.Uint64(hdr[:]))
+
+	n, err := binary.ReadUvarint(r.r)
+	if err != nil {
+		r.err, r.done = err, true
+		return
+	}
+	if uint64(cap(r.deltas)) < n {
+		r.deltas = make([]byte, n)
+	}
+	r.deltas = r.deltas[:n]
+	if _, err := io.ReadFull(r.r, r.deltas); err != nil {
+		r.err, r.done = err, true
+	}
+}
+
+// mergedPostings calls f with the posting list of each of keys, in
+// order, joining the spilled runs and the postings in memory. keys
+// must be sorted and contain every ngram.
+func (s *postingsBuilder) mergedPostings(keys []ngram, f func(ngram, []byte)) error {
+	if s.spill == nil || len(s.spill.runEnds) == 0 {
+		for _, k := range keys {
+			f(k, s.postings[k])
+		}
+		return nil
+	}
+
+	runs := s.spill.openRuns()
+	var h postingRunHeap
+	for _, r := range runs {
+		if !r.done {
+			h = append(h, r)
+		}
+	}
+	heap.Init(&h)
+
+	var merged []byte
+	for _, k := range keys {
+		merged = merged[:0]
+		for len(h) > 0 && h[0].ng == k {
+			r := h[0]
+			merged = append(merged, r.deltas...)
+			r.next()
+			if r.done {
+				heap.Pop(&h)
+			} else {
+				heap.Fix(&h, 0)
+			}
+		}
+		f(k, append(merged, s.postings[k]...))
+	}
+
+	for _, r := range runs {
+		if r.err != nil {
+			return r.err
+		}
+	}
+	if len(h) > 0 {
+		return fmt.Errorf("posting run %d has unknown ngram %v", h[0].run, h[0].ng)
+	}
+	return nil
+}
+
+// postingRunHeap orders runs by their current ngram. Runs at the same
+// ngram come out in run order, so their deltas join in the order
+// they were written.
+type postingRunHeap []*postingRunReader
+
+func (h postingRunHeap) Len() int { return len(h) }
+func (h postingRunHeap) Less(i, j int) bool {
+	if h[i].ng != h[j].ng {
+		return h[i].ng < h[j].ng
+	}
+	return h[i].run < h[j].run
+}
+func (h postingRunHeap) Swap(i, j int)       { h[i], h[j] = h[j], h[i] }
+func (h *postingRunHeap) Push(x interface{}) { *h = append(*h, x.(*postingRunReader)) }
+func (h *postingRunHeap) Pop() interface{} {
+	old := *h
+	x := old[len(old)-1]
+	*h = old[:len(old)-1]
+	return x
+}
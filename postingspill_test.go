@@ -0,0 +1,137 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package zoekt
+
+import (
+	"bufio"
+	"bytes"
+	"fmt"
+	"io/ioutil"
+	"math/rand"
+	"testing"
+
+	"github.com/google/zoekt/query"
+)
+
+func spillTestDocs() []Document {
+	rng := rand.New(rand.NewSource(1))
+	words := []string{"alpha", "beta", "gamma", "delta", "épsilon", "zeta", "eta", "θeta"}
+
+	var docs []Document
+	for i := 0; i < 200; i++ {
+		var buf bytes.Buffer
+		for j := rng.Intn(50); j >= 0; j-- {
+			fmt.Fprintf(&buf, "%s%d ", words[rng.Intn(len(words))], rng.Intn(20))
+		}
+		docs = append(docs, Document{
+			Name:    fmt.Sprintf("dir/%s/file%d", words[i%len(words)], i),
+			Content: buf.Bytes(),
+		})
+	}
+	return docs
+}
+
+func writeTestPostings(t *testing.T, s *postingsBuilder, blocked bool) []byte {
+	t.Helper()
+	var out bytes.Buffer
+	buffered := bufio.NewWriter(&out)
+	w := &writer{w: buffered}
+	var toc indexTOC
+	if err := writePostings(w, s, &toc.ngramText, &toc.runeOffsets, &toc.postings, &toc.fileEndRunes, blocked, postingEncodingVarint); err != nil {
+		t.Fatal(err)
+	}
+	buffered.Flush()
+	return out.Bytes()
+}
+
+func TestSpillPostings(t *testing.T) {
+	for _, blocked := range []bool{false, true} {
+		t.Run(fmt.Sprintf("blocked=%t", blocked), func(t *testing.T) {
+			dir := t.TempDir()
+			want := testIndexBuilder(t, nil, spillTestDocs()...)
+
+			got, err := NewIndexBuilder(nil)
+			if err != nil {
+				t.Fatal(err)
+			}
+			got.SpillPostings(dir, 1000)
+			for _, d := range spillTestDocs() {
+				if err := got.Add(d); err != nil {
+					t.Fatal(err)
+				}
+			}
+			if n := len(got.contentPostings.spill.runEnds); n < 10 {
+				t.Fatalf("got %d content runs, want many", n)
+			}
+
+			if !bytes.Equal(writeTestPostings(t, want.contentPostings, blocked), writeTestPostings(t, got.contentPostings, blocked)) {
+				t.Error("content postings differ after spilling")
+			}
+			if !bytes.Equal(writeTestPostings(t, want.namePostings, blocked), writeTestPostings(t, got.namePostings, blocked)) {
+				t.Error("name postings differ after spilling")
+			}
+			if fs, _ := ioutil.ReadDir(dir); len(fs) != 0 {
+				t.Errorf("spill files %v left after writing", fs)
+			}
+		})
+	}
+}
+
+func TestSpillPostingsSearch(t *testing.T) {
+	b, err := NewIndexBuilder(nil)
+	if err != nil {
+		t.Fatal(err)
+	}
+	b.SpillPostings(t.TempDir(), 100)
+	docs := spillTestDocs()
+	for _, d := range docs {
+		if err := b.Add(d); err != nil {
+			t.Fatal(err)
+		}
+	}
+
+	want := 0
+	for _, d := range docs {
+		if bytes.Contains(d.Content, []byte("θeta7 ")) {
+			want++
+		}
+	}
+	res := searchForTest(t, b, &query.Substring{Pattern: "θeta7 ", CaseSensitive: true})
+	if len(res.Files) != want || want == 0 {
+		t.Errorf("got %d files, want %d", len(res.Files), want)
+	}
+}
+
+func TestSpillPostingsClose(t *testing.T) {
+	dir := t.TempDir()
+	b, err := NewIndexBuilder(nil)
+	if err != nil {
+		t.Fatal(err)
+	}
+	b.SpillPostings(dir, 100)
+	for _, d := range spillTestDocs() {
+		if err := b.Add(d); err != nil {
+			t.Fatal(err)
+		}
+	}
+	if fs, _ := ioutil.ReadDir(dir); len(fs) == 0 {
+		t.Fatal("no spill files written")
+	}
+
+	b.Close()
+	if fs, _ := ioutil.ReadDir(dir); len(fs) != 0 {
+		t.Errorf("spill files %v left after Close", fs)
+	}
+}
@@ -0,0 +1,158 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package zoekt
+
+import (
+	"fmt"
+	"time"
+)
+
+type profiledNode struct {
+	*ProfileNode
+
+	// The last documents the node was evaluated on and matched.
+	lastDoc, lastMatch int64
+}
+
+// matchProfiler records the cost of the nodes of a match tree while
+// searching a document range, for SearchOptions.Profile.
+type matchProfiler struct {
+	profile QueryProfile
+	nodes   map[matchTree]*profiledNode
+}
+
+func newMatchProfiler(mt matchTree) *matchProfiler {
+	p := &matchProfiler{
+		profile: QueryProfile{Shards: 1},
+		nodes:   map[matchTree]*profiledNode{},
+	}
+	walkMatchTree(mt, 0, func(t matchTree, depth int) {
+		p.profile.Nodes = append(p.profile.Nodes, ProfileNode{
+			Depth: depth,
+			Node:  describeMatchTree(t),
+		})
+	})
+	i := 0
+	walkMatchTree(mt, 0, func(t matchTree, depth int) {
+		p.nodes[t] = &profiledNode{ProfileNode: &p.profile.Nodes[i], lastDoc: -1, lastMatch: -1}
+		i++
+	})
+	return p
+}
+
+// matches evaluates mt, recording its cost.
+func (p *matchProfiler) matches(cp *contentProvider, cost int, known *knownMatches, mt matchTree) (bool, bool) {
+	n := p.nodes[mt]
+	if n == nil {
+		return mt.matches(cp, cost, known)
+	}
+
+	loaded := cp.stats.ContentBytesLoaded
+	start := time.Now()
+	v, ok := mt.matches(cp, cost, known)
+	n.Time += time.Since(start)
+	n.ContentBytesLoaded += cp.stats.ContentBytesLoaded - loaded
+
+	n.Evals++
+	doc := int64(cp.idx)
+	if n.lastDoc != doc {
+		n.lastDoc = doc
+		n.Docs++
+	}
+	if ok && v && n.lastMatch != doc {
+		n.lastMatch = doc
+		n.Matched++
+		switch t := mt.(type) {
+		case *substrMatchTree:
+			n.Candidates += len(t.current)
+		case *symbolSubstrMatchTree:
+			n.Candidates += len(t.current)
+		case *regexpMatchTree:
+			n.Candidates += len(t.found)
+		case *symbolRegexpMatchTree:
+			n.Candidates += len(t.found)
+		case *symbolDictMatchTree:
+			n.Candidates += len(t.found)
+		}
+	}
+	return v, ok
+}
+
+// walkMatchTree calls f on the nodes of t that are evaluated through
+// evalMatchTree, in preorder. Unlike visitMatchTree it includes inner
+// nodes.
+func walkMatchTree(t matchTree, depth int, f func(t matchTree, depth int)) {
+	f(t, depth)
+	switch s := t.(type) {
+	case *andMatchTree:
+		for _, ch := range s.children {
+			walkMatchTree(ch, depth+1, f)
+		}
+	case *orMatchTree:
+		for _, ch := range s.children {
+			walkMatchTree(ch, depth+1, f)
+		}
+	case *andLineMatchTree:
+		for _, ch := range s.children {
+			walkMatchTree(ch, depth+1, f)
+		}
+	case *notMatchTree:
+		walkMatchTree(s.child, depth+1, f)
+	case *fileNameMatchTree:
+		walkMatchTree(s.child, depth+1, f)
+	}
+}
+
+// describeMatchTree describes a node without its children, which are
+// listed on their own, and without per document state, so nodes of
+// different shards compare equal.
+func describeMatchTree(t matchTree) string {
+	switch s := t.(type) {
+	case *andMatchTree:
+		return "and"
+	case *andLineMatchTree:
+		return "and(line)"
+	case *orMatchTree:
+		return "or"
+	case *notMatchTree:
+		return "not"
+	case *fileNameMatchTree:
+		return "f"
+	case *noVisitMatchTree:
+		return fmt.Sprintf("novisit(%s)", describeMatchTree(s.matchTree))
+	case *substrMatchTree:
+		return describeSubstr(s)
+	case *symbolSubstrMatchTree:
+		return fmt.Sprintf("symbol(%s)", describeSubstr(s.substrMatchTree))
+	case *symbolRegexpMatchTree:
+		return fmt.Sprintf("symbol(re(%s))", s.regexp)
+	case *symbolDictMatchTree:
+		if s.regexp != nil {
+			return fmt.Sprintf("symbol(dict(re(%s)))", s.regexp)
+		}
+		return fmt.Sprintf("symbol(dict(%q))", s.substr.Pattern)
+	case *branchQueryMatchTree:
+		return "branch"
+	}
+	return fmt.Sprintf("%v", t)
+}
+
+func describeSubstr(t *substrMatchTree) string {
+	f := ""
+	if t.fileName {
+		f = "f"
+	}
+	return fmt.Sprintf("%ssubstr(%q)", f, t.query.Pattern)
+}
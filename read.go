@@ -15,6 +15,7 @@
 package zoekt
 
 import (
+	"bytes"
 	"encoding/binary"
 	"encoding/json"
 	"fmt"
@@ -59,6 +60,42 @@ func (r *reader) U64() (uint64, error) {
 	return binary.BigEndian.Uint64(b), nil
 }
 
+func (r *reader) Varint() (uint64, error) {
+	// A uvarint of a uint64 is at most 10 bytes, but it may be
+	// shorter at the end of the file.
+	sz, err := r.r.Size()
+	if err != nil {
+		return 0, err
+	}
+	n := uint32(binary.MaxVarintLen64)
+	if r.off+n > sz {
+		n = sz - r.off
+	}
+	b, err := r.r.Read(r.off, n)
+	if err != nil {
+		return 0, err
+	}
+	v, m := binary.Uvarint(b)
+	if m <= 0 {
+		return 0, fmt.Errorf("invalid varint at offset %d", r.off)
+	}
+	r.off += uint32(m)
+	return v, nil
+}
+
+func (r *reader) String() (string, error) {
+	n, err := r.Varint()
+	if err != nil {
+		return "", err
+	}
+	b, err := r.r.Read(r.off, uint32(n))
+	if err != nil {
+		return "", err
+	}
+	r.off += uint32(n)
+	return string(b), nil
+}
+
 func (r *reader) readTOC(toc *indexTOC) error {
 	sz, err := r.r.Size()
 	if err != nil {
@@ -78,6 +115,10 @@ func (r *reader) readTOC(toc *indexTOC) error {
 		return err
 	}
 
+	if sectionCount == 0 {
+		return r.readTaggedTOC(toc, tocSection.off+tocSection.sz)
+	}
+
 	secs := toc.sections()
 
 	if len(secs) != int(sectionCount) {
@@ -92,6 +133,52 @@ func (r *reader) readTOC(toc *indexTOC) error {
 	return nil
 }
 
+// readTaggedTOC reads the sections of a tagged TOC, which ends at
+// offset end. Unknown sections are skipped.
+func (r *reader) readTaggedTOC(toc *indexTOC, end uint32) error {
+	secs := map[string]section{}
+	for _, s := range toc.sectionsTagged() {
+		secs[s.tag] = s.sec
+	}
+
+	for r.off < end {
+		tag, err := r.String()
+		if err != nil {
+			return err
+		}
+		kind, err := r.Varint()
+		if err != nil {
+			return err
+		}
+
+		sec := secs[tag]
+		if sec != nil && sec.kind() == sectionKindCompoundLazy && sectionKind(kind) == sectionKindCompound {
+			// Lazy sections are laid out like compound ones, and
+			// some were written as compound.
+			kind = uint64(sectionKindCompoundLazy)
+		}
+		if sec != nil && sec.kind() == sectionKind(kind) {
+			if err := sec.read(r); err != nil {
+				return err
+			}
+			continue
+		}
+		if sec != nil {
+			return fmt.Errorf("TOC section %q: got kind %d, want %d", tag, kind, sec.kind())
+		}
+
+		switch sectionKind(kind) {
+		case sectionKindSimple:
+			r.off += 8
+		case sectionKindCompound, sectionKindCompoundLazy:
+			r.off += 16
+		default:
+			return fmt.Errorf("TOC section %q: unknown kind %d", tag, kind)
+		}
+	}
+	return nil
+}
+
 func (r *indexData) readSectionBlob(sec simpleSection) ([]byte, error) {
 	return r.file.Read(sec.off, sec.sz)
 }
@@ -139,30 +226,52 @@ func (r *reader) readJSON(data interface{}, sec *simpleSection) error {
 
 func (r *reader) readIndexData(toc *indexTOC) (*indexData, error) {
 	d := indexData{
-		file:           r.r,
-		fileNameNgrams: map[ngram][]byte{},
-		branchIDs:      []map[string]uint{},
-		branchNames:    []map[uint]string{},
+		file:        r.r,
+		branchIDs:   []map[string]uint{},
+		branchNames: []map[uint]string{},
 	}
+	d.adviseSections(toc)
 
-	repo, md, err := r.readMetadata(toc)
-	if md != nil && md.IndexFormatVersion != IndexFormatVersion {
+	repos, md, err := r.readMetadata(toc)
+	if md != nil && md.IndexFormatVersion != IndexFormatVersion && md.IndexFormatVersion != NextIndexFormatVersion {
 		return nil, fmt.Errorf("file is v%d, want v%d", md.IndexFormatVersion, IndexFormatVersion)
 	} else if err != nil {
 		return nil, err
 	}
 
 	d.metaData = *md
-	d.repoMetaData = []Repository{*repo}
+	d.repoMetaData = make([]Repository, 0, len(repos))
+	for _, repo := range repos {
+		d.repoMetaData = append(d.repoMetaData, *repo)
+	}
 
-	d.boundariesStart = toc.fileContents.data.off
+	d.contentStart = toc.fileContents.data.off
 	d.boundaries = toc.fileContents.relativeIndex()
+	if toc.contentEncoding.sz > 0 {
+		blob, err := d.readSectionBlob(toc.contentEncoding)
+		if err != nil {
+			return nil, err
+		}
+		d.contentEncoding = contentEncoding(blob[0])
+		if d.contentEncoding > contentEncodingDeflate {
+			return nil, fmt.Errorf("unknown content encoding %d", d.contentEncoding)
+		}
+	}
+	if d.contentEncoding != contentEncodingRaw {
+		d.contentBlocks = d.boundaries
+		if d.boundaries, err = readSectionU32(d.file, toc.contentBoundaries); err != nil {
+			return nil, err
+		}
+		d.contentCacheID = nextContentCacheID()
+	}
 	d.newlinesStart = toc.newlines.data.off
 	d.newlinesIndex = toc.newlines.relativeIndex()
+	d.newlineCheckpointsStart = toc.newlineCheckpoints.data.off
+	d.newlineCheckpointsIndex = toc.newlineCheckpoints.relativeIndex()
 	d.docSectionsStart = toc.fileSections.data.off
 	d.docSectionsIndex = toc.fileSections.relativeIndex()
 
-	if d.metaData.IndexFormatVersion == 16 {
+	if d.metaData.IndexFormatVersion >= 16 {
 		d.symbols.symKindIndex = toc.symbolKindMap.relativeIndex()
 		d.fileEndSymbol, err = readSectionU32(d.file, toc.fileEndSymbol)
 		if err != nil {
@@ -183,6 +292,17 @@ func (r *reader) readIndexData(toc *indexTOC) (*indexData, error) {
 		}
 	}
 
+	if toc.symbolNames.data.sz > 0 {
+		d.symbolDict.namesIndex = toc.symbolNames.relativeIndex()
+		d.symbolDict.postingsIndex = toc.symbolPostings.relativeIndex()
+		if d.symbolDict.names, err = d.readSectionBlob(toc.symbolNames.data); err != nil {
+			return nil, err
+		}
+		if d.symbolDict.postings, err = d.readSectionBlob(toc.symbolPostings.data); err != nil {
+			return nil, err
+		}
+	}
+
 	d.checksums, err = d.readSectionBlob(toc.contentChecksums)
 	if err != nil {
 		return nil, err
@@ -198,6 +318,17 @@ func (r *reader) readIndexData(toc *indexTOC) (*indexData, error) {
 		return nil, err
 	}
 
+	if toc.postingEncoding.sz > 0 {
+		blob, err := d.readSectionBlob(toc.postingEncoding)
+		if err != nil {
+			return nil, err
+		}
+		d.postingEncoding = postingEncoding(blob[0])
+		if d.postingEncoding > postingEncodingPFOR {
+			return nil, fmt.Errorf("unknown posting encoding %d", d.postingEncoding)
+		}
+	}
+
 	d.fileBranchMasks, err = readSectionU64(d.file, toc.branchMasks)
 	if err != nil {
 		return nil, err
@@ -214,6 +345,7 @@ func (r *reader) readIndexData(toc *indexTOC) (*indexData, error) {
 	if err != nil {
 		return nil, err
 	}
+	d.buildNgramFilter()
 
 	for _, md := range d.repoMetaData {
 		repoBranchIDs := make(map[string]uint, len(md.Branches))
@@ -271,13 +403,27 @@ func (r *reader) readIndexData(toc *indexTOC) (*indexData, error) {
 		return nil, err
 	}
 
-	// This is a hack for now to keep the shard format unchanged. To support shard
-	// merging we will store "repos" in the shard.
-	repos := make([]uint16, 0, len(d.fileBranchMasks))
-	for i := 0; i < len(d.fileBranchMasks); i++ {
-		repos = append(repos, 0) // just support 1 repo for now.
+	// Shards without a repos section hold a single repository.
+	if toc.repos.sz > 0 {
+		blob, err := d.readSectionBlob(toc.repos)
+		if err != nil {
+			return nil, err
+		}
+		if len(blob) != 2*len(d.fileBranchMasks) {
+			return nil, fmt.Errorf("repos section has %d bytes, want %d", len(blob), 2*len(d.fileBranchMasks))
+		}
+		d.repos = make([]uint16, len(d.fileBranchMasks))
+		for i := range d.repos {
+			d.repos[i] = binary.BigEndian.Uint16(blob[2*i:])
+			if int(d.repos[i]) >= len(d.repoMetaData) {
+				return nil, fmt.Errorf("document %d has repository %d, have %d", i, d.repos[i], len(d.repoMetaData))
+			}
+		}
+	} else {
+		d.repos = make([]uint16, len(d.fileBranchMasks))
 	}
-	d.repos = repos
+
+	d.tombstones = d.readTombstones()
 
 	if err := d.calculateStats(); err != nil {
 		return nil, err
@@ -286,14 +432,53 @@ func (r *reader) readIndexData(toc *indexTOC) (*indexData, error) {
 	return &d, nil
 }
 
-func (r *reader) readMetadata(toc *indexTOC) (*Repository, *IndexMetadata, error) {
+// readTombstones returns the bitmap of documents whose name is in
+// their repository's FileTombstones, or nil if there are none.
+func (d *indexData) readTombstones() []uint64 {
+	has := false
+	for _, md := range d.repoMetaData {
+		has = has || len(md.FileTombstones) > 0
+	}
+	if !has {
+		return nil
+	}
+
+	bits := make([]uint64, (len(d.fileBranchMasks)+63)/64)
+	for i := range d.fileBranchMasks {
+		tombstones := d.repoMetaData[d.repos[i]].FileTombstones
+		if _, ok := tombstones[string(d.fileName(uint32(i)))]; ok {
+			bits[i/64] |= 1 << (i % 64)
+		}
+	}
+	return bits
+}
+
+func (r *reader) readMetadata(toc *indexTOC) ([]*Repository, *IndexMetadata, error) {
 	var md IndexMetadata
 	if err := r.readJSON(&md, &toc.metaData); err != nil {
 		return nil, nil, err
 	}
 
+	blob, err := r.r.Read(toc.repoMetaData.off, toc.repoMetaData.sz)
+	if err != nil {
+		return nil, &md, err
+	}
+
+	// Compound shards store a list of repositories. Their metadata
+	// can't be changed through a ".meta" file.
+	if b := bytes.TrimSpace(blob); len(b) > 0 && b[0] == '[' {
+		var repos []*Repository
+		if err := json.Unmarshal(b, &repos); err != nil {
+			return nil, &md, err
+		}
+		if len(repos) == 0 {
+			return nil, &md, fmt.Errorf("compound shard without repositories")
+		}
+		return repos, &md, nil
+	}
+
 	var repo Repository
-	if err := r.readJSON(&repo, &toc.repoMetaData); err != nil {
+	if err := json.Unmarshal(blob, &repo); err != nil {
 		return nil, &md, err
 	}
 
@@ -309,7 +494,7 @@ func (r *reader) readMetadata(toc *indexTOC) (*Repository, *IndexMetadata, error
 		}
 	}
 
-	return &repo, &md, nil
+	return []*Repository{&repo}, &md, nil
 }
 
 const ngramEncoding = 8
@@ -334,29 +519,33 @@ func (d *indexData) readNgrams(toc *indexTOC) (arrayNgramOffset, error) {
 	return makeArrayNgramOffset(ngrams, postingsIndex), nil
 }
 
-func (d *indexData) readFileNameNgrams(toc *indexTOC) (map[ngram][]byte, error) {
+func (d *indexData) readFileNameNgrams(toc *indexTOC) (sortedNgramPostings, error) {
 	nameNgramText, err := d.readSectionBlob(toc.nameNgramText)
 	if err != nil {
-		return nil, err
+		return sortedNgramPostings{}, err
 	}
 
 	fileNamePostingsData, err := d.readSectionBlob(toc.namePostings.data)
 	if err != nil {
-		return nil, err
+		return sortedNgramPostings{}, err
 	}
 
-	fileNamePostingsIndex := toc.namePostings.relativeIndex()
+	fileNamePostingsIndex, err := d.readSectionBlob(toc.namePostings.index)
+	if err != nil {
+		return sortedNgramPostings{}, err
+	}
 
-	fileNameNgrams := make(map[ngram][]byte, len(nameNgramText)/ngramEncoding)
-	for i := 0; i < len(nameNgramText); i += ngramEncoding {
-		j := i / ngramEncoding
-		off := fileNamePostingsIndex[j]
-		end := fileNamePostingsIndex[j+1]
-		ng := ngram(binary.BigEndian.Uint64(nameNgramText[i : i+ngramEncoding]))
-		fileNameNgrams[ng] = fileNamePostingsData[off:end]
+	if len(nameNgramText)%ngramEncoding != 0 || len(fileNamePostingsIndex)/4 != len(nameNgramText)/ngramEncoding {
+		return sortedNgramPostings{}, fmt.Errorf("file name ngrams: got %d bytes of offsets for %d bytes of ngrams",
+			len(fileNamePostingsIndex), len(nameNgramText))
 	}
 
-	return fileNameNgrams, nil
+	return sortedNgramPostings{
+		ngramText:   nameNgramText,
+		index:       fileNamePostingsIndex,
+		postings:    fileNamePostingsData,
+		postingsOff: toc.namePostings.data.off,
+	}, nil
 }
 
 func (d *indexData) verify() error {
@@ -382,33 +571,41 @@ func (d *indexData) verify() error {
 	return nil
 }
 
-func (d *indexData) readContents(i uint32) ([]byte, error) {
-	return d.readSectionBlob(simpleSection{
-		off: d.boundariesStart + d.boundaries[i],
-		sz:  d.boundaries[i+1] - d.boundaries[i],
-	})
+// readContents returns the content of document i. The compressed
+// content read to decompress it is counted in stats, if it is not
+// nil.
+func (d *indexData) readContents(i uint32, stats *Stats) ([]byte, error) {
+	return d.readContentSlice(d.boundaries[i], d.boundaries[i+1]-d.boundaries[i], stats)
 }
 
-func (d *indexData) readContentSlice(off uint32, sz uint32) ([]byte, error) {
+func (d *indexData) readContentSlice(off uint32, sz uint32, stats *Stats) ([]byte, error) {
+	if d.contentEncoding != contentEncodingRaw {
+		return d.readCompressedContent(off, sz, stats)
+	}
 	// TODO(hanwen): cap result if it is at the end of the content
 	// section.
 	return d.readSectionBlob(simpleSection{
-		off: d.boundariesStart + off,
+		off: d.contentStart + off,
 		sz:  sz,
 	})
 }
 
-func (d *indexData) readNewlines(i uint32, buf []uint32) ([]uint32, uint32, error) {
-	sec := simpleSection{
+// readNewlines returns the newline section of document i, and its
+// checkpoints if the shard has them.
+func (d *indexData) readNewlines(i uint32) (section, checkpoints []byte, err error) {
+	section, err = d.readSectionBlob(simpleSection{
 		off: d.newlinesStart + d.newlinesIndex[i],
 		sz:  d.newlinesIndex[i+1] - d.newlinesIndex[i],
-	}
-	blob, err := d.readSectionBlob(sec)
-	if err != nil {
-		return nil, 0, err
+	})
+	if err != nil || len(d.newlineCheckpointsIndex) == 0 {
+		return section, nil, err
 	}
 
-	return fromSizedDeltas(blob, buf), sec.sz, nil
+	checkpoints, err = d.readSectionBlob(simpleSection{
+		off: d.newlineCheckpointsStart + d.newlineCheckpointsIndex[i],
+		sz:  d.newlineCheckpointsIndex[i+1] - d.newlineCheckpointsIndex[i],
+	})
+	return section, checkpoints, err
 }
 
 func (d *indexData) readDocSections(i uint32, buf []DocumentSection) ([]DocumentSection, uint32, error) {
@@ -444,8 +641,23 @@ func NewSearcher(r IndexFile) (Searcher, error) {
 }
 
 // ReadMetadata returns the metadata of index shard without reading
-// the index data. The IndexFile is not closed.
+// the index data. The IndexFile is not closed. It fails for compound
+// shards, which hold several repositories; see ReadMetadataAll.
 func ReadMetadata(inf IndexFile) (*Repository, *IndexMetadata, error) {
+	repos, md, err := ReadMetadataAll(inf)
+	if err != nil {
+		return nil, md, err
+	}
+	if len(repos) > 1 {
+		return nil, md, fmt.Errorf("%s is a compound shard with %d repositories", inf.Name(), len(repos))
+	}
+	return repos[0], md, nil
+}
+
+// ReadMetadataAll returns the metadata of all repositories in an
+// index shard, without reading the index data. The IndexFile is not
+// closed.
+func ReadMetadataAll(inf IndexFile) ([]*Repository, *IndexMetadata, error) {
 	rd := &reader{r: inf}
 	var toc indexTOC
 	if err := rd.readTOC(&toc); err != nil {
@@ -488,6 +700,8 @@ func loadIndexData(r IndexFile) (*indexData, error) {
 //    n_2 trigram_2
 //    ...
 // where n_i is the length of the postings list of trigram_i stored in r.
+// A summary of the memory used by the ngram indexes is printed to
+// stderr.
 func PrintNgramStats(r IndexFile) error {
 	id, err := loadIndexData(r)
 	if err != nil {
@@ -498,5 +712,12 @@ func PrintNgramStats(r IndexFile) error {
 		rNgram = ngramToRunes(ngram)
 		fmt.Printf("%d\t%q\n", ss.sz, string(rNgram[:]))
 	}
+
+	// A map[ngram][]byte entry takes about 48 bytes.
+	n := id.fileNameNgrams.count()
+	fmt.Fprintf(os.Stderr, "content ngrams: %d, %d bytes in memory\n",
+		len(id.ngrams.bots), id.ngrams.SizeBytes())
+	fmt.Fprintf(os.Stderr, "file name ngrams: %d, %d bytes in memory (a map would use about %d bytes)\n",
+		n, id.fileNameNgrams.SizeBytes(), 48*n)
 	return nil
 }
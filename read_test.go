@@ -96,6 +96,9 @@ func TestReadWriteNames(t *testing.T) {
 	if toc.fileNames.data.sz != 4 {
 		t.Errorf("got contents size %d, want 4", toc.fileNames.data.sz)
 	}
+	if toc.namePostings.offsets != nil {
+		t.Errorf("got name posting offsets %v, want them left on disk", toc.namePostings.offsets)
+	}
 
 	data, err := r.readIndexData(&toc)
 	if err != nil {
@@ -104,7 +107,7 @@ func TestReadWriteNames(t *testing.T) {
 	if !reflect.DeepEqual([]uint32{0, 4}, data.fileNameIndex) {
 		t.Errorf("got index %v, want {0,4}", data.fileNameIndex)
 	}
-	if got := data.fileNameNgrams[stringToNGram("bCd")]; !reflect.DeepEqual(got, []byte{1}) {
+	if got := data.fileNameNgrams.Get(stringToNGram("bCd")); !reflect.DeepEqual(got, []byte{1}) {
 		t.Errorf("got trigram bcd at bits %v, want sz 2", data.fileNameNgrams)
 	}
 }
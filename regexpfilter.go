@@ -0,0 +1,298 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package zoekt
+
+import (
+	"bytes"
+	"regexp"
+	"regexp/syntax"
+	"unicode"
+	"unicode/utf8"
+)
+
+// maxPrefilterLiterals bounds the number of alternative literals a
+// regexpPrefilter scans for.
+const maxPrefilterLiterals = 16
+
+// regexpPrefilter narrows down where a regexp can match, by scanning
+// for a set of literals of which every match contains one.
+type regexpPrefilter struct {
+	lits [][]byte
+
+	// fold is set if literals match under simple case folding, as
+	// with (?i). Then foldLits holds the literals instead of lits.
+	fold     bool
+	foldLits [][]rune
+
+	// first has the possible first bytes of a match of a literal.
+	first [256]bool
+
+	// lineLocal is set if no match spans a newline and the regexp
+	// doesn't refer to the start or end of the text. Then it only has
+	// to run on the lines containing a literal.
+	lineLocal bool
+}
+
+// prefilterLiteral is a literal every match of a regexp contains.
+type prefilterLiteral struct {
+	runes []rune
+	fold  bool
+}
+
+// newRegexpPrefilter returns a prefilter for r, or nil if r has no
+// required literals.
+func newRegexpPrefilter(r *syntax.Regexp) *regexpPrefilter {
+	lits := requiredLiterals(r)
+	if len(lits) == 0 {
+		return nil
+	}
+
+	p := &regexpPrefilter{
+		lineLocal: isLineLocal(r),
+	}
+	for _, l := range lits {
+		p.fold = p.fold || l.fold
+	}
+	for _, l := range lits {
+		if p.fold {
+			p.foldLits = append(p.foldLits, l.runes)
+			var buf [utf8.UTFMax]byte
+			c := l.runes[0]
+			for f := c; ; {
+				utf8.EncodeRune(buf[:], f)
+				p.first[buf[0]] = true
+				if f = unicode.SimpleFold(f); f == c {
+					break
+				}
+			}
+		} else {
+			lit := []byte(string(l.runes))
+			p.first[lit[0]] = true
+			p.lits = append(p.lits, lit)
+		}
+	}
+	return p
+}
+
+// requiredLiterals returns literals such that every match of r
+// contains at least one of them, or nil if it can't find them.
+func requiredLiterals(r *syntax.Regexp) []prefilterLiteral {
+	switch r.Op {
+	case syntax.OpLiteral:
+		if len(r.Rune) == 0 {
+			return nil
+		}
+		return []prefilterLiteral{{runes: r.Rune, fold: r.Flags&syntax.FoldCase != 0}}
+	case syntax.OpCapture, syntax.OpPlus:
+		return requiredLiterals(r.Sub[0])
+	case syntax.OpRepeat:
+		if r.Min >= 1 {
+			return requiredLiterals(r.Sub[0])
+		}
+	case syntax.OpConcat:
+		// Any child's literals will do. Prefer long literals, as they
+		// are rarer, and then few alternatives.
+		var best []prefilterLiteral
+		for _, sub := range r.Sub {
+			if lits := requiredLiterals(sub); lits != nil && betterLiterals(lits, best) {
+				best = lits
+			}
+		}
+		return best
+	case syntax.OpAlternate:
+		var all []prefilterLiteral
+		for _, sub := range r.Sub {
+			lits := requiredLiterals(sub)
+			if lits == nil {
+				return nil
+			}
+			all = append(all, lits...)
+		}
+		if len(all) > maxPrefilterLiterals {
+			return nil
+		}
+		return all
+	}
+	return nil
+}
+
+func betterLiterals(a, b []prefilterLiteral) bool {
+	if b == nil {
+		return true
+	}
+	minLen := func(lits []prefilterLiteral) int {
+		m := len(lits[0].runes)
+		for _, l := range lits[1:] {
+			if len(l.runes) < m {
+				m = len(l.runes)
+			}
+		}
+		return m
+	}
+	if ma, mb := minLen(a), minLen(b); ma != mb {
+		return ma > mb
+	}
+	return len(a) < len(b)
+}
+
+// isLineLocal returns whether no match of r contains a newline, and
+// r doesn't match the start or end of the text. Running r on each
+// line then finds the same matches as running it on the whole text.
+func isLineLocal(r *syntax.Regexp) bool {
+	switch r.Op {
+	case syntax.OpAnyChar, syntax.OpBeginText, syntax.OpEndText:
+		return false
+	case syntax.OpLiteral:
+		for _, c := range r.Rune {
+			if c == '\n' {
+				return false
+			}
+		}
+	case syntax.OpCharClass:
+		for i := 0; i < len(r.Rune); i += 2 {
+			if r.Rune[i] <= '\n' && '\n' <= r.Rune[i+1] {
+				return false
+			}
+		}
+	}
+	for _, sub := range r.Sub {
+		if !isLineLocal(sub) {
+			return false
+		}
+	}
+	return true
+}
+
+// literalScanner finds the literals of a prefilter in a text. It
+// scans the text once for all literals: only at bytes that start a
+// literal does it compare the literals.
+type literalScanner struct {
+	p    *regexpPrefilter
+	text []byte
+}
+
+func newLiteralScanner(p *regexpPrefilter, text []byte) *literalScanner {
+	return &literalScanner{p: p, text: text}
+}
+
+// index returns the offset of the first literal at or after from, or
+// -1 if there is none.
+func (s *literalScanner) index(from int) int {
+	if from > len(s.text) {
+		return -1
+	}
+	if !s.p.fold && len(s.p.lits) == 1 {
+		if k := bytes.Index(s.text[from:], s.p.lits[0]); k >= 0 {
+			return from + k
+		}
+		return -1
+	}
+
+	for i := from; i < len(s.text); i++ {
+		if !s.p.first[s.text[i]] {
+			continue
+		}
+		if s.p.fold {
+			for _, l := range s.p.foldLits {
+				if hasPrefixFold(s.text[i:], l) {
+					return i
+				}
+			}
+			continue
+		}
+		for _, l := range s.p.lits {
+			if bytes.HasPrefix(s.text[i:], l) {
+				return i
+			}
+		}
+	}
+	return -1
+}
+
+// hasPrefixFold returns whether text starts with lit, under simple
+// case folding.
+func hasPrefixFold(text []byte, lit []rune) bool {
+	for _, c := range lit {
+		if len(text) == 0 {
+			return false
+		}
+		t, sz := utf8.DecodeRune(text)
+		if !equalFold(t, c) {
+			return false
+		}
+		text = text[sz:]
+	}
+	return true
+}
+
+func equalFold(a, b rune) bool {
+	if a == b {
+		return true
+	}
+	for f := unicode.SimpleFold(b); f != b; f = unicode.SimpleFold(f) {
+		if f == a {
+			return true
+		}
+	}
+	return false
+}
+
+// findAllIndex is like re.FindAllIndex(text, -1), for the regexp the
+// prefilter was made for. It returns whether re had to run at all.
+func (p *regexpPrefilter) findAllIndex(re *regexp.Regexp, text []byte) (idxs [][]int, ran bool) {
+	s := newLiteralScanner(p, text)
+	if !p.lineLocal {
+		if s.index(0) < 0 {
+			return nil, false
+		}
+		return re.FindAllIndex(text, -1), true
+	}
+
+	for pos := 0; pos <= len(text); {
+		i := s.index(pos)
+		if i < 0 {
+			break
+		}
+		start := bytes.LastIndexByte(text[:i], '\n') + 1
+		end := lineEnd(text, i)
+
+		// Run once on consecutive lines with literals.
+		for end < len(text) {
+			next := s.index(end + 1)
+			if next < 0 || bytes.IndexByte(text[end+1:next], '\n') >= 0 {
+				break
+			}
+			end = lineEnd(text, next)
+		}
+
+		ran = true
+		for _, idx := range re.FindAllIndex(text[start:end], -1) {
+			idx[0] += start
+			idx[1] += start
+			idxs = append(idxs, idx)
+		}
+		pos = end + 1
+	}
+	return idxs, ran
+}
+
+// lineEnd returns the offset of the newline ending the line containing
+// offset i, or len(text).
+func lineEnd(text []byte, i int) int {
+	if nl := bytes.IndexByte(text[i:], '\n'); nl >= 0 {
+		return i + nl
+	}
+	return len(text)
+}
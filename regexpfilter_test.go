@@ -0,0 +1,139 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package zoekt
+
+import (
+	"reflect"
+	"regexp"
+	"regexp/syntax"
+	"testing"
+
+	"github.com/google/zoekt/query"
+)
+
+func TestRequiredLiterals(t *testing.T) {
+	for expr, want := range map[string][]string{
+		"foo":              {"foo"},
+		"foo.*bar":         {"foo"},
+		"a.*barbaz":        {"barbaz"},
+		"(foo|barbaz)\\d+": {"foo", "barbaz"},
+		"(foo)+x{2,}":      {"foo"},
+		"foo|b*":           nil,
+		"[ab]c?":           nil,
+		"x?":               nil,
+	} {
+		r, err := syntax.Parse(expr, syntax.Perl)
+		if err != nil {
+			t.Fatal(err)
+		}
+		var got []string
+		for _, l := range requiredLiterals(r) {
+			got = append(got, string(l.runes))
+		}
+		if !reflect.DeepEqual(got, want) {
+			t.Errorf("%s: got %q, want %q", expr, got, want)
+		}
+	}
+}
+
+func TestRegexpPrefilter(t *testing.T) {
+	texts := []string{
+		"",
+		"foo",
+		"a foo\nbar foo12 foo3\n\nfoobar",
+		"FOO foo\nFoO99\n",
+		"nothing here\n",
+		"start\nfoo\nbar\nend",
+		"ſtraße STRASSE\nKelvin Kelvin kelvin",
+		"foo bar foo baz\nbarbaz foo1 foo2",
+	}
+	for _, expr := range []string{
+		"foo",
+		"foo\\d+",
+		"(?i)foo\\d*",
+		"(foo|bar)baz",
+		"(?m)^foo",
+		"(?m)foo$",
+		"^start",
+		"end$",
+		"foo\\b",
+		"foo\\sbar",
+		"(?s)foo.*bar",
+		"foo[^x]*bar",
+		"(?i)kelvin",
+		"(?i)stra",
+		"(?i)ſtr",
+		"bar$|baz",
+		"(fox|foo)\\d+",
+	} {
+		re := regexp.MustCompile(expr)
+		r, err := syntax.Parse(expr, syntax.Perl)
+		if err != nil {
+			t.Fatal(err)
+		}
+		p := newRegexpPrefilter(r)
+		if p == nil {
+			t.Errorf("%s: no prefilter", expr)
+			continue
+		}
+		for _, text := range texts {
+			want := re.FindAllIndex([]byte(text), -1)
+			got, ran := p.findAllIndex(re, []byte(text))
+			if len(want) == 0 && len(got) == 0 {
+				continue
+			}
+			if !ran || !reflect.DeepEqual(got, want) {
+				t.Errorf("%s on %q: got %v (ran %t), want %v", expr, text, got, ran, want)
+			}
+		}
+	}
+}
+
+func TestRegexpPrefilterLineLocal(t *testing.T) {
+	for expr, want := range map[string]bool{
+		"foo\\d+":     true,
+		"(?m)^foo$":   true,
+		"foo\\sbar":   false,
+		"(?s)foo.bar": false,
+		"foo[^x]bar":  false,
+		"^foo":        false,
+		"foo$":        false,
+	} {
+		r, err := syntax.Parse(expr, syntax.Perl)
+		if err != nil {
+			t.Fatal(err)
+		}
+		if got := isLineLocal(r); got != want {
+			t.Errorf("%s: got %t, want %t", expr, got, want)
+		}
+	}
+}
+
+func TestRegexpPrefilterStats(t *testing.T) {
+	b := testIndexBuilder(t, nil,
+		Document{Name: "f1", Content: []byte("x = ab12\ny = cd")},
+		Document{Name: "f2", Content: []byte("nothing")},
+		Document{Name: "f3", Content: []byte("ab without digits")},
+	)
+
+	// "ab" is too short for ngrams, so every file is evaluated.
+	res := searchForTest(t, b, &query.Regexp{Regexp: mustParseRE("ab[0-9]+"), Content: true})
+	if len(res.Files) != 1 || res.Files[0].FileName != "f1" {
+		t.Fatalf("got %v, want match in f1", res.Files)
+	}
+	if got, want := res.Stats.RegexpsConsidered, 2; got != want {
+		t.Errorf("got RegexpsConsidered %d, want %d", got, want)
+	}
+}
@@ -0,0 +1,219 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package zoekt
+
+import (
+	"fmt"
+	"sort"
+	"sync/atomic"
+)
+
+// accessHint tells an IndexFile how a range will be read.
+type accessHint int
+
+const (
+	// accessRandom turns off read ahead.
+	accessRandom accessHint = iota
+	// accessWillNeed reads the range ahead.
+	accessWillNeed
+)
+
+// hintedIndexFile is implemented by IndexFiles that are memory
+// mapped.
+type hintedIndexFile interface {
+	advise(off, sz uint32, hint accessHint)
+	lock(off, sz uint32, budget *LockBudget) int64
+	residency(hot []simpleSection) (ShardResidency, error)
+}
+
+// coldSections holds the compound sections of which searches read
+// small parts at random. NewSearcher reads the other sections in
+// full.
+var coldSections = map[string]bool{
+	"fileContents":       true,
+	"postings":           true,
+	"newlines":           true,
+	"fileSections":       true,
+	"newlineCheckpoints": true,
+}
+
+// postingsPrefetchBytes is the size from which a posting list is read
+// ahead before it is iterated. Smaller lists are only a page fault or
+// two.
+const postingsPrefetchBytes = 16 << 10
+
+// ShardResidency describes how much of a shard is in memory.
+type ShardResidency struct {
+	// MappedBytes is the size of the memory mapping.
+	MappedBytes int64
+
+	// ResidentBytes is the part of the mapping in the page cache.
+	ResidentBytes int64
+
+	// HotBytes is the size of the pages of the sections that
+	// searches read through the mapping, besides postings and
+	// content, and HotResidentBytes the part of them in the page
+	// cache.
+	HotBytes         int64
+	HotResidentBytes int64
+
+	// LockedBytes is the part of the mapping locked into memory, see
+	// LockBudget.
+	LockedBytes int64
+}
+
+// LockBudget limits the memory that shards lock into RAM with
+// LockHotSections.
+type LockBudget struct {
+	limit int64
+	used  int64
+}
+
+// NewLockBudget returns a budget for locking n bytes.
+func NewLockBudget(n int64) *LockBudget {
+	return &LockBudget{limit: n}
+}
+
+// Used returns the number of bytes locked.
+func (b *LockBudget) Used() int64 {
+	return atomic.LoadInt64(&b.used)
+}
+
+func (b *LockBudget) reserve(n int64) bool {
+	if atomic.AddInt64(&b.used, n) > b.limit {
+		atomic.AddInt64(&b.used, -n)
+		return false
+	}
+	return true
+}
+
+func (b *LockBudget) release(n int64) {
+	atomic.AddInt64(&b.used, -n)
+}
+
+// hotSections returns the sections that searches keep reading
+// through the mapping. NewSearcher copies most other sections.
+func (t *indexTOC) hotSections() []simpleSection {
+	return []simpleSection{
+		t.fileNames.data,
+		t.nameNgramText,
+		t.namePostings.data,
+		t.namePostings.index,
+		t.contentChecksums,
+		t.languages,
+		t.symbolMap.index,
+		t.symbolMap.data,
+		t.symbolKindMap.data,
+		t.symbolMetaData,
+		t.symbolNames.data,
+		t.symbolPostings.data,
+	}
+}
+
+// adviseSections reads ahead the sections that NewSearcher reads in
+// full, and remembers the hot sections for LockHotSections and
+// Residency.
+func (d *indexData) adviseSections(toc *indexTOC) {
+	d.hotSections = mergeSections(toc.hotSections())
+
+	f, ok := d.file.(hintedIndexFile)
+	if !ok {
+		return
+	}
+	var load []simpleSection
+	for _, t := range toc.sectionsTagged() {
+		switch s := t.sec.(type) {
+		case *simpleSection:
+			load = append(load, *s)
+		case *compoundSection:
+			if !coldSections[t.tag] {
+				load = append(load, s.data)
+			}
+			load = append(load, s.index)
+		case *lazyCompoundSection:
+			load = append(load, s.data, s.index)
+		}
+	}
+	for _, sec := range mergeSections(load) {
+		f.advise(sec.off, sec.sz, accessWillNeed)
+	}
+}
+
+// mergeSections sorts the non-empty sections, and merges the ones
+// that touch.
+func mergeSections(secs []simpleSection) []simpleSection {
+	var res []simpleSection
+	for _, s := range secs {
+		if s.sz > 0 {
+			res = append(res, s)
+		}
+	}
+	sort.Slice(res, func(i, j int) bool { return res[i].off < res[j].off })
+
+	merged := res[:0]
+	for _, s := range res {
+		if n := len(merged); n > 0 && merged[n-1].off+merged[n-1].sz >= s.off {
+			if end := s.off + s.sz; end > merged[n-1].off+merged[n-1].sz {
+				merged[n-1].sz = end - merged[n-1].off
+			}
+			continue
+		}
+		merged = append(merged, s)
+	}
+	return merged
+}
+
+// LockHotSections locks the hot sections into memory, as far as
+// budget allows. The memory is returned to budget when the shard is
+// closed. It returns the number of bytes locked.
+func (d *indexData) LockHotSections(budget *LockBudget) int64 {
+	f, ok := d.file.(hintedIndexFile)
+	if !ok {
+		return 0
+	}
+	var n int64
+	for _, sec := range d.hotSections {
+		n += f.lock(sec.off, sec.sz, budget)
+	}
+	return n
+}
+
+// Residency returns which part of the shard is in memory. It may not
+// be called concurrently with Close.
+func (d *indexData) Residency() (ShardResidency, error) {
+	f, ok := d.file.(hintedIndexFile)
+	if !ok {
+		return ShardResidency{}, fmt.Errorf("%s is not memory mapped", d.file.Name())
+	}
+	return f.residency(d.hotSections)
+}
+
+// prefetchPostings reads ahead the large posting lists of the case
+// variants of ng.
+func (d *indexData) prefetchPostings(ng ngram, caseSensitive bool) {
+	f, ok := d.file.(hintedIndexFile)
+	if !ok {
+		return
+	}
+	variants := []ngram{ng}
+	if !caseSensitive {
+		variants = generateCaseNgrams(ng)
+	}
+	for _, v := range variants {
+		if sec := d.ngrams.Get(v); sec.sz >= postingsPrefetchBytes {
+			f.advise(sec.off, sec.sz, accessWillNeed)
+		}
+	}
+}
@@ -42,6 +42,14 @@ func (s *Searcher) Search(ctx context.Context, args *SearchArgs, reply *SearchRe
 		defer cancel()
 	}
 
+	// The reply is encoded after we return, so it must not reference
+	// the shards.
+	if args.Opts != nil && args.Opts.NoCopy {
+		opts := *args.Opts
+		opts.NoCopy = false
+		args.Opts = &opts
+	}
+
 	r, err := s.Searcher.Search(ctx, args.Q, args.Opts)
 	if err != nil {
 		return err
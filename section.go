@@ -47,6 +47,12 @@ func (w *writer) B(b byte) {
 	w.Write(s)
 }
 
+func (w *writer) U16(n uint16) {
+	var enc [2]byte
+	binary.BigEndian.PutUint16(enc[:], n)
+	w.Write(enc[:])
+}
+
 func (w *writer) U32(n uint32) {
 	var enc [4]byte
 	binary.BigEndian.PutUint32(enc[:], n)
@@ -73,10 +79,25 @@ func (s *simpleSection) end(w *writer) {
 	s.sz = w.Off() - s.off
 }
 
+func (w *writer) String(s string) {
+	w.Varint(uint32(len(s)))
+	w.Write([]byte(s))
+}
+
+// sectionKind identifies the type of a tagged TOC section.
+type sectionKind int
+
+const (
+	sectionKindSimple       sectionKind = 0
+	sectionKindCompound     sectionKind = 1
+	sectionKindCompoundLazy sectionKind = 2
+)
+
 // section is a range of bytes in the index file.
 type section interface {
 	read(*reader) error
 	write(*writer)
+	kind() sectionKind
 }
 
 // simpleSection is a simple range of bytes.
@@ -103,6 +124,10 @@ func (s *simpleSection) write(w *writer) {
 	w.U32(s.sz)
 }
 
+func (s *simpleSection) kind() sectionKind {
+	return sectionKindSimple
+}
+
 // compoundSection is a range of bytes containg a list of variable
 // sized items.
 type compoundSection struct {
@@ -135,6 +160,10 @@ func (s *compoundSection) write(w *writer) {
 	s.index.write(w)
 }
 
+func (s *compoundSection) kind() sectionKind {
+	return sectionKindCompound
+}
+
 func (s *compoundSection) read(r *reader) error {
 	if err := s.data.read(r); err != nil {
 		return err
@@ -172,3 +201,7 @@ func (s *lazyCompoundSection) read(r *reader) error {
 	}
 	return s.index.read(r)
 }
+
+func (s *lazyCompoundSection) kind() sectionKind {
+	return sectionKindCompoundLazy
+}
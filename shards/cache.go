@@ -0,0 +1,191 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package shards
+
+import (
+	"container/list"
+	"fmt"
+	"sync"
+
+	"github.com/google/zoekt"
+)
+
+// resultCacheKey identifies the result of a query on a shard.
+type resultCacheKey struct {
+	// shard is the id of a loaded shard, see rankedShard.id.
+	shard string
+	query string
+	opts  string
+}
+
+func newResultCacheKey(shard, q string, opts *zoekt.SearchOptions) resultCacheKey {
+	return resultCacheKey{
+		shard: shard,
+		query: q,
+		// Only the options which change the result of a single
+		// shard. Total limits are enforced by canceling, and canceled
+		// searches are not cached. Shards keep only the top
+		// MaxDocDisplayCount files.
+		opts: fmt.Sprintf("%t %t %d %d %d", opts.EstimateDocCount, opts.Whole,
+			opts.ShardMaxMatchCount, opts.ShardMaxImportantMatch, opts.MaxDocDisplayCount),
+	}
+}
+
+type resultCacheEntry struct {
+	key  resultCacheKey
+	sr   *zoekt.SearchResult
+	size int64
+}
+
+// resultCache is a LRU cache of per shard search results, bounded by
+// the approximate memory used by the results.
+type resultCache struct {
+	budget int64
+
+	mu   sync.Mutex
+	size int64
+	lru  *list.List
+	// entries holds the entries by shard, so a shard's results can be
+	// purged without visiting the others.
+	entries map[string]map[resultCacheKey]*list.Element
+}
+
+func newResultCache(budget int64) *resultCache {
+	return &resultCache{
+		budget:  budget,
+		lru:     list.New(),
+		entries: make(map[string]map[resultCacheKey]*list.Element),
+	}
+}
+
+// get returns a copy of the cached result for key, which the caller
+// may modify.
+func (c *resultCache) get(key resultCacheKey) (*zoekt.SearchResult, bool) {
+	c.mu.Lock()
+	defer c.mu.Unlock()
+
+	e, ok := c.entries[key.shard][key]
+	if !ok {
+		metricSearchCacheMissesTotal.Inc()
+		return nil, false
+	}
+	metricSearchCacheHitsTotal.Inc()
+	c.lru.MoveToFront(e)
+	return cloneCachedResult(e.Value.(*resultCacheEntry).sr), true
+}
+
+// add caches sr for key. sr may reference the memory of the shard, so
+// it is copied.
+func (c *resultCache) add(key resultCacheKey, sr *zoekt.SearchResult) {
+	sr = cloneCachedResult(sr)
+	copyFiles(sr)
+	size := resultSize(sr)
+	if size > c.budget {
+		return
+	}
+
+	c.mu.Lock()
+	defer c.mu.Unlock()
+
+	shard := c.entries[key.shard]
+	if shard == nil {
+		shard = map[resultCacheKey]*list.Element{}
+		c.entries[key.shard] = shard
+	}
+	if e, ok := shard[key]; ok {
+		c.remove(e)
+	}
+	shard[key] = c.lru.PushFront(&resultCacheEntry{key: key, sr: sr, size: size})
+	c.size += size
+
+	for c.size > c.budget {
+		c.remove(c.lru.Back())
+	}
+	metricSearchCacheBytes.Set(float64(c.size))
+}
+
+// purge drops the results of the shard with the given id.
+func (c *resultCache) purge(shard string) {
+	c.mu.Lock()
+	defer c.mu.Unlock()
+
+	for _, e := range c.entries[shard] {
+		c.remove(e)
+	}
+	metricSearchCacheBytes.Set(float64(c.size))
+}
+
+func (c *resultCache) remove(e *list.Element) {
+	entry := c.lru.Remove(e).(*resultCacheEntry)
+	shard := c.entries[entry.key.shard]
+	delete(shard, entry.key)
+	if len(shard) == 0 {
+		delete(c.entries, entry.key.shard)
+	}
+	c.size -= entry.size
+}
+
+// cloneCachedResult copies the parts of sr that copyFiles and the
+// aggregation in shardedSearcher modify. Cached results are only
+// shared for reading.
+func cloneCachedResult(sr *zoekt.SearchResult) *zoekt.SearchResult {
+	cp := &zoekt.SearchResult{
+		Stats:         sr.Stats,
+		Progress:      sr.Progress,
+		Files:         make([]zoekt.FileMatch, len(sr.Files)),
+		RepoURLs:      sr.RepoURLs,
+		LineFragments: sr.LineFragments,
+	}
+	for i, f := range sr.Files {
+		f.LineMatches = append([]zoekt.LineMatch(nil), f.LineMatches...)
+		cp.Files[i] = f
+	}
+	return cp
+}
+
+// resultSize approximates the memory used by sr.
+func resultSize(sr *zoekt.SearchResult) int64 {
+	const fileMatchSize, lineMatchSize, fragmentSize = 256, 96, 48
+
+	var sz int64
+	for _, f := range sr.Files {
+		sz += fileMatchSize
+		sz += int64(len(f.FileName) + len(f.Repository) + len(f.Content) + len(f.Checksum) + len(f.Version))
+		for _, b := range f.Branches {
+			sz += int64(len(b))
+		}
+		for _, l := range f.LineMatches {
+			sz += lineMatchSize + int64(len(l.Line)) + fragmentSize*int64(len(l.LineFragments))
+		}
+	}
+	for k, v := range sr.RepoURLs {
+		sz += int64(len(k) + len(v))
+	}
+	for k, v := range sr.LineFragments {
+		sz += int64(len(k) + len(v))
+	}
+	return sz
+}
+
+// cachedStats returns the stats to report for a cached result. The
+// counts describing the result are kept, but no work was done.
+func cachedStats(s zoekt.Stats) zoekt.Stats {
+	return zoekt.Stats{
+		FileCount:            s.FileCount,
+		MatchCount:           s.MatchCount,
+		ShardFilesConsidered: s.ShardFilesConsidered,
+		FilesSkipped:         s.FilesSkipped,
+	}
+}
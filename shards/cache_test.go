@@ -0,0 +1,154 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package shards
+
+import (
+	"context"
+	"sync/atomic"
+	"testing"
+
+	"github.com/google/go-cmp/cmp"
+	"github.com/google/zoekt"
+	"github.com/google/zoekt/query"
+)
+
+type countingSearcher struct {
+	zoekt.Searcher
+	searches int64
+}
+
+func (s *countingSearcher) Search(ctx context.Context, q query.Q, opts *zoekt.SearchOptions) (*zoekt.SearchResult, error) {
+	atomic.AddInt64(&s.searches, 1)
+	return s.Searcher.Search(ctx, q, opts)
+}
+
+func TestResultCache(t *testing.T) {
+	b := testIndexBuilder(t, &zoekt.Repository{Name: "repo"},
+		zoekt.Document{Name: "f1", Content: []byte("needle haystack")},
+		zoekt.Document{Name: "f2", Content: []byte("haystack")})
+
+	ss := newShardedSearcher(2)
+	ss.cache = newResultCache(1 << 20)
+	defer ss.Close()
+
+	load := func() *countingSearcher {
+		s := &countingSearcher{Searcher: searcherForTest(t, b)}
+		ss.replace("shard", s)
+		return s
+	}
+	search := func(q query.Q, opts *zoekt.SearchOptions) *zoekt.SearchResult {
+		t.Helper()
+		res, err := ss.Search(context.Background(), q, opts)
+		if err != nil {
+			t.Fatal(err)
+		}
+		return res
+	}
+
+	s := load()
+	q := &query.Substring{Pattern: "needle"}
+	opts := &zoekt.SearchOptions{}
+
+	first := search(q, opts)
+	second := search(q, opts)
+	if got := atomic.LoadInt64(&s.searches); got != 1 {
+		t.Errorf("got %d shard searches for repeated query, want 1", got)
+	}
+	if d := cmp.Diff(first.Files, second.Files); d != "" {
+		t.Errorf("cached result differs (-first +second):\n%s", d)
+	}
+	if second.Stats.FileCount != 1 || second.Stats.IndexBytesLoaded != 0 {
+		t.Errorf("got cached stats %+v, want FileCount 1 and no I/O", second.Stats)
+	}
+
+	// Different options are a different result.
+	search(q, &zoekt.SearchOptions{Whole: true})
+	if got := atomic.LoadInt64(&s.searches); got != 2 {
+		t.Errorf("got %d shard searches after changing options, want 2", got)
+	}
+
+	// Profiled searches bypass the cache.
+	if res := search(q, &zoekt.SearchOptions{Profile: true}); res.Profile == nil {
+		t.Errorf("got no profile for profiled search")
+	}
+	if got := atomic.LoadInt64(&s.searches); got != 3 {
+		t.Errorf("got %d shard searches after profiled search, want 3", got)
+	}
+
+	// Reloading the shard invalidates its results.
+	s = load()
+	search(q, opts)
+	if got := atomic.LoadInt64(&s.searches); got != 1 {
+		t.Errorf("got %d shard searches after reload, want 1", got)
+	}
+}
+
+func TestResultCacheMaxDocDisplayCount(t *testing.T) {
+	b := testIndexBuilder(t, &zoekt.Repository{Name: "repo"},
+		zoekt.Document{Name: "f1", Content: []byte("needle haystack")},
+		zoekt.Document{Name: "f2", Content: []byte("needle")})
+
+	ss := newShardedSearcher(2)
+	ss.cache = newResultCache(1 << 20)
+	defer ss.Close()
+	ss.replace("shard", searcherForTest(t, b))
+
+	q := &query.Substring{Pattern: "needle"}
+	for _, tc := range []struct {
+		limit, want int
+	}{{1, 1}, {0, 2}, {1, 1}} {
+		res, err := ss.Search(context.Background(), q, &zoekt.SearchOptions{MaxDocDisplayCount: tc.limit})
+		if err != nil {
+			t.Fatal(err)
+		}
+		if len(res.Files) != tc.want {
+			t.Errorf("MaxDocDisplayCount %d: got %d files, want %d", tc.limit, len(res.Files), tc.want)
+		}
+	}
+}
+
+func TestResultCacheBudget(t *testing.T) {
+	sr := &zoekt.SearchResult{
+		Files: []zoekt.FileMatch{{FileName: "f", Content: make([]byte, 1000)}},
+	}
+	c := newResultCache(3 * resultSize(sr))
+
+	key := func(q string) resultCacheKey {
+		return newResultCacheKey("shard", q, &zoekt.SearchOptions{})
+	}
+	for _, q := range []string{"a", "b", "c", "d"} {
+		c.add(key(q), sr)
+	}
+
+	if _, ok := c.get(key("a")); ok {
+		t.Error("least recently used entry was not evicted")
+	}
+	for _, q := range []string{"b", "c", "d"} {
+		if _, ok := c.get(key(q)); !ok {
+			t.Errorf("entry %q was evicted", q)
+		}
+	}
+	if c.size > c.budget {
+		t.Errorf("cache size %d exceeds budget %d", c.size, c.budget)
+	}
+
+	c.purge("shard")
+	if c.size != 0 || c.lru.Len() != 0 {
+		t.Errorf("got size %d and %d entries after purge, want empty", c.size, c.lru.Len())
+	}
+	if len(c.entries) != 0 {
+		t.Errorf("got %d shards indexed after purge, want none", len(c.entries))
+	}
+}
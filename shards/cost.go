@@ -0,0 +1,111 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package shards
+
+import (
+	"regexp/syntax"
+
+	"github.com/google/zoekt/query"
+)
+
+// Per shard costs of query atoms, in units of a substring search.
+const (
+	costSubstring      = 1
+	costIndexedRegexp  = 2
+	costBruteForceScan = 50
+)
+
+// minIndexedLiteral is the shortest literal the index can look up,
+// the ngram size in runes.
+const minIndexedLiteral = 3
+
+// estimateCost returns a rough estimate of the work of searching q on
+// numShards shards, in units of a substring search on one shard. It
+// only looks at the query, so it is cheap enough to run before every
+// search. It doesn't use the posting list sizes in the ngram offsets:
+// those are per shard, and reading them means visiting every shard
+// before the query is admitted, which costs about as much as the
+// fan-out the admission limits.
+func estimateCost(q query.Q, numShards int) int64 {
+	c := shardCost(q)
+	if c < costSubstring {
+		c = costSubstring
+	}
+	return c * int64(numShards)
+}
+
+// shardCost estimates the cost of q on one shard.
+func shardCost(q query.Q) int64 {
+	switch s := q.(type) {
+	case *query.Substring:
+		return costSubstring
+	case *query.Regexp:
+		if regexpIndexable(s.Regexp) {
+			return costIndexedRegexp
+		}
+		return costBruteForceScan
+	case *query.Symbol:
+		return shardCost(s.Expr)
+	case *query.Type:
+		return shardCost(s.Child)
+	case *query.Not:
+		return shardCost(s.Child)
+	case *query.And:
+		// The cheapest child with content narrows down the files the
+		// others run on.
+		var min int64
+		for _, ch := range s.Children {
+			if c := shardCost(ch); c > 0 && (min == 0 || c < min) {
+				min = c
+			}
+		}
+		return min
+	case *query.Or:
+		var sum int64
+		for _, ch := range s.Children {
+			sum += shardCost(ch)
+		}
+		return sum
+	}
+	// Repository, branch and language filters use metadata.
+	return 0
+}
+
+// regexpIndexable returns whether the index can narrow down the
+// matches of r, as in indexData.regexpToMatchTreeRecursive.
+func regexpIndexable(r *syntax.Regexp) bool {
+	switch r.Op {
+	case syntax.OpLiteral:
+		return len(r.Rune) >= minIndexedLiteral
+	case syntax.OpCapture, syntax.OpPlus:
+		return regexpIndexable(r.Sub[0])
+	case syntax.OpRepeat:
+		return r.Min >= 1 && regexpIndexable(r.Sub[0])
+	case syntax.OpConcat:
+		for _, sub := range r.Sub {
+			if regexpIndexable(sub) {
+				return true
+			}
+		}
+	case syntax.OpAlternate:
+		for _, sub := range r.Sub {
+			if !regexpIndexable(sub) {
+				return false
+			}
+		}
+		return len(r.Sub) > 0
+	}
+	return false
+}
@@ -0,0 +1,207 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package shards
+
+import (
+	"runtime"
+	"sync"
+)
+
+// workPool runs shard searches for all queries on a fixed set of
+// workers, rather than each query starting its own. Every query runs
+// its own tasks on its goroutine, so it makes progress even when all
+// workers are busy. Idle workers steal tasks from the queries, in
+// turn, up to each query's weight.
+type workPool struct {
+	mu   sync.Mutex
+	cond *sync.Cond
+
+	// queues holds the queries with tasks. next is where workers
+	// start looking, so queries take turns.
+	queues []*workQueue
+	next   int
+}
+
+var (
+	sharedPoolOnce sync.Once
+	sharedPool     *workPool
+)
+
+// getWorkPool returns the process wide pool. It starts on first use,
+// as GOMAXPROCS may be changed during startup.
+func getWorkPool() *workPool {
+	sharedPoolOnce.Do(func() {
+		sharedPool = newWorkPool(runtime.GOMAXPROCS(0))
+	})
+	return sharedPool
+}
+
+func newWorkPool(workers int) *workPool {
+	p := &workPool{}
+	p.cond = sync.NewCond(&p.mu)
+	for i := 0; i < workers; i++ {
+		go p.work()
+	}
+	return p
+}
+
+// workQueue holds the tasks of one query.
+type workQueue struct {
+	pool *workPool
+
+	// weight is the number of workers that may run tasks of this
+	// queue at once, besides its owner.
+	weight  int
+	helpers int
+
+	tasks  []func()
+	closed bool
+	active bool
+
+	// running counts the tasks that were taken, but aren't done.
+	running int
+}
+
+// newQueue returns a queue for a query, which up to weight workers
+// may steal from.
+func (p *workPool) newQueue(weight int) *workQueue {
+	return &workQueue{pool: p, weight: weight}
+}
+
+// push adds a task to the queue.
+func (q *workQueue) push(task func()) {
+	p := q.pool
+	p.mu.Lock()
+	q.tasks = append(q.tasks, task)
+	if !q.active {
+		q.active = true
+		p.queues = append(p.queues, q)
+	}
+	p.mu.Unlock()
+	p.cond.Broadcast()
+}
+
+// setWeight changes how many workers may help.
+func (q *workQueue) setWeight(weight int) {
+	p := q.pool
+	p.mu.Lock()
+	q.weight = weight
+	p.mu.Unlock()
+}
+
+// close marks that no more tasks are pushed.
+func (q *workQueue) close() {
+	p := q.pool
+	p.mu.Lock()
+	q.closed = true
+	p.mu.Unlock()
+	p.cond.Broadcast()
+}
+
+// run runs tasks of the queue on the caller's goroutine until it is
+// closed, and all its tasks are done.
+func (q *workQueue) run() {
+	p := q.pool
+	p.mu.Lock()
+	defer p.mu.Unlock()
+	for {
+		if task := q.take(); task != nil {
+			p.mu.Unlock()
+			task()
+			p.mu.Lock()
+			q.done()
+			continue
+		}
+		if q.closed && q.running == 0 {
+			return
+		}
+		p.cond.Wait()
+	}
+}
+
+// take pops the oldest task. p.mu must be held.
+func (q *workQueue) take() func() {
+	if len(q.tasks) == 0 {
+		return nil
+	}
+	task := q.tasks[0]
+	q.tasks[0] = nil
+	q.tasks = q.tasks[1:]
+	q.running++
+	if len(q.tasks) == 0 {
+		q.pool.deactivate(q)
+	}
+	return task
+}
+
+// done marks a task as finished. p.mu must be held.
+func (q *workQueue) done() {
+	q.running--
+	if q.closed && q.running == 0 && len(q.tasks) == 0 {
+		q.pool.cond.Broadcast()
+	}
+}
+
+// deactivate removes q from the queues workers steal from. p.mu must
+// be held.
+func (p *workPool) deactivate(q *workQueue) {
+	q.active = false
+	for i, o := range p.queues {
+		if o == q {
+			p.queues = append(p.queues[:i], p.queues[i+1:]...)
+			if p.next > i {
+				p.next--
+			}
+			return
+		}
+	}
+}
+
+// steal returns a task from the first queue, starting at next, that
+// can use another worker. p.mu must be held.
+func (p *workPool) steal() (*workQueue, func()) {
+	for i := range p.queues {
+		j := (p.next + i) % len(p.queues)
+		q := p.queues[j]
+		if q.helpers >= q.weight {
+			continue
+		}
+		p.next = j + 1
+		q.helpers++
+		return q, q.take()
+	}
+	return nil, nil
+}
+
+func (p *workPool) work() {
+	p.mu.Lock()
+	defer p.mu.Unlock()
+	for {
+		q, task := p.steal()
+		if task == nil {
+			p.cond.Wait()
+			continue
+		}
+		p.mu.Unlock()
+		task()
+		p.mu.Lock()
+		q.helpers--
+		q.done()
+		if len(q.tasks) > 0 {
+			// The queue may have waited for a free helper.
+			p.cond.Broadcast()
+		}
+	}
+}
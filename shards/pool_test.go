@@ -0,0 +1,177 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package shards
+
+import (
+	"context"
+	"regexp/syntax"
+	"runtime"
+	"sync"
+	"sync/atomic"
+	"testing"
+	"time"
+
+	"github.com/google/zoekt"
+	"github.com/google/zoekt/query"
+)
+
+func TestWorkPool(t *testing.T) {
+	p := newWorkPool(4)
+
+	// Run two queries at once. One may use 2 helpers, the other none.
+	run := func(weight int, maxRunning *int64) int64 {
+		var ran, running int64
+		q := p.newQueue(weight)
+		go func() {
+			for i := 0; i < 50; i++ {
+				q.push(func() {
+					n := atomic.AddInt64(&running, 1)
+					for {
+						m := atomic.LoadInt64(maxRunning)
+						if n <= m || atomic.CompareAndSwapInt64(maxRunning, m, n) {
+							break
+						}
+					}
+					time.Sleep(time.Millisecond)
+					atomic.AddInt64(&running, -1)
+					atomic.AddInt64(&ran, 1)
+				})
+			}
+			q.close()
+		}()
+		q.run()
+		return ran
+	}
+
+	var wg sync.WaitGroup
+	var max2, max0 int64
+	var ran2, ran0 int64
+	wg.Add(2)
+	go func() { defer wg.Done(); ran2 = run(2, &max2) }()
+	go func() { defer wg.Done(); ran0 = run(0, &max0) }()
+	wg.Wait()
+
+	if ran2 != 50 || ran0 != 50 {
+		t.Errorf("ran %d and %d tasks, want 50 each", ran2, ran0)
+	}
+	if max2 > 3 {
+		t.Errorf("weight 2 query ran %d tasks at once, want at most 3", max2)
+	}
+	if max0 != 1 {
+		t.Errorf("weight 0 query ran %d tasks at once, want 1", max0)
+	}
+}
+
+func TestWorkPoolEmpty(t *testing.T) {
+	p := newWorkPool(1)
+	q := p.newQueue(1)
+	q.close()
+	q.run()
+}
+
+func TestEstimateCost(t *testing.T) {
+	re := func(s string) query.Q {
+		r, err := syntax.Parse(s, syntax.Perl)
+		if err != nil {
+			t.Fatal(err)
+		}
+		return &query.Regexp{Regexp: r, Content: true}
+	}
+
+	cases := []struct {
+		q    query.Q
+		want int64
+	}{
+		{&query.Substring{Pattern: "foo"}, costSubstring},
+		{re("foo.*bar"), costIndexedRegexp},
+		{re("fo+|bar"), costBruteForceScan},
+		{re("a.b"), costBruteForceScan},
+		{re("éü.x"), costBruteForceScan},
+		{re("éüß"), costIndexedRegexp},
+		{query.NewAnd(re("a.b"), &query.Substring{Pattern: "foo"}), costSubstring},
+		{query.NewOr(re("foo"), &query.Substring{Pattern: "bar"}), costIndexedRegexp + costSubstring},
+		{&query.Repo{Pattern: "foo"}, costSubstring},
+	}
+	for _, c := range cases {
+		if got := estimateCost(c.q, 10); got != 10*c.want {
+			t.Errorf("%s: got cost %d, want %d", c.q, got, 10*c.want)
+		}
+	}
+}
+
+func TestAdmit(t *testing.T) {
+	sched := newMultiScheduler(8)
+	sched.batchCost = 100
+
+	ctx := quickCtx(t)
+	proc, err := sched.Acquire(ctx)
+	if err != nil {
+		t.Fatal(err)
+	}
+	if workers, err := proc.Admit(ctx, 10, 8); err != nil || workers != 8 {
+		t.Errorf("cheap query got %d workers, %v; want 8", workers, err)
+	}
+	proc.Release()
+
+	proc, err = sched.Acquire(ctx)
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer proc.Release()
+	if workers, err := proc.Admit(ctx, 100, 8); err != nil || workers != 2 {
+		t.Errorf("expensive query got %d workers, %v; want 2", workers, err)
+	}
+	if !proc.batch {
+		t.Errorf("expensive query is not in batch")
+	}
+}
+
+type optsSearcher struct {
+	zoekt.Searcher
+	parallelism int
+}
+
+func (s *optsSearcher) Search(ctx context.Context, q query.Q, opts *zoekt.SearchOptions) (*zoekt.SearchResult, error) {
+	s.parallelism = opts.ShardParallelism
+	return s.Searcher.Search(ctx, q, opts)
+}
+
+func TestShardParallelismFollowsWeight(t *testing.T) {
+	defer runtime.GOMAXPROCS(runtime.GOMAXPROCS(8))
+
+	b := testIndexBuilder(t, &zoekt.Repository{Name: "repo"},
+		zoekt.Document{Name: "f1", Content: []byte("needle haystack")})
+	ss := newShardedSearcher(8)
+	defer ss.Close()
+	ss.intraShardParallelism = true
+	s := &optsSearcher{Searcher: searcherForTest(t, b)}
+	ss.replace("shard", s)
+
+	sched := newMultiScheduler(8)
+	ss.sched = sched
+	q := &query.Substring{Pattern: "needle"}
+	for _, tc := range []struct {
+		batchCost int64
+		want      int
+	}{{0, 8}, {1, 2}} {
+		sched.batchCost = tc.batchCost
+		if _, err := ss.Search(context.Background(), q, &zoekt.SearchOptions{}); err != nil {
+			t.Fatal(err)
+		}
+		if s.parallelism != tc.want {
+			t.Errorf("batchCost %d: got ShardParallelism %d, want %d", tc.batchCost, s.parallelism, tc.want)
+		}
+	}
+}
@@ -0,0 +1,125 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package shards
+
+import (
+	"path/filepath"
+	"sync"
+
+	"github.com/google/zoekt"
+	"github.com/prometheus/client_golang/prometheus"
+)
+
+type residencer interface {
+	Residency() (zoekt.ShardResidency, error)
+}
+
+type hotSectionLocker interface {
+	LockHotSections(budget *zoekt.LockBudget) int64
+}
+
+var (
+	descShardMappedBytes = prometheus.NewDesc("zoekt_shard_mapped_bytes",
+		"The size of the memory mapping of a shard", []string{"shard"}, nil)
+	descShardResidentBytes = prometheus.NewDesc("zoekt_shard_resident_bytes",
+		"The part of a shard in the page cache", []string{"shard"}, nil)
+	descShardHotBytes = prometheus.NewDesc("zoekt_shard_hot_bytes",
+		"The size of the sections of a shard read on every search, besides postings and content", []string{"shard"}, nil)
+	descShardHotResidentBytes = prometheus.NewDesc("zoekt_shard_hot_resident_bytes",
+		"The part of the hot sections of a shard in the page cache", []string{"shard"}, nil)
+	descShardLockedBytes = prometheus.NewDesc("zoekt_shard_locked_bytes",
+		"The part of a shard locked into memory", []string{"shard"}, nil)
+)
+
+// residencyCollector reports the page cache residency of the shards
+// of the directory searchers. It measures on every scrape, which
+// takes a system call per shard.
+type residencyCollector struct {
+	mu        sync.Mutex
+	searchers map[*shardedSearcher]struct{}
+}
+
+var shardResidency = &residencyCollector{
+	searchers: map[*shardedSearcher]struct{}{},
+}
+
+func init() {
+	prometheus.MustRegister(shardResidency)
+}
+
+func (c *residencyCollector) register(ss *shardedSearcher) {
+	c.mu.Lock()
+	defer c.mu.Unlock()
+	c.searchers[ss] = struct{}{}
+}
+
+func (c *residencyCollector) unregister(ss *shardedSearcher) {
+	c.mu.Lock()
+	defer c.mu.Unlock()
+	delete(c.searchers, ss)
+}
+
+func (c *residencyCollector) Describe(ch chan<- *prometheus.Desc) {
+	ch <- descShardMappedBytes
+	ch <- descShardResidentBytes
+	ch <- descShardHotBytes
+	ch <- descShardHotResidentBytes
+	ch <- descShardLockedBytes
+}
+
+func (c *residencyCollector) Collect(ch chan<- prometheus.Metric) {
+	c.mu.Lock()
+	var searchers []*shardedSearcher
+	for ss := range c.searchers {
+		searchers = append(searchers, ss)
+	}
+	c.mu.Unlock()
+
+	for _, ss := range searchers {
+		for shard, r := range ss.residency() {
+			for _, m := range []struct {
+				desc *prometheus.Desc
+				v    int64
+			}{
+				{descShardMappedBytes, r.MappedBytes},
+				{descShardResidentBytes, r.ResidentBytes},
+				{descShardHotBytes, r.HotBytes},
+				{descShardHotResidentBytes, r.HotResidentBytes},
+				{descShardLockedBytes, r.LockedBytes},
+			} {
+				ch <- prometheus.MustNewConstMetric(m.desc, prometheus.GaugeValue, float64(m.v), shard)
+			}
+		}
+	}
+}
+
+// residency returns the residency of the memory mapped shards, by
+// file name.
+func (ss *shardedSearcher) residency() map[string]zoekt.ShardResidency {
+	set := ss.acquireShards()
+	defer set.release()
+
+	res := map[string]zoekt.ShardResidency{}
+	for key, s := range set.shards {
+		r, ok := s.Searcher.(residencer)
+		if !ok {
+			continue
+		}
+		if sr, err := r.Residency(); err == nil {
+			res[filepath.Base(key)] = sr
+		}
+	}
+	return res
+}
@@ -42,6 +42,11 @@ type scheduler interface {
 //   queries to run in the larger interactive queue for Xs before moving them
 //   to the batch queue.
 //
+//   batchcost: setting batchcost=X will start search queries with an
+//   estimated cost of at least X in the batch queue. See estimateCost. By
+//   default it is 50000, about a regex which can't use the index over 1000
+//   shards.
+//
 // Note: these tuneables should be regarded as temporary while we experiment
 // with our scheduler in production. They should not be relied upon in
 // customers/sourcegraph.com in a permanent manor (only temporary).
@@ -113,6 +118,11 @@ type multiScheduler struct {
 	// interactiveDuration is how long we run a search query at interactive
 	// priority before downgrading it to a batch/slow query.
 	interactiveDuration time.Duration
+
+	// batchCost is the estimated cost from which queries start as batch
+	// queries. batchDiv is how many times fewer workers batch queries get.
+	batchCost int64
+	batchDiv  int
 }
 
 func newMultiScheduler(capacity int64) *multiScheduler {
@@ -136,12 +146,21 @@ func newMultiScheduler(capacity int64) *multiScheduler {
 		log.Printf("ZOEKTSCHED=interactiveseconds=%d specified. Search requests will move to batch queue after %d seconds.", interactiveseconds, interactiveseconds)
 	}
 
+	batchcost := zoektSched["batchcost"]
+	if batchcost == 0 {
+		batchcost = 50000
+	} else {
+		log.Printf("ZOEKTSCHED=batchcost=%d specified. Search requests with at least this cost start in the batch queue.", batchcost)
+	}
+
 	return &multiScheduler{
 		mu:             newRWMutex(),
 		semInteractive: newSema(capacity, "interactive"),
 		semBatch:       newSema(batchCap, "batch"),
 
 		interactiveDuration: time.Duration(interactiveseconds) * time.Second,
+		batchCost:           int64(batchcost),
+		batchDiv:            batchdiv,
 	}
 }
 
@@ -169,6 +188,8 @@ func (s *multiScheduler) Acquire(ctx context.Context) (*process, error) {
 			}
 			s.mu.RUnlock()
 		},
+		batchCost:  s.batchCost,
+		batchDiv:   s.batchDiv,
 		yieldTimer: newDeadlineTimer(time.Now().Add(s.interactiveDuration)),
 		yieldFunc: func(ctx context.Context) error {
 			if sem != nil {
@@ -247,6 +268,14 @@ type process struct {
 
 	// releaseFunc is called once by Release
 	releaseFunc func()
+
+	// batchCost is the estimated cost from which Admit moves the process
+	// to batch right away. It is 0 if the scheduler has no batch queue.
+	batchCost int64
+	// batchDiv divides the workers of a batch process.
+	batchDiv int
+	// batch is set once the process yielded to batch.
+	batch bool
 }
 
 // Release the resources/locks/semaphores associated with this process. Can
@@ -280,10 +309,39 @@ func (p *process) Yield(ctx context.Context) error {
 	// yieldFunc again.
 	p.yieldTimer.Stop()
 	p.yieldTimer = nil
+	p.batch = true
 
 	return nil
 }
 
+// Admit picks the queue for a search with the given estimated cost, and
+// returns how many workers it may use, out of workers. Expensive searches
+// yield to batch right away, rather than taking interactive capacity until
+// their deadline. Like Yield, this can not be called concurrently.
+func (p *process) Admit(ctx context.Context, cost int64, workers int) (int, error) {
+	if p.batchCost > 0 && cost >= p.batchCost && p.yieldTimer != nil {
+		p.yieldTimer.Stop()
+		p.yieldTimer = nil
+		if err := p.yieldFunc(ctx); err != nil {
+			return 0, err
+		}
+		p.batch = true
+	}
+	return p.Workers(workers), nil
+}
+
+// Workers returns how many of workers the process may use. Batch
+// processes get a fraction.
+func (p *process) Workers(workers int) int {
+	if p.batch && p.batchDiv > 1 {
+		workers /= p.batchDiv
+	}
+	if workers < 1 {
+		workers = 1
+	}
+	return workers
+}
+
 // newDeadlineTimer returns a timer which fires after deadline. Once it fires
 // Exceeded will always return true. Callers must call Stop when done to
 // release resources.
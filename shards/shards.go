@@ -21,12 +21,14 @@ import (
 	"io/ioutil"
 	"log"
 	"math"
+	"net/url"
 	"os"
 	"path"
+	"path/filepath"
 	"runtime"
 	"runtime/debug"
-	"sort"
 	"sync"
+	"sync/atomic"
 	"time"
 
 	"golang.org/x/sync/errgroup"
@@ -48,6 +50,10 @@ var (
 		Name: "zoekt_shards_loaded_total",
 		Help: "The total number of shards loaded",
 	})
+	metricShardsReady = promauto.NewGauge(prometheus.GaugeOpts{
+		Name: "zoekt_shards_ready_ratio",
+		Help: "The fraction of the shards found on startup that are loaded",
+	})
 	metricShardsLoadFailedTotal = promauto.NewCounter(prometheus.CounterOpts{
 		Name: "zoekt_shards_load_failed_total",
 		Help: "The total number of shard loads that failed",
@@ -108,6 +114,10 @@ var (
 		Name: "zoekt_search_shards_skipped_total",
 		Help: "Total shards that we did not process because a query was canceled",
 	})
+	metricSearchShardsSkippedFilterTotal = promauto.NewCounter(prometheus.CounterOpts{
+		Name: "zoekt_search_shards_skipped_filter_total",
+		Help: "Total shards that we did not process because their ngram filter showed they can't match",
+	})
 	metricSearchMatchCountTotal = promauto.NewCounter(prometheus.CounterOpts{
 		Name: "zoekt_search_match_count_total",
 		Help: "Total number of non-overlapping matches",
@@ -117,6 +127,19 @@ var (
 		Help: "Total number of candidate matches as a result of searching ngrams",
 	})
 
+	metricSearchCacheHitsTotal = promauto.NewCounter(prometheus.CounterOpts{
+		Name: "zoekt_search_cache_hits_total",
+		Help: "Total number of shard searches answered from the result cache",
+	})
+	metricSearchCacheMissesTotal = promauto.NewCounter(prometheus.CounterOpts{
+		Name: "zoekt_search_cache_misses_total",
+		Help: "Total number of shard searches not found in the result cache",
+	})
+	metricSearchCacheBytes = promauto.NewGauge(prometheus.GaugeOpts{
+		Name: "zoekt_search_cache_bytes",
+		Help: "The approximate size of the results in the result cache",
+	})
+
 	metricListRunning = promauto.NewGauge(prometheus.GaugeOpts{
 		Name: "zoekt_list_running",
 		Help: "The number of concurrent list requests running",
@@ -131,10 +154,28 @@ type repositorer interface {
 	Repository() *zoekt.Repository
 }
 
+type ngramFilterer interface {
+	NgramFilter() *zoekt.NgramFilter
+}
+
 type rankedShard struct {
 	zoekt.Searcher
 	name     string
 	priority float64
+
+	// repos holds the names of the shard's repositories. Compound
+	// shards have more than one.
+	repos []string
+
+	// id identifies this load of the shard. It changes every time the
+	// shard is replaced.
+	id string
+
+	// maxRank is the highest rank of the repositories in the shard.
+	maxRank uint16
+
+	// filter summarizes the ngrams of the shard, if it has one.
+	filter *zoekt.NgramFilter
 }
 
 type shardedSearcher struct {
@@ -144,59 +185,78 @@ type shardedSearcher struct {
 	// pressure.
 	sched scheduler
 
-	shards map[string]rankedShard
+	// current holds the current *shardSet. Searches read it without
+	// locking.
+	current atomic.Value
 
-	rankedVersion uint64
-	ranked        []rankedShard
+	// mu serializes changes to the shard set, and guards priority,
+	// generation and pending.
+	mu sync.Mutex
 
 	priority map[string]float64
+
+	// pending holds the shards loaded or dropped but not yet in the
+	// current set, by key. Dropped shards have a nil Searcher.
+	pending map[string]rankedShard
+
+	// generation is incremented for every replace, to give shards
+	// unique ids.
+	generation uint64
+
+	// cache holds per shard results, if enabled.
+	cache *resultCache
+
+	// intraShardParallelism sets SearchOptions.ShardParallelism if
+	// the caller didn't.
+	intraShardParallelism bool
+
+	// lockBudget limits the hot shard sections locked into memory,
+	// if set.
+	lockBudget *zoekt.LockBudget
 }
 
 func newShardedSearcher(n int64) *shardedSearcher {
 	ss := &shardedSearcher{
-		shards:   make(map[string]rankedShard),
 		sched:    newScheduler(n),
 		priority: make(map[string]float64),
 	}
+	ss.current.Store(newShardSet(map[string]rankedShard{}, ss.priority))
 	return ss
 }
 
-func (ss *shardedSearcher) watchPriorities(dir string, done chan struct{}) {
-	priorityPath := path.Join(dir, "priority.json")
-	var lastMtime time.Time
-
-	loadPriority := func() {
-		st, err := os.Stat(priorityPath)
-		if err != nil {
-			return // ignore missing file errors
-		}
-		if st.ModTime() == lastMtime {
-			return // file is unchanged
-		}
-		lastMtime = st.ModTime()
-		buf, err := ioutil.ReadFile(priorityPath)
-		if err != nil {
-			log.Printf("reloading priority.json, error %v", err)
-			return
-		}
-		priority := make(map[string]float64)
-		err = json.Unmarshal(buf, &priority)
-		if err != nil {
-			log.Printf("reloading priority.json, error %v", err)
-			return
-		}
+// loadPriority reloads priority.json if it changed since lastMtime.
+func (ss *shardedSearcher) loadPriority(priorityPath string, lastMtime *time.Time) {
+	st, err := os.Stat(priorityPath)
+	if err != nil {
+		return // ignore missing file errors
+	}
+	if st.ModTime() == *lastMtime {
+		return // file is unchanged
+	}
+	*lastMtime = st.ModTime()
+	buf, err := ioutil.ReadFile(priorityPath)
+	if err != nil {
+		log.Printf("reloading priority.json, error %v", err)
+		return
+	}
+	priority := make(map[string]float64)
+	err = json.Unmarshal(buf, &priority)
+	if err != nil {
+		log.Printf("reloading priority.json, error %v", err)
+		return
+	}
 
-		log.Printf("reloading priority.json: %d shards have priorities", len(priority))
+	log.Printf("reloading priority.json: %d shards have priorities", len(priority))
 
-		// get an exclusive lock to update priority map and invalidate ranking
-		proc := ss.sched.Exclusive()
-		defer proc.Release()
-		ss.priority = priority
-		ss.rankedVersion++
-		ss.ranked = nil // will regenerate ranking on next request
-	}
+	// The same shards, ranked by the new priorities.
+	ss.mu.Lock()
+	defer ss.mu.Unlock()
+	ss.priority = priority
+	ss.swapShards(ss.current.Load().(*shardSet).shards, nil)
+}
 
-	loadPriority()
+func (ss *shardedSearcher) watchPriorities(dir string, lastMtime time.Time, done chan struct{}) {
+	priorityPath := path.Join(dir, "priority.json")
 
 	// fsnotify is more efficient for watching a large number of files for changes, but a
 	// single stat call once a minute to check one file's modified time is negligible.
@@ -207,31 +267,101 @@ func (ss *shardedSearcher) watchPriorities(dir string, done chan struct{}) {
 			ticker.Stop()
 			return
 		case <-ticker.C:
-			loadPriority()
+			ss.loadPriority(priorityPath, &lastMtime)
 		}
 	}
 }
 
+// shardPriority returns a function giving the priority of a shard
+// file from the priorities returned by priority, for ordering shard
+// loads. Shards whose repository name can't be derived from the file
+// name get 0.
+func shardPriority(priority func() map[string]float64) func(string) float64 {
+	return func(fn string) float64 {
+		escaped, _ := versionFromPath(filepath.Base(fn))
+		name, err := url.QueryUnescape(escaped)
+		if err != nil {
+			return 0
+		}
+		return priority()[name]
+	}
+}
+
+// currentPriority returns the priorities from the last load of
+// priority.json.
+func (ss *shardedSearcher) currentPriority() map[string]float64 {
+	return ss.current.Load().(*shardSet).priority
+}
+
+// DirectorySearcherOptions configures the searcher returned by
+// NewDirectorySearcherWithOptions.
+type DirectorySearcherOptions struct {
+	// ResultCacheBytes is the memory budget for caching the search
+	// results of each shard. The cache is disabled if it is 0.
+	ResultCacheBytes int64
+
+	// IntraShardParallelism splits large shards across the search
+	// workers left idle when a query has fewer shards than workers.
+	IntraShardParallelism bool
+
+	// LoadParallelism is the number of shards loaded concurrently. It
+	// defaults to GOMAXPROCS. Shards load in order of their
+	// priority in priority.json.
+	LoadParallelism int
+
+	// LoadInBackground returns the searcher before the shards on
+	// disk are loaded. Searches meanwhile see the shards loaded so
+	// far. Use Ready to track the progress.
+	LoadInBackground bool
+
+	// LockHotSectionsBytes is the memory budget for locking the hot
+	// sections of the shards, which searches read besides postings
+	// and content, into RAM. Shards lock as they load, until the
+	// budget is used up. Nothing is locked if it is 0.
+	LockHotSectionsBytes int64
+}
+
 // NewDirectorySearcher returns a searcher instance that loads all
 // shards corresponding to a glob into memory.
 func NewDirectorySearcher(dir string) (zoekt.Streamer, error) {
+	return NewDirectorySearcherWithOptions(dir, DirectorySearcherOptions{})
+}
+
+// NewDirectorySearcherWithOptions is like NewDirectorySearcher, but
+// configured by opts.
+func NewDirectorySearcherWithOptions(dir string, opts DirectorySearcherOptions) (zoekt.Streamer, error) {
 	ss := newShardedSearcher(int64(runtime.GOMAXPROCS(0)))
+	if opts.ResultCacheBytes > 0 {
+		ss.cache = newResultCache(opts.ResultCacheBytes)
+	}
+	ss.intraShardParallelism = opts.IntraShardParallelism
+	if opts.LockHotSectionsBytes > 0 {
+		ss.lockBudget = zoekt.NewLockBudget(opts.LockHotSectionsBytes)
+	}
+	shardResidency.register(ss)
 	tl := &loader{
 		ss: ss,
 	}
-	dw, err := NewDirectoryWatcher(dir, tl)
+
+	// Read priorities first, so the most important shards load first.
+	var priorityMtime time.Time
+	ss.loadPriority(path.Join(dir, "priority.json"), &priorityMtime)
+
+	dw, err := newDirectoryWatcher(dir, tl, watcherOptions{
+		parallelism: opts.LoadParallelism,
+		priority:    shardPriority(ss.currentPriority),
+		background:  opts.LoadInBackground,
+	})
 	if err != nil {
 		return nil, err
 	}
 
-	go ss.watchPriorities(dir, dw.quit)
+	go ss.watchPriorities(dir, priorityMtime, dw.quit)
 
-	ds := &directorySearcher{
-		Streamer:         ss,
+	return &directorySearcher{
+		Streamer:         &typeRepoSearcher{Streamer: ss},
 		directoryWatcher: dw,
-	}
-
-	return &typeRepoSearcher{Streamer: ds}, nil
+	}, nil
 }
 
 type directorySearcher struct {
@@ -240,6 +370,12 @@ type directorySearcher struct {
 	directoryWatcher *DirectoryWatcher
 }
 
+// Ready returns the fraction of the shards on disk at startup that
+// are loaded.
+func (s *directorySearcher) Ready() float64 {
+	return s.directoryWatcher.Ready()
+}
+
 func (s *directorySearcher) Close() {
 	// We need to Stop directoryWatcher first since it calls load/unload on
 	// Searcher.
@@ -260,11 +396,18 @@ func (tl *loader) load(key string) {
 	}
 
 	metricShardsLoadedTotal.Inc()
-	tl.ss.replace(key, shard)
+	if l, ok := shard.(hotSectionLocker); ok && tl.ss.lockBudget != nil {
+		l.LockHotSections(tl.ss.lockBudget)
+	}
+	tl.ss.stage(key, shard)
 }
 
 func (tl *loader) drop(key string) {
-	tl.ss.replace(key, nil)
+	tl.ss.stage(key, nil)
+}
+
+func (tl *loader) flush() {
+	tl.ss.flush()
 }
 
 func (ss *shardedSearcher) String() string {
@@ -273,12 +416,25 @@ func (ss *shardedSearcher) String() string {
 
 // Close closes references to open files. It may be called only once.
 func (ss *shardedSearcher) Close() {
+	shardResidency.unregister(ss)
+
+	// Wait for running searches, so the shards are closed when Close
+	// returns.
 	proc := ss.sched.Exclusive()
 	defer proc.Release()
-	for _, s := range ss.shards {
-		s.Close()
+	ss.mu.Lock()
+	defer ss.mu.Unlock()
+	var all []zoekt.Searcher
+	for _, s := range ss.current.Load().(*shardSet).shards {
+		all = append(all, s.Searcher)
 	}
-	ss.shards = make(map[string]rankedShard)
+	for _, s := range ss.pending {
+		if s.Searcher != nil {
+			s.Close()
+		}
+	}
+	ss.pending = nil
+	ss.swapShards(map[string]rankedShard{}, all)
 }
 
 func selectRepoSet(shards []rankedShard, q query.Q) ([]rankedShard, query.Q) {
@@ -320,10 +476,15 @@ func selectRepoSet(shards []rankedShard, q query.Q) ([]rankedShard, query.Q) {
 		}
 
 		filtered := make([]rankedShard, 0, setSize)
+		compound := false
 
 		for _, s := range shards {
-			if hasRepo(s.name) {
-				filtered = append(filtered, s)
+			for _, name := range s.repos {
+				if hasRepo(name) {
+					filtered = append(filtered, s)
+					compound = compound || len(s.repos) > 1
+					break
+				}
 			}
 		}
 
@@ -333,6 +494,12 @@ func selectRepoSet(shards []rankedShard, q query.Q) ([]rankedShard, query.Q) {
 			return filtered, and
 		}
 
+		// Compound shards also hold repositories outside the set, so
+		// each shard has to apply the set itself.
+		if compound {
+			return filtered, and
+		}
+
 		// This optimization allows us to avoid the work done by
 		// indexData.simplify for each shard.
 		//
@@ -399,11 +566,26 @@ func (ss *shardedSearcher) Search(ctx context.Context, q query.Q, opts *zoekt.Se
 	aggregate.Wait = time.Since(start)
 	start = time.Now()
 
-	err = ss.streamSearch(ctx, proc, q, opts, stream.SenderFunc(func(r *zoekt.SearchResult) {
+	shards := ss.acquireShards()
+	defer shards.release()
+
+	// With NoCopy, the result pins the shards it references, as they
+	// may be closed once we release shards.
+	var releases []func()
+	err = ss.streamSearch(ctx, proc, shards.rankedShards(), q, opts, opts.MaxDocDisplayCount, stream.SenderFunc(func(r *zoekt.SearchResult) {
 		aggregate.Lock()
 		defer aggregate.Unlock()
 
+		if r.Release != nil {
+			releases = append(releases, r.Release)
+		}
 		aggregate.Stats.Add(r.Stats)
+		if r.Profile != nil {
+			if aggregate.Profile == nil {
+				aggregate.Profile = &zoekt.QueryProfile{}
+			}
+			aggregate.Profile.Add(r.Profile)
+		}
 
 		if len(r.Files) > 0 {
 			aggregate.Files = append(aggregate.Files, r.Files...)
@@ -422,6 +604,7 @@ func (ss *shardedSearcher) Search(ctx context.Context, q query.Q, opts *zoekt.Se
 		}
 	}))
 	if err != nil {
+		releaseAll(releases)
 		return nil, err
 	}
 
@@ -429,9 +612,18 @@ func (ss *shardedSearcher) Search(ctx context.Context, q query.Q, opts *zoekt.Se
 	if max := opts.MaxDocDisplayCount; max > 0 && len(aggregate.Files) > max {
 		aggregate.Files = aggregate.Files[:max]
 	}
-	copyFiles(aggregate.SearchResult)
+	if opts.NoCopy {
+		if len(releases) > 0 {
+			aggregate.Release = func() { releaseAll(releases) }
+		}
+	} else {
+		copyFiles(aggregate.SearchResult)
+	}
 
 	aggregate.Duration = time.Since(start)
+	if aggregate.Profile != nil {
+		tr.LazyPrintf("profile:\n%s", aggregate.Profile)
+	}
 	return aggregate.SearchResult, nil
 }
 
@@ -458,13 +650,36 @@ func (ss *shardedSearcher) StreamSearch(ctx context.Context, q query.Q, opts *zo
 		},
 	})
 
-	return ss.streamSearch(ctx, proc, q, opts, stream.SenderFunc(func(event *zoekt.SearchResult) {
-		copyFiles(event)
+	shards := ss.acquireShards()
+	defer shards.release()
+
+	return ss.streamSearch(ctx, proc, shards.rankedShards(), q, opts, 0, stream.SenderFunc(func(event *zoekt.SearchResult) {
+		// With NoCopy, the event is only valid during Send, while we
+		// hold shards. So the shards need no pins.
+		release := event.Release
+		event.Release = nil
+		if !opts.NoCopy {
+			copyFiles(event)
+		}
 		sender.Send(event)
+		if release != nil {
+			release()
+		}
 	}))
 }
 
-func (ss *shardedSearcher) streamSearch(ctx context.Context, proc *process, q query.Q, opts *zoekt.SearchOptions, sender zoekt.Sender) (err error) {
+// releaseAll calls the Release functions of results.
+func releaseAll(releases []func()) {
+	for _, release := range releases {
+		release()
+	}
+}
+
+// streamSearch searches the shards, which are sorted by decreasing
+// priority, and sends their results. If topK is positive, the caller
+// only keeps the topK highest scoring files, so shards that can't
+// score higher than the topK files found so far are skipped.
+func (ss *shardedSearcher) streamSearch(ctx context.Context, proc *process, shards []rankedShard, q query.Q, opts *zoekt.SearchOptions, topK int, sender zoekt.Sender) (err error) {
 	tr, ctx := trace.New(ctx, "shardedSearcher.streamSearch", "")
 	tr.LazyLog(q, true)
 	tr.LazyPrintf("opts: %+v", opts)
@@ -482,11 +697,18 @@ func (ss *shardedSearcher) streamSearch(ctx context.Context, proc *process, q qu
 		tr.Finish()
 	}()
 
-	shards := ss.getShards()
 	tr.LazyPrintf("before selectRepoSet shards:%d", len(shards))
 	shards, q = selectRepoSet(shards, q)
 	tr.LazyPrintf("after selectRepoSet shards:%d %s", len(shards), q)
 
+	// Shards whose ngram filter lacks the query's ngrams are skipped
+	// before they are scheduled. Estimates count all documents, so they
+	// need every shard.
+	var filter *zoekt.NgramFilterQuery
+	if !opts.EstimateDocCount {
+		filter = zoekt.NewNgramFilterQuery(q)
+	}
+
 	var childCtx context.Context
 	var cancel context.CancelFunc
 	if opts.MaxWallTime == 0 {
@@ -499,84 +721,191 @@ func (ss *shardedSearcher) streamSearch(ctx context.Context, proc *process, q qu
 
 	mu := sync.Mutex{}
 	pendingPriorities := prioritySlice{}
+	top := zoekt.TopScores{K: topK}
 
 	g, ctx := errgroup.WithContext(childCtx)
 
-	// For each query, throttle the number of parallel
-	// actions. Since searching is mostly CPU bound, we limit the
-	// number of parallel searches. This reduces the peak working
-	// set, which hopefully stops https://cs.bazel.build from crashing
-	// when looking for the string "com".
+	// Shards are searched on the shared work pool. The query's own
+	// goroutine runs its tasks, and idle pool workers help up to the
+	// query's weight, which depends on its estimated cost.
+	workers := runtime.GOMAXPROCS(0)
+	cost := estimateCost(q, len(shards))
+	weight, err := proc.Admit(ctx, cost, workers)
+	if err != nil {
+		return err
+	}
+	tr.LazyPrintf("cost:%d workers:%d", cost, weight)
+
+	if ss.intraShardParallelism && opts.ShardParallelism == 0 && len(shards) > 0 {
+		// The query holds weight workers. If there are fewer shards,
+		// the idle workers search within the shards.
+		if n := weight / len(shards); n > 1 {
+			o := *opts
+			o.ShardParallelism = n
+			opts = &o
+		}
+	}
+
+	wq := getWorkPool().newQueue(weight - 1)
+
+	var (
+		taskErrOnce sync.Once
+		taskErr     error
+	)
+	fail := func(err error) {
+		taskErrOnce.Do(func() {
+			taskErr = err
+			cancel()
+		})
+	}
+
+	// The cache key uses the query as seen by all shards. Cached
+	// results carry no profile, so profiled searches bypass the cache.
+	cache := ss.cache
+	if opts.Profile {
+		cache = nil
+	}
+	var cacheQuery string
+	if cache != nil {
+		cacheQuery = query.Simplify(q).String()
+	}
+
+	search := func(s rankedShard) {
+		var send zoekt.Sender = stream.SenderFunc(func(sr *zoekt.SearchResult) {
+			metricSearchContentBytesLoadedTotal.Add(float64(sr.Stats.ContentBytesLoaded))
+			metricSearchIndexBytesLoadedTotal.Add(float64(sr.Stats.IndexBytesLoaded))
+			metricSearchCrashesTotal.Add(float64(sr.Stats.Crashes))
+			metricSearchFileCountTotal.Add(float64(sr.Stats.FileCount))
+			metricSearchShardFilesConsideredTotal.Add(float64(sr.Stats.ShardFilesConsidered))
+			metricSearchFilesConsideredTotal.Add(float64(sr.Stats.FilesConsidered))
+			metricSearchFilesLoadedTotal.Add(float64(sr.Stats.FilesLoaded))
+			metricSearchFilesSkippedTotal.Add(float64(sr.Stats.FilesSkipped))
+			metricSearchShardsSkippedTotal.Add(float64(sr.Stats.ShardsSkipped))
+			metricSearchMatchCountTotal.Add(float64(sr.Stats.MatchCount))
+			metricSearchNgramMatchesTotal.Add(float64(sr.Stats.NgramMatches))
+
+			// MaxPendingPriority *cannot* be this result's Priority, because
+			// the priority is removed before computing max() and calling sender.Send.
+			// (There may be duplicate priorities, though-- that's fine.) A PendingShard
+			// is one that has not entered this critical section and sent its results.
+			//
+			// Note that there are at least two layers above this implementing streamSearch
+			// or StreamSearch that also take a lock for the entirety of the Send() operation.
+			//
+			// This is to avoid a potential race between shards sending back results
+			// if the priority were removed before sending without a lock:
+			// 1) shard A (pri 1), B (pri 2), C (pri 3) dispatch, pendingPriorities = [1, 2, 3]
+			// 2) C completes and removes itself from the priority list, pP = [1, 2]
+			// 3) B completes, removes itself, computes max, *and sends results* as maxPendingPriority=1,
+			//    indicating that no future results will come from a lower-ordered shard, pP = [1]
+			// 4) A completes, removes itself, computes max, and sends results with maxPP=-Inf, indicating
+			//    that the stream is finished (?)
+			// 5) C finally wakes up, computes max, and sends results with maxPP=-Inf, but with priority=3.
+			mu.Lock()
+			for _, f := range sr.Files {
+				top.Add(f.Score)
+			}
+			pendingPriorities.remove(s.priority)
+			sr.Progress.MaxPendingPriority = pendingPriorities.max()
+			sr.Progress.Priority = s.priority
+			sender.Send(sr)
+			mu.Unlock()
+		})
+
+		if cache != nil {
+			key := newResultCacheKey(s.id, cacheQuery, opts)
+			if sr, ok := cache.get(key); ok {
+				sr.Stats = cachedStats(sr.Stats)
+				send.Send(sr)
+				return
+			}
+
+			// Don't cache results cut short by crashes or
+			// cancelation.
+			uncached := send
+			send = stream.SenderFunc(func(sr *zoekt.SearchResult) {
+				if sr.Stats.Crashes == 0 && ctx.Err() == nil {
+					cache.add(key, sr)
+				}
+				uncached.Send(sr)
+			})
+		}
+
+		if err := searchOneShard(ctx, s, q, opts, send); err != nil {
+			mu.Lock()
+			pendingPriorities.remove(s.priority)
+			mu.Unlock()
+			fail(err)
+		}
+	}
+
+	// For each query, throttle the number of pending shard searches.
+	// Since searching is mostly CPU bound, we limit the number of
+	// parallel searches. This reduces the peak working set, which
+	// hopefully stops https://cs.bazel.build from crashing when looking
+	// for the string "com". It also lets the feeder skip shards based
+	// on the results so far.
 	//
-	// We do yield inside of the feeder. This means we could have num_workers +
-	// cap(feeder) searches run while yield blocks. However, doing it this way
-	// avoids needing to have synchronization in yield, so is done for
-	// simplicity.
-	feeder := make(chan rankedShard, runtime.GOMAXPROCS(0))
+	// We do yield inside of the feeder. This means we could have
+	// num_workers + cap(slots) searches run while yield blocks. However,
+	// doing it this way avoids needing to have synchronization in yield,
+	// so is done for simplicity.
+	slots := make(chan struct{}, workers)
 	g.Go(func() error {
-		defer close(feeder)
+		defer wq.close()
+		skipped, filtered := 0, 0
+		minSkippedPriority := math.Inf(1)
 		// Note: shards is sorted in order of descending priority.
 		for _, s := range shards {
+			if filter != nil && s.filter != nil && !s.filter.MayMatch(filter) {
+				filtered++
+				minSkippedPriority = math.Min(minSkippedPriority, s.priority)
+				continue
+			}
+
 			// We let searchOneShard handle context errors.
 			_ = proc.Yield(ctx)
+			wq.setWeight(proc.Workers(workers) - 1)
 			mu.Lock()
+			if top.Full() && zoekt.MaxFileScore(s.maxRank) <= top.Threshold() {
+				mu.Unlock()
+				skipped++
+				minSkippedPriority = math.Min(minSkippedPriority, s.priority)
+				continue
+			}
 			pendingPriorities.append(s.priority)
 			mu.Unlock()
-			feeder <- s
+
+			slots <- struct{}{}
+			s := s
+			wq.push(func() {
+				defer func() { <-slots }()
+				search(s)
+			})
+		}
+
+		metricSearchShardsSkippedFilterTotal.Add(float64(filtered))
+		if skipped > 0 || filtered > 0 {
+			mu.Lock()
+			sender.Send(&zoekt.SearchResult{
+				Stats: zoekt.Stats{ShardsSkipped: skipped, ShardsSkippedFilter: filtered},
+				Progress: zoekt.Progress{
+					Priority:           minSkippedPriority,
+					MaxPendingPriority: pendingPriorities.max(),
+				},
+			})
+			mu.Unlock()
 		}
 		return nil
 	})
-	for i := 0; i < runtime.GOMAXPROCS(0); i++ {
-		g.Go(func() error {
-			for s := range feeder {
-				err := searchOneShard(ctx, s, q, opts, stream.SenderFunc(func(sr *zoekt.SearchResult) {
-					metricSearchContentBytesLoadedTotal.Add(float64(sr.Stats.ContentBytesLoaded))
-					metricSearchIndexBytesLoadedTotal.Add(float64(sr.Stats.IndexBytesLoaded))
-					metricSearchCrashesTotal.Add(float64(sr.Stats.Crashes))
-					metricSearchFileCountTotal.Add(float64(sr.Stats.FileCount))
-					metricSearchShardFilesConsideredTotal.Add(float64(sr.Stats.ShardFilesConsidered))
-					metricSearchFilesConsideredTotal.Add(float64(sr.Stats.FilesConsidered))
-					metricSearchFilesLoadedTotal.Add(float64(sr.Stats.FilesLoaded))
-					metricSearchFilesSkippedTotal.Add(float64(sr.Stats.FilesSkipped))
-					metricSearchShardsSkippedTotal.Add(float64(sr.Stats.ShardsSkipped))
-					metricSearchMatchCountTotal.Add(float64(sr.Stats.MatchCount))
-					metricSearchNgramMatchesTotal.Add(float64(sr.Stats.NgramMatches))
-
-					// MaxPendingPriority *cannot* be this result's Priority, because
-					// the priority is removed before computing max() and calling sender.Send.
-					// (There may be duplicate priorities, though-- that's fine.) A PendingShard
-					// is one that has not entered this critical section and sent its results.
-					//
-					// Note that there are at least two layers above this implementing streamSearch
-					// or StreamSearch that also take a lock for the entirety of the Send() operation.
-					//
-					// This is to avoid a potential race between shards sending back results
-					// if the priority were removed before sending without a lock:
-					// 1) shard A (pri 1), B (pri 2), C (pri 3) dispatch, pendingPriorities = [1, 2, 3]
-					// 2) C completes and removes itself from the priority list, pP = [1, 2]
-					// 3) B completes, removes itself, computes max, *and sends results* as maxPendingPriority=1,
-					//    indicating that no future results will come from a lower-ordered shard, pP = [1]
-					// 4) A completes, removes itself, computes max, and sends results with maxPP=-Inf, indicating
-					//    that the stream is finished (?)
-					// 5) C finally wakes up, computes max, and sends results with maxPP=-Inf, but with priority=3.
-					mu.Lock()
-					pendingPriorities.remove(s.priority)
-					sr.Progress.MaxPendingPriority = pendingPriorities.max()
-					sr.Progress.Priority = s.priority
-					sender.Send(sr)
-					mu.Unlock()
-				}))
-				if err != nil {
-					mu.Lock()
-					pendingPriorities.remove(s.priority)
-					mu.Unlock()
-					return err
-				}
-			}
-			return nil
-		})
+	g.Go(func() error {
+		wq.run()
+		return nil
+	})
+	if err := g.Wait(); err != nil {
+		return err
 	}
-	return g.Wait()
+	return taskErr
 }
 
 func copySlice(src *[]byte) {
@@ -585,7 +914,8 @@ func copySlice(src *[]byte) {
 	*src = dst
 }
 
-// copyFiles must be protected by shardedSearcher.sched.
+// copyFiles copies the parts of sr that reference the memory of the
+// shard. The shard set holding the shard must be acquired.
 func copyFiles(sr *zoekt.SearchResult) {
 	for i := range sr.Files {
 		copySlice(&sr.Files[i].Content)
@@ -665,7 +995,9 @@ func (ss *shardedSearcher) List(ctx context.Context, r query.Q, opts *zoekt.List
 	defer proc.Release()
 	tr.LazyPrintf("acquired process")
 
-	shards := ss.getShards()
+	set := ss.acquireShards()
+	defer set.release()
+	shards := set.rankedShards()
 	shardCount := len(shards)
 	all := make(chan shardListResult, shardCount)
 	tr.LazyPrintf("shardCount: %d", len(shards))
@@ -724,84 +1056,115 @@ func (ss *shardedSearcher) List(ctx context.Context, r query.Q, opts *zoekt.List
 	return &agg, nil
 }
 
-// getShards returns the currently loaded shards. The shards must be accessed
-// under a rlock call. The shards are sorted by decreasing rank and should not
-// be mutated.
-func (s *shardedSearcher) getShards() []rankedShard {
-	if len(s.ranked) > 0 {
-		return s.ranked
-	}
-
-	var res []rankedShard
-	for _, sh := range s.shards {
-		// Add the current priority to the sorted list of ranked shards.
-		// This will be used for downstream result reordering.
-		res = append(res, rankedShard{
-			name:     sh.name,
-			priority: s.priority[sh.name],
-			Searcher: sh.Searcher,
-		})
-	}
-	sort.Slice(res, func(i, j int) bool {
-		priorityDiff := res[i].priority - res[j].priority
-		if priorityDiff != 0 {
-			return priorityDiff > 0
-		}
-		return res[i].name < res[j].name
-	})
-
-	// Cache ranked. We currently hold a read lock, so start a goroutine which
-	// acquires a write lock to update. Use requiredVersion to ensure our
-	// cached slice is still current after acquiring the write lock.
-	go func(ranked []rankedShard, requiredVersion uint64) {
-		proc := s.sched.Exclusive()
-		defer proc.Release()
-		if s.rankedVersion == requiredVersion {
-			s.ranked = ranked
-		}
-	}(res, s.rankedVersion)
-
-	return res
-}
-
-func shardName(s zoekt.Searcher) string {
+// shardInfo returns the names of the shard's repositories and their
+// highest rank.
+func shardInfo(s zoekt.Searcher) (names []string, maxRank uint16) {
 	q := query.Repo{}
 	result, err := s.List(context.Background(), &q, nil)
 	if err != nil {
-		return ""
+		return nil, math.MaxUint16
 	}
-	if len(result.Repos) == 0 {
-		return ""
+	for _, r := range result.Repos {
+		names = append(names, r.Repository.Name)
+		if r.Repository.Rank > maxRank {
+			maxRank = r.Repository.Rank
+		}
 	}
-	return result.Repos[0].Repository.Name
+	return names, maxRank
 }
 
+// replace loads or, if shard is nil, drops the shard under key, and
+// makes the change visible to searches right away.
 func (s *shardedSearcher) replace(key string, shard zoekt.Searcher) {
-	var name string
+	s.stage(key, shard)
+	s.flush()
+}
+
+// stage loads or, if shard is nil, drops the shard under key with the
+// next flush. Building a shard set copies the current one, so changes
+// are flushed in batches. A batch of an eighth of the loaded shards
+// flushes itself, which keeps the copies linear in the number of
+// shards loaded while the first shards already become searchable.
+func (s *shardedSearcher) stage(key string, shard zoekt.Searcher) {
+	var rs rankedShard
 	if shard != nil {
-		name = shardName(shard)
+		names, maxRank := shardInfo(shard)
+		// Compound shards are named and prioritized by their first
+		// repository.
+		var name string
+		if len(names) > 0 {
+			name = names[0]
+		}
+		rs = rankedShard{
+			name:     name,
+			repos:    names,
+			Searcher: shard,
+			maxRank:  maxRank,
+		}
+		if f, ok := shard.(ngramFilterer); ok {
+			rs.filter = f.NgramFilter()
+		}
 	}
 
-	proc := s.sched.Exclusive()
-	defer proc.Release()
+	s.mu.Lock()
+	defer s.mu.Unlock()
 
-	old := s.shards[key]
-	if old.Searcher != nil {
+	if shard != nil {
+		s.generation++
+		rs.id = fmt.Sprintf("%s@%d", key, s.generation)
+	}
+	if s.pending == nil {
+		s.pending = map[string]rankedShard{}
+	}
+	// A shard replaced before it was flushed was never searched.
+	if old, ok := s.pending[key]; ok && old.Searcher != nil {
 		old.Close()
 	}
+	s.pending[key] = rs
 
-	if shard == nil {
-		delete(s.shards, key)
-	} else {
-		s.shards[key] = rankedShard{
-			name:     name,
-			Searcher: shard,
+	if len(s.pending) > len(s.current.Load().(*shardSet).shards)/8 {
+		s.flushLocked()
+	}
+}
+
+// flush makes the staged changes visible to searches.
+func (s *shardedSearcher) flush() {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	s.flushLocked()
+}
+
+func (s *shardedSearcher) flushLocked() {
+	if len(s.pending) == 0 {
+		return
+	}
+
+	// Searches keep using the current set, so the next one is built
+	// from a copy.
+	cur := s.current.Load().(*shardSet).shards
+	shards := make(map[string]rankedShard, len(cur)+len(s.pending))
+	for k, v := range cur {
+		shards[k] = v
+	}
+
+	var retired []zoekt.Searcher
+	for key, rs := range s.pending {
+		if old, ok := shards[key]; ok && old.Searcher != nil {
+			retired = append(retired, old.Searcher)
+			if s.cache != nil {
+				s.cache.purge(old.id)
+			}
+		}
+		if rs.Searcher == nil {
+			delete(shards, key)
+		} else {
+			shards[key] = rs
 		}
 	}
-	s.rankedVersion++
-	s.ranked = nil
+	s.pending = nil
+	s.swapShards(shards, retired)
 
-	metricShardsLoaded.Set(float64(len(s.shards)))
+	metricShardsLoaded.Set(float64(len(shards)))
 }
 
 func loadShard(fn string) (zoekt.Searcher, error) {
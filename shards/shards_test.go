@@ -21,8 +21,10 @@ import (
 	"log"
 	"math"
 	"os"
+	"path/filepath"
 	"runtime"
 	"sort"
+	"sync/atomic"
 	"testing"
 	"time"
 
@@ -55,9 +57,11 @@ func TestCrashResilience(t *testing.T) {
 	log.SetOutput(out)
 	defer log.SetOutput(os.Stderr)
 	ss := newShardedSearcher(2)
-	ss.shards = map[string]rankedShard{
+	ss.mu.Lock()
+	ss.swapShards(map[string]rankedShard{
 		"x": {Searcher: &crashSearcher{}},
-	}
+	}, nil)
+	ss.mu.Unlock()
 
 	q := &query.Substring{Pattern: "hoi"}
 	opts := &zoekt.SearchOptions{}
@@ -166,6 +170,175 @@ func TestOrderByShard(t *testing.T) {
 	}
 }
 
+// blockingSearcher blocks searches until unblock is closed, and
+// records whether it was closed.
+type blockingSearcher struct {
+	rankSearcher
+	started chan struct{}
+	unblock chan struct{}
+	closed  int32
+}
+
+func (s *blockingSearcher) Search(ctx context.Context, q query.Q, opts *zoekt.SearchOptions) (*zoekt.SearchResult, error) {
+	close(s.started)
+	<-s.unblock
+	return s.rankSearcher.Search(ctx, q, opts)
+}
+
+func (s *blockingSearcher) Close() {
+	atomic.StoreInt32(&s.closed, 1)
+}
+
+func TestReplaceDuringSearch(t *testing.T) {
+	ss := newShardedSearcher(2)
+	old := &blockingSearcher{
+		started: make(chan struct{}),
+		unblock: make(chan struct{}),
+	}
+	ss.replace("shard", old)
+
+	done := make(chan *zoekt.SearchResult)
+	go func() {
+		res, err := ss.Search(context.Background(), &query.Substring{Pattern: "bla"}, &zoekt.SearchOptions{})
+		if err != nil {
+			t.Errorf("Search: %v", err)
+		}
+		done <- res
+	}()
+	<-old.started
+
+	// Neither replacing nor dropping shards waits for the search.
+	ss.replace("shard", &rankSearcher{rank: 1})
+	ss.replace("other", &rankSearcher{rank: 2})
+	ss.replace("other", nil)
+	if atomic.LoadInt32(&old.closed) != 0 {
+		t.Fatalf("replaced shard closed during search")
+	}
+	set := ss.acquireShards()
+	if got := len(set.rankedShards()); got != 1 {
+		t.Errorf("got %d shards, want 1", got)
+	}
+	set.release()
+
+	close(old.unblock)
+	if res := <-done; len(res.Files) != 1 || res.Files[0].FileName != "f0" {
+		t.Errorf("got %v, want the result of the replaced shard", res.Files)
+	}
+	if atomic.LoadInt32(&old.closed) != 1 {
+		t.Errorf("replaced shard not closed after search")
+	}
+}
+
+// scoreSearcher returns a file with the highest score possible for
+// its rank.
+type scoreSearcher struct {
+	rankSearcher
+}
+
+func (s *scoreSearcher) Search(ctx context.Context, q query.Q, opts *zoekt.SearchOptions) (*zoekt.SearchResult, error) {
+	sr, err := s.rankSearcher.Search(ctx, q, opts)
+	for i := range sr.Files {
+		sr.Files[i].Score = zoekt.MaxFileScore(s.rank)
+	}
+	return sr, err
+}
+
+func TestStageBatchesShardSets(t *testing.T) {
+	ss := newShardedSearcher(1)
+	defer ss.Close()
+
+	const n = 2000
+	copied := 0
+	last := ss.current.Load().(*shardSet)
+	for i := 0; i < n; i++ {
+		ss.stage(fmt.Sprintf("shard%d", i), &rankSearcher{rank: uint16(i)})
+		if cur := ss.current.Load().(*shardSet); cur != last {
+			copied += len(last.shards)
+			last = cur
+		}
+	}
+	ss.flush()
+
+	if got := len(ss.current.Load().(*shardSet).shards); got != n {
+		t.Errorf("got %d shards after flush, want %d", got, n)
+	}
+	// Each flush copies the set, and adds at least an eighth of it.
+	if copied > 9*n {
+		t.Errorf("copied %d shards loading %d, want them batched", copied, n)
+	}
+
+	// Dropping a shard only takes effect with the flush.
+	ss.stage("shard0", nil)
+	if _, ok := ss.current.Load().(*shardSet).shards["shard0"]; !ok {
+		t.Error("shard0 dropped before the flush")
+	}
+	ss.flush()
+	if _, ok := ss.current.Load().(*shardSet).shards["shard0"]; ok {
+		t.Error("shard0 not dropped by the flush")
+	}
+}
+
+func TestTopKSkipsShards(t *testing.T) {
+	ss := newShardedSearcher(1)
+
+	n := 20 * runtime.GOMAXPROCS(0)
+	for i := 0; i < n; i++ {
+		name := fmt.Sprintf("repo%d", i)
+		ss.priority[name] = float64(i)
+		ss.replace(fmt.Sprintf("shard%d", i), &scoreSearcher{rankSearcher{
+			rank: uint16(i),
+			repo: &zoekt.Repository{Name: name},
+		}})
+	}
+
+	opts := zoekt.SearchOptions{MaxDocDisplayCount: 2}
+	res, err := ss.Search(context.Background(), &query.Substring{Pattern: "bla"}, &opts)
+	if err != nil {
+		t.Fatalf("Search: %v", err)
+	}
+
+	var got []string
+	for _, f := range res.Files {
+		got = append(got, f.FileName)
+	}
+	want := []string{fmt.Sprintf("f%d", n-1), fmt.Sprintf("f%d", n-2)}
+	if d := cmp.Diff(want, got); d != "" {
+		t.Errorf("mismatch (-want +got):\n%s", d)
+	}
+	if res.Stats.ShardsSkipped == 0 {
+		t.Errorf("got no skipped shards, want lower ranked shards skipped")
+	}
+}
+
+func TestNgramFilterSkipsShards(t *testing.T) {
+	ss := newShardedSearcher(1)
+	for i, content := range []string{"needle in a haystack", "just hay", "more hay"} {
+		repo := &zoekt.Repository{Name: fmt.Sprintf("repo%d", i)}
+		b := testIndexBuilder(t, repo, zoekt.Document{Name: "f", Content: []byte(content)})
+		ss.replace(repo.Name, searcherForTest(t, b))
+	}
+
+	res, err := ss.Search(context.Background(), &query.Substring{Pattern: "needle"}, &zoekt.SearchOptions{})
+	if err != nil {
+		t.Fatal(err)
+	}
+	if len(res.Files) != 1 || res.Files[0].Repository != "repo0" {
+		t.Errorf("got %v, want a match in repo0", res.Files)
+	}
+	if res.Stats.ShardsSkippedFilter != 2 || res.Stats.ShardsSkipped != 0 {
+		t.Errorf("got %d shards skipped by filter, %d skipped, want 2 and 0", res.Stats.ShardsSkippedFilter, res.Stats.ShardsSkipped)
+	}
+
+	// Estimates need all shards.
+	res, err = ss.Search(context.Background(), &query.Substring{Pattern: "needle"}, &zoekt.SearchOptions{EstimateDocCount: true})
+	if err != nil {
+		t.Fatal(err)
+	}
+	if res.Stats.ShardFilesConsidered != 3 || res.Stats.ShardsSkippedFilter != 0 {
+		t.Errorf("got %+v, want 3 files considered", res.Stats)
+	}
+}
+
 func TestFilteringShardsByRepoSet(t *testing.T) {
 	ss := newShardedSearcher(1)
 
@@ -393,6 +566,39 @@ func TestShardedSearcher_List(t *testing.T) {
 	}
 }
 
+func TestLoaderLocksHotSections(t *testing.T) {
+	b := testIndexBuilder(t, &zoekt.Repository{Name: "repo"}, zoekt.Document{Name: "f", Content: []byte("needle")})
+	fn := filepath.Join(t.TempDir(), "repo_v16.00000.zoekt")
+	f, err := os.Create(fn)
+	if err != nil {
+		t.Fatal(err)
+	}
+	if err := b.Write(f); err != nil {
+		t.Fatal(err)
+	}
+	if err := f.Close(); err != nil {
+		t.Fatal(err)
+	}
+
+	ss := newShardedSearcher(1)
+	ss.lockBudget = zoekt.NewLockBudget(1 << 20)
+	tl := &loader{ss: ss}
+	tl.load(fn)
+
+	r, ok := ss.residency()["repo_v16.00000.zoekt"]
+	if !ok || r.MappedBytes == 0 || r.HotBytes == 0 {
+		t.Fatalf("got residency %+v, %v", r, ok)
+	}
+	if r.LockedBytes != ss.lockBudget.Used() {
+		t.Errorf("shard locked %d bytes, budget used %d", r.LockedBytes, ss.lockBudget.Used())
+	}
+
+	tl.drop(fn)
+	if n := ss.lockBudget.Used(); n != 0 {
+		t.Errorf("got %d bytes locked after dropping the shard", n)
+	}
+}
+
 func testIndexBuilder(t testing.TB, repo *zoekt.Repository, docs ...zoekt.Document) *zoekt.IndexBuilder {
 	b, err := zoekt.NewIndexBuilder(repo)
 	if err != nil {
@@ -0,0 +1,129 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package shards
+
+import (
+	"sort"
+	"sync"
+	"sync/atomic"
+
+	"github.com/google/zoekt"
+)
+
+// shardSet is an immutable snapshot of the loaded shards. Searches use
+// the set that is current when they start. Loading and dropping shards
+// installs a new set, and the shards it drops are closed once the
+// searches using older sets are done, so neither has to wait for the
+// other.
+type shardSet struct {
+	// refs counts the searches using the set, plus one while the set
+	// is current and one until its predecessor is released. It is
+	// first for 64-bit alignment.
+	refs int64
+
+	shards   map[string]rankedShard
+	priority map[string]float64
+
+	rankOnce sync.Once
+	ranked   []rankedShard
+
+	// next is the set that replaced this one, and retired the shards
+	// it dropped. Both are set before the set stops being current.
+	// Once the set is released, it closes retired and releases next.
+	// Since a set can only be released after its predecessor, a shard
+	// is never closed while an older set holding it is in use.
+	next    *shardSet
+	retired []zoekt.Searcher
+}
+
+func newShardSet(shards map[string]rankedShard, priority map[string]float64) *shardSet {
+	return &shardSet{
+		refs:     1,
+		shards:   shards,
+		priority: priority,
+	}
+}
+
+// acquire takes a reference on the set. It fails if the set has
+// already been released.
+func (s *shardSet) acquire() bool {
+	for {
+		n := atomic.LoadInt64(&s.refs)
+		if n == 0 {
+			return false
+		}
+		if atomic.CompareAndSwapInt64(&s.refs, n, n+1) {
+			return true
+		}
+	}
+}
+
+// release drops a reference on the set, closing the retired shards if
+// it was the last.
+func (s *shardSet) release() {
+	for s != nil && atomic.AddInt64(&s.refs, -1) == 0 {
+		for _, sh := range s.retired {
+			sh.Close()
+		}
+		s = s.next
+	}
+}
+
+// rankedShards returns the shards sorted by decreasing priority. The
+// result is computed once per set, and must not be mutated.
+func (s *shardSet) rankedShards() []rankedShard {
+	s.rankOnce.Do(func() {
+		res := make([]rankedShard, 0, len(s.shards))
+		for _, sh := range s.shards {
+			// Add the current priority to the sorted list of
+			// ranked shards. This will be used for downstream
+			// result reordering.
+			sh.priority = s.priority[sh.name]
+			res = append(res, sh)
+		}
+		sort.Slice(res, func(i, j int) bool {
+			priorityDiff := res[i].priority - res[j].priority
+			if priorityDiff != 0 {
+				return priorityDiff > 0
+			}
+			return res[i].name < res[j].name
+		})
+		s.ranked = res
+	})
+	return s.ranked
+}
+
+// acquireShards returns the current shard set. The caller must
+// release it once it no longer uses the shards or results referencing
+// their memory.
+func (ss *shardedSearcher) acquireShards() *shardSet {
+	for {
+		if s := ss.current.Load().(*shardSet); s.acquire() {
+			return s
+		}
+	}
+}
+
+// swapShards makes a set of shards current, retiring the given shards
+// of the current set. ss.mu must be held.
+func (ss *shardedSearcher) swapShards(shards map[string]rankedShard, retired []zoekt.Searcher) {
+	old := ss.current.Load().(*shardSet)
+	next := newShardSet(shards, ss.priority)
+	next.refs++
+	old.next = next
+	old.retired = retired
+	ss.current.Store(next)
+	old.release()
+}
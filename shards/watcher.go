@@ -20,9 +20,11 @@ import (
 	"os"
 	"path/filepath"
 	"runtime"
+	"sort"
 	"strconv"
 	"strings"
 	"sync"
+	"sync/atomic"
 	"time"
 
 	"github.com/fsnotify/fsnotify"
@@ -33,12 +35,22 @@ type shardLoader interface {
 	// Load a new file. Should be safe for concurrent calls.
 	load(filename string)
 	drop(filename string)
+
+	// flush is called once a scan loaded and dropped its shards.
+	flush()
 }
 
 type DirectoryWatcher struct {
 	dir        string
 	timestamps map[string]time.Time
 	loader     shardLoader
+	opts       watcherOptions
+
+	// initialTotal is the number of shards the first scan loads plus
+	// one for its final flush, or -1 before it knows. initialLoaded
+	// counts the ones done so far.
+	initialTotal  int64
+	initialLoaded int64
 
 	closeOnce sync.Once
 	// quit is closed by Close to signal the directory watcher to stop.
@@ -47,6 +59,21 @@ type DirectoryWatcher struct {
 	stopped chan struct{}
 }
 
+// watcherOptions configures how a DirectoryWatcher loads shards.
+type watcherOptions struct {
+	// parallelism is the number of shards loaded concurrently. It
+	// defaults to GOMAXPROCS.
+	parallelism int
+
+	// priority orders the shards of a scan, loading those with a
+	// higher priority first. Without it shards load in name order.
+	priority func(filename string) float64
+
+	// background makes the first scan run after the watcher is
+	// returned, rather than before.
+	background bool
+}
+
 func (sw *DirectoryWatcher) Stop() {
 	sw.closeOnce.Do(func() {
 		close(sw.quit)
@@ -55,14 +82,27 @@ func (sw *DirectoryWatcher) Stop() {
 }
 
 func NewDirectoryWatcher(dir string, loader shardLoader) (*DirectoryWatcher, error) {
+	return newDirectoryWatcher(dir, loader, watcherOptions{})
+}
+
+func newDirectoryWatcher(dir string, loader shardLoader, opts watcherOptions) (*DirectoryWatcher, error) {
+	if opts.parallelism <= 0 {
+		opts.parallelism = runtime.GOMAXPROCS(0)
+	}
 	sw := &DirectoryWatcher{
-		dir:        dir,
-		timestamps: map[string]time.Time{},
-		loader:     loader,
-		quit:       make(chan struct{}),
-		stopped:    make(chan struct{}),
+		dir:          dir,
+		timestamps:   map[string]time.Time{},
+		loader:       loader,
+		opts:         opts,
+		initialTotal: -1,
+		quit:         make(chan struct{}),
+		stopped:      make(chan struct{}),
 	}
-	if err := sw.scan(); err != nil {
+	if !opts.background {
+		if err := sw.scan(); err != nil {
+			return nil, err
+		}
+	} else if _, err := os.Stat(dir); err != nil {
 		return nil, err
 	}
 
@@ -73,6 +113,19 @@ func NewDirectoryWatcher(dir string, loader shardLoader) (*DirectoryWatcher, err
 	return sw, nil
 }
 
+// Ready returns the fraction of the shards found by the first scan
+// that are loaded. It is 1 once the first scan is done.
+func (s *DirectoryWatcher) Ready() float64 {
+	total := atomic.LoadInt64(&s.initialTotal)
+	if total < 0 {
+		return 0
+	}
+	if total == 0 {
+		return 1
+	}
+	return float64(atomic.LoadInt64(&s.initialLoaded)) / float64(total)
+}
+
 func (s *DirectoryWatcher) String() string {
 	return fmt.Sprintf("shardWatcher(%s)", s.dir)
 }
@@ -167,14 +220,26 @@ func (s *DirectoryWatcher) scan() error {
 		s.loader.drop(t)
 	}
 
+	initial := atomic.LoadInt64(&s.initialTotal) < 0
+	if initial {
+		atomic.StoreInt64(&s.initialTotal, int64(len(toLoad))+1)
+		metricShardsReady.Set(s.Ready())
+	}
+
 	if len(toLoad) == 0 {
+		s.loader.flush()
+		if initial {
+			atomic.AddInt64(&s.initialLoaded, 1)
+			metricShardsReady.Set(s.Ready())
+		}
 		return nil
 	}
 
 	log.Printf("loading %d shards", len(toLoad))
+	s.sortLoads(toLoad)
 
 	// Limit amount of concurrent shard loads.
-	throttle := make(chan struct{}, runtime.GOMAXPROCS(0))
+	throttle := make(chan struct{}, s.opts.parallelism)
 	lastProgress := time.Now()
 	for i, t := range toLoad {
 		// If taking a while to start-up occasionally give a progress message
@@ -186,16 +251,43 @@ func (s *DirectoryWatcher) scan() error {
 		throttle <- struct{}{}
 		go func(k string) {
 			s.loader.load(k)
+			if initial {
+				atomic.AddInt64(&s.initialLoaded, 1)
+				metricShardsReady.Set(s.Ready())
+			}
 			<-throttle
 		}(t)
 	}
 	for i := 0; i < cap(throttle); i++ {
 		throttle <- struct{}{}
 	}
+	s.loader.flush()
+	if initial {
+		atomic.AddInt64(&s.initialLoaded, 1)
+		metricShardsReady.Set(s.Ready())
+	}
 
 	return nil
 }
 
+// sortLoads orders shards by descending priority, then by name.
+func (s *DirectoryWatcher) sortLoads(fns []string) {
+	if s.opts.priority == nil {
+		sort.Strings(fns)
+		return
+	}
+	prio := make(map[string]float64, len(fns))
+	for _, fn := range fns {
+		prio[fn] = s.opts.priority(fn)
+	}
+	sort.Slice(fns, func(i, j int) bool {
+		if pi, pj := prio[fns[i]], prio[fns[j]]; pi != pj {
+			return pi > pj
+		}
+		return fns[i] < fns[j]
+	})
+}
+
 func (s *DirectoryWatcher) watch() error {
 	watcher, err := fsnotify.NewWatcher()
 	if err != nil {
@@ -233,6 +325,11 @@ func (s *DirectoryWatcher) watch() error {
 
 	go func() {
 		defer close(s.stopped)
+		if s.opts.background {
+			if err := s.scan(); err != nil {
+				log.Printf("scan %s: %v", s.dir, err)
+			}
+		}
 		for range signal {
 			s.scan()
 		}
@@ -36,6 +36,8 @@ func (l *loggingLoader) drop(k string) {
 	l.drops <- k
 }
 
+func (l *loggingLoader) flush() {}
+
 func advanceFS() {
 	time.Sleep(10 * time.Millisecond)
 }
@@ -218,3 +220,71 @@ func TestDirWatcherLoadLatest(t *testing.T) {
 	default:
 	}
 }
+
+func TestDirWatcherLoadByPriority(t *testing.T) {
+	dir := t.TempDir()
+
+	var names []string
+	for _, name := range []string{"a", "b", "c"} {
+		shard := filepath.Join(dir, name+"_v16.00000.zoekt")
+		if err := ioutil.WriteFile(shard, []byte("hello"), 0o644); err != nil {
+			t.Fatalf("WriteFile: %v", err)
+		}
+		names = append(names, shard)
+	}
+
+	// Loads block until released, so we can watch progress.
+	logger := &loggingLoader{
+		loads: make(chan string),
+		drops: make(chan string, 10),
+	}
+	priority := map[string]float64{"b": 3, "c": 2}
+	dw, err := newDirectoryWatcher(dir, logger, watcherOptions{
+		parallelism: 1,
+		priority:    shardPriority(func() map[string]float64 { return priority }),
+		background:  true,
+	})
+	if err != nil {
+		t.Fatalf("newDirectoryWatcher: %v", err)
+	}
+	defer dw.Stop()
+
+	for i, want := range []string{names[1], names[2], names[0]} {
+		if got := <-logger.loads; got != want {
+			t.Fatalf("load %d: got %v, want %v", i, got, want)
+		}
+	}
+
+	deadline := time.Now().Add(10 * time.Second)
+	for dw.Ready() < 1 {
+		if time.Now().After(deadline) {
+			t.Fatalf("got Ready %v after all loads, want 1", dw.Ready())
+		}
+		advanceFS()
+	}
+}
+
+func TestShardPriorityFollowsReload(t *testing.T) {
+	dir := t.TempDir()
+	priorityPath := filepath.Join(dir, "priority.json")
+	ss := newShardedSearcher(1)
+	defer ss.Close()
+	priority := shardPriority(ss.currentPriority)
+	shard := filepath.Join(dir, "a_v16.00000.zoekt")
+
+	var mtime time.Time
+	for i, want := range []float64{1, 2} {
+		if err := ioutil.WriteFile(priorityPath, []byte(fmt.Sprintf(`{"a": %v}`, want)), 0o644); err != nil {
+			t.Fatalf("WriteFile: %v", err)
+		}
+		// Make sure the reload sees a new mtime.
+		ts := time.Now().Add(time.Duration(i) * time.Minute)
+		if err := os.Chtimes(priorityPath, ts, ts); err != nil {
+			t.Fatalf("Chtimes: %v", err)
+		}
+		ss.loadPriority(priorityPath, &mtime)
+		if got := priority(shard); got != want {
+			t.Errorf("got priority %v, want %v", got, want)
+		}
+	}
+}
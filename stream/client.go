@@ -5,6 +5,7 @@ import (
 	"context"
 	"encoding/gob"
 	"fmt"
+	"mime"
 	"net/http"
 
 	"github.com/google/zoekt"
@@ -65,7 +66,7 @@ func (c *Client) StreamSearch(ctx context.Context, q query.Q, opts *zoekt.Search
 	if err != nil {
 		return err
 	}
-	req.Header.Set("Accept", "application/x-gob-stream")
+	req.Header.Set("Accept", binaryAccept)
 	req.Header.Set("Cache-Control", "no-cache")
 	req.Header.Set("Connection", "keep-alive")
 	req.Header.Set("Transfer-Encoding", "chunked")
@@ -76,10 +77,18 @@ func (c *Client) StreamSearch(ctx context.Context, q query.Q, opts *zoekt.Search
 	}
 	defer resp.Body.Close()
 
-	dec := gob.NewDecoder(resp.Body)
+	// Servers that predate the binary format answer with gob.
+	var decode func(*searchReply) error
+	if mediaType, _, _ := mime.ParseMediaType(resp.Header.Get("Content-Type")); mediaType == binaryMediaType {
+		decode = newBinaryDecoder(resp.Body).decode
+	} else {
+		dec := gob.NewDecoder(resp.Body)
+		decode = func(reply *searchReply) error { return dec.Decode(reply) }
+	}
+
 	for {
 		reply := &searchReply{}
-		err := dec.Decode(reply)
+		err := decode(reply)
 		if err != nil {
 			return fmt.Errorf("error during decoding: %w", err)
 		}
@@ -3,9 +3,14 @@
 package stream
 
 import (
+	"compress/gzip"
 	"encoding/gob"
 	"errors"
+	"fmt"
+	"mime"
 	"net/http"
+	"strconv"
+	"strings"
 	"sync"
 
 	"github.com/google/zoekt"
@@ -59,7 +64,7 @@ func (h *handler) ServeHTTP(w http.ResponseWriter, r *http.Request) {
 		return
 	}
 
-	eventWriter, err := newEventStreamWriter(w)
+	eventWriter, err := negotiateEventStreamWriter(w, r)
 	if err != nil {
 		http.Error(w, err.Error(), http.StatusInternalServerError)
 		return
@@ -71,11 +76,14 @@ func (h *handler) ServeHTTP(w http.ResponseWriter, r *http.Request) {
 		if err != nil {
 			_ = eventWriter.event(eventError, err)
 		}
+		_ = eventWriter.close()
 	}()
 
-	// mu protects aggStats and concurrent writes to the stream.
+	// mu protects aggStats, aggProfile and concurrent writes to the
+	// stream.
 	mu := sync.Mutex{}
 	var aggStats = zoekt.Stats{}
+	var aggProfile *zoekt.QueryProfile
 	send := func(zsr *zoekt.SearchResult) {
 		err := eventWriter.event(eventMatches, zsr)
 		if err != nil {
@@ -84,7 +92,15 @@ func (h *handler) ServeHTTP(w http.ResponseWriter, r *http.Request) {
 		}
 	}
 
-	err = h.Searcher.StreamSearch(ctx, args.Q, args.Opts, SenderFunc(func(event *zoekt.SearchResult) {
+	// Events are encoded during Send, so they need not be copied out
+	// of the shards.
+	var opts zoekt.SearchOptions
+	if args.Opts != nil {
+		opts = *args.Opts
+	}
+	opts.NoCopy = true
+
+	err = h.Searcher.StreamSearch(ctx, args.Q, &opts, SenderFunc(func(event *zoekt.SearchResult) {
 		mu.Lock()
 		defer mu.Unlock()
 
@@ -93,8 +109,20 @@ func (h *handler) ServeHTTP(w http.ResponseWriter, r *http.Request) {
 		// aggregate the stats.
 		if len(event.Files) == 0 {
 			aggStats.Add(event.Stats)
+			if event.Profile != nil {
+				if aggProfile == nil {
+					aggProfile = &zoekt.QueryProfile{}
+				}
+				aggProfile.Add(event.Profile)
+			}
 			return
 		}
+		if aggProfile != nil {
+			if event.Profile != nil {
+				aggProfile.Add(event.Profile)
+			}
+			event.Profile, aggProfile = aggProfile, nil
+		}
 
 		// If we have aggregate stats, we merge them with the new event before sending
 		// it, and reset aggStats afterwards.
@@ -106,8 +134,8 @@ func (h *handler) ServeHTTP(w http.ResponseWriter, r *http.Request) {
 		return
 	}))
 
-	if err == nil && !aggStats.Zero() {
-		send(&zoekt.SearchResult{Stats: aggStats})
+	if err == nil && (!aggStats.Zero() || aggProfile != nil) {
+		send(&zoekt.SearchResult{Stats: aggStats, Profile: aggProfile})
 	}
 
 	if err != nil {
@@ -116,9 +144,72 @@ func (h *handler) ServeHTTP(w http.ResponseWriter, r *http.Request) {
 	}
 }
 
+// Media types of the response formats. The request is always gob
+// encoded.
+const (
+	gobMediaType    = "application/x-gob-stream"
+	binaryMediaType = "application/x-zoekt-stream"
+)
+
+// binaryAccept is the Accept header of clients that prefer the binary
+// format, but can fall back to gob.
+var binaryAccept = fmt.Sprintf("%s; version=%d, %s", binaryMediaType, binaryVersion, gobMediaType)
+
 type eventStreamWriter struct {
 	enc   *gob.Encoder
 	flush func()
+
+	// bin replaces enc if the client accepts the binary format.
+	bin *binaryEncoder
+
+	// gz compresses the binary format, if the client accepts gzip.
+	gz *gzip.Writer
+}
+
+// acceptsBinary returns whether the Accept header of r lists the
+// version of the binary format we write.
+func acceptsBinary(r *http.Request) bool {
+	for _, accept := range strings.Split(r.Header.Get("Accept"), ",") {
+		mediaType, params, err := mime.ParseMediaType(accept)
+		if err == nil && mediaType == binaryMediaType && params["version"] == strconv.Itoa(binaryVersion) {
+			return true
+		}
+	}
+	return false
+}
+
+func acceptsGzip(r *http.Request) bool {
+	for _, enc := range strings.Split(r.Header.Get("Accept-Encoding"), ",") {
+		if strings.TrimSpace(strings.SplitN(enc, ";", 2)[0]) == "gzip" {
+			return true
+		}
+	}
+	return false
+}
+
+// negotiateEventStreamWriter returns a writer for the binary format if
+// the client accepts it, and for gob otherwise, so clients that
+// predate the binary format keep working.
+func negotiateEventStreamWriter(w http.ResponseWriter, r *http.Request) (*eventStreamWriter, error) {
+	if !acceptsBinary(r) {
+		return newEventStreamWriter(w)
+	}
+
+	flusher, ok := w.(http.Flusher)
+	if !ok {
+		return nil, errors.New("http flushing not supported")
+	}
+	setStreamHeaders(w, fmt.Sprintf("%s; version=%d", binaryMediaType, binaryVersion))
+
+	e := &eventStreamWriter{flush: flusher.Flush}
+	if acceptsGzip(r) {
+		w.Header().Set("Content-Encoding", "gzip")
+		e.gz = gzip.NewWriter(w)
+		e.bin = newBinaryEncoder(e.gz)
+	} else {
+		e.bin = newBinaryEncoder(w)
+	}
+	return e, nil
 }
 
 func newEventStreamWriter(w http.ResponseWriter) (*eventStreamWriter, error) {
@@ -127,7 +218,16 @@ func newEventStreamWriter(w http.ResponseWriter) (*eventStreamWriter, error) {
 		return nil, errors.New("http flushing not supported")
 	}
 
-	w.Header().Set("Content-Type", "application/x-gob-stream")
+	setStreamHeaders(w, gobMediaType)
+
+	return &eventStreamWriter{
+		enc:   gob.NewEncoder(w),
+		flush: flusher.Flush,
+	}, nil
+}
+
+func setStreamHeaders(w http.ResponseWriter, contentType string) {
+	w.Header().Set("Content-Type", contentType)
 	w.Header().Set("Cache-Control", "no-cache")
 	w.Header().Set("Connection", "keep-alive")
 	w.Header().Set("Transfer-Encoding", "chunked")
@@ -136,11 +236,6 @@ func newEventStreamWriter(w http.ResponseWriter) (*eventStreamWriter, error) {
 	// be delayed until buffers get full, leading to worst case latency of the
 	// full time a search takes to complete.
 	w.Header().Set("X-Accel-Buffering", "no")
-
-	return &eventStreamWriter{
-		enc:   gob.NewEncoder(w),
-		flush: flusher.Flush,
-	}, nil
 }
 
 func (e *eventStreamWriter) event(event eventType, data interface{}) error {
@@ -151,10 +246,32 @@ func (e *eventStreamWriter) event(event eventType, data interface{}) error {
 			data = err.Error()
 		}
 	}
-	err := e.enc.Encode(searchReply{Event: event, Data: data})
+	var err error
+	if e.bin != nil {
+		err = e.bin.event(event, data)
+	} else {
+		err = e.enc.Encode(searchReply{Event: event, Data: data})
+	}
 	if err != nil {
 		return err
 	}
+	if e.gz != nil {
+		if err := e.gz.Flush(); err != nil {
+			return err
+		}
+	}
+	e.flush()
+	return nil
+}
+
+// close ends the stream.
+func (e *eventStreamWriter) close() error {
+	if e.gz == nil {
+		return nil
+	}
+	if err := e.gz.Close(); err != nil {
+		return err
+	}
 	e.flush()
 	return nil
 }
@@ -0,0 +1,607 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package stream
+
+import (
+	"bufio"
+	"bytes"
+	"encoding/binary"
+	"errors"
+	"fmt"
+	"io"
+	"math"
+	"strings"
+	"time"
+
+	"github.com/google/zoekt"
+)
+
+// The binary stream format is an alternative to gob, which is cheaper
+// to decode for large result sets. The stream starts with the format
+// version as a uvarint. Each event follows as a frame: the payload
+// length as a uvarint, the event type as a byte, and the event data.
+//
+// Repository names, branch lists and other strings that repeat across
+// FileMatches are interned per stream: the first occurrence is sent
+// in full, and later ones as a reference to it. Lines of LineMatches
+// that are part of the file content sent along are sent as the byte
+// range of the content.
+const binaryVersion = 1
+
+// maxInterned bounds the number of strings interned per stream.
+// Strings beyond that are sent in full.
+const maxInterned = 1 << 16
+
+// maxFrameSize bounds the size of a frame the decoder accepts.
+const maxFrameSize = 1 << 30
+
+// Flags of an encoded LineMatch.
+const (
+	lineFileName = 1 << iota
+	// lineInContent means the line is Content[LineStart:LineEnd] of
+	// the FileMatch.
+	lineInContent
+	// lineIsFileName means the line is the FileName of the FileMatch.
+	lineIsFileName
+	lineHasSymbol
+)
+
+type binaryEncoder struct {
+	w io.Writer
+
+	wroteVersion bool
+	buf          []byte
+	strings      map[string]uint64
+	lists        map[string]uint64
+}
+
+func newBinaryEncoder(w io.Writer) *binaryEncoder {
+	return &binaryEncoder{
+		w:       w,
+		strings: map[string]uint64{},
+		lists:   map[string]uint64{},
+	}
+}
+
+// event writes one frame. data is nil, a string or a
+// *zoekt.SearchResult, depending on the event.
+func (e *binaryEncoder) event(event eventType, data interface{}) error {
+	e.buf = e.buf[:0]
+	e.buf = append(e.buf, byte(event))
+	switch event {
+	case eventMatches:
+		res, ok := data.(*zoekt.SearchResult)
+		if !ok {
+			return fmt.Errorf("data for event of type %s is %T, want *zoekt.SearchResult", event.string(), data)
+		}
+		e.searchResult(res)
+	case eventError:
+		s, ok := data.(string)
+		if !ok {
+			return fmt.Errorf("data for event of type %s is %T, want string", event.string(), data)
+		}
+		e.string(s)
+	}
+
+	var hdr []byte
+	if !e.wroteVersion {
+		hdr = appendUvarint(hdr, binaryVersion)
+		e.wroteVersion = true
+	}
+	hdr = appendUvarint(hdr, uint64(len(e.buf)))
+	if _, err := e.w.Write(hdr); err != nil {
+		return err
+	}
+	_, err := e.w.Write(e.buf)
+	return err
+}
+
+func appendUvarint(b []byte, v uint64) []byte {
+	var tmp [binary.MaxVarintLen64]byte
+	return append(b, tmp[:binary.PutUvarint(tmp[:], v)]...)
+}
+
+func (e *binaryEncoder) uvarint(v uint64) {
+	e.buf = appendUvarint(e.buf, v)
+}
+
+func (e *binaryEncoder) varint(v int64) {
+	var tmp [binary.MaxVarintLen64]byte
+	e.buf = append(e.buf, tmp[:binary.PutVarint(tmp[:], v)]...)
+}
+
+func (e *binaryEncoder) float(f float64) {
+	var tmp [8]byte
+	binary.LittleEndian.PutUint64(tmp[:], math.Float64bits(f))
+	e.buf = append(e.buf, tmp[:]...)
+}
+
+func (e *binaryEncoder) bytes(b []byte) {
+	e.uvarint(uint64(len(b)))
+	e.buf = append(e.buf, b...)
+}
+
+func (e *binaryEncoder) string(s string) {
+	e.uvarint(uint64(len(s)))
+	e.buf = append(e.buf, s...)
+}
+
+// interned writes s as a reference to an earlier occurrence, or as 0
+// followed by s.
+func (e *binaryEncoder) interned(s string) {
+	if ref, ok := e.strings[s]; ok {
+		e.uvarint(ref)
+		return
+	}
+	e.uvarint(0)
+	e.string(s)
+	if len(e.strings) < maxInterned {
+		e.strings[s] = uint64(len(e.strings) + 1)
+	}
+}
+
+// internedList interns a list of strings as a whole.
+func (e *binaryEncoder) internedList(l []string) {
+	key := strings.Join(l, "\x00")
+	if ref, ok := e.lists[key]; ok {
+		e.uvarint(ref)
+		return
+	}
+	e.uvarint(0)
+	e.uvarint(uint64(len(l)))
+	for _, s := range l {
+		e.interned(s)
+	}
+	if len(e.lists) < maxInterned {
+		e.lists[key] = uint64(len(e.lists) + 1)
+	}
+}
+
+func (e *binaryEncoder) internedMap(m map[string]string) {
+	e.uvarint(uint64(len(m)))
+	for k, v := range m {
+		e.interned(k)
+		e.interned(v)
+	}
+}
+
+func (e *binaryEncoder) searchResult(res *zoekt.SearchResult) {
+	s := &res.Stats
+	e.varint(s.ContentBytesLoaded)
+	e.varint(s.IndexBytesLoaded)
+	e.varint(int64(s.Crashes))
+	e.varint(int64(s.Duration))
+	e.varint(int64(s.FileCount))
+	e.varint(int64(s.ShardFilesConsidered))
+	e.varint(int64(s.FilesConsidered))
+	e.varint(int64(s.FilesLoaded))
+	e.varint(int64(s.FilesSkipped))
+	e.varint(int64(s.ShardsSkipped))
+	e.varint(int64(s.MatchCount))
+	e.varint(int64(s.NgramMatches))
+	e.varint(int64(s.Wait))
+	e.varint(int64(s.RegexpsConsidered))
+	e.varint(int64(s.ShardsSkippedFilter))
+	e.varint(s.CompressedContentBytesLoaded)
+
+	e.float(res.Progress.Priority)
+	e.float(res.Progress.MaxPendingPriority)
+
+	e.uvarint(uint64(len(res.Files)))
+	for i := range res.Files {
+		e.fileMatch(&res.Files[i])
+	}
+	e.internedMap(res.RepoURLs)
+	e.internedMap(res.LineFragments)
+	e.profile(res.Profile)
+}
+
+func (e *binaryEncoder) profile(p *zoekt.QueryProfile) {
+	if p == nil {
+		e.buf = append(e.buf, 0)
+		return
+	}
+	e.buf = append(e.buf, 1)
+	e.varint(int64(p.Shards))
+	e.varint(int64(p.Iterate))
+	e.varint(int64(p.Evaluate))
+	e.varint(int64(p.FillMatches))
+	e.varint(int64(p.GatherBranches))
+	e.uvarint(uint64(len(p.Nodes)))
+	for _, n := range p.Nodes {
+		e.varint(int64(n.Depth))
+		e.interned(n.Node)
+		e.varint(int64(n.Time))
+		e.varint(int64(n.Evals))
+		e.varint(int64(n.Docs))
+		e.varint(int64(n.Matched))
+		e.varint(n.ContentBytesLoaded)
+		e.varint(int64(n.Candidates))
+	}
+}
+
+func (e *binaryEncoder) fileMatch(fm *zoekt.FileMatch) {
+	e.float(fm.Score)
+	e.string(fm.Debug)
+	e.string(fm.FileName)
+	e.interned(fm.Repository)
+	e.internedList(fm.Branches)
+	e.uvarint(uint64(fm.RepositoryID))
+	e.bytes(fm.Content)
+	e.bytes(fm.Checksum)
+	e.interned(fm.Language)
+	e.interned(fm.SubRepositoryName)
+	e.interned(fm.SubRepositoryPath)
+	e.interned(fm.Version)
+
+	e.uvarint(uint64(len(fm.LineMatches)))
+	for i := range fm.LineMatches {
+		e.lineMatch(fm, &fm.LineMatches[i])
+	}
+}
+
+func (e *binaryEncoder) lineMatch(fm *zoekt.FileMatch, lm *zoekt.LineMatch) {
+	var flags byte
+	if lm.FileName {
+		flags |= lineFileName
+	}
+	if len(fm.Content) > 0 && 0 <= lm.LineStart && lm.LineStart <= lm.LineEnd && lm.LineEnd <= len(fm.Content) &&
+		bytes.Equal(fm.Content[lm.LineStart:lm.LineEnd], lm.Line) {
+		flags |= lineInContent
+	} else if len(lm.Line) > 0 && string(lm.Line) == fm.FileName {
+		flags |= lineIsFileName
+	}
+	e.buf = append(e.buf, flags)
+	if flags&(lineInContent|lineIsFileName) == 0 {
+		e.bytes(lm.Line)
+	}
+	e.varint(int64(lm.LineStart))
+	e.varint(int64(lm.LineEnd))
+	e.varint(int64(lm.LineNumber))
+	e.float(lm.Score)
+
+	e.uvarint(uint64(len(lm.LineFragments)))
+	for _, f := range lm.LineFragments {
+		e.varint(int64(f.LineOffset))
+		e.uvarint(uint64(f.Offset))
+		e.varint(int64(f.MatchLength))
+		if f.SymbolInfo == nil {
+			e.buf = append(e.buf, 0)
+			continue
+		}
+		e.buf = append(e.buf, lineHasSymbol)
+		e.interned(f.SymbolInfo.Sym)
+		e.interned(f.SymbolInfo.Kind)
+		e.interned(f.SymbolInfo.Parent)
+		e.interned(f.SymbolInfo.ParentKind)
+	}
+}
+
+var errTruncated = errors.New("truncated frame")
+
+type binaryDecoder struct {
+	r *bufio.Reader
+
+	readVersion bool
+	strings     []string
+	lists       [][]string
+
+	// b is the rest of the frame being decoded, err the first error
+	// while decoding it.
+	b   []byte
+	err error
+}
+
+func newBinaryDecoder(r io.Reader) *binaryDecoder {
+	return &binaryDecoder{r: bufio.NewReader(r)}
+}
+
+// decode reads the next frame into reply. The byte slices of the
+// result reference a buffer owned by the result, and branch lists are
+// shared between results of the stream.
+func (d *binaryDecoder) decode(reply *searchReply) error {
+	if !d.readVersion {
+		v, err := binary.ReadUvarint(d.r)
+		if err != nil {
+			return err
+		}
+		if v != binaryVersion {
+			return fmt.Errorf("unsupported stream version %d", v)
+		}
+		d.readVersion = true
+	}
+
+	n, err := binary.ReadUvarint(d.r)
+	if err != nil {
+		return err
+	}
+	if n == 0 || n > maxFrameSize {
+		return fmt.Errorf("invalid frame size %d", n)
+	}
+	frame := make([]byte, n)
+	if _, err := io.ReadFull(d.r, frame); err != nil {
+		return err
+	}
+
+	d.b, d.err = frame[1:], nil
+	reply.Event = eventType(frame[0])
+	switch reply.Event {
+	case eventMatches:
+		reply.Data = d.searchResult()
+	case eventError:
+		reply.Data = d.string()
+	case eventDone:
+		reply.Data = nil
+	default:
+		return fmt.Errorf("unknown event type %d", frame[0])
+	}
+	if d.err == nil && len(d.b) > 0 {
+		d.err = fmt.Errorf("%d bytes left in frame", len(d.b))
+	}
+	return d.err
+}
+
+func (d *binaryDecoder) fail(err error) {
+	if d.err == nil {
+		d.err = err
+	}
+	d.b = nil
+}
+
+func (d *binaryDecoder) byte() byte {
+	if len(d.b) == 0 {
+		d.fail(errTruncated)
+		return 0
+	}
+	c := d.b[0]
+	d.b = d.b[1:]
+	return c
+}
+
+func (d *binaryDecoder) uvarint() uint64 {
+	v, n := binary.Uvarint(d.b)
+	if n <= 0 {
+		d.fail(errTruncated)
+		return 0
+	}
+	d.b = d.b[n:]
+	return v
+}
+
+func (d *binaryDecoder) varint() int64 {
+	v, n := binary.Varint(d.b)
+	if n <= 0 {
+		d.fail(errTruncated)
+		return 0
+	}
+	d.b = d.b[n:]
+	return v
+}
+
+func (d *binaryDecoder) int() int {
+	return int(d.varint())
+}
+
+func (d *binaryDecoder) float() float64 {
+	if len(d.b) < 8 {
+		d.fail(errTruncated)
+		return 0
+	}
+	f := math.Float64frombits(binary.LittleEndian.Uint64(d.b))
+	d.b = d.b[8:]
+	return f
+}
+
+// count reads a length, which must fit in the rest of the frame as
+// every element takes at least a byte.
+func (d *binaryDecoder) count() int {
+	n := d.uvarint()
+	if n > uint64(len(d.b)) {
+		d.fail(errTruncated)
+		return 0
+	}
+	return int(n)
+}
+
+func (d *binaryDecoder) bytes() []byte {
+	n := d.count()
+	if n == 0 {
+		return nil
+	}
+	b := d.b[:n:n]
+	d.b = d.b[n:]
+	return b
+}
+
+func (d *binaryDecoder) string() string {
+	return string(d.bytes())
+}
+
+func (d *binaryDecoder) interned() string {
+	ref := d.uvarint()
+	if ref == 0 {
+		s := d.string()
+		if d.err == nil && len(d.strings) < maxInterned {
+			d.strings = append(d.strings, s)
+		}
+		return s
+	}
+	if ref > uint64(len(d.strings)) {
+		d.fail(fmt.Errorf("unknown string reference %d", ref))
+		return ""
+	}
+	return d.strings[ref-1]
+}
+
+func (d *binaryDecoder) internedList() []string {
+	ref := d.uvarint()
+	if ref == 0 {
+		var l []string
+		if n := d.count(); n > 0 {
+			l = make([]string, n)
+			for i := range l {
+				l[i] = d.interned()
+			}
+		}
+		if d.err == nil && len(d.lists) < maxInterned {
+			d.lists = append(d.lists, l)
+		}
+		return l
+	}
+	if ref > uint64(len(d.lists)) {
+		d.fail(fmt.Errorf("unknown list reference %d", ref))
+		return nil
+	}
+	return d.lists[ref-1]
+}
+
+func (d *binaryDecoder) internedMap() map[string]string {
+	n := d.count()
+	if n == 0 {
+		return nil
+	}
+	m := make(map[string]string, n)
+	for i := 0; i < n; i++ {
+		k := d.interned()
+		m[k] = d.interned()
+	}
+	return m
+}
+
+func (d *binaryDecoder) searchResult() *zoekt.SearchResult {
+	res := &zoekt.SearchResult{}
+	s := &res.Stats
+	s.ContentBytesLoaded = d.varint()
+	s.IndexBytesLoaded = d.varint()
+	s.Crashes = d.int()
+	s.Duration = time.Duration(d.varint())
+	s.FileCount = d.int()
+	s.ShardFilesConsidered = d.int()
+	s.FilesConsidered = d.int()
+	s.FilesLoaded = d.int()
+	s.FilesSkipped = d.int()
+	s.ShardsSkipped = d.int()
+	s.MatchCount = d.int()
+	s.NgramMatches = d.int()
+	s.Wait = time.Duration(d.varint())
+	s.RegexpsConsidered = d.int()
+	s.ShardsSkippedFilter = d.int()
+	s.CompressedContentBytesLoaded = d.varint()
+
+	res.Progress.Priority = d.float()
+	res.Progress.MaxPendingPriority = d.float()
+
+	if n := d.count(); n > 0 {
+		res.Files = make([]zoekt.FileMatch, n)
+		for i := range res.Files {
+			d.fileMatch(&res.Files[i])
+		}
+	}
+	res.RepoURLs = d.internedMap()
+	res.LineFragments = d.internedMap()
+	res.Profile = d.profile()
+	return res
+}
+
+func (d *binaryDecoder) profile() *zoekt.QueryProfile {
+	if d.byte() == 0 {
+		return nil
+	}
+	p := &zoekt.QueryProfile{
+		Shards:         d.int(),
+		Iterate:        time.Duration(d.varint()),
+		Evaluate:       time.Duration(d.varint()),
+		FillMatches:    time.Duration(d.varint()),
+		GatherBranches: time.Duration(d.varint()),
+	}
+	if n := d.count(); n > 0 {
+		p.Nodes = make([]zoekt.ProfileNode, n)
+		for i := range p.Nodes {
+			p.Nodes[i] = zoekt.ProfileNode{
+				Depth:              d.int(),
+				Node:               d.interned(),
+				Time:               time.Duration(d.varint()),
+				Evals:              d.int(),
+				Docs:               d.int(),
+				Matched:            d.int(),
+				ContentBytesLoaded: d.varint(),
+				Candidates:         d.int(),
+			}
+		}
+	}
+	return p
+}
+
+func (d *binaryDecoder) fileMatch(fm *zoekt.FileMatch) {
+	fm.Score = d.float()
+	fm.Debug = d.string()
+	fm.FileName = d.string()
+	fm.Repository = d.interned()
+	fm.Branches = d.internedList()
+	fm.RepositoryID = uint32(d.uvarint())
+	fm.Content = d.bytes()
+	fm.Checksum = d.bytes()
+	fm.Language = d.interned()
+	fm.SubRepositoryName = d.interned()
+	fm.SubRepositoryPath = d.interned()
+	fm.Version = d.interned()
+
+	if n := d.count(); n > 0 {
+		fm.LineMatches = make([]zoekt.LineMatch, n)
+		for i := range fm.LineMatches {
+			d.lineMatch(fm, &fm.LineMatches[i])
+		}
+	}
+}
+
+func (d *binaryDecoder) lineMatch(fm *zoekt.FileMatch, lm *zoekt.LineMatch) {
+	flags := d.byte()
+	lm.FileName = flags&lineFileName != 0
+	if flags&(lineInContent|lineIsFileName) == 0 {
+		lm.Line = d.bytes()
+	}
+	lm.LineStart = d.int()
+	lm.LineEnd = d.int()
+	lm.LineNumber = d.int()
+	lm.Score = d.float()
+	switch {
+	case flags&lineInContent != 0:
+		if lm.LineStart < 0 || lm.LineStart > lm.LineEnd || lm.LineEnd > len(fm.Content) {
+			d.fail(fmt.Errorf("line range [%d,%d) out of content", lm.LineStart, lm.LineEnd))
+			return
+		}
+		lm.Line = fm.Content[lm.LineStart:lm.LineEnd:lm.LineEnd]
+	case flags&lineIsFileName != 0:
+		lm.Line = []byte(fm.FileName)
+	}
+
+	if n := d.count(); n > 0 {
+		lm.LineFragments = make([]zoekt.LineFragmentMatch, n)
+		for i := range lm.LineFragments {
+			f := &lm.LineFragments[i]
+			f.LineOffset = d.int()
+			f.Offset = uint32(d.uvarint())
+			f.MatchLength = d.int()
+			if d.byte()&lineHasSymbol != 0 {
+				f.SymbolInfo = &zoekt.Symbol{
+					Sym:        d.interned(),
+					Kind:       d.interned(),
+					Parent:     d.interned(),
+					ParentKind: d.interned(),
+				}
+			}
+		}
+	}
+}
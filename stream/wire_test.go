@@ -0,0 +1,277 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package stream
+
+import (
+	"bytes"
+	"context"
+	"encoding/gob"
+	"net/http"
+	"net/http/httptest"
+	"reflect"
+	"testing"
+	"time"
+
+	"github.com/google/go-cmp/cmp"
+	"github.com/google/zoekt"
+	"github.com/google/zoekt/internal/mockSearcher"
+	"github.com/google/zoekt/query"
+)
+
+func wireTestResult() *zoekt.SearchResult {
+	content := []byte("package main\nfunc main() {}\n")
+	return &zoekt.SearchResult{
+		Stats: zoekt.Stats{
+			ContentBytesLoaded:   1,
+			IndexBytesLoaded:     2,
+			Crashes:              3,
+			Duration:             4 * time.Second,
+			FileCount:            5,
+			ShardFilesConsidered: 6,
+			FilesConsidered:      7,
+			FilesLoaded:          8,
+			FilesSkipped:         9,
+			ShardsSkipped:        10,
+			MatchCount:           11,
+			NgramMatches:         12,
+			Wait:                 13 * time.Millisecond,
+			RegexpsConsidered:    14,
+			ShardsSkippedFilter:  15,
+
+			CompressedContentBytesLoaded: 16,
+		},
+		Progress: zoekt.Progress{Priority: 1.5, MaxPendingPriority: -2},
+		Files: []zoekt.FileMatch{{
+			Score:             100.5,
+			Debug:             "debug",
+			FileName:          "main.go",
+			Repository:        "github.com/foo/bar",
+			Branches:          []string{"main", "dev"},
+			RepositoryID:      42,
+			Content:           content,
+			Checksum:          []byte{1, 2, 3},
+			Language:          "Go",
+			SubRepositoryName: "sub",
+			SubRepositoryPath: "sub/path",
+			Version:           "abc",
+			LineMatches: []zoekt.LineMatch{{
+				Line:       content[13:27],
+				LineStart:  13,
+				LineEnd:    27,
+				LineNumber: 2,
+				Score:      3.5,
+				LineFragments: []zoekt.LineFragmentMatch{{
+					LineOffset:  5,
+					Offset:      18,
+					MatchLength: 4,
+					SymbolInfo:  &zoekt.Symbol{Sym: "main", Kind: "function"},
+				}},
+			}, {
+				Line:     []byte("main.go"),
+				FileName: true,
+				LineFragments: []zoekt.LineFragmentMatch{{
+					MatchLength: 4,
+				}},
+			}},
+		}, {
+			FileName:   "other.go",
+			Repository: "github.com/foo/bar",
+			Branches:   []string{"main", "dev"},
+			LineMatches: []zoekt.LineMatch{{
+				Line:       []byte("not in content"),
+				LineStart:  100,
+				LineEnd:    114,
+				LineNumber: 7,
+			}},
+		}},
+		RepoURLs:      map[string]string{"github.com/foo/bar": "https://github.com/foo/bar"},
+		LineFragments: map[string]string{"github.com/foo/bar": "#L{{.LineNumber}}"},
+		Profile: &zoekt.QueryProfile{
+			Shards:         2,
+			Iterate:        1,
+			Evaluate:       2,
+			FillMatches:    3,
+			GatherBranches: 4,
+			Nodes: []zoekt.ProfileNode{
+				{Node: "AND", Time: 5, Evals: 6, Docs: 7, Matched: 8, ContentBytesLoaded: 9, Candidates: 10},
+				{Depth: 1, Node: `substr("main")`, Time: 1},
+			},
+		},
+	}
+}
+
+func TestBinaryRoundTrip(t *testing.T) {
+	// The encoder lists the fields; update it when these change.
+	for typ, want := range map[reflect.Type]int{
+		reflect.TypeOf(zoekt.SearchResult{}):      7,
+		reflect.TypeOf(zoekt.QueryProfile{}):      6,
+		reflect.TypeOf(zoekt.ProfileNode{}):       8,
+		reflect.TypeOf(zoekt.Stats{}):             16,
+		reflect.TypeOf(zoekt.Progress{}):          2,
+		reflect.TypeOf(zoekt.FileMatch{}):         13,
+		reflect.TypeOf(zoekt.LineMatch{}):         7,
+		reflect.TypeOf(zoekt.LineFragmentMatch{}): 4,
+		reflect.TypeOf(zoekt.Symbol{}):            4,
+	} {
+		if got := typ.NumField(); got != want {
+			t.Errorf("%s has %d fields, the binary format knows %d", typ, got, want)
+		}
+	}
+
+	network := new(bytes.Buffer)
+	enc := newBinaryEncoder(network)
+	dec := newBinaryDecoder(network)
+
+	tests := []struct {
+		event eventType
+		data  interface{}
+	}{
+		{eventMatches, wireTestResult()},
+		{eventMatches, wireTestResult()},
+		{eventMatches, &zoekt.SearchResult{Stats: zoekt.Stats{Crashes: 1}}},
+		{eventError, "test error"},
+		{eventDone, nil},
+	}
+	for _, tt := range tests {
+		if err := enc.event(tt.event, tt.data); err != nil {
+			t.Fatal(err)
+		}
+		var reply searchReply
+		if err := dec.decode(&reply); err != nil {
+			t.Fatal(err)
+		}
+		if reply.Event != tt.event {
+			t.Fatalf("got %s, want %s", reply.Event.string(), tt.event.string())
+		}
+		if d := cmp.Diff(tt.data, reply.Data); d != "" {
+			t.Fatalf("mismatch for event type %s (-want +got):\n%s", tt.event.string(), d)
+		}
+	}
+}
+
+func TestBinaryInterning(t *testing.T) {
+	network := new(bytes.Buffer)
+	enc := newBinaryEncoder(network)
+
+	res := wireTestResult()
+	res.RepoURLs = nil
+	res.LineFragments = nil
+	res.Profile = nil
+	var sizes []int
+	for i := 0; i < 2; i++ {
+		network.Reset()
+		if err := enc.event(eventMatches, res); err != nil {
+			t.Fatal(err)
+		}
+		sizes = append(sizes, network.Len())
+	}
+	strings := len(res.Files[0].Repository) + len("main") + len("dev") + len(res.Files[0].Language)
+	if sizes[1] > sizes[0]-strings {
+		t.Errorf("got frame sizes %v, want the second smaller by at least %d", sizes, strings)
+	}
+
+	var gobBuf bytes.Buffer
+	registerGob()
+	if err := gob.NewEncoder(&gobBuf).Encode(searchReply{Event: eventMatches, Data: res}); err != nil {
+		t.Fatal(err)
+	}
+	if sizes[0] >= gobBuf.Len() {
+		t.Errorf("binary frame of %d bytes, gob of %d", sizes[0], gobBuf.Len())
+	}
+}
+
+func TestBinaryDecodeTruncated(t *testing.T) {
+	network := new(bytes.Buffer)
+	if err := newBinaryEncoder(network).event(eventMatches, wireTestResult()); err != nil {
+		t.Fatal(err)
+	}
+	b := network.Bytes()
+	// Keep the frame length as is, and cut the payload short.
+	for n := len(b) - 1; n > 2; n -= 7 {
+		var reply searchReply
+		if err := newBinaryDecoder(bytes.NewReader(b[:n])).decode(&reply); err == nil {
+			t.Fatalf("decoding %d of %d bytes succeeded", n, len(b))
+		}
+	}
+}
+
+func TestStreamSearchNegotiation(t *testing.T) {
+	q := &query.Substring{Pattern: "main"}
+	want := wireTestResult()
+	searcher := &mockSearcher.MockSearcher{
+		WantSearch:   q,
+		SearchResult: want,
+	}
+
+	s := httptest.NewServer(&handler{Searcher: adapter{searcher}})
+	defer s.Close()
+
+	var resp *http.Response
+	cl := &http.Client{Transport: roundTripperFunc(func(req *http.Request) (*http.Response, error) {
+		var err error
+		resp, err = http.DefaultTransport.RoundTrip(req)
+		return resp, err
+	})}
+
+	var got []*zoekt.SearchResult
+	err := NewClient(s.URL, cl).StreamSearch(context.Background(), q, nil, SenderFunc(func(res *zoekt.SearchResult) {
+		got = append(got, res)
+	}))
+	if err != nil {
+		t.Fatal(err)
+	}
+	// The transport decompresses gzip transparently.
+	if ct := resp.Header.Get("Content-Type"); ct != "application/x-zoekt-stream; version=1" || !resp.Uncompressed {
+		t.Errorf("got Content-Type %q, compressed %v, want the binary format compressed", ct, resp.Uncompressed)
+	}
+	if len(got) != 1 {
+		t.Fatalf("got %d results, want 1", len(got))
+	}
+	if d := cmp.Diff(want, got[0]); d != "" {
+		t.Errorf("mismatch (-want +got):\n%s", d)
+	}
+
+	// A client that only knows gob gets gob.
+	buf := new(bytes.Buffer)
+	if err := gob.NewEncoder(buf).Encode(&searchArgs{Q: q}); err != nil {
+		t.Fatal(err)
+	}
+	req, err := http.NewRequest("POST", s.URL, buf)
+	if err != nil {
+		t.Fatal(err)
+	}
+	req.Header.Set("Accept", gobMediaType)
+	gobResp, err := http.DefaultClient.Do(req)
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer gobResp.Body.Close()
+	var reply searchReply
+	if err := gob.NewDecoder(gobResp.Body).Decode(&reply); err != nil {
+		t.Fatal(err)
+	}
+	if ct := gobResp.Header.Get("Content-Type"); ct != gobMediaType || gobResp.Uncompressed {
+		t.Errorf("got Content-Type %q, compressed %v for a gob client", ct, gobResp.Uncompressed)
+	}
+	if d := cmp.Diff(want, reply.Data); d != "" {
+		t.Errorf("gob mismatch (-want +got):\n%s", d)
+	}
+}
+
+type roundTripperFunc func(*http.Request) (*http.Response, error)
+
+func (f roundTripperFunc) RoundTrip(req *http.Request) (*http.Response, error) {
+	return f(req)
+}
@@ -0,0 +1,355 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package zoekt
+
+import (
+	"bytes"
+	"fmt"
+	"regexp"
+	"regexp/syntax"
+	"sort"
+	"unicode"
+	"unicode/utf8"
+
+	"github.com/google/zoekt/query"
+)
+
+// symbolNames maps the lowercased symbol names to the indices of their
+// symbols into runeDocSections, for writeSymbolDict.
+func (b *IndexBuilder) symbolNames() map[string][]uint32 {
+	names := map[string][]uint32{}
+	for i, secs := range b.docSections {
+		content := b.contentStrings[i].data
+		for j, sec := range secs {
+			name := string(toLower(content[sec.Start:sec.End]))
+			names[name] = append(names[name], b.fileEndSymbol[i]+uint32(j))
+		}
+	}
+	return names
+}
+
+// writeSymbolDict writes the symbol dictionary of a
+// NextIndexFormatVersion shard: the lowercased symbol names in sorted
+// order as the items of names, and for each name the sized deltas of
+// the indices of its symbols into runeDocSections as the items of
+// postings.
+func writeSymbolDict(w *writer, names, postings *compoundSection, dict map[string][]uint32) {
+	keys := make([]string, 0, len(dict))
+	for k := range dict {
+		keys = append(keys, k)
+	}
+	sort.Strings(keys)
+
+	names.start(w)
+	for _, k := range keys {
+		names.addItem(w, []byte(k))
+	}
+	names.end(w)
+
+	postings.start(w)
+	for _, k := range keys {
+		postings.addItem(w, toSizedDeltas(dict[k]))
+	}
+	postings.end(w)
+}
+
+// symbolDict looks up symbols by their lowercased name. It is empty
+// for shards written before NextIndexFormatVersion.
+type symbolDict struct {
+	names         []byte
+	namesIndex    []uint32
+	postings      []byte
+	postingsIndex []uint32
+}
+
+func (s *symbolDict) empty() bool {
+	return len(s.namesIndex) == 0
+}
+
+func (s *symbolDict) numNames() int {
+	if s.empty() {
+		return 0
+	}
+	return len(s.namesIndex) - 1
+}
+
+func (s *symbolDict) name(i int) []byte {
+	return s.names[s.namesIndex[i]:s.namesIndex[i+1]]
+}
+
+// nameAt returns the name that holds byte off of names.
+func (s *symbolDict) nameAt(off uint32) int {
+	return sort.Search(s.numNames(), func(i int) bool { return s.namesIndex[i+1] > off })
+}
+
+// symbols appends the symbols named by name i to dst.
+func (s *symbolDict) symbols(i int, dst []uint32) []uint32 {
+	return append(dst, fromSizedDeltas(s.postings[s.postingsIndex[i]:s.postingsIndex[i+1]], nil)...)
+}
+
+// containing returns the names that contain lowered. Since the names
+// are stored back to back, it searches them all at once.
+func (s *symbolDict) containing(lowered []byte) []int {
+	var res []int
+	var off uint32
+	for int(off) < len(s.names) {
+		j := bytes.Index(s.names[off:], lowered)
+		if j < 0 {
+			break
+		}
+		start := off + uint32(j)
+		i := s.nameAt(start)
+		if start+uint32(len(lowered)) <= s.namesIndex[i+1] {
+			res = append(res, i)
+			off = s.namesIndex[i+1]
+		} else {
+			off = start + 1
+		}
+	}
+	return res
+}
+
+// prefixed returns the range of names starting with prefix.
+func (s *symbolDict) prefixed(prefix []byte) (int, int) {
+	n := s.numNames()
+	lo := sort.Search(n, func(i int) bool { return bytes.Compare(s.name(i), prefix) >= 0 })
+	hi := lo + sort.Search(n-lo, func(i int) bool { return !bytes.HasPrefix(s.name(lo+i), prefix) })
+	return lo, hi
+}
+
+// anchoredPrefix returns the literal a regexp starts with, if it is
+// anchored to the start of the text. Symbol names don't span lines,
+// so the start of a line is the start of the name.
+func anchoredPrefix(re *syntax.Regexp) string {
+	if re.Op != syntax.OpConcat || len(re.Sub) < 2 {
+		return ""
+	}
+	if op := re.Sub[0].Op; op != syntax.OpBeginText && op != syntax.OpBeginLine {
+		return ""
+	}
+	if re.Sub[1].Op != syntax.OpLiteral {
+		return ""
+	}
+	return string(toLower([]byte(string(re.Sub[1].Rune))))
+}
+
+// hasNegatedClass returns whether re has a character class that
+// includes the last rune, as negated classes such as [^a-z] and \W do.
+// Folding case shrinks them: (?i)[^a-z] doesn't match 'n', so it
+// misses the lowercased names of symbols that [^a-z] matches.
+func hasNegatedClass(re *syntax.Regexp) bool {
+	if re.Op == syntax.OpCharClass && len(re.Rune) > 0 && re.Rune[len(re.Rune)-1] == unicode.MaxRune {
+		return true
+	}
+	for _, sub := range re.Sub {
+		if hasNegatedClass(sub) {
+			return true
+		}
+	}
+	return false
+}
+
+// symbolDictMatchTree matches symbols found through the symbol
+// dictionary of a shard. The dictionary is case folded, so syms may
+// hold symbols that only match case insensitively; matches checks
+// them against the content.
+type symbolDictMatchTree struct {
+	matchNode
+
+	// syms holds the indices of the candidate symbols into
+	// runeDocSections, in increasing order.
+	syms          []uint32
+	fileEndSymbol []uint32
+
+	// Either substr or regexp is set.
+	substr        *query.Substring
+	substrLowered []byte
+	regexp        *regexp.Regexp
+
+	// mutable
+	next        int
+	docSyms     []uint32
+	reEvaluated bool
+	found       []*candidateMatch
+}
+
+// newSymbolDictMatchTree returns a matchTree for the symbols matching
+// q, or nil if the shard has no symbol dictionary or q is not a
+// content substring or regexp the dictionary can find.
+func (d *indexData) newSymbolDictMatchTree(q query.Q) (matchTree, error) {
+	dict := &d.symbolDict
+	if dict.empty() {
+		return nil, nil
+	}
+
+	t := &symbolDictMatchTree{fileEndSymbol: d.fileEndSymbol}
+	var names []int
+	switch s := q.(type) {
+	case *query.Substring:
+		if s.FileName || s.Pattern == "" {
+			return nil, nil
+		}
+		t.substr = s
+		t.substrLowered = toLower([]byte(s.Pattern))
+		names = dict.containing(t.substrLowered)
+
+	case *query.Regexp:
+		if s.FileName {
+			return nil, nil
+		}
+		prefix := ""
+		if !s.CaseSensitive {
+			prefix = "(?i)"
+		}
+		var err error
+		if t.regexp, err = regexp.Compile(prefix + s.Regexp.String()); err != nil {
+			return nil, err
+		}
+
+		// The names are lowercased, so they are filtered case
+		// insensitively. That only finds all matches of a case
+		// sensitive regexp if it has no negated classes.
+		folded := t.regexp
+		if s.CaseSensitive {
+			if hasNegatedClass(s.Regexp) {
+				return nil, nil
+			}
+			if folded, err = regexp.Compile("(?i)" + s.Regexp.String()); err != nil {
+				return nil, err
+			}
+		}
+		lo, hi := 0, dict.numNames()
+		if p := anchoredPrefix(s.Regexp); p != "" {
+			lo, hi = dict.prefixed([]byte(p))
+		}
+		for i := lo; i < hi; i++ {
+			if folded.Match(dict.name(i)) {
+				names = append(names, i)
+			}
+		}
+
+	default:
+		return nil, nil
+	}
+
+	for _, i := range names {
+		t.syms = dict.symbols(i, t.syms)
+	}
+	sort.Slice(t.syms, func(i, j int) bool { return t.syms[i] < t.syms[j] })
+	return t, nil
+}
+
+// symbolDoc returns the document holding symbol sym.
+func (t *symbolDictMatchTree) symbolDoc(sym uint32) uint32 {
+	n := len(t.fileEndSymbol) - 1
+	return uint32(sort.Search(n, func(i int) bool { return t.fileEndSymbol[i+1] > sym }))
+}
+
+func (t *symbolDictMatchTree) nextDoc() uint32 {
+	if t.next >= len(t.syms) {
+		return maxUInt32
+	}
+	return t.symbolDoc(t.syms[t.next])
+}
+
+func (t *symbolDictMatchTree) skipTo(doc uint32) {
+	if int(doc) >= len(t.fileEndSymbol) {
+		t.next = len(t.syms)
+		return
+	}
+	first := t.fileEndSymbol[doc]
+	t.next += sort.Search(len(t.syms)-t.next, func(i int) bool { return t.syms[t.next+i] >= first })
+}
+
+func (t *symbolDictMatchTree) prepare(doc uint32) {
+	t.skipTo(doc)
+	start := t.next
+	if int(doc)+1 < len(t.fileEndSymbol) {
+		end := t.fileEndSymbol[doc+1]
+		for t.next < len(t.syms) && t.syms[t.next] < end {
+			t.next++
+		}
+	}
+	t.docSyms = t.syms[start:t.next]
+	t.found = t.found[:0]
+	t.reEvaluated = false
+}
+
+func (t *symbolDictMatchTree) matches(cp *contentProvider, cost int, known *knownMatches) (bool, bool) {
+	if t.reEvaluated {
+		return len(t.found) > 0, true
+	}
+	if len(t.docSyms) == 0 {
+		return false, true
+	}
+
+	need := costContent
+	if t.regexp != nil {
+		need = costRegexp
+	}
+	if cost < need {
+		return false, false
+	}
+
+	sections := cp.docSections()
+	content := cp.data(false)
+	first := t.fileEndSymbol[cp.idx]
+
+	found := t.found[:0]
+	for _, sym := range t.docSyms {
+		i := sym - first
+		sec := sections[i]
+		add := func(start, end int) {
+			cm := cp.cands.alloc()
+			cm.byteOffset = sec.Start + uint32(start)
+			cm.byteMatchSz = uint32(end - start)
+			cm.symbol = true
+			cm.symbolIdx = i
+			found = append(found, cm)
+		}
+
+		text := content[sec.Start:sec.End]
+		if t.regexp != nil {
+			if idx := t.regexp.FindIndex(text); idx != nil {
+				add(idx[0], idx[1])
+			}
+		} else {
+			// Like substrMatchTree, report every occurrence, even
+			// overlapping ones.
+			for off := 0; off < len(text); {
+				if t.substr.CaseSensitive {
+					if bytes.HasPrefix(text[off:], []byte(t.substr.Pattern)) {
+						add(off, off+len(t.substr.Pattern))
+					}
+				} else if sz, ok := caseFoldingEqualsRunes(t.substrLowered, text[off:]); ok {
+					add(off, off+sz)
+				}
+				_, sz := utf8.DecodeRune(text[off:])
+				off += sz
+			}
+		}
+	}
+	t.found = found
+	t.reEvaluated = true
+
+	return len(t.found) > 0, true
+}
+
+func (t *symbolDictMatchTree) String() string {
+	if t.regexp != nil {
+		return fmt.Sprintf("symbol(dict(re(%s)), %d)", t.regexp, len(t.syms))
+	}
+	return fmt.Sprintf("symbol(dict(%q), %d)", t.substr.Pattern, len(t.syms))
+}
@@ -0,0 +1,128 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package zoekt
+
+import (
+	"bytes"
+	"context"
+	"fmt"
+	"reflect"
+	"testing"
+
+	"github.com/google/zoekt/query"
+)
+
+func TestSymbolDict(t *testing.T) {
+	var docs []Document
+	for i := 0; i < 20; i++ {
+		var content bytes.Buffer
+		var secs []DocumentSection
+		for _, sym := range []string{"NewServer", "newsServer", "aaaa", fmt.Sprintf("Handler%d", i), "Ünïcode"} {
+			fmt.Fprintf(&content, "func ")
+			start := uint32(content.Len())
+			content.WriteString(sym)
+			secs = append(secs, DocumentSection{Start: start, End: uint32(content.Len())})
+			fmt.Fprintf(&content, "() { return %s }\n", sym)
+		}
+		docs = append(docs, Document{Name: fmt.Sprintf("f%d.go", i), Content: content.Bytes(), Symbols: secs})
+	}
+	docs = append(docs, Document{Name: "nosyms.go", Content: []byte("func NewServer() {}\n")})
+
+	search := func(version int, q query.Q) (*SearchResult, matchTree) {
+		b := testIndexBuilder(t, nil, docs...)
+		b.indexFormatVersion = version
+		s := searcherForTest(t, b)
+		defer s.Close()
+
+		mt, err := s.(*indexData).newMatchTree(q)
+		if err != nil {
+			t.Fatalf("newMatchTree: %v", err)
+		}
+		res, err := s.Search(context.Background(), q, &SearchOptions{Whole: true})
+		if err != nil {
+			t.Fatalf("Search: %v", err)
+		}
+		clearScores(res)
+		return res, mt
+	}
+
+	for _, tc := range []struct {
+		q      query.Q
+		files  int
+		noDict bool
+	}{
+		{&query.Substring{Pattern: "server"}, 20, false},
+		{&query.Substring{Pattern: "Server", CaseSensitive: true}, 20, false},
+		{&query.Substring{Pattern: "wsServer", CaseSensitive: true}, 20, false},
+		{&query.Substring{Pattern: "NEWS"}, 20, false},
+		{&query.Substring{Pattern: "aaa"}, 20, false},
+		{&query.Substring{Pattern: "handler1"}, 11, false},
+		{&query.Substring{Pattern: "ünï"}, 20, false},
+		{&query.Substring{Pattern: "return"}, 0, false},
+		{&query.Substring{Pattern: "ler1Ü"}, 0, false},
+		{&query.Regexp{Regexp: mustParseRE("^new")}, 20, false},
+		{&query.Regexp{Regexp: mustParseRE("^New"), CaseSensitive: true}, 20, false},
+		{&query.Regexp{Regexp: mustParseRE("Handler1[3-5]$")}, 3, false},
+		{&query.Regexp{Regexp: mustParseRE("s.r")}, 20, false},
+		{&query.Regexp{Regexp: mustParseRE("^handler"), CaseSensitive: true}, 0, false},
+		{&query.Regexp{Regexp: mustParseRE(".*")}, 20, false},
+		{&query.Regexp{Regexp: mustParseRE("^[^a-z]"), CaseSensitive: true}, 20, true},
+		{&query.Regexp{Regexp: mustParseRE("^[^a-z]")}, 20, false},
+	} {
+		q := &query.Symbol{Expr: tc.q}
+		want, _ := search(IndexFormatVersion, q)
+		got, mt := search(NextIndexFormatVersion, q)
+		if _, ok := mt.(*symbolDictMatchTree); ok == tc.noDict {
+			t.Errorf("%s: got %T, want dictionary %v", q, mt, !tc.noDict)
+		}
+		if len(want.Files) != tc.files {
+			t.Errorf("%s: got %d files, want %d", q, len(want.Files), tc.files)
+		}
+		if !reflect.DeepEqual(got.Files, want.Files) {
+			t.Errorf("%s: got %v, want %v", q, got.Files, want.Files)
+		}
+	}
+}
+
+func TestSymbolDictLookup(t *testing.T) {
+	var dict symbolDict
+	var buf bytes.Buffer
+	w := &writer{w: &buf}
+	var names, postings compoundSection
+	writeSymbolDict(w, &names, &postings, map[string][]uint32{
+		"abc": {1, 5}, "abd": {2}, "bcd": {0, 3, 4},
+	})
+	dict.names = buf.Bytes()[names.data.off : names.data.off+names.data.sz]
+	dict.namesIndex = names.relativeIndex()
+	dict.postings = buf.Bytes()[postings.data.off : postings.data.off+postings.data.sz]
+	dict.postingsIndex = postings.relativeIndex()
+
+	if got, want := dict.containing([]byte("bc")), []int{0, 2}; !reflect.DeepEqual(got, want) {
+		t.Errorf("containing(bc): got %v, want %v", got, want)
+	}
+	// "cab" only occurs across names.
+	if got := dict.containing([]byte("cab")); len(got) != 0 {
+		t.Errorf("containing(cab): got %v, want none", got)
+	}
+	if lo, hi := dict.prefixed([]byte("ab")); lo != 0 || hi != 2 {
+		t.Errorf("prefixed(ab): got [%d, %d), want [0, 2)", lo, hi)
+	}
+	if lo, hi := dict.prefixed([]byte("c")); lo != hi {
+		t.Errorf("prefixed(c): got [%d, %d), want empty", lo, hi)
+	}
+	if got, want := dict.symbols(2, []uint32{9}), []uint32{9, 0, 3, 4}; !reflect.DeepEqual(got, want) {
+		t.Errorf("symbols(2): got %v, want %v", got, want)
+	}
+}
@@ -30,6 +30,16 @@ package zoekt
 // 16: ctags metadata
 const IndexFormatVersion = 16
 
+// NextIndexFormatVersion is the index format version which is being rolled
+// out. Shards in this format are read alongside IndexFormatVersion shards,
+// but are only written when opted in (see NewIndexBuilder), so that readers
+// can be deployed before writers. Shard file names keep using
+// IndexFormatVersion.
+// 17: posting lists are split into blocks with a skip table; tagged TOC
+// sections; optional bit-packed posting encoding; optional compressed
+// content
+const NextIndexFormatVersion = 17
+
 // FeatureVersion is increased if a feature is added that requires reindexing data
 // without changing the format version
 // 2: Rank field for shards.
@@ -62,13 +72,42 @@ type indexTOC struct {
 	subRepos    simpleSection
 
 	nameNgramText    simpleSection
-	namePostings     compoundSection
+	namePostings     lazyCompoundSection
 	nameRuneOffsets  simpleSection
 	metaData         simpleSection
 	repoMetaData     simpleSection
 	nameEndRunes     simpleSection
 	contentChecksums simpleSection
 	runeDocSections  simpleSection
+
+	// postingEncoding holds a single postingEncoding byte. It is only
+	// present in NextIndexFormatVersion shards.
+	postingEncoding simpleSection
+
+	// repos holds the uint16 index into the repository metadata of
+	// each document. It is only present in NextIndexFormatVersion
+	// shards, which may hold several repositories.
+	repos simpleSection
+
+	// newlineCheckpoints holds the newlineCheckpoints of the newlines
+	// of each document. It is only present in NextIndexFormatVersion
+	// shards.
+	newlineCheckpoints compoundSection
+
+	// contentEncoding holds a single contentEncoding byte. If it is
+	// not contentEncodingRaw, the items of fileContents are content
+	// blocks, and contentBoundaries holds the uint32 offsets of the
+	// documents in the uncompressed content. Both are only present in
+	// NextIndexFormatVersion shards.
+	contentEncoding   simpleSection
+	contentBoundaries simpleSection
+
+	// symbolNames holds the lowercased symbol names in sorted order,
+	// and symbolPostings the indices into runeDocSections of the
+	// symbols of each name, see writeSymbolDict. Both are only present
+	// in NextIndexFormatVersion shards.
+	symbolNames    compoundSection
+	symbolPostings compoundSection
 }
 
 func (t *indexTOC) sections() []section {
@@ -100,3 +139,46 @@ func (t *indexTOC) sections() []section {
 		&t.runeDocSections,
 	}
 }
+
+type taggedSection struct {
+	tag string
+	sec section
+}
+
+// sectionsTagged returns the sections of a NextIndexFormatVersion
+// TOC. These are written with a name and kind, so readers can skip
+// sections they don't know about.
+func (t *indexTOC) sectionsTagged() []taggedSection {
+	return []taggedSection{
+		{"metadata", &t.metaData},
+		{"repoMetaData", &t.repoMetaData},
+		{"fileContents", &t.fileContents},
+		{"fileNames", &t.fileNames},
+		{"fileSections", &t.fileSections},
+		{"fileEndSymbol", &t.fileEndSymbol},
+		{"symbolMap", &t.symbolMap},
+		{"symbolKindMap", &t.symbolKindMap},
+		{"symbolMetaData", &t.symbolMetaData},
+		{"newlines", &t.newlines},
+		{"ngramText", &t.ngramText},
+		{"postings", &t.postings},
+		{"nameNgramText", &t.nameNgramText},
+		{"namePostings", &t.namePostings},
+		{"branchMasks", &t.branchMasks},
+		{"subRepos", &t.subRepos},
+		{"runeOffsets", &t.runeOffsets},
+		{"nameRuneOffsets", &t.nameRuneOffsets},
+		{"fileEndRunes", &t.fileEndRunes},
+		{"nameEndRunes", &t.nameEndRunes},
+		{"contentChecksums", &t.contentChecksums},
+		{"languages", &t.languages},
+		{"runeDocSections", &t.runeDocSections},
+		{"postingEncoding", &t.postingEncoding},
+		{"repos", &t.repos},
+		{"newlineCheckpoints", &t.newlineCheckpoints},
+		{"contentEncoding", &t.contentEncoding},
+		{"contentBoundaries", &t.contentBoundaries},
+		{"symbolNames", &t.symbolNames},
+		{"symbolPostings", &t.symbolPostings},
+	}
+}
@@ -0,0 +1,267 @@
+// Copyright 2016 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package zoekt
+
+import (
+	"container/heap"
+	"sort"
+)
+
+// maxFragmentScore bounds the "fragment" score of a file, the best
+// matchScore of its lines.
+const maxFragmentScore = scoreWordMatch
+
+// topFilesCompactMin is the number of stored candidates below which
+// topFiles doesn't bother dropping the candidates of losing files.
+const topFilesCompactMin = 1024
+
+// pendingFile is a document that matched, whose line matches are
+// only filled in if it may be among the best files.
+type pendingFile struct {
+	doc uint32
+
+	// score and bound bound the file score from below and above.
+	// atoms is the fraction of matching atoms.
+	score float64
+	bound float64
+	atoms float64
+
+	// matches is the number of candidate matches, which stands in
+	// for the number of line matches until they are filled in.
+	matches int
+
+	// pruned is set once the file can't be among the best files,
+	// and its candidates are dropped.
+	pruned bool
+
+	// The ranges of the candidates and branch query masks in
+	// topFiles.
+	candStart, candEnd     int
+	branchStart, branchEnd int
+}
+
+// topFiles collects the matches of a search that only returns the k
+// best files. It keeps the candidate matches of the files that may
+// still be among the k best. The files are kept in doc order, so the
+// shard limits can be applied to them as to filled in files.
+type topFiles struct {
+	k     int
+	files []pendingFile
+
+	cands       []candidateMatch
+	branchMasks []uint64
+
+	// lower holds the k best lower bounds, so no file whose
+	// upper bound is below lower.Threshold() is among the best.
+	lower     TopScores
+	compactAt int
+}
+
+func newTopFiles(k int) *topFiles {
+	return &topFiles{
+		k:         k,
+		lower:     TopScores{K: k},
+		compactAt: topFilesCompactMin,
+	}
+}
+
+// mayWin returns whether a file with the given upper bound of its
+// score may be among the k best files.
+func (t *topFiles) mayWin(bound float64) bool {
+	return !t.lower.Full() || bound >= t.lower.Threshold()
+}
+
+// add adds a matching document, with the candidates and branch query
+// masks of gatherMatches and branchQueryMasks. It returns the number
+// of matches to count for the document.
+func (t *topFiles) add(doc uint32, score, bound, atoms float64, cands []*candidateMatch, branchMasks []uint64) int {
+	f := pendingFile{
+		doc:     doc,
+		score:   score,
+		bound:   bound,
+		atoms:   atoms,
+		matches: len(cands),
+		pruned:  true,
+	}
+	if len(cands) == 0 {
+		// The file name is the match.
+		f.matches = 1
+	}
+	if t.mayWin(bound) {
+		t.lower.Add(score)
+		f.pruned = false
+		f.candStart = len(t.cands)
+		for _, c := range cands {
+			t.cands = append(t.cands, *c)
+		}
+		f.candEnd = len(t.cands)
+		f.branchStart = len(t.branchMasks)
+		t.branchMasks = append(t.branchMasks, branchMasks...)
+		f.branchEnd = len(t.branchMasks)
+	}
+	t.files = append(t.files, f)
+
+	if len(t.cands) >= t.compactAt {
+		t.compact()
+	}
+	return f.matches
+}
+
+// addFile adds a file of another topFiles.
+func (t *topFiles) addFile(from *topFiles, f pendingFile) {
+	if f.pruned || !t.mayWin(f.bound) {
+		f.pruned = true
+		t.files = append(t.files, f)
+		return
+	}
+	t.lower.Add(f.score)
+	cands, masks := f.candStart, f.branchStart
+	f.candStart = len(t.cands)
+	t.cands = append(t.cands, from.cands[cands:f.candEnd]...)
+	f.candEnd = len(t.cands)
+	f.branchStart = len(t.branchMasks)
+	t.branchMasks = append(t.branchMasks, from.branchMasks[masks:f.branchEnd]...)
+	f.branchEnd = len(t.branchMasks)
+	t.files = append(t.files, f)
+}
+
+// compact drops the candidates of the files that can no longer be
+// among the best.
+func (t *topFiles) compact() {
+	cands, masks := t.cands[:0], t.branchMasks[:0]
+	for i := range t.files {
+		f := &t.files[i]
+		if f.pruned {
+			continue
+		}
+		if !t.mayWin(f.bound) {
+			f.pruned = true
+			continue
+		}
+		// The ranges only move down, so appending in place is
+		// safe.
+		start := len(cands)
+		cands = append(cands, t.cands[f.candStart:f.candEnd]...)
+		f.candStart, f.candEnd = start, len(cands)
+		start = len(masks)
+		masks = append(masks, t.branchMasks[f.branchStart:f.branchEnd]...)
+		f.branchStart, f.branchEnd = start, len(masks)
+	}
+	t.cands, t.branchMasks = cands, masks
+
+	t.compactAt = 2 * len(t.cands)
+	if t.compactAt < topFilesCompactMin {
+		t.compactAt = topFilesCompactMin
+	}
+}
+
+// fillTopFiles fills in the files of top, best first, until no other
+// file can make the top.k, and appends the top.k best to res.Files.
+func (d *indexData) fillTopFiles(top *topFiles, opts *SearchOptions, res *SearchResult) {
+	var order []int
+	for i := range top.files {
+		if f := &top.files[i]; !f.pruned && top.mayWin(f.bound) {
+			order = append(order, i)
+		}
+	}
+	sort.Slice(order, func(i, j int) bool {
+		return top.files[order[i]].bound > top.files[order[j]].bound
+	})
+
+	cp := &contentProvider{
+		id:    d,
+		stats: &res.Stats,
+	}
+	prof := &QueryProfile{}
+	var timer phaseTimer
+	if res.Profile != nil {
+		prof = res.Profile
+		timer.on = true
+	}
+
+	best := TopScores{K: top.k}
+	var cands []*candidateMatch
+	for _, i := range order {
+		f := &top.files[i]
+		if best.Full() && f.bound < best.Threshold() {
+			break
+		}
+		timer.start()
+		cp.setDocument(f.doc)
+		cands = cands[:0]
+		for j := f.candStart; j < f.candEnd; j++ {
+			cands = append(cands, &top.cands[j])
+		}
+
+		fileMatch := d.newFileMatch(f.doc)
+		d.addFileScores(&fileMatch, f.doc, f.atoms)
+		d.fillFileMatch(cp, &fileMatch, cands, top.branchMasks[f.branchStart:f.branchEnd], opts, timer.phase, prof)
+		best.Add(fileMatch.Score)
+
+		res.Files = append(res.Files, fileMatch)
+		res.Stats.MatchCount += len(fileMatch.LineMatches) - f.matches
+	}
+
+	SortFilesByScore(res.Files)
+	if len(res.Files) > top.k {
+		res.Files = res.Files[:top.k]
+	}
+}
+
+// TopScores tracks the K highest scores added. Once it is full, a
+// score at most Threshold() is not among them. With K <= 0 it tracks
+// nothing.
+type TopScores struct {
+	K      int
+	scores scoreHeap
+}
+
+// Full returns whether K scores were added.
+func (t *TopScores) Full() bool {
+	return t.K > 0 && len(t.scores) >= t.K
+}
+
+// Threshold returns the lowest of the K highest scores. It may only
+// be called if t is full.
+func (t *TopScores) Threshold() float64 {
+	return t.scores[0]
+}
+
+// Add adds a score.
+func (t *TopScores) Add(score float64) {
+	if t.K <= 0 {
+		return
+	}
+	if len(t.scores) < t.K {
+		heap.Push(&t.scores, score)
+	} else if score > t.scores[0] {
+		t.scores[0] = score
+		heap.Fix(&t.scores, 0)
+	}
+}
+
+// scoreHeap is a min-heap of scores.
+type scoreHeap []float64
+
+func (h scoreHeap) Len() int            { return len(h) }
+func (h scoreHeap) Less(i, j int) bool  { return h[i] < h[j] }
+func (h scoreHeap) Swap(i, j int)       { h[i], h[j] = h[j], h[i] }
+func (h *scoreHeap) Push(x interface{}) { *h = append(*h, x.(float64)) }
+func (h *scoreHeap) Pop() interface{} {
+	old := *h
+	x := old[len(old)-1]
+	*h = old[:len(old)-1]
+	return x
+}
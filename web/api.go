@@ -37,6 +37,10 @@ type ResultInput struct {
 	Duration      time.Duration
 	FileMatches   []*FileMatch
 	SearchOptions string
+
+	// Profile is the query profile, if requested with the profile
+	// URL parameter.
+	Profile string
 }
 
 // FileMatch holds the per file data provided to search results template
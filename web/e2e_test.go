@@ -129,6 +129,10 @@ func TestBasic(t *testing.T) {
 		"/search?q=magic": {
 			`value=magic`,
 		},
+		"/search?q=water&profile=1": {
+			"<pre>shards: 1,",
+			"substr(&#34;water&#34;) (time=",
+		},
 	} {
 		checkNeedles(t, ts, req, needles)
 	}
@@ -260,11 +260,17 @@ func (s *Server) serveSearchErr(w http.ResponseWriter, r *http.Request) error {
 		sOpts.TotalMaxImportantMatch = n
 	}
 	sOpts.MaxDocDisplayCount = num
+	// The results are rendered before we return.
+	sOpts.NoCopy = true
+	sOpts.Profile = qvals.Get("profile") != ""
 
 	result, err := s.Searcher.Search(ctx, q, &sOpts)
 	if err != nil {
 		return err
 	}
+	if result.Release != nil {
+		defer result.Release()
+	}
 
 	fileMatches, err := s.formatResults(result, queryStr, s.Print)
 	if err != nil {
@@ -283,6 +289,9 @@ func (s *Server) serveSearchErr(w http.ResponseWriter, r *http.Request) error {
 		SearchOptions: sOpts.String(),
 		FileMatches:   fileMatches,
 	}
+	if result.Profile != nil {
+		res.Profile = result.Profile.String()
+	}
 	if res.Stats.Wait < res.Stats.Duration/10 {
 		// Suppress queueing stats if they are neglible.
 		res.Stats.Wait = 0
@@ -530,7 +539,8 @@ func (s *Server) servePrintErr(w http.ResponseWriter, r *http.Request) error {
 	q := &query.And{Children: qs}
 
 	sOpts := zoekt.SearchOptions{
-		Whole: true,
+		Whole:  true,
+		NoCopy: true,
 	}
 
 	ctx := r.Context()
@@ -538,6 +548,9 @@ func (s *Server) servePrintErr(w http.ResponseWriter, r *http.Request) error {
 	if err != nil {
 		return err
 	}
+	if result.Release != nil {
+		defer result.Release()
+	}
 
 	if len(result.Files) != 1 {
 		var ss []string
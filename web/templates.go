@@ -229,6 +229,7 @@ document.onkeydown=function(e){
            href="search?q={{.Last.Query}}&num={{More .Last.Num}}">show more</a>).
       {{else}}.{{end}}
     </h5>
+    {{if .Profile}}<pre>{{.Profile}}</pre>{{end}}
     {{range .FileMatches}}
     <table class="table table-hover table-condensed">
       <thead>
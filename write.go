@@ -19,6 +19,7 @@ import (
 	"bytes"
 	"encoding/binary"
 	"encoding/json"
+	"fmt"
 	"io"
 	"sort"
 	"time"
@@ -32,6 +33,17 @@ func (w *writer) writeTOC(toc *indexTOC) {
 	}
 }
 
+// writeTaggedTOC writes the TOC of a NextIndexFormatVersion shard. A
+// section count of 0 marks the TOC as tagged.
+func (w *writer) writeTaggedTOC(toc *indexTOC) {
+	w.U32(0)
+	for _, s := range toc.sectionsTagged() {
+		w.String(s.tag)
+		w.Varint(uint32(s.sec.kind()))
+		s.sec.write(w)
+	}
+}
+
 func (s *compoundSection) writeStrings(w *writer, strs []*searchableString) {
 	s.start(w)
 	for _, f := range strs {
@@ -53,13 +65,101 @@ func (s *compoundSection) writeMap(w *writer, m map[string]uint32) {
 	s.writeStrings(w, keys)
 }
 
+// postingBlockSize is the number of postings in a block of a
+// NextIndexFormatVersion posting list.
+const postingBlockSize = 128
+
+// postingEncoding identifies how the blocks of NextIndexFormatVersion
+// posting lists are encoded. It is recorded in the postingEncoding
+// section of the TOC.
+type postingEncoding byte
+
+const (
+	// postingEncodingVarint stores the deltas of a block as varints.
+	postingEncodingVarint postingEncoding = iota
+	// postingEncodingPFOR bit-packs the deltas of a block with packPFOR.
+	postingEncodingPFOR
+)
+
+// encodePostingBlocks converts a delta varint encoded posting list
+// into the blocked encoding of NextIndexFormatVersion:
+//
+//	uvarint(count)
+//	if count > postingBlockSize:
+//	  per block: uint32 first posting, uint32 offset of block data
+//	block data
+//
+// For short lists, the deltas are the original encoding. Otherwise,
+// the data of each block holds the deltas following the first posting
+// of that block, which is stored in the skip table, so a reader can
+// seek to a block without decoding the ones before it. The block data
+// is encoded according to enc.
+func encodePostingBlocks(deltas []byte, enc postingEncoding) []byte {
+	count := 0
+	for _, c := range deltas {
+		if c < 0x80 {
+			count++
+		}
+	}
+
+	var buf [binary.MaxVarintLen64]byte
+	out := append([]byte{}, buf[:binary.PutUvarint(buf[:], uint64(count))]...)
+	if count <= postingBlockSize {
+		return append(out, deltas...)
+	}
+
+	blocks := (count + postingBlockSize - 1) / postingBlockSize
+	skips := make([]byte, 8*blocks)
+	data := make([]byte, 0, len(deltas))
+
+	block := make([]uint32, 0, postingBlockSize)
+	flush := func() {
+		switch enc {
+		case postingEncodingPFOR:
+			data = packPFOR(data, block)
+		default:
+			for _, d := range block {
+				data = append(data, buf[:binary.PutUvarint(buf[:], uint64(d))]...)
+			}
+		}
+		block = block[:0]
+	}
+
+	var p uint32
+	for i := 0; len(deltas) > 0; i++ {
+		delta, sz := binary.Uvarint(deltas)
+		deltas = deltas[sz:]
+		p += uint32(delta)
+		if i%postingBlockSize == 0 {
+			if i > 0 {
+				flush()
+			}
+			j := 8 * (i / postingBlockSize)
+			binary.BigEndian.PutUint32(skips[j:], p)
+			binary.BigEndian.PutUint32(skips[j+4:], uint32(len(data)))
+			continue
+		}
+		block = append(block, uint32(delta))
+	}
+	flush()
+
+	out = append(out, skips...)
+	return append(out, data...)
+}
+
 func writePostings(w *writer, s *postingsBuilder, ngramText *simpleSection,
-	charOffsets *simpleSection, postings *compoundSection, endRunes *simpleSection) {
-	keys := make(ngramSlice, 0, len(s.postings))
-	for k := range s.postings {
+	charOffsets *simpleSection, postings *compoundSection, endRunes *simpleSection,
+	blocked bool, enc postingEncoding) error {
+	// Every ngram has a last offset, also if its postings were
+	// spilled.
+	keys := make(ngramSlice, 0, len(s.lastOffsets))
+	for k := range s.lastOffsets {
 		keys = append(keys, k)
 	}
 	sort.Sort(keys)
+	if s.spill != nil {
+		defer s.spill.remove()
+	}
 
 	ngramText.start(w)
 	for _, k := range keys {
@@ -70,8 +170,14 @@ func writePostings(w *writer, s *postingsBuilder, ngramText *simpleSection,
 	ngramText.end(w)
 
 	postings.start(w)
-	for _, k := range keys {
-		postings.addItem(w, s.postings[k])
+	if err := s.mergedPostings(keys, func(_ ngram, deltas []byte) {
+		if blocked {
+			postings.addItem(w, encodePostingBlocks(deltas, enc))
+		} else {
+			postings.addItem(w, deltas)
+		}
+	}); err != nil {
+		return err
 	}
 	postings.end(w)
 
@@ -82,19 +188,39 @@ func writePostings(w *writer, s *postingsBuilder, ngramText *simpleSection,
 	endRunes.start(w)
 	w.Write(toSizedDeltas(s.endRunes))
 	endRunes.end(w)
+	return nil
 }
 
 func (b *IndexBuilder) Write(out io.Writer) error {
+	defer b.Close()
+
+	if len(b.repoList) > 1 && b.indexFormatVersion < NextIndexFormatVersion {
+		return fmt.Errorf("compound shards need index format version %d", NextIndexFormatVersion)
+	}
+
 	buffered := bufio.NewWriterSize(out, 1<<20)
 	defer buffered.Flush()
 
 	w := &writer{w: buffered}
 	toc := indexTOC{}
 
-	toc.fileContents.writeStrings(w, b.contentStrings)
+	blocked := b.indexFormatVersion >= NextIndexFormatVersion
+
+	if blocked && b.contentEncoding != contentEncodingRaw {
+		if err := writeContentBlocks(w, &toc.fileContents, &toc.contentBoundaries, b.contentStrings, b.contentEncoding); err != nil {
+			return err
+		}
+	} else {
+		toc.fileContents.writeStrings(w, b.contentStrings)
+	}
+	var checkpoints [][]byte
 	toc.newlines.start(w)
 	for _, f := range b.contentStrings {
-		toc.newlines.addItem(w, toSizedDeltas(newLinesIndices(f.data)))
+		nls := newLinesIndices(f.data)
+		toc.newlines.addItem(w, toSizedDeltas(nls))
+		if blocked {
+			checkpoints = append(checkpoints, newlineCheckpoints(nls))
+		}
 	}
 	toc.newlines.end(w)
 
@@ -124,12 +250,16 @@ func (b *IndexBuilder) Write(out io.Writer) error {
 	}
 	toc.fileSections.end(w)
 
-	writePostings(w, b.contentPostings, &toc.ngramText, &toc.runeOffsets, &toc.postings, &toc.fileEndRunes)
+	if err := writePostings(w, b.contentPostings, &toc.ngramText, &toc.runeOffsets, &toc.postings, &toc.fileEndRunes, blocked, b.postingEncoding); err != nil {
+		return err
+	}
 
 	// names.
 	toc.fileNames.writeStrings(w, b.nameStrings)
 
-	writePostings(w, b.namePostings, &toc.nameNgramText, &toc.nameRuneOffsets, &toc.namePostings, &toc.nameEndRunes)
+	if err := writePostings(w, b.namePostings, &toc.nameNgramText, &toc.nameRuneOffsets, &toc.namePostings.compoundSection, &toc.nameEndRunes, blocked, b.postingEncoding); err != nil {
+		return err
+	}
 
 	toc.subRepos.start(w)
 	w.Write(toSizedDeltas(b.subRepos))
@@ -147,8 +277,32 @@ func (b *IndexBuilder) Write(out io.Writer) error {
 	w.Write(marshalDocSections(b.runeDocSections))
 	toc.runeDocSections.end(w)
 
+	if blocked {
+		toc.postingEncoding.start(w)
+		w.B(byte(b.postingEncoding))
+		toc.postingEncoding.end(w)
+
+		toc.repos.start(w)
+		for _, r := range b.repos {
+			w.U16(r)
+		}
+		toc.repos.end(w)
+
+		toc.newlineCheckpoints.start(w)
+		for _, c := range checkpoints {
+			toc.newlineCheckpoints.addItem(w, c)
+		}
+		toc.newlineCheckpoints.end(w)
+
+		toc.contentEncoding.start(w)
+		w.B(byte(b.contentEncoding))
+		toc.contentEncoding.end(w)
+
+		writeSymbolDict(w, &toc.symbolNames, &toc.symbolPostings, b.symbolNames())
+	}
+
 	if err := b.writeJSON(&IndexMetadata{
-		IndexFormatVersion:  IndexFormatVersion,
+		IndexFormatVersion:  b.indexFormatVersion,
 		IndexTime:           time.Now(),
 		IndexFeatureVersion: FeatureVersion,
 		PlainASCII:          b.contentPostings.isPlainASCII && b.namePostings.isPlainASCII,
@@ -157,14 +311,23 @@ func (b *IndexBuilder) Write(out io.Writer) error {
 	}, &toc.metaData, w); err != nil {
 		return err
 	}
-	if err := b.writeJSON(b.repo, &toc.repoMetaData, w); err != nil {
+	// Compound shards store a list of repositories.
+	var repoMetaData interface{} = b.repoList[0]
+	if len(b.repoList) > 1 {
+		repoMetaData = b.repoList
+	}
+	if err := b.writeJSON(repoMetaData, &toc.repoMetaData, w); err != nil {
 		return err
 	}
 
 	var tocSection simpleSection
 
 	tocSection.start(w)
-	w.writeTOC(&toc)
+	if b.indexFormatVersion >= NextIndexFormatVersion {
+		w.writeTaggedTOC(&toc)
+	} else {
+		w.writeTOC(&toc)
+	}
 	tocSection.end(w)
 	tocSection.write(w)
 	return w.err